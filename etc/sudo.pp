@@ -311,6 +311,7 @@ still allow people to get their work done."
 	ln -s -f ${bindir}/sudo ${pp_destdir}/usr/bin
 	ln -s -f ${bindir}/sudoedit ${pp_destdir}/usr/bin
 	ln -s -f ${bindir}/sudoreplay ${pp_destdir}/usr/bin
+	ln -s -f ${sbindir}/sudo_logagent ${pp_destdir}/usr/sbin
 	ln -s -f ${sbindir}/sudo_sendlog ${pp_destdir}/usr/sbin
 	ln -s -f ${sbindir}/visudo ${pp_destdir}/usr/sbin
 %endif
@@ -384,6 +385,7 @@ still allow people to get their work done."
 	$bindir/sudo        	4755 root:
 	$bindir/sudoedit    	0755 root: symlink sudo
 	$bindir/sudoreplay  	0755
+	$sbindir/sudo_logagent  0755
 	$sbindir/sudo_sendlog   0755
 	$sbindir/sudo_logsrvd        optional,ignore
 	$sbindir/visudo     	0755
@@ -424,6 +426,7 @@ still allow people to get their work done."
 	/usr/bin/sudo    	0755 root: symlink $bindir/sudo
 	/usr/bin/sudoedit    	0755 root: symlink $bindir/sudoedit
 	/usr/bin/sudoreplay    	0755 root: symlink $bindir/sudoreplay
+	/usr/sbin/sudo_logagent 0755 root: symlink $sbindir/sudo_logagent
 	/usr/sbin/sudo_sendlog  0755 root: symlink $sbindir/sendlog
 	/usr/sbin/visudo    	0755 root: symlink $sbindir/visudo
 %endif
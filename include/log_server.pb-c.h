@@ -63,6 +63,10 @@ typedef enum {
 struct  _ClientMessage
 {
   ProtobufCMessage base;
+  /*
+   * multiplexed session, 0 if none 
+   */
+  uint32_t session_id;
   ClientMessage__TypeCase type_case;
   union {
     AcceptMessage *accept_msg;
@@ -82,7 +86,7 @@ struct  _ClientMessage
 };
 #define CLIENT_MESSAGE__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&client_message__descriptor) \
-    , CLIENT_MESSAGE__TYPE__NOT_SET, {0} }
+    , 0, CLIENT_MESSAGE__TYPE__NOT_SET, {0} }
 
 
 /*
@@ -119,10 +123,18 @@ struct  _IoBuffer
    * keystroke data 
    */
   ProtobufCBinaryData data;
+  /*
+   * length of data before compression 
+   */
+  uint32_t uncompressed_len;
+  /*
+   * CRC-32 of data before compression 
+   */
+  uint32_t checksum;
 };
 #define IO_BUFFER__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&io_buffer__descriptor) \
-    , NULL, {0,NULL} }
+    , NULL, {0,NULL}, 0, 0 }
 
 
 struct  _InfoMessage__StringList
@@ -358,10 +370,15 @@ struct  _ClientHello
    * free-form client description 
    */
   char *client_id;
+  /*
+   * supported I/O buffer compression 
+   */
+  size_t n_compression;
+  char **compression;
 };
 #define CLIENT_HELLO__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&client_hello__descriptor) \
-    , (char *)protobuf_c_empty_string }
+    , (char *)protobuf_c_empty_string, 0,NULL }
 
 
 typedef enum {
@@ -381,6 +398,10 @@ typedef enum {
 struct  _ServerMessage
 {
   ProtobufCMessage base;
+  /*
+   * multiplexed session, 0 if none 
+   */
+  uint32_t session_id;
   ServerMessage__TypeCase type_case;
   union {
     /*
@@ -407,7 +428,7 @@ struct  _ServerMessage
 };
 #define SERVER_MESSAGE__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&server_message__descriptor) \
-    , SERVER_MESSAGE__TYPE__NOT_SET, {0} }
+    , 0, SERVER_MESSAGE__TYPE__NOT_SET, {0} }
 
 
 /*
@@ -429,10 +450,19 @@ struct  _ServerHello
    */
   size_t n_servers;
   char **servers;
+  /*
+   * supported I/O buffer compression 
+   */
+  size_t n_compression;
+  char **compression;
+  /*
+   * accepts multiplexed sessions 
+   */
+  protobuf_c_boolean multiplex;
 };
 #define SERVER_HELLO__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&server_hello__descriptor) \
-    , (char *)protobuf_c_empty_string, (char *)protobuf_c_empty_string, 0,NULL }
+    , (char *)protobuf_c_empty_string, (char *)protobuf_c_empty_string, 0,NULL, 0,NULL, 0 }
 
 
 /* ClientMessage methods */
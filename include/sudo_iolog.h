@@ -42,6 +42,16 @@
 #define IO_EVENT_SUSPEND	7
 #define IO_EVENT_COUNT		8
 
+/*
+ * Binary timing records start with a byte of IOLOG_TIMING_BINARY|event,
+ * followed by the delay seconds and nanoseconds and the event-specific
+ * fields, each stored as an unsigned LEB128 varint.  The signal name
+ * of a suspend event is stored as a varint length followed by the name.
+ * Text records always start with an ASCII digit.
+ */
+#define IOLOG_TIMING_BINARY	0x80
+#define IOLOG_TIMING_RECMAX	64
+
 /*
  * Indexes into iolog_files[] array.
  * These must match the IO_EVENT_ defines above.
@@ -56,6 +66,27 @@
 #define IOFD_TIMING	5
 #define IOFD_MAX	6
 
+/*
+ * I/O log compression methods, see iolog_set_compress().
+ */
+#define IOLOG_COMPRESS_NONE	0
+#define IOLOG_COMPRESS_GZIP	1
+#define IOLOG_COMPRESS_ZSTD	2
+
+/*
+ * The I/O log index maps elapsed session time to a position in each
+ * I/O log file so replay can start without reading from the beginning.
+ * For compressed files, offset is the start of a gzip member or zstd
+ * frame and skip is the number of uncompressed bytes to discard after it.
+ */
+#define IOLOG_INDEX_INTERVAL	30	/* seconds of session time */
+
+struct iolog_index_entry {
+    struct timespec elapsed;
+    off_t offset[IOFD_MAX];
+    off_t skip[IOFD_MAX];
+};
+
 struct timing_closure {
     struct timespec delay;
     const char *decimal;
@@ -73,13 +104,17 @@ struct timing_closure {
 
 struct iolog_file {
     bool enabled;
-    bool compressed;
+    unsigned char compressed;	/* IOLOG_COMPRESS_* */
     bool writable;
+    bool binary;	/* timing file has binary records */
+    unsigned int pending;	/* buffers queued for the compression thread */
+    const char *thread_errstr;	/* deferred compression thread error */
     union {
 	FILE *f;
 #ifdef HAVE_ZLIB_H
 	gzFile g;
 #endif
+	struct iolog_zstd *z;
 	void *v;
     } fd;
 };
@@ -99,6 +134,9 @@ bool expand_iolog_path(const char *inpath, char *path, size_t pathlen, const str
 bool iolog_parse_timing(const char *line, struct timing_closure *timing);
 char *iolog_parse_delay(const char *cp, struct timespec *delay, const char *decimal_point);
 int iolog_read_timing_record(struct iolog_file *iol, struct timing_closure *timing);
+int iolog_fmt_timing_io(char *buf, size_t bufsize, bool binary, int event, const struct timespec *delay, size_t nbytes);
+int iolog_fmt_timing_suspend(char *buf, size_t bufsize, bool binary, const struct timespec *delay, const char *signame);
+int iolog_fmt_timing_winsize(char *buf, size_t bufsize, bool binary, const struct timespec *delay, int lines, int cols);
 struct eventlog *iolog_parse_loginfo(int dfd, const char *iolog_dir);
 bool iolog_parse_loginfo_json(FILE *fp, const char *iolog_dir, struct eventlog *evlog);
 void iolog_adjust_delay(struct timespec *delay, struct timespec *max_delay, double scale_factor);
@@ -106,23 +144,33 @@ void iolog_adjust_delay(struct timespec *delay, struct timespec *max_delay, doub
 /* iolog_fileio.c */
 struct passwd;
 struct group;
+bool iolog_checkpoint(struct iolog_file *iol, off_t *offsetp, const char **errstr);
 bool iolog_close(struct iolog_file *iol, const char **errstr);
 bool iolog_eof(struct iolog_file *iol);
+bool iolog_index_append(int dfd, const struct iolog_index_entry *entry);
+bool iolog_index_find(int dfd, const struct timespec *target, struct iolog_index_entry *entry);
+bool iolog_index_seek(int dfd, struct iolog_file *iolog_files, const struct iolog_index_entry *entry, bool skip);
+bool iolog_index_truncate(int dfd, const struct timespec *elapsed);
 bool iolog_mkdtemp(char *path);
 bool iolog_mkpath(char *path);
 bool iolog_nextid(char *iolog_dir, char sessid[7]);
 bool iolog_open(struct iolog_file *iol, int dfd, int iofd, const char *mode);
 bool iolog_rename(const char *from, const char *to);
+bool iolog_reopen(struct iolog_file *iol, int dfd, int iofd, off_t offset);
 bool iolog_write_info_file(int dfd, struct eventlog *evlog);
+bool iolog_write_index(int dfd, struct iolog_file *iolog_files, const struct timespec *elapsed);
 char *iolog_gets(struct iolog_file *iol, char *buf, size_t nbytes, const char **errsttr);
 const char *iolog_fd_to_name(int iofd);
+int iolog_getc(struct iolog_file *iol, const char **errstr);
 int iolog_openat(int fdf, const char *path, int flags);
 off_t iolog_seek(struct iolog_file *iol, off_t offset, int whence);
 ssize_t iolog_read(struct iolog_file *iol, void *buf, size_t nbytes, const char **errstr);
 ssize_t iolog_write(struct iolog_file *iol, const void *buf, size_t len, const char **errstr);
 void iolog_clearerr(struct iolog_file *iol);
 void iolog_rewind(struct iolog_file *iol);
-void iolog_set_compress(bool);
+void iolog_set_binary_timing(bool);
+void iolog_set_compress(int method);
+void iolog_set_compress_thread(bool);
 void iolog_set_defaults(void);
 void iolog_set_flush(bool);
 void iolog_set_gid(gid_t gid);
@@ -24,6 +24,9 @@
 #include <config.h>
 
 #include <sys/stat.h>
+#ifdef HAVE___ATOMIC_COMPARE_EXCHANGE_N
+# include <sys/mman.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #ifdef HAVE_STDBOOL_H
@@ -31,6 +34,11 @@
 #else
 # include "compat/stdbool.h"
 #endif
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
@@ -49,14 +57,20 @@
 #include "sudo_queue.h"
 #include "sudo_util.h"
 
+#include "iolog_thread.h"
+#include "iolog_zstd.h"
+
 static unsigned char const gzip_magic[2] = {0x1f, 0x8b};
+static unsigned char const zstd_magic[4] = {0x28, 0xb5, 0x2f, 0xfd};
 static unsigned int sessid_max = SESSID_MAX;
 static mode_t iolog_filemode = S_IRUSR|S_IWUSR;
 static mode_t iolog_dirmode = S_IRWXU;
 static uid_t iolog_uid = ROOT_UID;
 static gid_t iolog_gid = ROOT_GID;
 static bool iolog_gid_set;
-static bool iolog_compress;
+static int iolog_compress;
+static bool iolog_compress_thread;
+static bool iolog_binary_timing;
 static bool iolog_flush;
 
 /*
@@ -280,10 +294,23 @@ iolog_set_defaults(void)
     iolog_uid = ROOT_UID;
     iolog_gid = ROOT_GID;
     iolog_gid_set = false;
-    iolog_compress = false;
+    iolog_compress = IOLOG_COMPRESS_NONE;
+    iolog_compress_thread = false;
+    iolog_binary_timing = false;
     iolog_flush = false;
 }
 
+/*
+ * Set whether new timing files use binary records.
+ */
+void
+iolog_set_binary_timing(bool newval)
+{
+    debug_decl(iolog_set_binary_timing, SUDO_DEBUG_UTIL);
+    iolog_binary_timing = newval;
+    debug_return;
+}
+
 /*
  * Set max sequence number (aka session ID)
  */
@@ -354,13 +381,35 @@ iolog_set_mode(mode_t mode)
 }
 
 /*
- * Set iolog_compress
+ * Set iolog_compress to one of the IOLOG_COMPRESS_* methods.
+ * If zstd support is not available, gzip is used instead.
  */
 void
-iolog_set_compress(bool newval)
+iolog_set_compress(int method)
 {
     debug_decl(iolog_set_compress, SUDO_DEBUG_UTIL);
-    iolog_compress = newval;
+
+#ifndef HAVE_ZSTD_H
+    if (method == IOLOG_COMPRESS_ZSTD) {
+	sudo_debug_printf(SUDO_DEBUG_WARN,
+	    "%s: zstd support not enabled, using gzip", __func__);
+	method = IOLOG_COMPRESS_GZIP;
+    }
+#endif
+    iolog_compress = method;
+
+    debug_return;
+}
+
+/*
+ * Set iolog_compress_thread.  If set, compressed I/O log files are
+ * compressed and written by a separate thread.
+ */
+void
+iolog_set_compress_thread(bool newval)
+{
+    debug_decl(iolog_set_compress_thread, SUDO_DEBUG_UTIL);
+    iolog_compress_thread = newval;
     debug_return;
 }
 
@@ -421,103 +470,325 @@ iolog_openat(int dfd, const char *path, int flags)
 }
 
 /*
- * Read the on-disk sequence number, set sessid to the next
- * number, and update the on-disk copy.
- * Uses file locking to avoid sequence number collisions.
+ * The seq file holds the last session ID used as six base 36 digits
+ * followed by a newline.
  */
-bool
-iolog_nextid(char *iolog_dir, char sessid[7])
+#define SEQ_LEN	7
+
+static const char b36char[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+/*
+ * Parse the base 36 session ID at the start of buf and store it in idp.
+ * Returns true on success or false (with *idp set to 0) if buf does
+ * not contain a valid ID.
+ */
+static bool
+iolog_parse_seq(const char *buf, size_t len, unsigned long *idp)
 {
-    char buf[32], *ep;
-    int i, len, fd = -1;
-    unsigned long id = 0;
-    ssize_t nread;
-    bool ret = false;
-    char pathbuf[PATH_MAX];
-    static const char b36char[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-    debug_decl(iolog_nextid, SUDO_DEBUG_UTIL);
+    char numbuf[SEQ_LEN], *ep;
+    unsigned long id;
+    debug_decl(iolog_parse_seq, SUDO_DEBUG_UTIL);
+
+    if (len > 0 && buf[len - 1] == '\n')
+	len--;
+    if (len > 0 && len < sizeof(numbuf)) {
+	memcpy(numbuf, buf, len);
+	numbuf[len] = '\0';
+	id = strtoul(numbuf, &ep, 36);
+	if (ep != numbuf && *ep == '\0' && id < sessid_max) {
+	    *idp = id;
+	    debug_return_bool(true);
+	}
+    }
+    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	"bad sequence number: %.*s", (int)len, buf);
+    *idp = 0;
+    debug_return_bool(false);
+}
 
-    /*
-     * Create I/O log directory if it doesn't already exist.
-     */
-    if (!iolog_mkdirs(iolog_dir))
-	goto done;
+/*
+ * Convert id to a string of SEQ_LEN bytes, including the trailing newline.
+ * Note that that least significant digits go at the end of the string.
+ */
+static void
+iolog_fmt_seq(unsigned long id, char *buf)
+{
+    int i;
 
-    /*
-     * Open sequence file
-     */
-    len = snprintf(pathbuf, sizeof(pathbuf), "%s/seq", iolog_dir);
-    if (len < 0 || len >= ssizeof(pathbuf)) {
+    for (i = SEQ_LEN - 2; i >= 0; i--) {
+	buf[i] = b36char[id % 36];
+	id /= 36;
+    }
+    buf[SEQ_LEN - 1] = '\n';
+}
+
+/*
+ * Open the seq file in iolog_dir.
+ * Sets pathbuf (assumed to be PATH_MAX bytes) to the path of the seq file.
+ * Returns an open file descriptor on success, else -1.
+ */
+static int
+iolog_open_seq(const char *iolog_dir, char *pathbuf)
+{
+    int len, fd;
+    debug_decl(iolog_open_seq, SUDO_DEBUG_UTIL);
+
+    len = snprintf(pathbuf, PATH_MAX, "%s/seq", iolog_dir);
+    if (len < 0 || len >= PATH_MAX) {
 	errno = ENAMETOOLONG;
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
 	    "%s: %s/seq", __func__, iolog_dir);
-	goto done;
+	debug_return_int(-1);
     }
     fd = iolog_openat(AT_FDCWD, pathbuf, O_RDWR|O_CREAT);
     if (fd == -1) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
 	    "%s: unable to open %s", __func__, pathbuf);
-	goto done;
     }
+    debug_return_int(fd);
+}
+
+/*
+ * Read the on-disk sequence number with the seq file locked,
+ * add incr to it and update the on-disk copy.
+ * If sessid is not NULL, it is set to the new number.
+ * The seq file is truncated to SEQ_LEN bytes.
+ * If incr is 0 and the file is already SEQ_LEN bytes, it is left alone.
+ */
+static bool
+iolog_update_seq_locked(int fd, const char *path, unsigned long incr,
+    char sessid[7])
+{
+    char buf[32];
+    unsigned long id = 0;
+    struct stat sb;
+    ssize_t nread;
+    debug_decl(iolog_update_seq_locked, SUDO_DEBUG_UTIL);
+
     if (!sudo_lock_file(fd, SUDO_LOCK)) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-	    "unable to lock %s", pathbuf);
-	goto done;
+	    "unable to lock %s", path);
+	debug_return_bool(false);
+    }
+    if (incr == 0 && sessid == NULL) {
+	/*
+	 * Another process may have fixed the size while we waited for
+	 * the lock and be updating the file via a mapping, which does
+	 * not take the lock.  Rewriting it now could undo its update.
+	 */
+	if (fstat(fd, &sb) == -1)
+	    goto bad;
+	if (sb.st_size == SEQ_LEN) {
+	    sudo_lock_file(fd, SUDO_UNLOCK);
+	    debug_return_bool(true);
+	}
     }
     if (fchown(fd, iolog_uid, iolog_gid) != 0) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
 	    "%s: unable to fchown %d:%d %s", __func__,
-	    (int)iolog_uid, (int)iolog_gid, pathbuf);
+	    (int)iolog_uid, (int)iolog_gid, path);
     }
 
     /* Read current seq number (base 36). */
-    nread = read(fd, buf, sizeof(buf) - 1);
-    if (nread != 0) {
-	if (nread == -1) {
-	    goto done;
-	}
-	if (buf[nread - 1] == '\n')
-	    nread--;
-	buf[nread] = '\0';
-	id = strtoul(buf, &ep, 36);
-	if (ep == buf || *ep != '\0' || id >= sessid_max) {
-	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-		"%s: bad sequence number: %s", pathbuf, buf);
-	    id = 0;
+#ifdef HAVE_PREAD
+    nread = pread(fd, buf, sizeof(buf), 0);
+#else
+    nread = lseek(fd, 0, SEEK_SET) == -1 ? -1 : read(fd, buf, sizeof(buf));
+#endif
+    if (nread == -1)
+	goto bad;
+    if (nread != 0)
+	(void)iolog_parse_seq(buf, nread, &id);
+    id += incr;
+
+    /* Rewind and overwrite old seq file. */
+    iolog_fmt_seq(id, buf);
+#ifdef HAVE_PWRITE
+    if (pwrite(fd, buf, SEQ_LEN, 0) != SEQ_LEN) {
+#else
+    if (lseek(fd, 0, SEEK_SET) == -1 || write(fd, buf, SEQ_LEN) != SEQ_LEN) {
+#endif
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+	    "%s: unable to write %s", __func__, path);
+	goto bad;
+    }
+    if (nread > SEQ_LEN && ftruncate(fd, SEQ_LEN) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+	    "%s: unable to truncate %s", __func__, path);
+	goto bad;
+    }
+    sudo_lock_file(fd, SUDO_UNLOCK);
+
+    /* Stash id for logging purposes. */
+    if (sessid != NULL) {
+	memcpy(sessid, buf, 6);
+	sessid[6] = '\0';
+    }
+    debug_return_bool(true);
+bad:
+    sudo_lock_file(fd, SUDO_UNLOCK);
+    debug_return_bool(false);
+}
+
+#ifdef HAVE___ATOMIC_COMPARE_EXCHANGE_N
+/*
+ * The seq file is mapped shared and updated with an atomic
+ * compare and swap of the first eight bytes of the mapping, which
+ * covers the SEQ_LEN bytes of the file plus one byte past EOF.
+ * Processes allocating session IDs never block each other and
+ * the on-disk format is unchanged.  A long-running process, such
+ * as sudo_logsrvd, keeps the mapping between calls.
+ */
+union iolog_seq_word {
+    uint64_t u64;
+    char buf[8];
+};
+
+static struct iolog_seq_map {
+    char *dir;
+    uint64_t *word;
+    dev_t dev;
+    ino_t ino;
+} seq_map;
+
+static void
+iolog_unmap_seq(void)
+{
+    debug_decl(iolog_unmap_seq, SUDO_DEBUG_UTIL);
+
+    if (seq_map.word != NULL) {
+	munmap((void *)seq_map.word, sizeof(*seq_map.word));
+	seq_map.word = NULL;
+    }
+    free(seq_map.dir);
+    seq_map.dir = NULL;
+
+    debug_return;
+}
+
+/*
+ * Map the seq file in iolog_dir, reusing an existing mapping if
+ * the file has not been replaced.  A new or non-canonical seq file
+ * is first rewritten under lock so that it is exactly SEQ_LEN bytes.
+ * Returns a pointer to the shared word on success, else NULL.
+ */
+static uint64_t *
+iolog_map_seq(const char *iolog_dir)
+{
+    char pathbuf[PATH_MAX];
+    struct stat sb;
+    void *addr;
+    int fd;
+    debug_decl(iolog_map_seq, SUDO_DEBUG_UTIL);
+
+    if (seq_map.word != NULL) {
+	if (strcmp(seq_map.dir, iolog_dir) == 0) {
+	    (void)snprintf(pathbuf, sizeof(pathbuf), "%s/seq", iolog_dir);
+	    if (stat(pathbuf, &sb) == 0 && sb.st_size == SEQ_LEN &&
+		    sb.st_dev == seq_map.dev && sb.st_ino == seq_map.ino)
+		debug_return_ptr(seq_map.word);
 	}
+	iolog_unmap_seq();
     }
-    id++;
 
-    /*
-     * Convert id to a string and stash in sessid.
-     * Note that that least significant digits go at the end of the string.
-     */
-    for (i = 5; i >= 0; i--) {
-	buf[i] = b36char[id % 36];
-	id /= 36;
+    fd = iolog_open_seq(iolog_dir, pathbuf);
+    if (fd == -1)
+	debug_return_ptr(NULL);
+    if (fstat(fd, &sb) == -1)
+	goto bad;
+    if (sb.st_size != SEQ_LEN) {
+	/* Only the lock holder changes the size of the file. */
+	if (!iolog_update_seq_locked(fd, pathbuf, 0, NULL))
+	    goto bad;
+    }
+
+    addr = mmap(NULL, sizeof(*seq_map.word), PROT_READ|PROT_WRITE,
+	MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+	    "%s: unable to mmap %s", __func__, pathbuf);
+	goto bad;
     }
-    buf[6] = '\n';
+    if ((seq_map.dir = strdup(iolog_dir)) == NULL) {
+	munmap(addr, sizeof(*seq_map.word));
+	goto bad;
+    }
+    seq_map.word = addr;
+    seq_map.dev = sb.st_dev;
+    seq_map.ino = sb.st_ino;
+    close(fd);
+
+    debug_return_ptr(seq_map.word);
+bad:
+    close(fd);
+    debug_return_ptr(NULL);
+}
+
+/*
+ * Atomically increment the sequence number in the mapped seq file.
+ */
+static bool
+iolog_nextid_mapped(const char *iolog_dir, char sessid[7])
+{
+    union iolog_seq_word oword, nword;
+    uint64_t *word;
+    unsigned long id;
+    debug_decl(iolog_nextid_mapped, SUDO_DEBUG_UTIL);
+
+    if ((word = iolog_map_seq(iolog_dir)) == NULL)
+	debug_return_bool(false);
+
+    oword.u64 = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+    do {
+	(void)iolog_parse_seq(oword.buf, SEQ_LEN, &id);
+	nword = oword;
+	iolog_fmt_seq(id + 1, nword.buf);
+    } while (!__atomic_compare_exchange_n(word, &oword.u64, nword.u64,
+	false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
 
     /* Stash id for logging purposes. */
-    memcpy(sessid, buf, 6);
+    memcpy(sessid, nword.buf, 6);
     sessid[6] = '\0';
 
-    /* Rewind and overwrite old seq file, including the NUL byte. */
-#ifdef HAVE_PWRITE
-    if (pwrite(fd, buf, 7, 0) != 7) {
-#else
-    if (lseek(fd, 0, SEEK_SET) == -1 || write(fd, buf, 7) != 7) {
+    debug_return_bool(true);
+}
+#endif /* HAVE___ATOMIC_COMPARE_EXCHANGE_N */
+
+/*
+ * Set sessid to the next sequence number and update the on-disk copy.
+ * If supported, the seq file is updated lock-free via a shared mapping,
+ * otherwise file locking is used to avoid sequence number collisions.
+ * The two must not be mixed: a locked update is a plain read-modify-write
+ * that a concurrent compare and swap does not see, so if the file cannot
+ * be mapped an error is returned instead.
+ */
+bool
+iolog_nextid(char *iolog_dir, char sessid[7])
+{
+#ifndef HAVE___ATOMIC_COMPARE_EXCHANGE_N
+    char pathbuf[PATH_MAX];
+    bool ret;
+    int fd;
 #endif
-	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
-	    "%s: unable to write %s", __func__, pathbuf);
-	goto done;
-    }
-    ret = true;
+    debug_decl(iolog_nextid, SUDO_DEBUG_UTIL);
+
+    /*
+     * Create I/O log directory if it doesn't already exist.
+     */
+    if (!iolog_mkdirs(iolog_dir))
+	debug_return_bool(false);
+
+#ifdef HAVE___ATOMIC_COMPARE_EXCHANGE_N
+    debug_return_bool(iolog_nextid_mapped(iolog_dir, sessid));
+#else
+    fd = iolog_open_seq(iolog_dir, pathbuf);
+    if (fd == -1)
+	debug_return_bool(false);
+    ret = iolog_update_seq_locked(fd, pathbuf, 1, sessid);
+    close(fd);
 
-done:
-    if (fd != -1)
-	close(fd);
     debug_return_bool(ret);
+#endif /* HAVE___ATOMIC_COMPARE_EXCHANGE_N */
 }
 
 /*
@@ -558,7 +829,7 @@ iolog_open(struct iolog_file *iol, int dfd, int iofd, const char *mode)
 {
     int flags;
     const char *file;
-    unsigned char magic[2];
+    unsigned char magic[4];
     debug_decl(iolog_open, SUDO_DEBUG_UTIL);
 
     if (mode[0] == 'r') {
@@ -566,6 +837,9 @@ iolog_open(struct iolog_file *iol, int dfd, int iofd, const char *mode)
     } else if (mode[0] == 'w') {
 	flags = O_CREAT|O_TRUNC;
 	flags |= mode[1] == '+' ? O_RDWR : O_WRONLY;
+    } else if (mode[0] == 'a' && mode[1] == '\0') {
+	/* Need read access to check for an existing compression header. */
+	flags = O_CREAT|O_APPEND|O_RDWR;
     } else {
 	sudo_debug_printf(SUDO_DEBUG_ERROR,
 	    "%s: invalid I/O mode %s", __func__, mode);
@@ -578,36 +852,75 @@ iolog_open(struct iolog_file *iol, int dfd, int iofd, const char *mode)
     }
 
     iol->writable = false;
-    iol->compressed = false;
+    iol->compressed = IOLOG_COMPRESS_NONE;
+    iol->binary = false;
+    iol->pending = 0;
+    iol->thread_errstr = NULL;
     if (iol->enabled) {
 	int fd = iolog_openat(dfd, file, flags);
 	if (fd != -1) {
-	    if (*mode == 'w') {
+	    ssize_t nread = 0;
+
+	    if (*mode != 'w') {
+		/* check for gzip or zstd magic number */
+		nread = pread(fd, magic, sizeof(magic), 0);
+		if (nread >= ssizeof(gzip_magic) &&
+			memcmp(magic, gzip_magic, sizeof(gzip_magic)) == 0) {
+		    iol->compressed = IOLOG_COMPRESS_GZIP;
+		} else if (nread == ssizeof(zstd_magic) &&
+			memcmp(magic, zstd_magic, sizeof(zstd_magic)) == 0) {
+		    iol->compressed = IOLOG_COMPRESS_ZSTD;
+		}
+	    }
+	    if (*mode != 'r') {
 		if (fchown(fd, iolog_uid, iolog_gid) != 0) {
 		    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
 			"%s: unable to fchown %d:%d %s", __func__,
 			(int)iolog_uid, (int)iolog_gid, file);
 		}
-		iol->compressed = iolog_compress;
-	    } else {
-		/* check for gzip magic number */
-		if (pread(fd, magic, sizeof(magic), 0) == ssizeof(magic)) {
-		    if (magic[0] == gzip_magic[0] && magic[1] == gzip_magic[1])
-			iol->compressed = true;
+		if (nread == 0) {
+		    /* New or empty file. */
+		    iol->compressed = iolog_compress;
+		    if (iofd == IOFD_TIMING) {
+			/* A new timing file invalidates any existing index. */
+			iol->binary = iolog_binary_timing;
+			(void)unlinkat(dfd, "index", 0);
+		    }
 		}
 	    }
+	    iol->fd.v = NULL;
 	    if (fcntl(fd, F_SETFD, FD_CLOEXEC) != -1) {
+		/* Compressed streams cannot be read and written at once. */
+		switch (iol->compressed) {
+		case IOLOG_COMPRESS_NONE:
+		    iol->fd.f = fdopen(fd, mode);
+		    break;
 #ifdef HAVE_ZLIB_H
-		if (iol->compressed)
-		    iol->fd.g = gzdopen(fd, mode);
-		else
+		case IOLOG_COMPRESS_GZIP:
+		    iol->fd.g = gzdopen(fd, mode[0] == 'r' ? "r" : mode);
+		    break;
 #endif
-		    iol->fd.f = fdopen(fd, mode);
+#ifdef HAVE_ZSTD_H
+		case IOLOG_COMPRESS_ZSTD:
+		    iol->fd.z = iolog_zstd_open(fd, mode[0] == 'r' ? "r" : mode);
+		    break;
+#endif
+		default:
+		    sudo_debug_printf(SUDO_DEBUG_ERROR,
+			"%s: %s: unsupported compression method %d", __func__,
+			file, iol->compressed);
+		    errno = ENOTSUP;
+		    break;
+		}
 	    }
 	    if (iol->fd.v != NULL) {
 		switch ((flags & O_ACCMODE)) {
-		case O_WRONLY:
 		case O_RDWR:
+		    /* Compressed files are only opened for reading. */
+		    if (iol->compressed && mode[0] == 'r')
+			break;
+		    FALLTHROUGH;
+		case O_WRONLY:
 		    iol->writable = true;
 		    break;
 		}
@@ -655,6 +968,21 @@ iolog_close(struct iolog_file *iol, const char **errstr)
     bool ret = true;
     debug_decl(iolog_close, SUDO_DEBUG_UTIL);
 
+    /* Wait for data queued for the compression thread to be written. */
+    if (iol->compressed && iol->writable) {
+	if (!iolog_thread_drain(iol, errstr)) {
+	    /* Report the first error. */
+	    ret = false;
+	    errstr = NULL;
+	}
+    }
+
+#ifdef HAVE_ZSTD_H
+    if (iol->compressed == IOLOG_COMPRESS_ZSTD) {
+	if (!iolog_zstd_close(iol->fd.z, errstr))
+	    ret = false;
+    } else
+#endif
 #ifdef HAVE_ZLIB_H
     if (iol->compressed) {
 	int errnum;
@@ -693,6 +1021,16 @@ iolog_seek(struct iolog_file *iol, off_t offset, int whence)
     off_t ret;
     //debug_decl(iolog_seek, SUDO_DEBUG_UTIL);
 
+    if (iol->compressed && iol->writable) {
+	if (!iolog_thread_drain(iol, NULL))
+	    return -1;
+    }
+
+#ifdef HAVE_ZSTD_H
+    if (iol->compressed == IOLOG_COMPRESS_ZSTD)
+	ret = iolog_zstd_seek(iol->fd.z, offset, whence);
+    else
+#endif
 #ifdef HAVE_ZLIB_H
     if (iol->compressed)
 	ret = gzseek(iol->fd.g, offset, whence);
@@ -712,6 +1050,11 @@ iolog_rewind(struct iolog_file *iol)
 {
     debug_decl(iolog_rewind, SUDO_DEBUG_UTIL);
 
+#ifdef HAVE_ZSTD_H
+    if (iol->compressed == IOLOG_COMPRESS_ZSTD)
+	iolog_zstd_rewind(iol->fd.z);
+    else
+#endif
 #ifdef HAVE_ZLIB_H
     if (iol->compressed)
 	(void)gzrewind(iol->fd.g);
@@ -722,6 +1065,116 @@ iolog_rewind(struct iolog_file *iol)
     debug_return;
 }
 
+/*
+ * Close iol and open it again for reading at the raw file offset.
+ * For a compressed file, offset must be the start of a gzip member
+ * or zstd frame.  Returns true on success and false on error.  If offset is not
+ * within the file, iol is left unchanged, otherwise it is disabled
+ * on error.
+ */
+bool
+iolog_reopen(struct iolog_file *iol, int dfd, int iofd, off_t offset)
+{
+    const char *errstr, *file = iolog_fd_to_name(iofd);
+    unsigned char compressed = iol->compressed;
+    bool binary = iol->binary;
+    struct stat sb;
+    int fd;
+    debug_decl(iolog_reopen, SUDO_DEBUG_UTIL);
+
+    fd = iolog_openat(dfd, file, O_RDONLY);
+    if (fd == -1)
+	debug_return_bool(false);
+    if (fstat(fd, &sb) == -1 || offset > sb.st_size ||
+	    lseek(fd, offset, SEEK_SET) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: unable to seek to offset %lld in %s", __func__,
+	    (long long)offset, file);
+	close(fd);
+	debug_return_bool(false);
+    }
+    (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (!iolog_close(iol, &errstr)) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "%s: unable to close %s: %s", __func__, file, errstr);
+    }
+    iol->enabled = false;
+    iol->writable = false;
+#ifdef HAVE_ZSTD_H
+    if (compressed == IOLOG_COMPRESS_ZSTD)
+	iol->fd.z = iolog_zstd_open(fd, "r");
+    else
+#endif
+#ifdef HAVE_ZLIB_H
+    if (compressed)
+	iol->fd.g = gzdopen(fd, "r");
+    else
+#endif
+	iol->fd.f = fdopen(fd, "r");
+    if (iol->fd.v == NULL) {
+	close(fd);
+	debug_return_bool(false);
+    }
+    iol->enabled = true;
+    iol->compressed = compressed;
+    iol->binary = binary;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Make the data written to iol so far independently readable and
+ * store the raw file offset of the next write in offsetp.
+ * For a compressed file, this ends the current gzip member or zstd
+ * frame and the next write will start a new one.
+ */
+bool
+iolog_checkpoint(struct iolog_file *iol, off_t *offsetp, const char **errstr)
+{
+    off_t offset;
+    debug_decl(iolog_checkpoint, SUDO_DEBUG_UTIL);
+
+    if (iol->compressed) {
+	if (!iolog_thread_drain(iol, errstr))
+	    debug_return_bool(false);
+    }
+
+#ifdef HAVE_ZSTD_H
+    if (iol->compressed == IOLOG_COMPRESS_ZSTD) {
+	if (!iolog_zstd_flush(iol->fd.z, true, errstr))
+	    debug_return_bool(false);
+	offset = iolog_zstd_offset(iol->fd.z);
+    } else
+#endif
+#ifdef HAVE_ZLIB_H
+    if (iol->compressed) {
+	if (gzflush(iol->fd.g, Z_FINISH) != Z_OK) {
+	    if (errstr != NULL)
+		*errstr = gzstrerror(iol->fd.g);
+	    debug_return_bool(false);
+	}
+	offset = gzoffset(iol->fd.g);
+    } else
+#endif
+    {
+	if (fflush(iol->fd.f) != 0) {
+	    if (errstr != NULL)
+		*errstr = strerror(errno);
+	    debug_return_bool(false);
+	}
+	offset = ftello(iol->fd.f);
+    }
+    if (offset == -1) {
+	if (errstr != NULL)
+	    *errstr = strerror(errno);
+	debug_return_bool(false);
+    }
+    *offsetp = offset;
+
+    debug_return_bool(true);
+}
+
 /*
  * Read from a (possibly compressed) I/O log file.
  */
@@ -739,6 +1192,11 @@ iolog_read(struct iolog_file *iol, void *buf, size_t nbytes,
 	debug_return_ssize_t(-1);
     }
 
+#ifdef HAVE_ZSTD_H
+    if (iol->compressed == IOLOG_COMPRESS_ZSTD) {
+	nread = iolog_zstd_read(iol->fd.z, buf, nbytes, errstr);
+    } else
+#endif
 #ifdef HAVE_ZLIB_H
     if (iol->compressed) {
 	if ((nread = gzread(iol->fd.g, buf, nbytes)) == -1) {
@@ -760,12 +1218,13 @@ iolog_read(struct iolog_file *iol, void *buf, size_t nbytes,
 
 /*
  * Write to an I/O log, optionally compressing.
+ * If iolog_compress_thread is set, compressed files are written
+ * by the compression thread.
  */
 ssize_t
 iolog_write(struct iolog_file *iol, const void *buf, size_t len,
     const char **errstr)
 {
-    ssize_t ret;
     debug_decl(iolog_write, SUDO_DEBUG_UTIL);
 
     if (len > UINT_MAX) {
@@ -775,6 +1234,40 @@ iolog_write(struct iolog_file *iol, const void *buf, size_t len,
 	debug_return_ssize_t(-1);
     }
 
+    if (iol->compressed) {
+	if (iolog_compress_thread)
+	    debug_return_ssize_t(iolog_thread_write(iol, buf, len, errstr));
+
+	/* The setting may have changed, wait for any queued data. */
+	if (!iolog_thread_drain(iol, errstr))
+	    debug_return_ssize_t(-1);
+    }
+    debug_return_ssize_t(iolog_write_direct(iol, buf, len, errstr));
+}
+
+/*
+ * Write to an I/O log in the calling thread, optionally compressing.
+ */
+ssize_t
+iolog_write_direct(struct iolog_file *iol, const void *buf, size_t len,
+    const char **errstr)
+{
+    ssize_t ret;
+    debug_decl(iolog_write_direct, SUDO_DEBUG_UTIL);
+
+#ifdef HAVE_ZSTD_H
+    if (iol->compressed == IOLOG_COMPRESS_ZSTD) {
+	ret = iolog_zstd_write(iol->fd.z, buf, len, errstr);
+	if (ret == -1)
+	    goto done;
+	if (iolog_flush) {
+	    if (!iolog_zstd_flush(iol->fd.z, false, errstr)) {
+		ret = -1;
+		goto done;
+	    }
+	}
+    } else
+#endif
 #ifdef HAVE_ZLIB_H
     if (iol->compressed) {
 	ret = gzwrite(iol->fd.g, (const voidp)buf, len);
@@ -825,6 +1318,11 @@ iolog_eof(struct iolog_file *iol)
     bool ret;
     debug_decl(iolog_eof, SUDO_DEBUG_UTIL);
 
+#ifdef HAVE_ZSTD_H
+    if (iol->compressed == IOLOG_COMPRESS_ZSTD)
+	ret = iolog_zstd_eof(iol->fd.z);
+    else
+#endif
 #ifdef HAVE_ZLIB_H
     if (iol->compressed)
 	ret = gzeof(iol->fd.g) == 1;
@@ -839,6 +1337,11 @@ iolog_clearerr(struct iolog_file *iol)
 {
     debug_decl(iolog_eof, SUDO_DEBUG_UTIL);
 
+#ifdef HAVE_ZSTD_H
+    if (iol->compressed == IOLOG_COMPRESS_ZSTD)
+	iolog_zstd_clearerr(iol->fd.z);
+    else
+#endif
 #ifdef HAVE_ZLIB_H
     if (iol->compressed)
 	gzclearerr(iol->fd.g);
@@ -848,6 +1351,39 @@ iolog_clearerr(struct iolog_file *iol)
     debug_return;
 }
 
+/*
+ * Like getc() but for struct iolog_file.
+ * There is no debug_decl since this is called for every byte of
+ * a binary timing record.
+ */
+int
+iolog_getc(struct iolog_file *iol, const char **errstr)
+{
+    int ch;
+
+#ifdef HAVE_ZSTD_H
+    if (iol->compressed == IOLOG_COMPRESS_ZSTD) {
+	ch = iolog_zstd_getc(iol->fd.z, errstr);
+    } else
+#endif
+#ifdef HAVE_ZLIB_H
+    if (iol->compressed) {
+	if ((ch = gzgetc(iol->fd.g)) == -1) {
+	    ch = EOF;
+	    if (errstr != NULL)
+		*errstr = gzstrerror(iol->fd.g);
+	}
+    } else
+#endif
+    {
+	if ((ch = getc(iol->fd.f)) == EOF) {
+	    if (errstr != NULL)
+		*errstr = strerror(errno);
+	}
+    }
+    return ch;
+}
+
 /*
  * Like gets() but for struct iolog_file.
  */
@@ -865,6 +1401,11 @@ iolog_gets(struct iolog_file *iol, char *buf, size_t nbytes,
 	debug_return_str(NULL);
     }
 
+#ifdef HAVE_ZSTD_H
+    if (iol->compressed == IOLOG_COMPRESS_ZSTD) {
+	str = iolog_zstd_gets(iol->fd.z, buf, nbytes, errstr);
+    } else
+#endif
 #ifdef HAVE_ZLIB_H
     if (iol->compressed) {
 	if ((str = gzgets(iol->fd.g, buf, nbytes)) == NULL) {
@@ -966,6 +1507,14 @@ iolog_write_info_file_json(int dfd, struct eventlog *evlog)
     if (!sudo_json_close_object(&json))
 	goto oom;
 
+    /* Timing file format, version 1 (text) is implied. */
+    if (iolog_binary_timing) {
+	json_value.type = JSON_NUMBER;
+	json_value.u.number = 2;
+	if (!sudo_json_add_value(&json, "timing_version", &json_value))
+	    goto oom;
+    }
+
     if (!eventlog_store_json(&json, evlog))
 	goto done;
 
@@ -1023,6 +1572,304 @@ iolog_write_info_file(int dfd, struct eventlog *evlog)
     debug_return_bool(true);
 }
 
+/*
+ * Format entry as a line in the I/O log index: the elapsed time
+ * followed by "offset:skip" for each I/O log file in IOFD_* order.
+ * Returns the length of the line or -1 if buf is too small.
+ */
+static int
+iolog_fmt_index(char *buf, size_t bufsize,
+    const struct iolog_index_entry *entry)
+{
+    size_t len;
+    int iofd, n;
+    debug_decl(iolog_fmt_index, SUDO_DEBUG_UTIL);
+
+    n = snprintf(buf, bufsize, "%lld.%09ld", (long long)entry->elapsed.tv_sec,
+	entry->elapsed.tv_nsec);
+    if (n < 0 || (size_t)n >= bufsize)
+	debug_return_int(-1);
+    len = (size_t)n;
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	n = snprintf(buf + len, bufsize - len, " %lld:%lld",
+	    (long long)entry->offset[iofd], (long long)entry->skip[iofd]);
+	if (n < 0 || (size_t)n >= bufsize - len)
+	    debug_return_int(-1);
+	len += (size_t)n;
+    }
+    if (len + 1 >= bufsize)
+	debug_return_int(-1);
+    buf[len++] = '\n';
+    buf[len] = '\0';
+
+    debug_return_int((int)len);
+}
+
+/*
+ * Parse a line from the I/O log index, see iolog_fmt_index().
+ */
+static bool
+iolog_parse_index(char *line, struct iolog_index_entry *entry)
+{
+    const char *errstr;
+    char *cp, *ep, *last;
+    int iofd;
+    debug_decl(iolog_parse_index, SUDO_DEBUG_UTIL);
+
+    line[strcspn(line, "\n")] = '\0';
+    if ((cp = strtok_r(line, " ", &last)) == NULL)
+	debug_return_bool(false);
+    cp = iolog_parse_delay(cp, &entry->elapsed, ".");
+    if (cp == NULL || *cp != '\0')
+	debug_return_bool(false);
+
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	if ((cp = strtok_r(NULL, " ", &last)) == NULL)
+	    debug_return_bool(false);
+	if ((ep = strchr(cp, ':')) == NULL)
+	    debug_return_bool(false);
+	*ep++ = '\0';
+	entry->offset[iofd] = sudo_strtonum(cp, 0, LLONG_MAX, &errstr);
+	if (errstr != NULL)
+	    debug_return_bool(false);
+	entry->skip[iofd] = sudo_strtonum(ep, 0, LLONG_MAX, &errstr);
+	if (errstr != NULL)
+	    debug_return_bool(false);
+    }
+    if (strtok_r(NULL, " ", &last) != NULL)
+	debug_return_bool(false);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Append entry to the I/O log index in dfd, creating it as needed.
+ */
+bool
+iolog_index_append(int dfd, const struct iolog_index_entry *entry)
+{
+    char buf[1024];
+    ssize_t nwritten;
+    int fd, len;
+    debug_decl(iolog_index_append, SUDO_DEBUG_UTIL);
+
+    len = iolog_fmt_index(buf, sizeof(buf), entry);
+    if (len == -1) {
+	/* Not actually possible due to the size of buf[]. */
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: unable to format index entry", __func__);
+	debug_return_bool(false);
+    }
+
+    fd = iolog_openat(dfd, "index", O_CREAT|O_APPEND|O_WRONLY);
+    if (fd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "%s: unable to open index", __func__);
+	debug_return_bool(false);
+    }
+    if (fchown(fd, iolog_uid, iolog_gid) != 0) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+	    "%s: unable to fchown %d:%d index", __func__,
+	    (int)iolog_uid, (int)iolog_gid);
+    }
+    /* A single write so readers never see a partial entry. */
+    nwritten = write(fd, buf, (size_t)len);
+    close(fd);
+    if (nwritten != len) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "%s: unable to write index", __func__);
+	debug_return_bool(false);
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Add an entry for the current position of each enabled I/O log file
+ * to the index.  Compressed files start a new gzip member afterwards.
+ */
+bool
+iolog_write_index(int dfd, struct iolog_file *iolog_files,
+    const struct timespec *elapsed)
+{
+    struct iolog_index_entry entry;
+    const char *errstr;
+    int iofd;
+    debug_decl(iolog_write_index, SUDO_DEBUG_UTIL);
+
+    memset(&entry, 0, sizeof(entry));
+    entry.elapsed = *elapsed;
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	if (!iolog_files[iofd].enabled)
+	    continue;
+	if (!iolog_checkpoint(&iolog_files[iofd], &entry.offset[iofd],
+		&errstr)) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"%s: unable to checkpoint %s: %s", __func__,
+		iolog_fd_to_name(iofd), errstr);
+	    debug_return_bool(false);
+	}
+    }
+
+    debug_return_bool(iolog_index_append(dfd, &entry));
+}
+
+/*
+ * Open the I/O log index in dfd for reading.
+ * Returns NULL if there is no index.
+ */
+static FILE *
+iolog_index_open(int dfd, int flags)
+{
+    FILE *fp = NULL;
+    int fd;
+    debug_decl(iolog_index_open, SUDO_DEBUG_UTIL);
+
+    fd = iolog_openat(dfd, "index", flags);
+    if (fd == -1) {
+	if (errno != ENOENT) {
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"%s: unable to open index", __func__);
+	}
+	debug_return_ptr(NULL);
+    }
+    if ((fp = fdopen(fd, flags == O_RDONLY ? "r" : "r+")) == NULL)
+	close(fd);
+
+    debug_return_ptr(fp);
+}
+
+/*
+ * Find the last index entry at or before target.
+ * Returns true if one was found, else false.
+ */
+bool
+iolog_index_find(int dfd, const struct timespec *target,
+    struct iolog_index_entry *entry)
+{
+    struct iolog_index_entry cur;
+    char line[LINE_MAX];
+    bool found = false;
+    FILE *fp;
+    debug_decl(iolog_index_find, SUDO_DEBUG_UTIL);
+
+    if ((fp = iolog_index_open(dfd, O_RDONLY)) == NULL)
+	debug_return_bool(false);
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (!iolog_parse_index(line, &cur)) {
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+		"%s: invalid index entry", __func__);
+	    break;
+	}
+	if (sudo_timespeccmp(&cur.elapsed, target, >))
+	    break;
+	*entry = cur;
+	found = true;
+    }
+    fclose(fp);
+
+    debug_return_bool(found);
+}
+
+/*
+ * Remove index entries after elapsed, such as when an I/O log
+ * is about to be overwritten from that point on.
+ */
+bool
+iolog_index_truncate(int dfd, const struct timespec *elapsed)
+{
+    struct iolog_index_entry cur;
+    char line[LINE_MAX];
+    bool ret = true;
+    off_t pos = 0;
+    FILE *fp;
+    debug_decl(iolog_index_truncate, SUDO_DEBUG_UTIL);
+
+    if ((fp = iolog_index_open(dfd, O_RDWR)) == NULL)
+	debug_return_bool(errno == ENOENT);
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (!iolog_parse_index(line, &cur) ||
+		sudo_timespeccmp(&cur.elapsed, elapsed, >)) {
+	    if (ftruncate(fileno(fp), pos) == -1) {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		    "%s: unable to truncate index", __func__);
+		ret = false;
+	    }
+	    break;
+	}
+	pos = ftello(fp);
+    }
+    fclose(fp);
+
+    debug_return_bool(ret);
+}
+
+/*
+ * Position each enabled I/O log file in iolog_files at entry.
+ * If skip is false, compressed files are left at the start of the
+ * gzip member or zstd frame and the caller is responsible for skipping.
+ */
+static bool
+iolog_index_position(int dfd, struct iolog_file *iolog_files,
+    const struct iolog_index_entry *entry, bool skip)
+{
+    int iofd;
+    debug_decl(iolog_index_position, SUDO_DEBUG_UTIL);
+
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	struct iolog_file *iol = &iolog_files[iofd];
+	off_t offset = entry->offset[iofd];
+	struct stat sb;
+
+	if (!iol->enabled)
+	    continue;
+	if (iol->compressed) {
+	    if (!iolog_reopen(iol, dfd, iofd, offset))
+		goto bad;
+	    if (skip && entry->skip[iofd] != 0) {
+		if (iolog_seek(iol, entry->skip[iofd], SEEK_SET) == -1)
+		    goto bad;
+	    }
+	} else {
+	    if (skip)
+		offset += entry->skip[iofd];
+	    if (fstat(fileno(iol->fd.f), &sb) == -1 || offset > sb.st_size)
+		goto bad;
+	    if (iolog_seek(iol, offset, SEEK_SET) == -1)
+		goto bad;
+	}
+    }
+    debug_return_bool(true);
+bad:
+    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	"%s: unable to seek %s to index entry [%lld, %ld]", __func__,
+	iolog_fd_to_name(iofd), (long long)entry->elapsed.tv_sec,
+	entry->elapsed.tv_nsec);
+    debug_return_bool(false);
+}
+
+/*
+ * Position the I/O log files in iolog_files at the index entry.
+ * Compressed files are reopened read-only.
+ * On failure, the files are moved back to the beginning if possible.
+ */
+bool
+iolog_index_seek(int dfd, struct iolog_file *iolog_files,
+    const struct iolog_index_entry *entry, bool skip)
+{
+    struct iolog_index_entry start;
+    debug_decl(iolog_index_seek, SUDO_DEBUG_UTIL);
+
+    if (iolog_index_position(dfd, iolog_files, entry, skip))
+	debug_return_bool(true);
+
+    memset(&start, 0, sizeof(start));
+    (void)iolog_index_position(dfd, iolog_files, &start, false);
+    debug_return_bool(false);
+}
+
 /*
  * Map IOFD_* -> name.
  */
@@ -280,6 +280,19 @@ json_store_timestamp(struct json_item *item, struct eventlog *evlog)
     debug_return_bool(true);
 }
 
+static bool
+json_store_timing_version(struct json_item *item, struct eventlog *evlog)
+{
+    debug_decl(json_store_timing_version, SUDO_DEBUG_UTIL);
+
+    /* The timing file reader detects the record format on its own. */
+    if (item->u.number < 1 || item->u.number > 2) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "unsupported timing file version %lld", item->u.number);
+    }
+    debug_return_bool(true);
+}
+
 static bool
 json_store_ttyname(struct json_item *item, struct eventlog *evlog)
 {
@@ -311,6 +324,7 @@ static struct iolog_json_key {
     { "submithost", JSON_STRING, json_store_submithost },
     { "submituser", JSON_STRING, json_store_submituser },
     { "timestamp", JSON_OBJECT, json_store_timestamp },
+    { "timing_version", JSON_NUMBER, json_store_timing_version },
     { "ttyname", JSON_STRING, json_store_ttyname },
     { NULL }
 };
@@ -0,0 +1,234 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "sudo_compat.h"
+#include "sudo_debug.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+#include "sudo_iolog.h"
+
+#include "iolog_thread.h"
+
+#ifdef HAVE_PTHREAD_H
+
+/*
+ * A buffer waiting to be compressed and written by the compression
+ * thread.  The data immediately follows the struct.
+ */
+struct iolog_thread_buf {
+    TAILQ_ENTRY(iolog_thread_buf) entries;
+    struct iolog_file *iol;
+    size_t len;
+};
+TAILQ_HEAD(iolog_thread_buf_list, iolog_thread_buf);
+
+/*
+ * All compressed I/O log files share a single compression thread.
+ * The queue and the pending and thread_errstr members of each
+ * struct iolog_file are protected by queue_mutex.
+ */
+static struct iolog_thread_buf_list queue = TAILQ_HEAD_INITIALIZER(queue);
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static size_t queue_bytes;
+static bool thread_started;
+static bool thread_failed;
+
+/*
+ * Write queued buffers in the order they were queued.
+ * The thread runs until the process exits.
+ */
+static void *
+iolog_thread_main(void *unused)
+{
+    struct iolog_thread_buf *tbuf;
+    struct iolog_file *iol;
+    const char *errstr;
+
+    pthread_mutex_lock(&queue_mutex);
+    for (;;) {
+	while ((tbuf = TAILQ_FIRST(&queue)) == NULL)
+	    pthread_cond_wait(&queue_cond, &queue_mutex);
+	TAILQ_REMOVE(&queue, tbuf, entries);
+	iol = tbuf->iol;
+
+	/* After a write error, the rest of the file's data is discarded. */
+	if (iol->thread_errstr == NULL) {
+	    pthread_mutex_unlock(&queue_mutex);
+	    errstr = NULL;
+	    if (iolog_write_direct(iol, tbuf + 1, tbuf->len, &errstr) == -1) {
+		if (errstr == NULL)
+		    errstr = strerror(EIO);
+	    }
+	    pthread_mutex_lock(&queue_mutex);
+	    if (errstr != NULL)
+		iol->thread_errstr = errstr;
+	}
+	iol->pending--;
+	queue_bytes -= tbuf->len;
+	pthread_cond_broadcast(&done_cond);
+	free(tbuf);
+    }
+    /* NOTREACHED */
+    return NULL;
+}
+
+/*
+ * Start the compression thread with all signals blocked.
+ * Must be called with queue_mutex held.
+ */
+static bool
+iolog_thread_start(void)
+{
+    sigset_t mask, omask;
+    pthread_t thread;
+    int error;
+    debug_decl(iolog_thread_start, SUDO_DEBUG_UTIL);
+
+    /* Signals are handled by the thread that writes the I/O log. */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, &omask);
+    error = pthread_create(&thread, NULL, iolog_thread_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &omask, NULL);
+    if (error != 0) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR,
+	    "%s: unable to create compression thread: %s", __func__,
+	    strerror(error));
+	debug_return_bool(false);
+    }
+    pthread_detach(thread);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Queue buf to be compressed and written to iol by the compression
+ * thread.  If more than IOLOG_THREAD_QUEUE_MAX bytes are already
+ * queued, waits for the thread to catch up first.  An error writing
+ * earlier data is returned by the next write or iolog_thread_drain().
+ * If the thread cannot be started, the data is written directly.
+ */
+ssize_t
+iolog_thread_write(struct iolog_file *iol, const void *buf, size_t len,
+    const char **errstr)
+{
+    struct iolog_thread_buf *tbuf;
+    debug_decl(iolog_thread_write, SUDO_DEBUG_UTIL);
+
+    if ((tbuf = malloc(sizeof(*tbuf) + len)) == NULL) {
+	if (errstr != NULL)
+	    *errstr = strerror(errno);
+	debug_return_ssize_t(-1);
+    }
+    tbuf->iol = iol;
+    tbuf->len = len;
+    memcpy(tbuf + 1, buf, len);
+
+    pthread_mutex_lock(&queue_mutex);
+    if (iol->thread_errstr != NULL) {
+	if (errstr != NULL)
+	    *errstr = iol->thread_errstr;
+	pthread_mutex_unlock(&queue_mutex);
+	free(tbuf);
+	debug_return_ssize_t(-1);
+    }
+    if (!thread_started) {
+	if (thread_failed || !iolog_thread_start()) {
+	    thread_failed = true;
+	    pthread_mutex_unlock(&queue_mutex);
+	    free(tbuf);
+	    debug_return_ssize_t(iolog_write_direct(iol, buf, len, errstr));
+	}
+	thread_started = true;
+    }
+    while (queue_bytes != 0 && queue_bytes + len > IOLOG_THREAD_QUEUE_MAX)
+	pthread_cond_wait(&done_cond, &queue_mutex);
+    TAILQ_INSERT_TAIL(&queue, tbuf, entries);
+    queue_bytes += len;
+    iol->pending++;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+
+    debug_return_ssize_t((ssize_t)len);
+}
+
+/*
+ * Wait for the compression thread to write all data queued for iol.
+ * Returns false if the thread was unable to write it.
+ */
+bool
+iolog_thread_drain(struct iolog_file *iol, const char **errstr)
+{
+    bool ret = true;
+    debug_decl(iolog_thread_drain, SUDO_DEBUG_UTIL);
+
+    pthread_mutex_lock(&queue_mutex);
+    while (iol->pending != 0)
+	pthread_cond_wait(&done_cond, &queue_mutex);
+    if (iol->thread_errstr != NULL) {
+	if (errstr != NULL)
+	    *errstr = iol->thread_errstr;
+	ret = false;
+    }
+    pthread_mutex_unlock(&queue_mutex);
+
+    debug_return_bool(ret);
+}
+
+#else
+
+/*
+ * Without threads, I/O log files are compressed by the writer.
+ */
+ssize_t
+iolog_thread_write(struct iolog_file *iol, const void *buf, size_t len,
+    const char **errstr)
+{
+    return iolog_write_direct(iol, buf, len, errstr);
+}
+
+bool
+iolog_thread_drain(struct iolog_file *iol, const char **errstr)
+{
+    return true;
+}
+
+#endif /* HAVE_PTHREAD_H */
@@ -0,0 +1,35 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef IOLOG_THREAD_H
+#define IOLOG_THREAD_H
+
+/*
+ * Maximum number of bytes queued for the compression thread.
+ * Once reached, writers block until the thread catches up.
+ */
+#define IOLOG_THREAD_QUEUE_MAX	(1024 * 1024)
+
+/* iolog_thread.c */
+ssize_t iolog_thread_write(struct iolog_file *iol, const void *buf, size_t len, const char **errstr);
+bool iolog_thread_drain(struct iolog_file *iol, const char **errstr);
+
+/* iolog_fileio.c */
+ssize_t iolog_write_direct(struct iolog_file *iol, const void *buf, size_t len, const char **errstr);
+
+#endif /* IOLOG_THREAD_H */
@@ -30,6 +30,11 @@
 #else
 # include "compat/stdbool.h"
 #endif /* HAVE_STDBOOL_H */
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
 #include <string.h>
 #include <signal.h>
 #include <unistd.h>
@@ -400,8 +405,102 @@ bad:
     debug_return_bool(false);
 }
 
+/*
+ * Read an unsigned LEB128 varint from a binary timing record.
+ * Returns true on success, else false.
+ */
+static bool
+iolog_read_varint(struct iolog_file *iol, unsigned long long maxval,
+    unsigned long long *valp, const char **errstr)
+{
+    unsigned long long val = 0;
+    unsigned int shift;
+    int ch;
+
+    for (shift = 0; shift < 64; shift += 7) {
+	if ((ch = iolog_getc(iol, errstr)) == EOF)
+	    return false;
+	val |= (unsigned long long)(ch & 0x7f) << shift;
+	if (!(ch & 0x80)) {
+	    if (val > maxval)
+		break;
+	    *valp = val;
+	    return true;
+	}
+    }
+    *errstr = strerror(ERANGE);
+    return false;
+}
+
+/*
+ * Parse the rest of a binary timing record after the initial byte.
+ * Returns true on success and false on failure.
+ */
+static bool
+iolog_parse_timing_binary(struct iolog_file *iol, int ch,
+    struct timing_closure *timing, const char **errstr)
+{
+    char signame[SIG2STR_MAX];
+    unsigned long long val;
+    size_t len;
+    debug_decl(iolog_parse_timing_binary, SUDO_DEBUG_UTIL);
+
+    /* Clear iolog descriptor. */
+    timing->iol = NULL;
+
+    timing->event = ch & ~IOLOG_TIMING_BINARY;
+    if (timing->event >= IO_EVENT_COUNT ||
+	    timing->event == IO_EVENT_TTYOUT_1_8_7) {
+	*errstr = U_("invalid event type");
+	goto bad;
+    }
+
+    if (!iolog_read_varint(iol, TIME_T_MAX, &val, errstr))
+	goto bad;
+    timing->delay.tv_sec = (time_t)val;
+    if (!iolog_read_varint(iol, 999999999, &val, errstr))
+	goto bad;
+    timing->delay.tv_nsec = (long)val;
+
+    switch (timing->event) {
+    case IO_EVENT_SUSPEND:
+	/* Signal name (no leading SIG prefix). */
+	if (!iolog_read_varint(iol, sizeof(signame) - 1, &val, errstr))
+	    goto bad;
+	for (len = 0; len < (size_t)val; len++) {
+	    if ((ch = iolog_getc(iol, errstr)) == EOF)
+		goto bad;
+	    signame[len] = (char)ch;
+	}
+	signame[len] = '\0';
+	if (str2sig(signame, &timing->u.signo) == -1) {
+	    *errstr = U_("invalid signal name");
+	    goto bad;
+	}
+	break;
+    case IO_EVENT_WINSIZE:
+	if (!iolog_read_varint(iol, INT_MAX, &val, errstr))
+	    goto bad;
+	timing->u.winsize.lines = (int)val;
+	if (!iolog_read_varint(iol, INT_MAX, &val, errstr))
+	    goto bad;
+	timing->u.winsize.cols = (int)val;
+	break;
+    default:
+	if (!iolog_read_varint(iol, SIZE_MAX, &val, errstr))
+	    goto bad;
+	timing->u.nbytes = (size_t)val;
+	break;
+    }
+
+    debug_return_bool(true);
+bad:
+    debug_return_bool(false);
+}
+
 /*
  * Read the next record from the timing file.
+ * Records may be in either text or binary format.
  * Return 0 on success, 1 on EOF and -1 on error.
  */
 int
@@ -409,10 +508,11 @@ iolog_read_timing_record(struct iolog_file *iol, struct timing_closure *timing)
 {
     char line[LINE_MAX];
     const char *errstr;
+    int ch;
     debug_decl(iolog_read_timing_record, SUDO_DEBUG_UTIL);
 
-    /* Read next record from timing file. */
-    if (iolog_gets(iol, line, sizeof(line), &errstr) == NULL) {
+    /* The first byte of the record tells us its format. */
+    if ((ch = iolog_getc(iol, &errstr)) == EOF) {
 	/* EOF or error reading timing file, we are done. */
 	if (iolog_eof(iol))
 	    debug_return_int(1);
@@ -420,6 +520,28 @@ iolog_read_timing_record(struct iolog_file *iol, struct timing_closure *timing)
 	debug_return_int(-1);
     }
 
+    if (ISSET(ch, IOLOG_TIMING_BINARY)) {
+	/* Parse binary timing file record. */
+	iol->binary = true;
+	if (!iolog_parse_timing_binary(iol, ch, timing, &errstr)) {
+	    if (iolog_eof(iol))
+		errstr = U_("truncated record");
+	    sudo_warnx(U_("invalid timing file record: %s"), errstr);
+	    debug_return_int(-1);
+	}
+	debug_return_int(0);
+    }
+
+    /* Read the rest of the line. */
+    line[0] = (char)ch;
+    line[1] = '\0';
+    if (ch != '\n' && iolog_gets(iol, line + 1, sizeof(line) - 1, &errstr) == NULL) {
+	if (!iolog_eof(iol)) {
+	    sudo_warnx(U_("error reading timing file: %s"), errstr);
+	    debug_return_int(-1);
+	}
+    }
+
     /* Parse timing file record. */
     line[strcspn(line, "\n")] = '\0';
     if (!iolog_parse_timing(line, timing)) {
@@ -429,3 +551,131 @@ iolog_read_timing_record(struct iolog_file *iol, struct timing_closure *timing)
 
     debug_return_int(0);
 }
+
+/*
+ * Store val as an unsigned LEB128 varint in buf.
+ * Returns the number of bytes used.
+ */
+static size_t
+iolog_put_varint(unsigned char *buf, unsigned long long val)
+{
+    size_t len = 0;
+
+    while (val >= 0x80) {
+	buf[len++] = (unsigned char)(val & 0x7f) | 0x80;
+	val >>= 7;
+    }
+    buf[len++] = (unsigned char)val;
+    return len;
+}
+
+/*
+ * Store the initial byte and delay of a binary timing record in buf,
+ * which must be at least IOLOG_TIMING_RECMAX bytes.
+ * Returns the number of bytes used.
+ */
+static size_t
+iolog_put_timing_hdr(unsigned char *buf, int event,
+    const struct timespec *delay)
+{
+    size_t len = 0;
+
+    buf[len++] = IOLOG_TIMING_BINARY | (unsigned char)event;
+    len += iolog_put_varint(buf + len, (unsigned long long)delay->tv_sec);
+    len += iolog_put_varint(buf + len, (unsigned long long)delay->tv_nsec);
+    return len;
+}
+
+/*
+ * Format a timing record for an I/O buffer of nbytes.
+ * Returns the length of the record or -1 if buf is too small.
+ */
+int
+iolog_fmt_timing_io(char *buf, size_t bufsize, bool binary, int event,
+    const struct timespec *delay, size_t nbytes)
+{
+    unsigned char *ubuf = (unsigned char *)buf;
+    int len;
+    debug_decl(iolog_fmt_timing_io, SUDO_DEBUG_UTIL);
+
+    if (binary) {
+	if (bufsize < IOLOG_TIMING_RECMAX)
+	    goto overflow;
+	len = (int)iolog_put_timing_hdr(ubuf, event, delay);
+	len += (int)iolog_put_varint(ubuf + len, nbytes);
+    } else {
+	len = snprintf(buf, bufsize, "%d %lld.%09ld %zu\n", event,
+	    (long long)delay->tv_sec, delay->tv_nsec, nbytes);
+	if (len < 0 || (size_t)len >= bufsize)
+	    goto overflow;
+    }
+    debug_return_int(len);
+overflow:
+    errno = EOVERFLOW;
+    debug_return_int(-1);
+}
+
+/*
+ * Format a timing record for a command suspend or resume.
+ * The signal name does not include the "SIG" prefix.
+ * Returns the length of the record or -1 if buf is too small.
+ */
+int
+iolog_fmt_timing_suspend(char *buf, size_t bufsize, bool binary,
+    const struct timespec *delay, const char *signame)
+{
+    unsigned char *ubuf = (unsigned char *)buf;
+    size_t namelen;
+    int len;
+    debug_decl(iolog_fmt_timing_suspend, SUDO_DEBUG_UTIL);
+
+    if (binary) {
+	namelen = strlen(signame);
+	if (bufsize < IOLOG_TIMING_RECMAX || namelen >= SIG2STR_MAX)
+	    goto overflow;
+	len = (int)iolog_put_timing_hdr(ubuf, IO_EVENT_SUSPEND, delay);
+	len += (int)iolog_put_varint(ubuf + len, namelen);
+	memcpy(buf + len, signame, namelen);
+	len += (int)namelen;
+    } else {
+	len = snprintf(buf, bufsize, "%d %lld.%09ld %s\n", IO_EVENT_SUSPEND,
+	    (long long)delay->tv_sec, delay->tv_nsec, signame);
+	if (len < 0 || (size_t)len >= bufsize)
+	    goto overflow;
+    }
+    debug_return_int(len);
+overflow:
+    errno = EOVERFLOW;
+    debug_return_int(-1);
+}
+
+/*
+ * Format a timing record for a terminal window size change.
+ * Returns the length of the record or -1 if buf is too small.
+ */
+int
+iolog_fmt_timing_winsize(char *buf, size_t bufsize, bool binary,
+    const struct timespec *delay, int lines, int cols)
+{
+    unsigned char *ubuf = (unsigned char *)buf;
+    int len;
+    debug_decl(iolog_fmt_timing_winsize, SUDO_DEBUG_UTIL);
+
+    if (binary) {
+	if (bufsize < IOLOG_TIMING_RECMAX)
+	    goto overflow;
+	len = (int)iolog_put_timing_hdr(ubuf, IO_EVENT_WINSIZE, delay);
+	len += (int)iolog_put_varint(ubuf + len, (unsigned int)lines);
+	len += (int)iolog_put_varint(ubuf + len, (unsigned int)cols);
+    } else {
+	len = snprintf(buf, bufsize, "%d %lld.%09ld %d %d\n",
+	    IO_EVENT_WINSIZE, (long long)delay->tv_sec, delay->tv_nsec,
+	    lines, cols);
+	if (len < 0 || (size_t)len >= bufsize)
+	    goto overflow;
+    }
+    debug_return_int(len);
+overflow:
+    errno = EOVERFLOW;
+    debug_return_int(-1);
+}
@@ -0,0 +1,448 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+#include <config.h>
+
+#ifdef HAVE_ZSTD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <zstd.h>
+
+#include "sudo_compat.h"
+#include "sudo_debug.h"
+#include "sudo_util.h"
+
+#include "iolog_zstd.h"
+
+/*
+ * Compression level to use when writing.  On recorded terminal
+ * sessions, level 6 gives a better ratio than zlib's default level
+ * while still using less CPU time.
+ */
+#define IOLOG_ZSTD_LEVEL	6
+
+struct iolog_zstd {
+    FILE *fp;
+    ZSTD_CCtx *cctx;		/* set when writing */
+    ZSTD_DCtx *dctx;		/* set when reading */
+    const char *errstr;		/* description of the last error */
+    bool eof;
+    bool error;
+    bool drain;			/* decompressor may hold more output */
+    off_t start;		/* file offset reading started at */
+    off_t pos;			/* uncompressed offset from start */
+    ZSTD_inBuffer in;		/* compressed data read from fp */
+    size_t insize;
+    size_t bufsize;
+    size_t off;			/* read position in buf */
+    size_t len;			/* amount of decompressed data in buf */
+    unsigned char *inbuf;
+    unsigned char *buf;		/* decompressed data or compressed output */
+};
+
+/*
+ * Open fd for reading or writing zstd-compressed data.
+ * Like gzdopen(), the descriptor is not closed on failure.
+ * When reading, decompression starts at the current file offset.
+ */
+struct iolog_zstd *
+iolog_zstd_open(int fd, const char *mode)
+{
+    struct iolog_zstd *zf;
+    debug_decl(iolog_zstd_open, SUDO_DEBUG_UTIL);
+
+    if ((zf = calloc(1, sizeof(*zf))) == NULL)
+	debug_return_ptr(NULL);
+
+    if (mode[0] == 'r') {
+	if ((zf->start = lseek(fd, 0, SEEK_CUR)) == -1)
+	    goto bad;
+	if ((zf->dctx = ZSTD_createDCtx()) == NULL)
+	    goto bad;
+	zf->insize = ZSTD_DStreamInSize();
+	zf->bufsize = ZSTD_DStreamOutSize();
+	if ((zf->inbuf = malloc(zf->insize)) == NULL)
+	    goto bad;
+	zf->in.src = zf->inbuf;
+    } else {
+	if ((zf->cctx = ZSTD_createCCtx()) == NULL)
+	    goto bad;
+	if (ZSTD_isError(ZSTD_CCtx_setParameter(zf->cctx,
+		ZSTD_c_compressionLevel, IOLOG_ZSTD_LEVEL)))
+	    goto bad;
+	zf->bufsize = ZSTD_CStreamOutSize();
+    }
+    if ((zf->buf = malloc(zf->bufsize)) == NULL)
+	goto bad;
+    if ((zf->fp = fdopen(fd, mode)) == NULL)
+	goto bad;
+
+    debug_return_ptr(zf);
+bad:
+    ZSTD_freeCCtx(zf->cctx);
+    ZSTD_freeDCtx(zf->dctx);
+    free(zf->inbuf);
+    free(zf->buf);
+    free(zf);
+    debug_return_ptr(NULL);
+}
+
+/*
+ * Compress the data in "in" and write the result.
+ * For ZSTD_e_flush and ZSTD_e_end, loop until all data is written.
+ */
+static bool
+iolog_zstd_compress(struct iolog_zstd *zf, ZSTD_inBuffer *in,
+    ZSTD_EndDirective mode)
+{
+    size_t remaining;
+    debug_decl(iolog_zstd_compress, SUDO_DEBUG_UTIL);
+
+    do {
+	ZSTD_outBuffer out = { zf->buf, zf->bufsize, 0 };
+
+	remaining = ZSTD_compressStream2(zf->cctx, &out, in, mode);
+	if (ZSTD_isError(remaining)) {
+	    zf->error = true;
+	    zf->errstr = ZSTD_getErrorName(remaining);
+	    debug_return_bool(false);
+	}
+	if (out.pos != 0) {
+	    if (fwrite(zf->buf, 1, out.pos, zf->fp) != out.pos) {
+		zf->error = true;
+		zf->errstr = strerror(errno);
+		debug_return_bool(false);
+	    }
+	}
+    } while (mode == ZSTD_e_continue ? in->pos != in->size : remaining != 0);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Decompress more data into buf if it is empty.
+ * When the last call filled buf, zstd may still have decompressed
+ * data buffered internally, so call it again before reading more
+ * input or reporting EOF.
+ * Returns false on EOF or error.
+ */
+static bool
+iolog_zstd_fill(struct iolog_zstd *zf)
+{
+    while (zf->off == zf->len) {
+	ZSTD_outBuffer out = { zf->buf, zf->bufsize, 0 };
+	size_t rc;
+
+	if (zf->eof || zf->error)
+	    return false;
+	if (zf->in.pos == zf->in.size && !zf->drain) {
+	    const size_t nread = fread(zf->inbuf, 1, zf->insize, zf->fp);
+	    if (nread == 0) {
+		if (ferror(zf->fp)) {
+		    zf->error = true;
+		    zf->errstr = strerror(errno);
+		} else {
+		    zf->eof = true;
+		}
+		return false;
+	    }
+	    zf->in.size = nread;
+	    zf->in.pos = 0;
+	}
+	rc = ZSTD_decompressStream(zf->dctx, &out, &zf->in);
+	if (ZSTD_isError(rc)) {
+	    zf->error = true;
+	    zf->errstr = ZSTD_getErrorName(rc);
+	    return false;
+	}
+	zf->off = 0;
+	zf->len = out.pos;
+	zf->drain = out.pos == out.size;
+    }
+    return true;
+}
+
+/*
+ * Write any buffered compressed data.  If end is set, the current
+ * frame is completed and the next write will start a new one.
+ */
+bool
+iolog_zstd_flush(struct iolog_zstd *zf, bool end, const char **errstr)
+{
+    ZSTD_inBuffer in = { NULL, 0, 0 };
+    debug_decl(iolog_zstd_flush, SUDO_DEBUG_UTIL);
+
+    if (zf->cctx == NULL)
+	debug_return_bool(true);
+
+    if (!iolog_zstd_compress(zf, &in, end ? ZSTD_e_end : ZSTD_e_flush))
+	goto bad;
+    if (fflush(zf->fp) != 0) {
+	zf->error = true;
+	zf->errstr = strerror(errno);
+	goto bad;
+    }
+    debug_return_bool(true);
+bad:
+    if (errstr != NULL)
+	*errstr = zf->errstr;
+    debug_return_bool(false);
+}
+
+/*
+ * Complete the current frame (if writing) and close the file.
+ */
+bool
+iolog_zstd_close(struct iolog_zstd *zf, const char **errstr)
+{
+    bool ret = true;
+    debug_decl(iolog_zstd_close, SUDO_DEBUG_UTIL);
+
+    if (zf->cctx != NULL)
+	ret = iolog_zstd_flush(zf, true, errstr);
+    if (fclose(zf->fp) != 0 && ret) {
+	ret = false;
+	if (errstr != NULL)
+	    *errstr = strerror(errno);
+    }
+    ZSTD_freeCCtx(zf->cctx);
+    ZSTD_freeDCtx(zf->dctx);
+    free(zf->inbuf);
+    free(zf->buf);
+    free(zf);
+
+    debug_return_bool(ret);
+}
+
+/*
+ * Returns the raw file offset, like gzoffset().
+ * When writing, the file should be flushed first.
+ */
+off_t
+iolog_zstd_offset(struct iolog_zstd *zf)
+{
+    return ftello(zf->fp);
+}
+
+/*
+ * Start decompressing from the beginning again.
+ */
+static bool
+iolog_zstd_reset(struct iolog_zstd *zf)
+{
+    debug_decl(iolog_zstd_reset, SUDO_DEBUG_UTIL);
+
+    if (fseeko(zf->fp, zf->start, SEEK_SET) == -1)
+	debug_return_bool(false);
+    ZSTD_DCtx_reset(zf->dctx, ZSTD_reset_session_only);
+    zf->in.size = zf->in.pos = 0;
+    zf->off = zf->len = 0;
+    zf->pos = 0;
+    zf->eof = false;
+    zf->error = false;
+    zf->drain = false;
+
+    debug_return_bool(true);
+}
+
+void
+iolog_zstd_rewind(struct iolog_zstd *zf)
+{
+    debug_decl(iolog_zstd_rewind, SUDO_DEBUG_UTIL);
+
+    if (zf->dctx != NULL)
+	(void)iolog_zstd_reset(zf);
+
+    debug_return;
+}
+
+/*
+ * Seek to an uncompressed offset, like gzseek().
+ * Seeking backwards requires decompressing from the start.
+ * When writing, only the current position may be queried.
+ * There is no debug_decl since there is no debug_return_off_t().
+ */
+off_t
+iolog_zstd_seek(struct iolog_zstd *zf, off_t offset, int whence)
+{
+    off_t target;
+
+    switch (whence) {
+    case SEEK_SET:
+	target = offset;
+	break;
+    case SEEK_CUR:
+	target = zf->pos + offset;
+	break;
+    default:
+	target = -1;
+	break;
+    }
+    if (target < 0 || (zf->cctx != NULL && target != zf->pos)) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    if (target < zf->pos) {
+	if (!iolog_zstd_reset(zf))
+	    return -1;
+    }
+    while (zf->pos < target) {
+	size_t n;
+
+	if (!iolog_zstd_fill(zf))
+	    return -1;
+	n = MIN((size_t)(target - zf->pos), zf->len - zf->off);
+	zf->off += n;
+	zf->pos += n;
+    }
+
+    return zf->pos;
+}
+
+ssize_t
+iolog_zstd_read(struct iolog_zstd *zf, void *buf, size_t nbytes,
+    const char **errstr)
+{
+    size_t n, nread = 0;
+    debug_decl(iolog_zstd_read, SUDO_DEBUG_UTIL);
+
+    while (nread < nbytes) {
+	if (!iolog_zstd_fill(zf)) {
+	    if (zf->error) {
+		if (errstr != NULL)
+		    *errstr = zf->errstr;
+		debug_return_ssize_t(-1);
+	    }
+	    break;
+	}
+	n = MIN(nbytes - nread, zf->len - zf->off);
+	memcpy((char *)buf + nread, zf->buf + zf->off, n);
+	zf->off += n;
+	zf->pos += n;
+	nread += n;
+    }
+
+    debug_return_ssize_t((ssize_t)nread);
+}
+
+ssize_t
+iolog_zstd_write(struct iolog_zstd *zf, const void *buf, size_t len,
+    const char **errstr)
+{
+    ZSTD_inBuffer in = { buf, len, 0 };
+    debug_decl(iolog_zstd_write, SUDO_DEBUG_UTIL);
+
+    if (!iolog_zstd_compress(zf, &in, ZSTD_e_continue)) {
+	if (errstr != NULL)
+	    *errstr = zf->errstr;
+	debug_return_ssize_t(-1);
+    }
+    zf->pos += len;
+
+    debug_return_ssize_t((ssize_t)len);
+}
+
+/*
+ * No debug_decl since this is called for every byte of
+ * a binary timing record.
+ */
+int
+iolog_zstd_getc(struct iolog_zstd *zf, const char **errstr)
+{
+    if (!iolog_zstd_fill(zf)) {
+	if (zf->error && errstr != NULL)
+	    *errstr = zf->errstr;
+	return EOF;
+    }
+    zf->pos++;
+    return zf->buf[zf->off++];
+}
+
+/*
+ * Like fgets(3), reads at most nbytes - 1 bytes, stopping after a newline.
+ */
+char *
+iolog_zstd_gets(struct iolog_zstd *zf, char *buf, size_t nbytes,
+    const char **errstr)
+{
+    size_t len = 0;
+    debug_decl(iolog_zstd_gets, SUDO_DEBUG_UTIL);
+
+    while (len + 1 < nbytes) {
+	const unsigned char *nl;
+	size_t n;
+
+	if (!iolog_zstd_fill(zf))
+	    break;
+	n = MIN(nbytes - 1 - len, zf->len - zf->off);
+	nl = memchr(zf->buf + zf->off, '\n', n);
+	if (nl != NULL)
+	    n = (size_t)(nl - (zf->buf + zf->off)) + 1;
+	memcpy(buf + len, zf->buf + zf->off, n);
+	zf->off += n;
+	zf->pos += n;
+	len += n;
+	if (nl != NULL)
+	    break;
+    }
+    if (len == 0 || zf->error) {
+	if (zf->error && errstr != NULL)
+	    *errstr = zf->errstr;
+	debug_return_str(NULL);
+    }
+    buf[len] = '\0';
+
+    debug_return_str(buf);
+}
+
+bool
+iolog_zstd_eof(struct iolog_zstd *zf)
+{
+    debug_decl(iolog_zstd_eof, SUDO_DEBUG_UTIL);
+
+    debug_return_bool(zf->eof && zf->off == zf->len);
+}
+
+void
+iolog_zstd_clearerr(struct iolog_zstd *zf)
+{
+    debug_decl(iolog_zstd_clearerr, SUDO_DEBUG_UTIL);
+
+    zf->eof = false;
+    zf->error = false;
+    clearerr(zf->fp);
+
+    debug_return;
+}
+
+#endif /* HAVE_ZSTD_H */
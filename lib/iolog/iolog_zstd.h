@@ -0,0 +1,43 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef IOLOG_ZSTD_H
+#define IOLOG_ZSTD_H
+
+/*
+ * Minimal stdio-like interface to zstd-compressed I/O log files,
+ * modeled on zlib's gzFile functions.  A file is either read or
+ * written, never both.  Each flush with end set completes the current
+ * zstd frame; readers decompress concatenated frames transparently.
+ */
+struct iolog_zstd;
+
+struct iolog_zstd *iolog_zstd_open(int fd, const char *mode);
+bool iolog_zstd_close(struct iolog_zstd *zf, const char **errstr);
+bool iolog_zstd_flush(struct iolog_zstd *zf, bool end, const char **errstr);
+off_t iolog_zstd_offset(struct iolog_zstd *zf);
+off_t iolog_zstd_seek(struct iolog_zstd *zf, off_t offset, int whence);
+void iolog_zstd_rewind(struct iolog_zstd *zf);
+ssize_t iolog_zstd_read(struct iolog_zstd *zf, void *buf, size_t nbytes, const char **errstr);
+ssize_t iolog_zstd_write(struct iolog_zstd *zf, const void *buf, size_t len, const char **errstr);
+int iolog_zstd_getc(struct iolog_zstd *zf, const char **errstr);
+char *iolog_zstd_gets(struct iolog_zstd *zf, char *buf, size_t nbytes, const char **errstr);
+bool iolog_zstd_eof(struct iolog_zstd *zf);
+void iolog_zstd_clearerr(struct iolog_zstd *zf);
+
+#endif /* IOLOG_ZSTD_H */
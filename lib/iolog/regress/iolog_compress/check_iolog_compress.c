@@ -0,0 +1,408 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_ZSTD_H
+# include <zstd.h>
+#endif
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudo_compat.h"
+#include "sudo_util.h"
+#include "sudo_fatal.h"
+#include "sudo_iolog.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/*
+ * Check that I/O log data written with each compression method reads
+ * back unchanged.  With -b, also compare the compression ratio and
+ * the time to write and read back terminal output for each method.
+ */
+
+/* Size of the reads used to check the data. */
+#define READ_SIZE	1000
+
+/* Benchmark defaults: 16MB of generated output in 256 byte records. */
+#define BENCH_SIZE	(16 * 1024 * 1024)
+#define BENCH_RECSIZE	256
+#define BENCH_RUNS	5
+
+/*
+ * Fill buf with compressible text that looks like terminal output.
+ */
+static void
+fill_output(char *buf, size_t len)
+{
+    unsigned int line = 0;
+    size_t off = 0;
+
+    while (off < len) {
+	char tmp[64];
+	int n = snprintf(tmp, sizeof(tmp), "line %u of command output\r\n",
+	    line++);
+	if ((size_t)n > len - off)
+	    n = (int)(len - off);
+	memcpy(buf + off, tmp, n);
+	off += n;
+    }
+}
+
+/*
+ * Write len bytes to ttyout in records of recsize bytes with the given
+ * compression method, then read them back and check that exactly the
+ * same data is returned.
+ */
+static void
+test_roundtrip(int dfd, const char *name, int method, size_t len,
+    size_t recsize, int *ntests, int *nerrors)
+{
+    struct iolog_file iol;
+    const char *errstr;
+    char *data, *buf;
+    size_t off;
+    ssize_t nread;
+
+    data = malloc(MAX(len, 1));
+    buf = malloc(READ_SIZE);
+    if (data == NULL || buf == NULL)
+	sudo_fatalx("unable to allocate memory");
+    fill_output(data, len);
+
+    iolog_set_compress(method);
+    memset(&iol, 0, sizeof(iol));
+    iol.enabled = true;
+    if (!iolog_open(&iol, dfd, IOFD_TTYOUT, "w"))
+	sudo_fatal("%s: unable to create ttyout", name);
+    for (off = 0; off < len; off += recsize) {
+	if (iolog_write(&iol, data + off, MIN(recsize, len - off),
+		&errstr) == -1)
+	    sudo_fatalx("%s: unable to write ttyout: %s", name, errstr);
+    }
+    if (!iolog_close(&iol, &errstr))
+	sudo_fatalx("%s: unable to close ttyout: %s", name, errstr);
+
+    (*ntests)++;
+    memset(&iol, 0, sizeof(iol));
+    iol.enabled = true;
+    if (!iolog_open(&iol, dfd, IOFD_TTYOUT, "r"))
+	sudo_fatal("%s: unable to open ttyout", name);
+    for (off = 0; ; off += nread) {
+	nread = iolog_read(&iol, buf, READ_SIZE, &errstr);
+	if (nread <= 0)
+	    break;
+	if (off + nread > len || memcmp(buf, data + off, nread) != 0) {
+	    sudo_warnx("%s: %zu/%zu bytes: wrong data at offset %zu", name,
+		len, recsize, off);
+	    (*nerrors)++;
+	    goto done;
+	}
+    }
+    if (nread == -1) {
+	sudo_warnx("%s: %zu/%zu bytes: read error at offset %zu: %s", name,
+	    len, recsize, off, errstr);
+	(*nerrors)++;
+    } else if (off != len) {
+	sudo_warnx("%s: %zu/%zu bytes: only %zu bytes read back", name,
+	    len, recsize, off);
+	(*nerrors)++;
+    } else if (!iolog_eof(&iol)) {
+	sudo_warnx("%s: %zu/%zu bytes: not at EOF", name, len, recsize);
+	(*nerrors)++;
+    }
+done:
+    (void)iolog_close(&iol, &errstr);
+    free(buf);
+    free(data);
+}
+
+static void
+test_method(const char *testdir, const char *name, int method,
+    size_t blksize, int *ntests, int *nerrors)
+{
+    const size_t sizes[] = {
+	0, 1, blksize - 1, blksize, blksize + 1, 2 * blksize, 3 * blksize
+    };
+    char *dir;
+    size_t i;
+    int dfd;
+
+    if (asprintf(&dir, "%s/%s", testdir, name) == -1)
+	sudo_fatalx("unable to allocate memory");
+    if (!iolog_mkpath(dir))
+	sudo_fatal("unable to create %s", dir);
+    if ((dfd = open(dir, O_RDONLY)) == -1)
+	sudo_fatal("unable to open %s", dir);
+
+    /*
+     * Large records are compressed in full blocks.  With flushing
+     * enabled, small records that don't divide the block size leave
+     * a partial block when the decompressor's output buffer fills.
+     */
+    for (i = 0; i < nitems(sizes); i++) {
+	iolog_set_flush(false);
+	test_roundtrip(dfd, name, method, sizes[i], 4096, ntests, nerrors);
+	iolog_set_flush(true);
+	test_roundtrip(dfd, name, method, sizes[i], 1000, ntests, nerrors);
+    }
+    iolog_set_flush(false);
+
+    close(dfd);
+    free(dir);
+}
+
+static double
+elapsed_ms(struct timespec *start)
+{
+    struct timespec now;
+
+    sudo_gettime_mono(&now);
+    sudo_timespecsub(&now, start, &now);
+    return (now.tv_sec * 1000.0) + (now.tv_nsec / 1000000.0);
+}
+
+/*
+ * Read the contents of path into a newly allocated buffer.
+ */
+static char *
+read_file(const char *path, size_t *lenp)
+{
+    struct stat sb;
+    char *buf;
+    size_t len = 0;
+    ssize_t nread;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &sb) == -1)
+	sudo_fatal("%s", path);
+    if ((buf = malloc(MAX(sb.st_size, 1))) == NULL)
+	sudo_fatalx("unable to allocate memory");
+    while (len < (size_t)sb.st_size) {
+	nread = read(fd, buf + len, (size_t)sb.st_size - len);
+	if (nread <= 0)
+	    break;
+	len += (size_t)nread;
+    }
+    close(fd);
+    *lenp = len;
+    return buf;
+}
+
+/*
+ * Write data to ttyout in records of recsize bytes with the given
+ * compression method, then read it back.  Reports the compression
+ * ratio and the best write and read times over several runs.
+ */
+static void
+bench_method(int dfd, const char *name, int method, const char *data,
+    size_t len, size_t recsize, int runs)
+{
+    double ms, write_ms = 0, read_ms = 0;
+    struct iolog_file iol;
+    struct timespec start;
+    const char *errstr;
+    struct stat sb;
+    char *buf;
+    size_t off;
+    int i;
+
+    if ((buf = malloc(64 * 1024)) == NULL)
+	sudo_fatalx("unable to allocate memory");
+
+    iolog_set_compress(method);
+    for (i = 0; i < runs; i++) {
+	memset(&iol, 0, sizeof(iol));
+	iol.enabled = true;
+	if (!iolog_open(&iol, dfd, IOFD_TTYOUT, "w"))
+	    sudo_fatal("%s: unable to create ttyout", name);
+	sudo_gettime_mono(&start);
+	for (off = 0; off < len; off += recsize) {
+	    if (iolog_write(&iol, data + off, MIN(recsize, len - off),
+		    &errstr) == -1)
+		sudo_fatalx("%s: unable to write ttyout: %s", name, errstr);
+	}
+	if (!iolog_close(&iol, &errstr))
+	    sudo_fatalx("%s: unable to close ttyout: %s", name, errstr);
+	ms = elapsed_ms(&start);
+	if (i == 0 || ms < write_ms)
+	    write_ms = ms;
+
+	memset(&iol, 0, sizeof(iol));
+	iol.enabled = true;
+	if (!iolog_open(&iol, dfd, IOFD_TTYOUT, "r"))
+	    sudo_fatal("%s: unable to open ttyout", name);
+	sudo_gettime_mono(&start);
+	while (iolog_read(&iol, buf, 64 * 1024, &errstr) > 0)
+	    continue;
+	ms = elapsed_ms(&start);
+	(void)iolog_close(&iol, &errstr);
+	if (i == 0 || ms < read_ms)
+	    read_ms = ms;
+    }
+    if (fstatat(dfd, "ttyout", &sb, 0) == -1)
+	sudo_fatal("%s: ttyout", name);
+
+    printf("%-12s %10lld bytes  ratio %6.2f  write %8.1f ms  "
+	"read %8.1f ms\n", name, (long long)sb.st_size,
+	sb.st_size ? (double)len / sb.st_size : 0.0, write_ms, read_ms);
+    free(buf);
+}
+
+/*
+ * Compare the compression methods on the contents of path, or on
+ * generated terminal output if path is NULL.
+ */
+static void
+benchmark(const char *testdir, const char *path, size_t recsize, int runs,
+    bool flush)
+{
+    char *data, *dir;
+    size_t len;
+    int dfd;
+
+    if (path != NULL) {
+	data = read_file(path, &len);
+    } else {
+	len = BENCH_SIZE;
+	if ((data = malloc(len)) == NULL)
+	    sudo_fatalx("unable to allocate memory");
+	fill_output(data, len);
+    }
+
+    if (asprintf(&dir, "%s/bench", testdir) == -1)
+	sudo_fatalx("unable to allocate memory");
+    if (!iolog_mkpath(dir))
+	sudo_fatal("unable to create %s", dir);
+    if ((dfd = open(dir, O_RDONLY)) == -1)
+	sudo_fatal("unable to open %s", dir);
+
+    printf("%s: %zu bytes in %zu byte records%s, best of %d runs\n",
+	path ? path : "generated output", len, recsize,
+	flush ? ", flushed" : "", runs);
+    iolog_set_flush(flush);
+    bench_method(dfd, "uncompressed", IOLOG_COMPRESS_NONE, data, len,
+	recsize, runs);
+#ifdef HAVE_ZLIB_H
+    bench_method(dfd, "gzip", IOLOG_COMPRESS_GZIP, data, len, recsize, runs);
+#endif
+#ifdef HAVE_ZSTD_H
+    bench_method(dfd, "zstd", IOLOG_COMPRESS_ZSTD, data, len, recsize, runs);
+#endif
+    iolog_set_flush(false);
+
+    close(dfd);
+    free(dir);
+    free(data);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: %s [-bf] [-n runs] [-r recsize] [file ...]\n",
+	getprogname());
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char testdir[] = "compress.XXXXXX";
+    char *rmargs[] = { "rm", "-rf", NULL, NULL };
+    int ch, status, tests = 0, errors = 0, runs = BENCH_RUNS;
+    size_t recsize = BENCH_RECSIZE;
+    bool bench = false, flush = false;
+    const char *errstr;
+
+    initprogname(argc > 0 ? argv[0] : "check_iolog_compress");
+
+    while ((ch = getopt(argc, argv, "bfn:r:")) != -1) {
+	switch (ch) {
+	case 'b':
+	    bench = true;
+	    break;
+	case 'f':
+	    flush = true;
+	    break;
+	case 'n':
+	    runs = sudo_strtonum(optarg, 1, INT_MAX, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx("number of runs %s: %s", optarg, errstr);
+	    break;
+	case 'r':
+	    recsize = sudo_strtonum(optarg, 1, INT_MAX, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx("record size %s: %s", optarg, errstr);
+	    break;
+	default:
+	    usage();
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (mkdtemp(testdir) == NULL)
+	sudo_fatal("unable to create test dir");
+    rmargs[2] = testdir;
+
+    iolog_set_owner(geteuid(), getegid());
+
+    test_method(testdir, "uncompressed", IOLOG_COMPRESS_NONE, 64 * 1024,
+	&tests, &errors);
+#ifdef HAVE_ZLIB_H
+    test_method(testdir, "gzip", IOLOG_COMPRESS_GZIP, 64 * 1024,
+	&tests, &errors);
+#endif
+#ifdef HAVE_ZSTD_H
+    /* The decompressor may hold data back when its output buffer fills. */
+    test_method(testdir, "zstd", IOLOG_COMPRESS_ZSTD, ZSTD_DStreamOutSize(),
+	&tests, &errors);
+#endif
+
+    if (bench) {
+	if (argc == 0) {
+	    benchmark(testdir, NULL, recsize, runs, flush);
+	} else {
+	    while (argc-- > 0)
+		benchmark(testdir, *argv++, recsize, runs, flush);
+	}
+    }
+
+    if (tests != 0) {
+	printf("iolog_compress: %d test%s run, %d errors, %d%% success rate\n",
+	    tests, tests == 1 ? "" : "s", errors,
+	    (tests - errors) * 100 / tests);
+    }
+
+    /* Clean up (avoid running via shell) */
+    fflush(stdout);
+    execvp("rm", rmargs);
+    wait(&status);
+
+    exit(errors);
+}
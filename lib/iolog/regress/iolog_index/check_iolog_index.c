@@ -0,0 +1,301 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudo_compat.h"
+#include "sudo_util.h"
+#include "sudo_fatal.h"
+#include "sudo_iolog.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/* Output written between index entries, one chunk every 30 seconds. */
+static const char *chunks[] = {
+    "first chunk of output\r\n",
+    "second chunk of output\r\n",
+    "third chunk of output\r\n",
+    NULL
+};
+
+/*
+ * Write the chunks to ttyout, adding an index entry after each
+ * one except the last.
+ */
+static void
+write_session(int dfd, struct iolog_file *iolog_files)
+{
+    struct timespec elapsed = { 0, 0 };
+    const char *errstr;
+    char buf[1024];
+    int i, iofd, len;
+
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	iolog_files[iofd].enabled = iofd == IOFD_TTYOUT || iofd == IOFD_TIMING;
+	if (!iolog_open(&iolog_files[iofd], dfd, iofd, "w"))
+	    sudo_fatal("unable to create %s", iolog_fd_to_name(iofd));
+    }
+
+    for (i = 0; chunks[i] != NULL; i++) {
+	const struct timespec delay = { IOLOG_INDEX_INTERVAL, 0 };
+	const size_t nbytes = strlen(chunks[i]);
+
+	if (i != 0) {
+	    if (!iolog_write_index(dfd, iolog_files, &elapsed))
+		sudo_fatalx("unable to write index entry");
+	}
+	if (iolog_write(&iolog_files[IOFD_TTYOUT], chunks[i], nbytes,
+		&errstr) == -1)
+	    sudo_fatalx("unable to write ttyout: %s", errstr);
+	len = iolog_fmt_timing_io(buf, sizeof(buf), false, IO_EVENT_TTYOUT,
+	    &delay, nbytes);
+	if (len == -1 || iolog_write(&iolog_files[IOFD_TIMING], buf, len,
+		&errstr) == -1)
+	    sudo_fatalx("unable to write timing: %s", errstr);
+	sudo_timespecadd(&elapsed, &delay, &elapsed);
+    }
+
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	if (iolog_files[iofd].enabled)
+	    (void)iolog_close(&iolog_files[iofd], &errstr);
+    }
+}
+
+static void
+open_session(int dfd, struct iolog_file *iolog_files)
+{
+    int iofd;
+
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	iolog_files[iofd].enabled = iofd == IOFD_TTYOUT || iofd == IOFD_TIMING;
+	if (!iolog_open(&iolog_files[iofd], dfd, iofd, "r"))
+	    sudo_fatal("unable to open %s", iolog_fd_to_name(iofd));
+    }
+}
+
+static void
+close_session(struct iolog_file *iolog_files)
+{
+    const char *errstr;
+    int iofd;
+
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	if (iolog_files[iofd].enabled)
+	    (void)iolog_close(&iolog_files[iofd], &errstr);
+    }
+}
+
+/*
+ * Verify that the next data read from ttyout matches expected.
+ */
+static bool
+check_ttyout(struct iolog_file *iolog_files, const char *expected)
+{
+    const size_t len = strlen(expected);
+    const char *errstr;
+    char buf[1024];
+    ssize_t nread;
+
+    nread = iolog_read(&iolog_files[IOFD_TTYOUT], buf, len, &errstr);
+    return nread == (ssize_t)len && memcmp(buf, expected, len) == 0;
+}
+
+/*
+ * Seek to the index entry closest to target and check that the
+ * data read from ttyout is the expected chunk.
+ */
+static void
+check_seek(int dfd, const char *name, time_t target, time_t elapsed,
+    int chunk, int *ntests, int *nerrors)
+{
+    struct iolog_file iolog_files[IOFD_MAX];
+    struct iolog_index_entry entry;
+    struct timespec ts;
+    bool found;
+
+    open_session(dfd, iolog_files);
+
+    (*ntests)++;
+    ts.tv_sec = target;
+    ts.tv_nsec = 0;
+    found = iolog_index_find(dfd, &ts, &entry);
+    if (elapsed == -1) {
+	if (found) {
+	    sudo_warnx("%s: unexpected index entry for %lld", name,
+		(long long)target);
+	    (*nerrors)++;
+	}
+	memset(&entry, 0, sizeof(entry));
+    } else if (!found || entry.elapsed.tv_sec != elapsed) {
+	sudo_warnx("%s: expected index entry %lld for %lld, got %lld", name,
+	    (long long)elapsed, (long long)target,
+	    found ? (long long)entry.elapsed.tv_sec : -1LL);
+	(*nerrors)++;
+	close_session(iolog_files);
+	return;
+    }
+
+    (*ntests)++;
+    if (!iolog_index_seek(dfd, iolog_files, &entry, true)) {
+	sudo_warnx("%s: unable to seek to %lld", name,
+	    (long long)entry.elapsed.tv_sec);
+	(*nerrors)++;
+    } else if (!check_ttyout(iolog_files, chunks[chunk])) {
+	sudo_warnx("%s: wrong data at %lld", name,
+	    (long long)entry.elapsed.tv_sec);
+	(*nerrors)++;
+    }
+
+    close_session(iolog_files);
+}
+
+static void
+test_iolog_index(const char *testdir, const char *name, int method,
+    int *ntests, int *nerrors)
+{
+    struct iolog_file iolog_files[IOFD_MAX];
+    struct iolog_index_entry entry;
+    struct timespec ts;
+    char *dir;
+    int dfd;
+
+    if (asprintf(&dir, "%s/%s", testdir, name) == -1)
+	sudo_fatalx("unable to allocate memory");
+    if (!iolog_mkpath(dir))
+	sudo_fatal("unable to create %s", dir);
+    if ((dfd = open(dir, O_RDONLY)) == -1)
+	sudo_fatal("unable to open %s", dir);
+
+    iolog_set_compress(method);
+    write_session(dfd, iolog_files);
+
+    /* Before the first entry, replay starts at the beginning. */
+    check_seek(dfd, name, 10, -1, 0, ntests, nerrors);
+
+    /* Closest entry at or before the target. */
+    check_seek(dfd, name, 30, 30, 1, ntests, nerrors);
+    check_seek(dfd, name, 45, 30, 1, ntests, nerrors);
+    check_seek(dfd, name, 90, 60, 2, ntests, nerrors);
+
+    /* Entries past the truncation point are removed. */
+    (*ntests)++;
+    ts.tv_sec = 45;
+    ts.tv_nsec = 0;
+    if (!iolog_index_truncate(dfd, &ts)) {
+	sudo_warnx("%s: unable to truncate index", name);
+	(*nerrors)++;
+    }
+    check_seek(dfd, name, 90, 30, 1, ntests, nerrors);
+
+    /* Uncompressed data to discard after the offset. */
+    memset(&entry, 0, sizeof(entry));
+    entry.elapsed.tv_sec = 100;
+    entry.skip[IOFD_TTYOUT] = strlen(chunks[0]);
+    if (!iolog_index_append(dfd, &entry))
+	sudo_fatal("unable to append to index");
+    check_seek(dfd, name, 100, 100, 1, ntests, nerrors);
+
+    /* An entry that doesn't match the I/O log is ignored. */
+    memset(&entry, 0, sizeof(entry));
+    entry.elapsed.tv_sec = 120;
+    entry.offset[IOFD_TTYOUT] = 1024 * 1024;
+    if (!iolog_index_append(dfd, &entry))
+	sudo_fatal("unable to append to index");
+    open_session(dfd, iolog_files);
+    (*ntests)++;
+    ts = entry.elapsed;
+    if (!iolog_index_find(dfd, &ts, &entry) ||
+	    iolog_index_seek(dfd, iolog_files, &entry, true)) {
+	sudo_warnx("%s: seek to invalid index entry succeeded", name);
+	(*nerrors)++;
+    } else if (!check_ttyout(iolog_files, chunks[0])) {
+	sudo_warnx("%s: not at start after invalid index entry", name);
+	(*nerrors)++;
+    }
+    close_session(iolog_files);
+
+    /* Creating a new timing file removes the old index entries. */
+    (*ntests)++;
+    write_session(dfd, iolog_files);
+    ts.tv_sec = 200;
+    if (!iolog_index_find(dfd, &ts, &entry) || entry.elapsed.tv_sec != 60) {
+	sudo_warnx("%s: stale index after new timing file", name);
+	(*nerrors)++;
+    }
+
+    close(dfd);
+    free(dir);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char testdir[] = "index.XXXXXX";
+    char *rmargs[] = { "rm", "-rf", NULL, NULL };
+    int status, tests = 0, errors = 0;
+
+    initprogname(argc > 0 ? argv[0] : "check_iolog_index");
+
+    if (mkdtemp(testdir) == NULL)
+	sudo_fatal("unable to create test dir");
+    rmargs[2] = testdir;
+
+    iolog_set_owner(geteuid(), getegid());
+
+    test_iolog_index(testdir, "uncompressed", IOLOG_COMPRESS_NONE, &tests,
+	&errors);
+#ifdef HAVE_ZLIB_H
+    test_iolog_index(testdir, "gzip", IOLOG_COMPRESS_GZIP, &tests, &errors);
+#endif
+#ifdef HAVE_ZSTD_H
+    test_iolog_index(testdir, "zstd", IOLOG_COMPRESS_ZSTD, &tests, &errors);
+#endif
+
+    /* Compressed data written by the compression thread. */
+    iolog_set_compress_thread(true);
+#ifdef HAVE_ZLIB_H
+    test_iolog_index(testdir, "gzip-thread", IOLOG_COMPRESS_GZIP, &tests,
+	&errors);
+#endif
+#ifdef HAVE_ZSTD_H
+    test_iolog_index(testdir, "zstd-thread", IOLOG_COMPRESS_ZSTD, &tests,
+	&errors);
+#endif
+
+    if (tests != 0) {
+	printf("iolog_index: %d test%s run, %d errors, %d%% success rate\n",
+	    tests, tests == 1 ? "" : "s", errors,
+	    (tests - errors) * 100 / tests);
+    }
+
+    /* Clean up (avoid running via shell) */
+    fflush(stdout);
+    execvp("rm", rmargs);
+    wait(&status);
+
+    exit(errors);
+}
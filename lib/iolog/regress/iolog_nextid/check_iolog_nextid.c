@@ -0,0 +1,242 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudo_compat.h"
+#include "sudo_util.h"
+#include "sudo_fatal.h"
+#include "sudo_iolog.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+#define NPROCS	8
+#define NIDS	250
+
+struct nextid_test {
+    const char *dir;		/* subdirectory of the test dir */
+    const char *seq;		/* initial seq file contents or NULL */
+    unsigned int maxseq;	/* 0 for the default */
+    const char *ids[3];		/* expected session IDs */
+    const char *result;		/* expected final seq file contents */
+};
+
+static struct nextid_test nextid_tests[] = {
+    { "new", NULL, 0, { "000001", "000002", "000003" }, "000003\n" },
+    { "existing", "00000Z\n", 0, { "000010", "000011", "000012" }, "000012\n" },
+    { "nonewline", "0000ZZ", 0, { "000100", "000101", "000102" }, "000102\n" },
+    { "long", "000009\n\n\n", 0, { "000001", "000002", "000003" }, "000003\n" },
+    { "garbage", "%%%%%%\n", 0, { "000001", "000002", "000003" }, "000003\n" },
+    { "maxseq", "000008\n", 10, { "000009", "00000A", "000001" }, "000001\n" },
+    { NULL }
+};
+
+static bool
+write_file(const char *path, const char *contents)
+{
+    FILE *fp;
+    bool ret;
+
+    if ((fp = fopen(path, "w")) == NULL)
+	return false;
+    ret = fputs(contents, fp) != EOF;
+    if (fclose(fp) == EOF)
+	ret = false;
+    return ret;
+}
+
+static bool
+check_file(const char *path, const char *expected)
+{
+    char buf[64];
+    size_t nread;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL)
+	return false;
+    nread = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[nread] = '\0';
+    return strcmp(buf, expected) == 0;
+}
+
+static void
+test_iolog_nextid(const char *testdir, int *ntests, int *nerrors)
+{
+    struct nextid_test *nt;
+    char sessid[7], *dir, *seq;
+    int i;
+
+    for (nt = nextid_tests; nt->dir != NULL; nt++) {
+	if (asprintf(&dir, "%s/%s", testdir, nt->dir) == -1 ||
+		asprintf(&seq, "%s/seq", dir) == -1)
+	    sudo_fatalx("unable to allocate memory");
+	if (nt->seq != NULL) {
+	    if (!iolog_mkpath(dir) || !write_file(seq, nt->seq))
+		sudo_fatal("unable to create %s", seq);
+	}
+	iolog_set_maxseq(nt->maxseq ? nt->maxseq : SESSID_MAX);
+
+	for (i = 0; i < 3; i++) {
+	    (*ntests)++;
+	    if (!iolog_nextid(dir, sessid)) {
+		sudo_warnx("%s: unable to get next ID", dir);
+		(*nerrors)++;
+		continue;
+	    }
+	    if (strcmp(sessid, nt->ids[i]) != 0) {
+		sudo_warnx("%s: expected ID %s, got %s", dir, nt->ids[i],
+		    sessid);
+		(*nerrors)++;
+	    }
+	}
+	(*ntests)++;
+	if (!check_file(seq, nt->result)) {
+	    sudo_warnx("%s: unexpected contents", seq);
+	    (*nerrors)++;
+	}
+	free(seq);
+	free(dir);
+    }
+    iolog_set_maxseq(SESSID_MAX);
+}
+
+static int
+compare_ids(const void *v1, const void *v2)
+{
+    return strcmp(v1, v2);
+}
+
+/*
+ * Allocate IDs from multiple processes at once, starting with no seq
+ * file.  They must be unique and the seq file must hold the last one.
+ */
+static void
+test_iolog_nextid_concurrent(const char *testdir, int *ntests, int *nerrors)
+{
+    char (*ids)[7], sessid[7], *dir, *seq;
+    int i, j, status, pfd[2], start[2];
+    size_t nids = 0;
+    pid_t pid;
+
+    if (asprintf(&dir, "%s/concurrent", testdir) == -1 ||
+	    asprintf(&seq, "%s/seq", dir) == -1)
+	sudo_fatalx("unable to allocate memory");
+    if ((ids = calloc(NPROCS * NIDS, sizeof(*ids))) == NULL)
+	sudo_fatalx("unable to allocate memory");
+    if (pipe(pfd) == -1 || pipe(start) == -1)
+	sudo_fatal("pipe");
+
+    for (i = 0; i < NPROCS; i++) {
+	switch (fork()) {
+	case -1:
+	    sudo_fatal("fork");
+	case 0:
+	    close(pfd[0]);
+	    close(start[1]);
+	    /* Wait until all children exist so they race on the new file. */
+	    if (read(start[0], &j, 1) == -1)
+		_exit(1);
+	    for (j = 0; j < NIDS; j++) {
+		if (!iolog_nextid(dir, sessid))
+		    _exit(1);
+		if (write(pfd[1], sessid, sizeof(sessid)) != sizeof(sessid))
+		    _exit(1);
+	    }
+	    _exit(0);
+	}
+    }
+    close(pfd[1]);
+    close(start[0]);
+    close(start[1]);
+    while (nids < NPROCS * NIDS &&
+	    read(pfd[0], ids[nids], sizeof(ids[nids])) == sizeof(ids[nids]))
+	nids++;
+    close(pfd[0]);
+    while ((pid = wait(&status)) != -1) {
+	(*ntests)++;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+	    sudo_warnx("child %d failed", (int)pid);
+	    (*nerrors)++;
+	}
+    }
+
+    (*ntests)++;
+    if (nids != NPROCS * NIDS) {
+	sudo_warnx("expected %d IDs, got %zu", NPROCS * NIDS, nids);
+	(*nerrors)++;
+    }
+    qsort(ids, nids, sizeof(*ids), compare_ids);
+    for (i = 1; i < (int)nids; i++) {
+	(*ntests)++;
+	if (strcmp(ids[i - 1], ids[i]) == 0) {
+	    sudo_warnx("duplicate ID %s", ids[i]);
+	    (*nerrors)++;
+	}
+    }
+
+    /* NPROCS * NIDS is 2000, or 1JK in base 36. */
+    (*ntests)++;
+    if (!check_file(seq, "0001JK\n")) {
+	sudo_warnx("%s: unexpected contents", seq);
+	(*nerrors)++;
+    }
+    free(ids);
+    free(seq);
+    free(dir);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char testdir[] = "nextid.XXXXXX";
+    char *rmargs[] = { "rm", "-rf", NULL, NULL };
+    int status, tests = 0, errors = 0;
+
+    initprogname(argc > 0 ? argv[0] : "check_iolog_nextid");
+
+    if (mkdtemp(testdir) == NULL)
+	sudo_fatal("unable to create test dir");
+    rmargs[2] = testdir;
+
+    iolog_set_owner(geteuid(), getegid());
+
+    test_iolog_nextid(testdir, &tests, &errors);
+    test_iolog_nextid_concurrent(testdir, &tests, &errors);
+
+    if (tests != 0) {
+	printf("iolog_nextid: %d test%s run, %d errors, %d%% success rate\n",
+	    tests, tests == 1 ? "" : "s", errors,
+	    (tests - errors) * 100 / tests);
+    }
+
+    /* Clean up (avoid running via shell) */
+    fflush(stdout);
+    execvp("rm", rmargs);
+    wait(&status);
+
+    exit(errors);
+}
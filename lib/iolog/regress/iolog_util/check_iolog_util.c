@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -127,6 +128,128 @@ test_adjust_delay(int *ntests, int *nerrors)
     (*ntests) += i;
 }
 
+static struct timing_record_test {
+    bool binary;
+    int event;
+    struct timespec delay;
+    size_t nbytes;
+    int signo;
+    int lines;
+    int cols;
+} timing_record_tests[] = {
+    { false, IO_EVENT_TTYOUT,  {     0, 123456789 },      42, 0, 0, 0 },
+    { true,  IO_EVENT_TTYOUT,  {     0, 123456789 },      42, 0, 0, 0 },
+    { true,  IO_EVENT_STDIN,   {     0,         0 },       0, 0, 0, 0 },
+    { true,  IO_EVENT_STDOUT,  { 86400, 999999999 }, 1048576, 0, 0, 0 },
+    { true,  IO_EVENT_WINSIZE, {     1,       500 }, 0, 0, 24, 80 },
+    { false, IO_EVENT_WINSIZE, {     1,       500 }, 0, 0, 50, 132 },
+    { true,  IO_EVENT_SUSPEND, {     3,         7 }, 0, SIGTSTP, 0, 0 },
+    { false, IO_EVENT_SUSPEND, {     3,         7 }, 0, SIGCONT, 0, 0 },
+    { true,  IO_EVENT_TTYIN,   {     0,         1 },     127, 0, 0, 0 },
+    { true,  IO_EVENT_TTYIN,   {     0,         1 },     128, 0, 0, 0 }
+};
+
+/*
+ * Write a timing record in the format specified by the test.
+ */
+static int
+fmt_timing_record(struct timing_record_test *test, char *buf, size_t bufsize)
+{
+    char signame[SIG2STR_MAX];
+
+    switch (test->event) {
+    case IO_EVENT_WINSIZE:
+	return iolog_fmt_timing_winsize(buf, bufsize, test->binary,
+	    &test->delay, test->lines, test->cols);
+    case IO_EVENT_SUSPEND:
+	if (sig2str(test->signo, signame) == -1)
+	    return -1;
+	return iolog_fmt_timing_suspend(buf, bufsize, test->binary,
+	    &test->delay, signame);
+    default:
+	return iolog_fmt_timing_io(buf, bufsize, test->binary, test->event,
+	    &test->delay, test->nbytes);
+    }
+}
+
+/*
+ * Test that iolog_read_timing_record() can read back text and binary
+ * records written by iolog_fmt_timing_*(), including a mix of both.
+ */
+void
+test_timing_records(int *ntests, int *nerrors)
+{
+    struct timing_closure timing;
+    struct iolog_file iol;
+    char buf[IOLOG_TIMING_RECMAX];
+    unsigned int i;
+    int len;
+
+    memset(&iol, 0, sizeof(iol));
+    iol.enabled = true;
+    if ((iol.fd.f = tmpfile()) == NULL)
+	sudo_fatal("tmpfile");
+
+    for (i = 0; i < nitems(timing_record_tests); i++) {
+	struct timing_record_test *test = &timing_record_tests[i];
+
+	len = fmt_timing_record(test, buf, sizeof(buf));
+	if (len <= 0 || len > ssizeof(buf)) {
+	    sudo_warnx("%s:%u unable to format record", __func__, i);
+	    (*nerrors)++;
+	    continue;
+	}
+	if (test->binary != ((buf[0] & IOLOG_TIMING_BINARY) != 0)) {
+	    sudo_warnx("%s:%u wrong record type", __func__, i);
+	    (*nerrors)++;
+	}
+	if (fwrite(buf, 1, (size_t)len, iol.fd.f) != (size_t)len)
+	    sudo_fatal("fwrite");
+    }
+    rewind(iol.fd.f);
+
+    for (i = 0; i < nitems(timing_record_tests); i++) {
+	struct timing_record_test *test = &timing_record_tests[i];
+	bool ok;
+
+	memset(&timing, 0, sizeof(timing));
+	timing.decimal = ".";
+	if (iolog_read_timing_record(&iol, &timing) != 0) {
+	    sudo_warnx("%s:%u unable to read record", __func__, i);
+	    (*nerrors)++;
+	    break;
+	}
+	ok = timing.event == test->event &&
+	    sudo_timespeccmp(&timing.delay, &test->delay, ==);
+	switch (test->event) {
+	case IO_EVENT_WINSIZE:
+	    ok = ok && timing.u.winsize.lines == test->lines &&
+		timing.u.winsize.cols == test->cols;
+	    break;
+	case IO_EVENT_SUSPEND:
+	    ok = ok && timing.u.signo == test->signo;
+	    break;
+	default:
+	    ok = ok && timing.u.nbytes == test->nbytes;
+	    break;
+	}
+	if (!ok) {
+	    sudo_warnx("%s:%u record mismatch", __func__, i);
+	    (*nerrors)++;
+	}
+    }
+    (*ntests) += i;
+
+    /* Should be at EOF now. */
+    (*ntests)++;
+    if (iolog_read_timing_record(&iol, &timing) != 1) {
+	sudo_warnx("%s: expected EOF", __func__);
+	(*nerrors)++;
+    }
+
+    fclose(iol.fd.f);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -138,6 +261,8 @@ main(int argc, char *argv[])
 
     test_adjust_delay(&tests, &errors);
 
+    test_timing_records(&tests, &errors);
+
     if (tests != 0) {
 	printf("iolog_util: %d test%s run, %d errors, %d%% success rate\n",
 	    tests, tests == 1 ? "" : "s", errors,
@@ -649,7 +649,7 @@ void   server_hello__free_unpacked
   assert(message->base.descriptor == &server_hello__descriptor);
   protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
 }
-static const ProtobufCFieldDescriptor client_message__field_descriptors[13] =
+static const ProtobufCFieldDescriptor client_message__field_descriptors[14] =
 {
   {
     "accept_msg",
@@ -807,6 +807,18 @@ static const ProtobufCFieldDescriptor client_message__field_descriptors[13] =
     0 | PROTOBUF_C_FIELD_FLAG_ONEOF,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "session_id",
+    14,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(ClientMessage, session_id),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned client_message__field_indices_by_name[] = {
   0,   /* field[0] = accept_msg */
@@ -815,6 +827,7 @@ static const unsigned client_message__field_indices_by_name[] = {
   12,   /* field[12] = hello_msg */
   1,   /* field[1] = reject_msg */
   3,   /* field[3] = restart_msg */
+  13,   /* field[13] = session_id */
   9,   /* field[9] = stderr_buf */
   7,   /* field[7] = stdin_buf */
   8,   /* field[8] = stdout_buf */
@@ -826,7 +839,7 @@ static const unsigned client_message__field_indices_by_name[] = {
 static const ProtobufCIntRange client_message__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 13 }
+  { 0, 14 }
 };
 const ProtobufCMessageDescriptor client_message__descriptor =
 {
@@ -836,7 +849,7 @@ const ProtobufCMessageDescriptor client_message__descriptor =
   "ClientMessage",
   "",
   sizeof(ClientMessage),
-  13,
+  14,
   client_message__field_descriptors,
   client_message__field_indices_by_name,
   1,  client_message__number_ranges,
@@ -894,7 +907,7 @@ const ProtobufCMessageDescriptor time_spec__descriptor =
   (ProtobufCMessageInit) time_spec__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor io_buffer__field_descriptors[2] =
+static const ProtobufCFieldDescriptor io_buffer__field_descriptors[4] =
 {
   {
     "delay",
@@ -920,15 +933,41 @@ static const ProtobufCFieldDescriptor io_buffer__field_descriptors[2] =
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "uncompressed_len",
+    3,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(IoBuffer, uncompressed_len),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "checksum",
+    4,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(IoBuffer, checksum),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned io_buffer__field_indices_by_name[] = {
+  3,   /* field[3] = checksum */
   1,   /* field[1] = data */
   0,   /* field[0] = delay */
+  2,   /* field[2] = uncompressed_len */
 };
 static const ProtobufCIntRange io_buffer__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 2 }
+  { 0, 4 }
 };
 const ProtobufCMessageDescriptor io_buffer__descriptor =
 {
@@ -938,7 +977,7 @@ const ProtobufCMessageDescriptor io_buffer__descriptor =
   "IoBuffer",
   "",
   sizeof(IoBuffer),
-  2,
+  4,
   io_buffer__field_descriptors,
   io_buffer__field_indices_by_name,
   1,  io_buffer__number_ranges,
@@ -1559,7 +1598,7 @@ const ProtobufCMessageDescriptor command_suspend__descriptor =
   (ProtobufCMessageInit) command_suspend__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor client_hello__field_descriptors[1] =
+static const ProtobufCFieldDescriptor client_hello__field_descriptors[2] =
 {
   {
     "client_id",
@@ -1573,14 +1612,27 @@ static const ProtobufCFieldDescriptor client_hello__field_descriptors[1] =
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "compression",
+    2,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_STRING,
+    offsetof(ClientHello, n_compression),
+    offsetof(ClientHello, compression),
+    NULL,
+    &protobuf_c_empty_string,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned client_hello__field_indices_by_name[] = {
   0,   /* field[0] = client_id */
+  1,   /* field[1] = compression */
 };
 static const ProtobufCIntRange client_hello__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 1 }
+  { 0, 2 }
 };
 const ProtobufCMessageDescriptor client_hello__descriptor =
 {
@@ -1590,14 +1642,14 @@ const ProtobufCMessageDescriptor client_hello__descriptor =
   "ClientHello",
   "",
   sizeof(ClientHello),
-  1,
+  2,
   client_hello__field_descriptors,
   client_hello__field_indices_by_name,
   1,  client_hello__number_ranges,
   (ProtobufCMessageInit) client_hello__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor server_message__field_descriptors[5] =
+static const ProtobufCFieldDescriptor server_message__field_descriptors[6] =
 {
   {
     "hello",
@@ -1659,6 +1711,18 @@ static const ProtobufCFieldDescriptor server_message__field_descriptors[5] =
     0 | PROTOBUF_C_FIELD_FLAG_ONEOF,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "session_id",
+    6,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(ServerMessage, session_id),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned server_message__field_indices_by_name[] = {
   4,   /* field[4] = abort */
@@ -1666,11 +1730,12 @@ static const unsigned server_message__field_indices_by_name[] = {
   3,   /* field[3] = error */
   0,   /* field[0] = hello */
   2,   /* field[2] = log_id */
+  5,   /* field[5] = session_id */
 };
 static const ProtobufCIntRange server_message__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 5 }
+  { 0, 6 }
 };
 const ProtobufCMessageDescriptor server_message__descriptor =
 {
@@ -1680,14 +1745,14 @@ const ProtobufCMessageDescriptor server_message__descriptor =
   "ServerMessage",
   "",
   sizeof(ServerMessage),
-  5,
+  6,
   server_message__field_descriptors,
   server_message__field_indices_by_name,
   1,  server_message__number_ranges,
   (ProtobufCMessageInit) server_message__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor server_hello__field_descriptors[3] =
+static const ProtobufCFieldDescriptor server_hello__field_descriptors[5] =
 {
   {
     "server_id",
@@ -1725,8 +1790,34 @@ static const ProtobufCFieldDescriptor server_hello__field_descriptors[3] =
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "compression",
+    4,
+    PROTOBUF_C_LABEL_REPEATED,
+    PROTOBUF_C_TYPE_STRING,
+    offsetof(ServerHello, n_compression),
+    offsetof(ServerHello, compression),
+    NULL,
+    &protobuf_c_empty_string,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
+  {
+    "multiplex",
+    5,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_BOOL,
+    0,   /* quantifier_offset */
+    offsetof(ServerHello, multiplex),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned server_hello__field_indices_by_name[] = {
+  3,   /* field[3] = compression */
+  4,   /* field[4] = multiplex */
   1,   /* field[1] = redirect */
   0,   /* field[0] = server_id */
   2,   /* field[2] = servers */
@@ -1734,7 +1825,7 @@ static const unsigned server_hello__field_indices_by_name[] = {
 static const ProtobufCIntRange server_hello__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 3 }
+  { 0, 5 }
 };
 const ProtobufCMessageDescriptor server_hello__descriptor =
 {
@@ -1744,7 +1835,7 @@ const ProtobufCMessageDescriptor server_hello__descriptor =
   "ServerHello",
   "",
   sizeof(ServerHello),
-  3,
+  5,
   server_hello__field_descriptors,
   server_hello__field_indices_by_name,
   1,  server_hello__number_ranges,
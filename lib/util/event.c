@@ -172,7 +172,6 @@ sudo_ev_base_init(struct sudo_event_base *base)
     debug_decl(sudo_ev_base_init, SUDO_DEBUG_EVENT);
 
     TAILQ_INIT(&base->events);
-    TAILQ_INIT(&base->timeouts);
     for (i = 0; i < NSIG; i++)
 	TAILQ_INIT(&base->signals[i]);
     if (sudo_ev_base_alloc_impl(base) != 0) {
@@ -244,6 +243,7 @@ sudo_ev_base_free_v1(struct sudo_event_base *base)
     sudo_ev_base_free_impl(base);
     close(base->signal_pipe[0]);
     close(base->signal_pipe[1]);
+    free(base->timeouts);
     free(base);
 
     debug_return;
@@ -272,6 +272,7 @@ sudo_ev_init(struct sudo_event *ev, int fd, short events,
     ev->fd = fd;
     ev->events = events & SUDO_EV_MASK;
     ev->pfd_idx = -1;
+    ev->timeout_idx = -1;
     ev->callback = callback;
     ev->closure = closure;
 
@@ -447,6 +448,146 @@ sudo_ev_add_signal(struct sudo_event_base *base, struct sudo_event *ev,
     debug_return_int(0);
 }
 
+/*
+ * Timeout events are stored in a binary min-heap ordered by their
+ * absolute timeout.  Each event records its own index in the heap
+ * so that it can be removed or rescheduled in O(log n) time.
+ */
+static inline void
+sudo_ev_timeouts_set(struct sudo_event_base *base, int idx,
+    struct sudo_event *ev)
+{
+    base->timeouts[idx] = ev;
+    ev->timeout_idx = idx;
+}
+
+/*
+ * Move the event at idx towards the root until the heap is ordered.
+ */
+static void
+sudo_ev_timeouts_up(struct sudo_event_base *base, int idx)
+{
+    struct sudo_event *ev = base->timeouts[idx];
+
+    while (idx > 0) {
+	const int parent = (idx - 1) / 2;
+	struct sudo_event *pev = base->timeouts[parent];
+
+	if (!sudo_timespeccmp(&ev->timeout, &pev->timeout, <))
+	    break;
+	sudo_ev_timeouts_set(base, idx, pev);
+	idx = parent;
+    }
+    sudo_ev_timeouts_set(base, idx, ev);
+}
+
+/*
+ * Move the event at idx towards the leaves until the heap is ordered.
+ */
+static void
+sudo_ev_timeouts_down(struct sudo_event_base *base, int idx)
+{
+    struct sudo_event *ev = base->timeouts[idx];
+
+    for (;;) {
+	int child = (idx * 2) + 1;
+	struct sudo_event *cev;
+
+	if (child >= base->timeouts_len)
+	    break;
+	cev = base->timeouts[child];
+	if (child + 1 < base->timeouts_len) {
+	    struct sudo_event *rev = base->timeouts[child + 1];
+	    if (sudo_timespeccmp(&rev->timeout, &cev->timeout, <)) {
+		child++;
+		cev = rev;
+	    }
+	}
+	if (!sudo_timespeccmp(&cev->timeout, &ev->timeout, <))
+	    break;
+	sudo_ev_timeouts_set(base, idx, cev);
+	idx = child;
+    }
+    sudo_ev_timeouts_set(base, idx, ev);
+}
+
+/*
+ * Restore heap order after the timeout of the event at idx changed.
+ */
+static void
+sudo_ev_timeouts_adjust(struct sudo_event_base *base, int idx)
+{
+    if (idx > 0) {
+	struct sudo_event *ev = base->timeouts[idx];
+	struct sudo_event *pev = base->timeouts[(idx - 1) / 2];
+
+	if (sudo_timespeccmp(&ev->timeout, &pev->timeout, <)) {
+	    sudo_ev_timeouts_up(base, idx);
+	    return;
+	}
+    }
+    sudo_ev_timeouts_down(base, idx);
+}
+
+/*
+ * Make sure there is room in the timeouts heap for one more event.
+ */
+static int
+sudo_ev_timeouts_reserve(struct sudo_event_base *base)
+{
+    struct sudo_event **timeouts;
+    int new_max;
+    debug_decl(sudo_ev_timeouts_reserve, SUDO_DEBUG_EVENT);
+
+    if (base->timeouts_len < base->timeouts_max)
+	debug_return_int(0);
+
+    new_max = base->timeouts_max ? base->timeouts_max * 2 : 32;
+    timeouts = reallocarray(base->timeouts, new_max, sizeof(*timeouts));
+    if (timeouts == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: unable to allocate %d timeout slots", __func__, new_max);
+	debug_return_int(-1);
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"%s: timeouts_max %d -> %d", __func__, base->timeouts_max, new_max);
+    base->timeouts = timeouts;
+    base->timeouts_max = new_max;
+
+    debug_return_int(0);
+}
+
+/*
+ * Insert an event in the timeouts heap.
+ * The caller must have reserved space via sudo_ev_timeouts_reserve().
+ */
+static void
+sudo_ev_timeouts_insert(struct sudo_event_base *base, struct sudo_event *ev)
+{
+    const int idx = base->timeouts_len++;
+
+    base->timeouts[idx] = ev;
+    sudo_ev_timeouts_up(base, idx);
+    SET(ev->flags, SUDO_EVQ_TIMEOUTS);
+}
+
+/*
+ * Remove an event from the timeouts heap.
+ */
+static void
+sudo_ev_timeouts_remove(struct sudo_event_base *base, struct sudo_event *ev)
+{
+    const int idx = ev->timeout_idx;
+    struct sudo_event *last = base->timeouts[--base->timeouts_len];
+
+    if (last != ev) {
+	sudo_ev_timeouts_set(base, idx, last);
+	sudo_ev_timeouts_adjust(base, idx);
+    }
+    CLR(ev->flags, SUDO_EVQ_TIMEOUTS);
+    ev->timeout_idx = -1;
+}
+
 int
 sudo_ev_add_v1(struct sudo_event_base *base, struct sudo_event *ev,
     const struct timeval *timo, bool tohead)
@@ -480,14 +621,19 @@ sudo_ev_add_v2(struct sudo_event_base *base, struct sudo_event *ev,
 	}
     }
 
+    /* Reserve space in the timeouts heap before modifying anything. */
+    if (timo != NULL && !ISSET(ev->flags, SUDO_EVQ_TIMEOUTS)) {
+	if (sudo_ev_timeouts_reserve(base) != 0)
+	    debug_return_int(-1);
+    }
+
     /* Only add new events to the events list. */
     if (ISSET(ev->flags, SUDO_EVQ_INSERTED)) {
-	/* If event no longer has a timeout, remove from timeouts queue. */
+	/* If event no longer has a timeout, remove from timeouts heap. */
 	if (timo == NULL && ISSET(ev->flags, SUDO_EVQ_TIMEOUTS)) {
 	    sudo_debug_printf(SUDO_DEBUG_INFO,
-		"%s: removing event %p from timeouts queue", __func__, ev);
-	    CLR(ev->flags, SUDO_EVQ_TIMEOUTS);
-	    TAILQ_REMOVE(&base->timeouts, ev, timeouts_entries);
+		"%s: removing event %p from timeouts heap", __func__, ev);
+	    sudo_ev_timeouts_remove(base, ev);
 	}
     } else {
 	/* Special handling for signal events. */
@@ -512,24 +658,15 @@ sudo_ev_add_v2(struct sudo_event_base *base, struct sudo_event *ev,
     }
     /* Timeouts can be changed for existing events. */
     if (timo != NULL) {
-	struct sudo_event *evtmp;
-	if (ISSET(ev->flags, SUDO_EVQ_TIMEOUTS)) {
-	    /* Remove from timeouts list, then add back. */
-	    TAILQ_REMOVE(&base->timeouts, ev, timeouts_entries);
-	}
-	/* Convert to absolute time and insert in sorted order; O(n). */
+	/* Convert to absolute time and insert in the heap; O(log n). */
 	sudo_gettime_mono(&ev->timeout);
 	sudo_timespecadd(&ev->timeout, timo, &ev->timeout);
-	TAILQ_FOREACH(evtmp, &base->timeouts, timeouts_entries) {
-	    if (sudo_timespeccmp(&ev->timeout, &evtmp->timeout, <))
-		break;
-	}
-	if (evtmp != NULL) {
-	    TAILQ_INSERT_BEFORE(evtmp, ev, timeouts_entries);
+	if (ISSET(ev->flags, SUDO_EVQ_TIMEOUTS)) {
+	    /* Already in the heap, just restore heap order. */
+	    sudo_ev_timeouts_adjust(base, ev->timeout_idx);
 	} else {
-	    TAILQ_INSERT_TAIL(&base->timeouts, ev, timeouts_entries);
+	    sudo_ev_timeouts_insert(base, ev);
 	}
-	SET(ev->flags, SUDO_EVQ_TIMEOUTS);
     }
     debug_return_int(0);
 }
@@ -600,9 +737,9 @@ sudo_ev_del_v1(struct sudo_event_base *base, struct sudo_event *ev)
 	/* Unlink from event list. */
 	TAILQ_REMOVE(&base->events, ev, entries);
 
-	/* Unlink from timeouts list. */
+	/* Remove from timeouts heap. */
 	if (ISSET(ev->flags, SUDO_EVQ_TIMEOUTS))
-	    TAILQ_REMOVE(&base->timeouts, ev, timeouts_entries);
+	    sudo_ev_timeouts_remove(base, ev);
     }
 
     /* Unlink from active list. */
@@ -612,6 +749,7 @@ sudo_ev_del_v1(struct sudo_event_base *base, struct sudo_event *ev)
     /* Mark event unused. */
     ev->flags = 0;
     ev->pfd_idx = -1;
+    ev->timeout_idx = -1;
 
     debug_return_int(0);
 }
@@ -671,12 +809,11 @@ rescan:
 	case 0:
 	    /* Timed out, activate timeout events. */
 	    sudo_gettime_mono(&now);
-	    while ((ev = TAILQ_FIRST(&base->timeouts)) != NULL) {
+	    while ((ev = sudo_ev_first_timeout(base)) != NULL) {
 		if (sudo_timespeccmp(&ev->timeout, &now, >))
 		    break;
-		/* Remove from timeouts list. */
-		CLR(ev->flags, SUDO_EVQ_TIMEOUTS);
-		TAILQ_REMOVE(&base->timeouts, ev, timeouts_entries);
+		/* Remove from timeouts heap. */
+		sudo_ev_timeouts_remove(base, ev);
 		/* Make event active. */
 		ev->revents = SUDO_EV_TIMEOUT;
 		TAILQ_INSERT_TAIL(&base->active, ev, active_entries);
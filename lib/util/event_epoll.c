@@ -0,0 +1,460 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+#include <config.h>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sudo_compat.h"
+#include "sudo_util.h"
+#include "sudo_fatal.h"
+#include "sudo_debug.h"
+#include "sudo_event.h"
+
+/*
+ * The kernel only allows a single registration per fd so we keep a list
+ * of the events for each fd and register the union of their interests.
+ */
+struct sudo_ev_epoll_fd {
+    SLIST_HEAD(, sudo_event) events; /* I/O events for this fd */
+    short mask;			/* registered SUDO_EV_READ|SUDO_EV_WRITE */
+    bool always;		/* not supported by epoll, always ready */
+};
+
+int
+sudo_ev_base_alloc_impl(struct sudo_event_base *base)
+{
+    debug_decl(sudo_ev_base_alloc_impl, SUDO_DEBUG_EVENT);
+
+    base->epfds = NULL;
+    base->epfd_max = 0;
+    base->epfd_always = 0;
+    base->epevent_max = 32;
+    base->epevents = reallocarray(NULL, base->epevent_max,
+	sizeof(struct epoll_event));
+    if (base->epevents == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: unable to allocate %d epoll events", __func__,
+	    base->epevent_max);
+	base->epevent_max = 0;
+	base->epoll_fd = -1;
+	debug_return_int(-1);
+    }
+    base->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (base->epoll_fd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "%s: unable to create epoll instance", __func__);
+	free(base->epevents);
+	base->epevents = NULL;
+	debug_return_int(-1);
+    }
+    base->epoll_pid = getpid();
+
+    debug_return_int(0);
+}
+
+void
+sudo_ev_base_free_impl(struct sudo_event_base *base)
+{
+    debug_decl(sudo_ev_base_free_impl, SUDO_DEBUG_EVENT);
+
+    if (base->epoll_fd != -1)
+	close(base->epoll_fd);
+    free(base->epevents);
+    free(base->epfds);
+
+    debug_return;
+}
+
+/*
+ * Make sure the epfds array is large enough to hold fd.
+ */
+static int
+sudo_ev_epoll_resize(struct sudo_event_base *base, int fd)
+{
+    static int nofile_max = -1;
+    struct sudo_ev_epoll_fd *epfds;
+    int i, new_max;
+    debug_decl(sudo_ev_epoll_resize, SUDO_DEBUG_EVENT);
+
+    if (fd < base->epfd_max)
+	debug_return_int(0);
+
+    if (nofile_max == -1) {
+	struct rlimit rlim;
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0) {
+	    nofile_max = rlim.rlim_cur;
+	}
+    }
+
+    /* Don't allow epfd_max to go over RLIM_NOFILE unless fd requires it. */
+    new_max = base->epfd_max ? base->epfd_max : 32;
+    while (new_max <= fd)
+	new_max *= 2;
+    if (new_max > nofile_max && nofile_max > fd)
+	new_max = nofile_max;
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"%s: epfd_max %d -> %d", __func__, base->epfd_max, new_max);
+    epfds = reallocarray(base->epfds, new_max, sizeof(*epfds));
+    if (epfds == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: unable to allocate %d epoll fds", __func__, new_max);
+	debug_return_int(-1);
+    }
+    for (i = base->epfd_max; i < new_max; i++) {
+	SLIST_INIT(&epfds[i].events);
+	epfds[i].mask = 0;
+	epfds[i].always = false;
+    }
+    base->epfds = epfds;
+    base->epfd_max = new_max;
+
+    debug_return_int(0);
+}
+
+/*
+ * Register, modify or remove fd in the kernel's interest list.
+ */
+static int
+sudo_ev_epoll_ctl(struct sudo_event_base *base, int fd, short oldmask,
+    short newmask)
+{
+    struct epoll_event epev;
+    int op;
+    debug_decl(sudo_ev_epoll_ctl, SUDO_DEBUG_EVENT);
+
+    memset(&epev, 0, sizeof(epev));
+    epev.data.fd = fd;
+    if (ISSET(newmask, SUDO_EV_READ))
+	epev.events |= EPOLLIN;
+    if (ISSET(newmask, SUDO_EV_WRITE))
+	epev.events |= EPOLLOUT;
+
+    if (newmask == 0) {
+	op = EPOLL_CTL_DEL;
+    } else if (oldmask == 0) {
+	op = EPOLL_CTL_ADD;
+    } else {
+	op = EPOLL_CTL_MOD;
+    }
+
+    if (epoll_ctl(base->epoll_fd, op, fd, &epev) == -1) {
+	switch (errno) {
+	case EEXIST:
+	    /* Stale registration (fd was reused). */
+	    if (op == EPOLL_CTL_ADD) {
+		op = EPOLL_CTL_MOD;
+		if (epoll_ctl(base->epoll_fd, op, fd, &epev) == 0)
+		    break;
+	    }
+	    goto bad;
+	case ENOENT:
+	    /* The fd was closed, which removes it from the interest list. */
+	    if (op == EPOLL_CTL_DEL)
+		break;
+	    if (op == EPOLL_CTL_MOD) {
+		op = EPOLL_CTL_ADD;
+		if (epoll_ctl(base->epoll_fd, op, fd, &epev) == 0)
+		    break;
+	    }
+	    goto bad;
+	case EBADF:
+	    /*
+	     * The fd was closed before its events were deleted, which
+	     * also removed it from the interest list.  The remaining
+	     * events for fd are about to be deleted too.
+	     */
+	    if (op == EPOLL_CTL_DEL || op == EPOLL_CTL_MOD)
+		break;
+	    goto bad;
+	default:
+	    goto bad;
+	}
+    }
+
+    debug_return_int(0);
+bad:
+    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	"%s: epoll_ctl(%d, %d)", __func__, op, fd);
+    debug_return_int(-1);
+}
+
+/*
+ * Recompute the interest mask for fd and update the kernel's copy.
+ * Descriptors that epoll does not support, such as regular files,
+ * are treated as always ready, just like poll(2) does.
+ */
+static int
+sudo_ev_epoll_update(struct sudo_event_base *base, int fd)
+{
+    struct sudo_ev_epoll_fd *epfd = &base->epfds[fd];
+    struct sudo_event *ev;
+    short mask = 0;
+    debug_decl(sudo_ev_epoll_update, SUDO_DEBUG_EVENT);
+
+    SLIST_FOREACH(ev, &epfd->events, fd_entries) {
+	mask |= (ev->events & (SUDO_EV_READ|SUDO_EV_WRITE));
+    }
+    if (mask == epfd->mask)
+	debug_return_int(0);
+
+    if (epfd->always) {
+	if (mask == 0) {
+	    epfd->always = false;
+	    base->epfd_always--;
+	}
+    } else if (base->epoll_pid == getpid()) {
+	/* Skip the update in a child process, see sudo_ev_epoll_reinit(). */
+	if (sudo_ev_epoll_ctl(base, fd, epfd->mask, mask) == -1) {
+	    if (errno != EPERM || epfd->mask != 0)
+		debug_return_int(-1);
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		"%s: fd %d not supported by epoll, always ready",
+		__func__, fd);
+	    epfd->always = true;
+	    base->epfd_always++;
+	}
+    }
+    epfd->mask = mask;
+
+    debug_return_int(0);
+}
+
+/*
+ * An epoll instance is shared with the parent after fork(2), so changes
+ * made by the child would affect the parent's interest list.
+ * If we are in a new process, create a new epoll instance and
+ * re-register all the descriptors.
+ */
+static int
+sudo_ev_epoll_reinit(struct sudo_event_base *base)
+{
+    const pid_t pid = getpid();
+    int fd, epoll_fd;
+    debug_decl(sudo_ev_epoll_reinit, SUDO_DEBUG_EVENT);
+
+    if (base->epoll_pid == pid)
+	debug_return_int(0);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"%s: re-creating epoll instance after fork (pid %d -> %d)",
+	__func__, (int)base->epoll_pid, (int)pid);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "%s: unable to create epoll instance", __func__);
+	debug_return_int(-1);
+    }
+    close(base->epoll_fd);
+    base->epoll_fd = epoll_fd;
+    base->epoll_pid = pid;
+
+    for (fd = 0; fd < base->epfd_max; fd++) {
+	struct sudo_ev_epoll_fd *epfd = &base->epfds[fd];
+
+	if (epfd->mask == 0 || epfd->always)
+	    continue;
+	if (sudo_ev_epoll_ctl(base, fd, 0, epfd->mask) == -1) {
+	    if (errno != EPERM)
+		debug_return_int(-1);
+	    epfd->always = true;
+	    base->epfd_always++;
+	}
+    }
+
+    debug_return_int(0);
+}
+
+int
+sudo_ev_add_impl(struct sudo_event_base *base, struct sudo_event *ev)
+{
+    struct sudo_ev_epoll_fd *epfd;
+    debug_decl(sudo_ev_add_impl, SUDO_DEBUG_EVENT);
+
+    if (ev->fd < 0) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: invalid fd %d", __func__, ev->fd);
+	debug_return_int(-1);
+    }
+    if (sudo_ev_epoll_reinit(base) == -1)
+	debug_return_int(-1);
+    if (sudo_ev_epoll_resize(base, ev->fd) == -1)
+	debug_return_int(-1);
+
+    epfd = &base->epfds[ev->fd];
+    SLIST_INSERT_HEAD(&epfd->events, ev, fd_entries);
+    if (sudo_ev_epoll_update(base, ev->fd) == -1) {
+	SLIST_REMOVE_HEAD(&epfd->events, fd_entries);
+	debug_return_int(-1);
+    }
+
+    debug_return_int(0);
+}
+
+int
+sudo_ev_del_impl(struct sudo_event_base *base, struct sudo_event *ev)
+{
+    debug_decl(sudo_ev_del_impl, SUDO_DEBUG_EVENT);
+
+    if (ev->fd < 0 || ev->fd >= base->epfd_max) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: invalid fd %d", __func__, ev->fd);
+	debug_return_int(-1);
+    }
+
+    SLIST_REMOVE(&base->epfds[ev->fd].events, ev, sudo_event, fd_entries);
+    debug_return_int(sudo_ev_epoll_update(base, ev->fd));
+}
+
+/*
+ * Activate the events for fd that match the ready mask.
+ */
+static int
+sudo_ev_epoll_activate(struct sudo_event_base *base, int fd, short ready)
+{
+    struct sudo_event *ev;
+    int nactive = 0;
+    debug_decl(sudo_ev_epoll_activate, SUDO_DEBUG_EVENT);
+
+    SLIST_FOREACH(ev, &base->epfds[fd].events, fd_entries) {
+	const short what = ev->events & ready;
+	if (what == 0 || ISSET(ev->flags, SUDO_EVQ_ACTIVE))
+	    continue;
+	/* Make event active. */
+	sudo_debug_printf(SUDO_DEBUG_DEBUG,
+	    "%s: polled fd %d, events %d, activating %p",
+	    __func__, fd, what, ev);
+	ev->revents = what;
+	sudo_ev_activate(base, ev);
+	nactive++;
+    }
+
+    debug_return_int(nactive);
+}
+
+int
+sudo_ev_scan_impl(struct sudo_event_base *base, int flags)
+{
+    struct timespec now, ts;
+    struct sudo_event *ev;
+    int i, nready, timeout;
+    debug_decl(sudo_ev_scan_impl, SUDO_DEBUG_EVENT);
+
+    if (sudo_ev_epoll_reinit(base) == -1)
+	debug_return_int(-1);
+
+    if (base->epfd_always > 0) {
+	/* Some fds are always ready, just check for other events. */
+	timeout = 0;
+    } else if ((ev = sudo_ev_first_timeout(base)) != NULL) {
+	sudo_gettime_mono(&now);
+	sudo_timespecsub(&ev->timeout, &now, &ts);
+	if (ts.tv_sec < 0) {
+	    timeout = 0;
+	} else if (ts.tv_sec >= INT_MAX / 1000) {
+	    timeout = INT_MAX;
+	} else {
+	    /* Round up to avoid waking before the timeout expires. */
+	    timeout = (ts.tv_sec * 1000) + ((ts.tv_nsec + 999999) / 1000000);
+	}
+    } else if (ISSET(flags, SUDO_EVLOOP_NONBLOCK)) {
+	timeout = 0;
+    } else {
+	timeout = -1;
+    }
+
+    nready = epoll_wait(base->epoll_fd, base->epevents, base->epevent_max,
+	timeout);
+    switch (nready) {
+    case -1:
+	/* Error: EINTR (signal) */
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "epoll_wait");
+	break;
+    case 0:
+	/* Front end will activate timeout events. */
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: timeout", __func__);
+	break;
+    default:
+	/* Activate the events for each fd that is ready. */
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: %d fds ready", __func__,
+	    nready);
+	for (i = 0; i < nready; i++) {
+	    const struct epoll_event *epev = &base->epevents[i];
+	    short ready = 0;
+
+	    if (epev->data.fd < 0 || epev->data.fd >= base->epfd_max)
+		continue;
+	    if (epev->events & (EPOLLIN|EPOLLHUP|EPOLLERR))
+		ready |= SUDO_EV_READ;
+	    if (epev->events & (EPOLLOUT|EPOLLHUP|EPOLLERR))
+		ready |= SUDO_EV_WRITE;
+	    sudo_ev_epoll_activate(base, epev->data.fd, ready);
+	}
+
+	/* If the events array was filled, make it larger for next time. */
+	if (nready == base->epevent_max) {
+	    struct epoll_event *epevents;
+	    const int new_max = base->epevent_max * 2;
+
+	    epevents = reallocarray(base->epevents, new_max,
+		sizeof(struct epoll_event));
+	    if (epevents != NULL) {
+		sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		    "%s: epevent_max %d -> %d", __func__, base->epevent_max,
+		    new_max);
+		base->epevents = epevents;
+		base->epevent_max = new_max;
+	    }
+	}
+	break;
+    }
+
+    if (nready != -1 && base->epfd_always > 0) {
+	/* Activate events for fds that epoll(7) cannot monitor. */
+	TAILQ_FOREACH(ev, &base->events, entries) {
+	    if (ev->fd < 0 || ev->fd >= base->epfd_max)
+		continue;
+	    if (!base->epfds[ev->fd].always)
+		continue;
+	    nready += sudo_ev_epoll_activate(base, ev->fd,
+		SUDO_EV_READ|SUDO_EV_WRITE);
+	}
+    }
+
+    debug_return_int(nready);
+}
@@ -0,0 +1,264 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sudo_compat.h"
+#include "sudo_fatal.h"
+#include "sudo_util.h"
+#include "sudo_event.h"
+#include "sudo_rand.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/*
+ * Test the event timeout heap.  With -b, also report the cost
+ * of adding, rescheduling, deleting and expiring timeout events.
+ */
+
+#define DEFAULT_NTIMERS	20000
+#define MAX_TIMEOUT_NS	50000000	/* 50ms */
+
+struct test_timer {
+    struct sudo_event *ev;
+    bool deleted;
+    bool fired;
+};
+
+static struct timespec last_fired;
+static int nfired, order_errors;
+
+static void
+timer_cb(int fd, int what, void *v)
+{
+    struct test_timer *timer = v;
+
+    /* Events must expire in timeout order. */
+    if (sudo_timespeccmp(&timer->ev->timeout, &last_fired, <))
+	order_errors++;
+    last_fired = timer->ev->timeout;
+    timer->fired = true;
+    nfired++;
+}
+
+static void
+random_timeout(struct timespec *ts)
+{
+    ts->tv_sec = 0;
+    ts->tv_nsec = arc4random_uniform(MAX_TIMEOUT_NS);
+}
+
+/*
+ * Verify heap order and that each event's heap index is correct.
+ */
+static bool
+check_heap(struct sudo_event_base *base)
+{
+    int i;
+
+    for (i = 0; i < base->timeouts_len; i++) {
+	struct sudo_event *ev = base->timeouts[i];
+
+	if (ev->timeout_idx != i)
+	    return false;
+	if (i > 0) {
+	    struct sudo_event *pev = base->timeouts[(i - 1) / 2];
+	    if (sudo_timespeccmp(&ev->timeout, &pev->timeout, <))
+		return false;
+	}
+    }
+    return true;
+}
+
+static double
+elapsed_ns(struct timespec *start)
+{
+    struct timespec now;
+
+    sudo_gettime_mono(&now);
+    sudo_timespecsub(&now, start, &now);
+    return (now.tv_sec * 1000000000.0) + now.tv_nsec;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: %s [-b] [-n ntimers]\n", getprogname());
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sudo_event_base *base;
+    struct test_timer *timers;
+    struct timespec ts, start;
+    int ch, i, ndeleted = 0, ntimers = DEFAULT_NTIMERS;
+    int errors = 0, ntests = 0;
+    bool benchmark = false;
+    const char *errstr;
+    double ns_add, ns_resched, ns_del, ns_expire;
+
+    initprogname(argc > 0 ? argv[0] : "event_timeout_test");
+
+    while ((ch = getopt(argc, argv, "bn:")) != -1) {
+	switch (ch) {
+	case 'b':
+	    benchmark = true;
+	    break;
+	case 'n':
+	    ntimers = sudo_strtonum(optarg, 1, INT_MAX, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx_nodebug("number of timers %s: %s", optarg, errstr);
+	    break;
+	default:
+	    usage();
+	}
+    }
+
+    if ((base = sudo_ev_base_alloc()) == NULL)
+	sudo_fatalx_nodebug("unable to allocate event base");
+    timers = calloc(ntimers, sizeof(*timers));
+    if (timers == NULL)
+	sudo_fatalx_nodebug("unable to allocate memory");
+    for (i = 0; i < ntimers; i++) {
+	timers[i].ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT, timer_cb, &timers[i]);
+	if (timers[i].ev == NULL)
+	    sudo_fatalx_nodebug("unable to allocate memory");
+    }
+
+    /* Add all timers with a random timeout. */
+    sudo_gettime_mono(&start);
+    for (i = 0; i < ntimers; i++) {
+	random_timeout(&ts);
+	if (sudo_ev_add(base, timers[i].ev, &ts, false) == -1)
+	    sudo_fatalx_nodebug("unable to add event");
+    }
+    ns_add = elapsed_ns(&start);
+
+    ntests++;
+    if (base->timeouts_len != ntimers || !check_heap(base)) {
+	sudo_warnx_nodebug("failed test #%d: heap invalid after add", ntests);
+	errors++;
+    }
+
+    /* Reschedule every timer in place. */
+    sudo_gettime_mono(&start);
+    for (i = 0; i < ntimers; i++) {
+	random_timeout(&ts);
+	if (sudo_ev_add(base, timers[i].ev, &ts, false) == -1)
+	    sudo_fatalx_nodebug("unable to add event");
+    }
+    ns_resched = elapsed_ns(&start);
+
+    ntests++;
+    if (base->timeouts_len != ntimers || !check_heap(base)) {
+	sudo_warnx_nodebug("failed test #%d: heap invalid after reschedule",
+	    ntests);
+	errors++;
+    }
+
+    /* Delete a random subset of the timers. */
+    for (i = 0; i < ntimers; i++) {
+	if (arc4random_uniform(4) == 0) {
+	    sudo_ev_del(base, timers[i].ev);
+	    timers[i].deleted = true;
+	    ndeleted++;
+	}
+    }
+
+    ntests++;
+    if (base->timeouts_len != ntimers - ndeleted || !check_heap(base)) {
+	sudo_warnx_nodebug("failed test #%d: heap invalid after delete",
+	    ntests);
+	errors++;
+    }
+
+    /* Run the remaining timers, they must fire in order. */
+    sudo_ev_dispatch(base);
+
+    ntests++;
+    if (order_errors != 0) {
+	sudo_warnx_nodebug("failed test #%d: %d timers fired out of order",
+	    ntests, order_errors);
+	errors++;
+    }
+    ntests++;
+    if (nfired != ntimers - ndeleted || base->timeouts_len != 0) {
+	sudo_warnx_nodebug("failed test #%d: expected %d timers to fire, "
+	    "got %d", ntests, ntimers - ndeleted, nfired);
+	errors++;
+    }
+    ntests++;
+    for (i = 0; i < ntimers; i++) {
+	if (timers[i].fired == timers[i].deleted) {
+	    sudo_warnx_nodebug("failed test #%d: timer %d %s", ntests, i,
+		timers[i].deleted ? "fired after delete" : "did not fire");
+	    errors++;
+	    break;
+	}
+    }
+
+    if (benchmark) {
+	/* Time deleting a full heap, in insertion order. */
+	for (i = 0; i < ntimers; i++) {
+	    random_timeout(&ts);
+	    sudo_ev_add(base, timers[i].ev, &ts, false);
+	}
+	sudo_gettime_mono(&start);
+	for (i = 0; i < ntimers; i++)
+	    sudo_ev_del(base, timers[i].ev);
+	ns_del = elapsed_ns(&start);
+
+	/* Time expiring a full heap. */
+	sudo_timespecclear(&ts);
+	for (i = 0; i < ntimers; i++)
+	    sudo_ev_add(base, timers[i].ev, &ts, false);
+	last_fired.tv_sec = 0;
+	last_fired.tv_nsec = 0;
+	sudo_gettime_mono(&start);
+	sudo_ev_dispatch(base);
+	ns_expire = elapsed_ns(&start);
+
+	printf("%s: %d timers: add %.1f ns, reschedule %.1f ns, "
+	    "delete %.1f ns, expire %.1f ns (per event)\n", getprogname(),
+	    ntimers, ns_add / ntimers, ns_resched / ntimers,
+	    ns_del / ntimers, ns_expire / ntimers);
+    }
+
+    for (i = 0; i < ntimers; i++)
+	sudo_ev_free(timers[i].ev);
+    free(timers);
+    sudo_ev_base_free(base);
+
+    printf("%s: %d tests run, %d errors, %d%% success rate\n",
+	getprogname(), ntests, errors, (ntests - errors) * 100 / ntests);
+    exit(errors);
+}
@@ -73,56 +73,48 @@ has_strlistval(InfoMessage *info)
  * Returns a NULL-terminated string vector.
  */
 static char **
-strlist_copy(InfoMessage__StringList *strlist)
+strlist_copy(struct logsrvd_arena *arena, InfoMessage__StringList *strlist)
 {
     char **dst, **src = strlist->strings;
     size_t i, len = strlist->n_strings;
     debug_decl(strlist_copy, SUDO_DEBUG_UTIL);
 
-    dst = reallocarray(NULL, len + 1, sizeof(char *));
+    dst = arena_calloc(arena, len + 1, sizeof(char *));
     if (dst == NULL) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
-	    "reallocarray(NULL, %zu, %zu)", len + 1, sizeof(char *));
-	goto bad;
+	    "arena_calloc(%zu, %zu)", len + 1, sizeof(char *));
+	debug_return_ptr(NULL);
     }
     for (i = 0; i < len; i++) {
-	if ((dst[i] = strdup(src[i])) == NULL) {
+	if ((dst[i] = arena_strdup(arena, src[i])) == NULL) {
 	    sudo_debug_printf(
 		SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO, "strdup");
-	    goto bad;
+	    debug_return_ptr(NULL);
 	}
     }
     dst[i] = NULL;
     debug_return_ptr(dst);
-
-bad:
-    if (dst != NULL) {
-	while (i--)
-	    free(dst[i]);
-	free(dst);
-    }
-    debug_return_ptr(NULL);
 }
 
 /*
  * Fill in eventlog details from an AcceptMessage
- * Caller is responsible for freeing strings in struct eventlog.
+ * The eventlog and its strings are allocated from the specified arena.
  * Returns true on success and false on failure.
  */
 struct eventlog *
-evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
+evlog_new(struct logsrvd_arena *arena, TimeSpec *submit_time,
+    InfoMessage **info_msgs, size_t infolen)
 {
     struct eventlog *evlog;
     size_t idx;
     debug_decl(evlog_new, SUDO_DEBUG_UTIL);
 
-    evlog = calloc(1, sizeof(*evlog));
+    evlog = arena_calloc(arena, 1, sizeof(*evlog));
     if (evlog == NULL) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
-	    "calloc(1, %zu)", sizeof(*evlog));
+	    "arena_calloc(1, %zu)", sizeof(*evlog));
 	goto bad;
     }
-    memset(evlog, 0, sizeof(*evlog));
 
     /* Submit time. */
     if (submit_time != NULL) {
@@ -156,7 +148,8 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
 	    }
 	    if (strcmp(key, "command") == 0) {
 		if (has_strval(info)) {
-		    if ((evlog->command = strdup(info->u.strval)) == NULL) {
+		    evlog->command = arena_strdup(arena, info->u.strval);
+		    if (evlog->command == NULL) {
 			sudo_debug_printf(
 			    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 			    "strdup");
@@ -186,7 +179,7 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
 	case 'r':
 	    if (strcmp(key, "runargv") == 0) {
 		if (has_strlistval(info)) {
-		    evlog->argv = strlist_copy(info->u.strlistval);
+		    evlog->argv = strlist_copy(arena, info->u.strlistval);
 		    if (evlog->argv == NULL)
 			goto bad;
 		} else {
@@ -197,7 +190,8 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
 	    }
 	    if (strcmp(key, "runchroot") == 0) {
 		if (has_strval(info)) {
-		    if ((evlog->runchroot = strdup(info->u.strval)) == NULL) {
+		    evlog->runchroot = arena_strdup(arena, info->u.strval);
+		    if (evlog->runchroot == NULL) {
 			sudo_debug_printf(
 			    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 			    "strdup");
@@ -211,7 +205,8 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
 	    }
 	    if (strcmp(key, "runcwd") == 0) {
 		if (has_strval(info)) {
-		    if ((evlog->runcwd = strdup(info->u.strval)) == NULL) {
+		    evlog->runcwd = arena_strdup(arena, info->u.strval);
+		    if (evlog->runcwd == NULL) {
 			sudo_debug_printf(
 			    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 			    "strdup");
@@ -225,7 +220,7 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
 	    }
 	    if (strcmp(key, "runenv") == 0) {
 		if (has_strlistval(info)) {
-		    evlog->envp = strlist_copy(info->u.strlistval);
+		    evlog->envp = strlist_copy(arena, info->u.strlistval);
 		    if (evlog->envp == NULL)
 			goto bad;
 		} else {
@@ -248,7 +243,8 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
 	    }
 	    if (strcmp(key, "rungroup") == 0) {
 		if (has_strval(info)) {
-		    if ((evlog->rungroup = strdup(info->u.strval)) == NULL) {
+		    evlog->rungroup = arena_strdup(arena, info->u.strval);
+		    if (evlog->rungroup == NULL) {
 			sudo_debug_printf(
 			    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 			    "strdup");
@@ -274,7 +270,8 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
 	    }
 	    if (strcmp(key, "runuser") == 0) {
 		if (has_strval(info)) {
-		    if ((evlog->runuser = strdup(info->u.strval)) == NULL) {
+		    evlog->runuser = arena_strdup(arena, info->u.strval);
+		    if (evlog->runuser == NULL) {
 			sudo_debug_printf(
 			    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 			    "strdup");
@@ -290,7 +287,8 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
 	case 's':
 	    if (strcmp(key, "submitcwd") == 0) {
 		if (has_strval(info)) {
-		    if ((evlog->cwd = strdup(info->u.strval)) == NULL) {
+		    evlog->cwd = arena_strdup(arena, info->u.strval);
+		    if (evlog->cwd == NULL) {
 			sudo_debug_printf(
 			    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 			    "strdup");
@@ -304,7 +302,8 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
 	    }
 	    if (strcmp(key, "submitgroup") == 0) {
 		if (has_strval(info)) {
-		    if ((evlog->submitgroup = strdup(info->u.strval)) == NULL) {
+		    evlog->submitgroup = arena_strdup(arena, info->u.strval);
+		    if (evlog->submitgroup == NULL) {
 			sudo_debug_printf(
 			    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 			    "strdup");
@@ -318,7 +317,8 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
 	    }
 	    if (strcmp(key, "submithost") == 0) {
 		if (has_strval(info)) {
-		    if ((evlog->submithost = strdup(info->u.strval)) == NULL) {
+		    evlog->submithost = arena_strdup(arena, info->u.strval);
+		    if (evlog->submithost == NULL) {
 			sudo_debug_printf(
 			    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 			    "strdup");
@@ -332,7 +332,8 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
 	    }
 	    if (strcmp(key, "submituser") == 0) {
 		if (has_strval(info)) {
-		    if ((evlog->submituser = strdup(info->u.strval)) == NULL) {
+		    evlog->submituser = arena_strdup(arena, info->u.strval);
+		    if (evlog->submituser == NULL) {
 			sudo_debug_printf(
 			    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 			    "strdup");
@@ -348,7 +349,8 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
 	case 't':
 	    if (strcmp(key, "ttyname") == 0) {
 		if (has_strval(info)) {
-		    if ((evlog->ttyname = strdup(info->u.strval)) == NULL) {
+		    evlog->ttyname = arena_strdup(arena, info->u.strval);
+		    if (evlog->ttyname == NULL) {
 			sudo_debug_printf(
 			    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 			    "strdup");
@@ -388,7 +390,8 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
 
     /* Other settings that must exist for event logging. */
     if (evlog->cwd == NULL) {
-	if ((evlog->cwd = strdup("unknown")) == NULL) {
+	evlog->cwd = arena_strdup(arena, "unknown");
+	if (evlog->cwd == NULL) {
 	    sudo_debug_printf(
 		SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 		"strdup");
@@ -396,7 +399,8 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
 	}
     }
     if (evlog->runcwd == NULL) {
-	if ((evlog->runcwd = strdup(evlog->cwd)) == NULL) {
+	evlog->runcwd = arena_strdup(arena, evlog->cwd);
+	if (evlog->runcwd == NULL) {
 	    sudo_debug_printf(
 		SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 		"strdup");
@@ -405,7 +409,8 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
     }
     if (evlog->submitgroup == NULL) {
 	/* TODO: make submitgroup required */
-	if ((evlog->submitgroup = strdup("unknown")) == NULL) {
+	evlog->submitgroup = arena_strdup(arena, "unknown");
+	if (evlog->submitgroup == NULL) {
 	    sudo_debug_printf(
 		SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 		"strdup");
@@ -413,7 +418,8 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
 	}
     }
     if (evlog->ttyname == NULL) {
-	if ((evlog->ttyname = strdup("unknown")) == NULL) {
+	evlog->ttyname = arena_strdup(arena, "unknown");
+	if (evlog->ttyname == NULL) {
 	    sudo_debug_printf(
 		SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 		"strdup");
@@ -424,7 +430,7 @@ evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen)
     debug_return_ptr(evlog);
 
 bad:
-    eventlog_free(evlog);
+    /* Any memory allocated from the arena is freed with the connection. */
     debug_return_ptr(NULL);
 }
 
@@ -608,7 +614,7 @@ create_iolog_path(struct connection_closure *closure)
 	    "unable to mkdir iolog path %s", pathbuf);
         goto bad;
     }
-    if ((evlog->iolog_path = strdup(pathbuf)) == NULL) {
+    if ((evlog->iolog_path = arena_strdup(&closure->arena, pathbuf)) == NULL) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 	    "strdup");
 	goto bad;
@@ -626,7 +632,6 @@ create_iolog_path(struct connection_closure *closure)
 
     debug_return_bool(true);
 bad:
-    free(evlog->iolog_path);
     evlog->iolog_path = NULL;
     debug_return_bool(false);
 }
@@ -647,6 +652,366 @@ iolog_create(int iofd, struct connection_closure *closure)
 	closure->iolog_dir_fd, iofd, "w"));
 }
 
+/*
+ * Returns true if writes to the I/O log file for iofd are asynchronous.
+ * Such files must only be written via the write-behind buffer.
+ */
+static bool
+iolog_async(int iofd, struct connection_closure *closure)
+{
+#ifdef HAVE_IO_URING
+    if (closure->uring != NULL && !closure->iolog_files[iofd].compressed &&
+	    !closure->iolog_deflate[iofd].passthru)
+	return true;
+#endif
+    return false;
+}
+
+/*
+ * Write the buffered data for iofd to its I/O log file.
+ */
+static bool
+iolog_write_buffer(int iofd, struct connection_closure *closure)
+{
+    struct connection_buffer *buf = &closure->iolog_bufs[iofd];
+    const char *errstr;
+    debug_decl(iolog_write_buffer, SUDO_DEBUG_UTIL);
+
+    if (buf->len == 0)
+	debug_return_bool(true);
+
+    if (!iolog_write(&closure->iolog_files[iofd], buf->data, buf->len,
+	    &errstr)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to write to %s/%s: %s", closure->evlog->iolog_path,
+	    iolog_fd_to_name(iofd), errstr);
+	debug_return_bool(false);
+    }
+    closure->iolog_buffered -= buf->len;
+    buf->len = 0;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Write all buffered I/O log data to disk.
+ * The timing file is written last so it never refers to data
+ * that is not yet present in the other log files.
+ * If sync is set and the files are written via io_uring, they are
+ * also queued for fdatasync(2); that does not block the event loop
+ * and the commit point is only sent once it has completed.
+ */
+bool
+iolog_flush_all(struct connection_closure *closure, bool sync)
+{
+    struct timespec start;
+    int iofd;
+    debug_decl(iolog_flush_all, SUDO_DEBUG_UTIL);
+
+#ifdef HAVE_IO_URING
+    /* All the files of a session use the same compression setting. */
+    if (iolog_async(IOFD_TIMING, closure)) {
+	bool ret;
+
+	if (closure->iolog_buffered == 0 &&
+		(!sync || closure->uring_unsynced == 0))
+	    debug_return_bool(true);
+	sudo_gettime_mono(&start);
+	ret = uring_flush(closure, sync);
+	if (!ret) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to queue writes to %s", closure->evlog->iolog_path);
+	}
+	metrics_observe(&closure->metrics->iolog_flush, &start);
+	debug_return_bool(ret);
+    }
+#endif
+
+    if (closure->iolog_buffered == 0)
+	debug_return_bool(true);
+    sudo_gettime_mono(&start);
+
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	if (iofd == IOFD_TIMING)
+	    continue;
+	if (!iolog_write_buffer(iofd, closure))
+	    debug_return_bool(false);
+    }
+    if (!iolog_write_buffer(IOFD_TIMING, closure))
+	debug_return_bool(false);
+    metrics_observe(&closure->metrics->iolog_flush, &start);
+    debug_return_bool(true);
+}
+
+/*
+ * Append len bytes of data to the write-behind buffer for iofd.
+ * Buffers are written to disk when the commit point is sent,
+ * when they reach IOLOG_BUFSIZ bytes or, if iolog_flush is set,
+ * after each message (see iolog_buffer_timing()).
+ */
+static bool
+iolog_buffer(int iofd, const void *data, unsigned int len,
+    struct connection_closure *closure)
+{
+    struct connection_buffer *buf = &closure->iolog_bufs[iofd];
+    debug_decl(iolog_buffer, SUDO_DEBUG_UTIL);
+
+    if (closure->iolog_buffered + len > IOLOG_BUFSIZ) {
+	if (!iolog_flush_all(closure, false))
+	    debug_return_bool(false);
+    }
+    if (buf->len + len > buf->size) {
+	if (!expand_buf(buf, buf->len + len)) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to expand I/O log buffer to %u bytes", buf->len + len);
+	    debug_return_bool(false);
+	}
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    closure->iolog_buffered += len;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Append a timing record to the write-behind buffer.  The timing record
+ * is the last thing buffered for each message, so if iolog_flush is set
+ * this is where the buffered data is written out, instead of waiting
+ * for the next commit point.
+ */
+static bool
+iolog_buffer_timing(const char *tbuf, int len,
+    struct connection_closure *closure)
+{
+    debug_decl(iolog_buffer_timing, SUDO_DEBUG_UTIL);
+
+    if (!iolog_buffer(IOFD_TIMING, tbuf, len, closure))
+	debug_return_bool(false);
+    if (logsrvd_conf_iolog_flush())
+	debug_return_bool(iolog_flush_all(closure, false));
+    debug_return_bool(true);
+}
+
+#ifdef HAVE_ZLIB_H
+/*
+ * Switch the gzip-compressed I/O log file for iofd to storing the
+ * client's deflate data as-is.  Closing the gzFile completes its gzip
+ * member; we then append a new member whose header and trailer we
+ * write ourselves around the client's sync-flushed deflate blocks.
+ */
+static bool
+iolog_passthru_start(int iofd, struct connection_closure *closure)
+{
+    /* Deflate, no flags, no mtime, Unix */
+    static const unsigned char gzip_header[] = {
+	0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03
+    };
+    struct iolog_file *iol = &closure->iolog_files[iofd];
+    struct iolog_deflate *id = &closure->iolog_deflate[iofd];
+    const char *errstr, *name = iolog_fd_to_name(iofd);
+    int fd;
+    debug_decl(iolog_passthru_start, SUDO_DEBUG_UTIL);
+
+    if (!iolog_write_buffer(iofd, closure))
+	debug_return_bool(false);
+    iol->enabled = false;
+    if (!iolog_close(iol, &errstr)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to close %s/%s: %s", closure->evlog->iolog_path,
+	    name, errstr);
+	debug_return_bool(false);
+    }
+    fd = iolog_openat(closure->iolog_dir_fd, name, O_WRONLY|O_APPEND);
+    if (fd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to open %s/%s", closure->evlog->iolog_path, name);
+	debug_return_bool(false);
+    }
+    (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if ((id->start = lseek(fd, 0, SEEK_END)) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to seek to end of %s/%s", closure->evlog->iolog_path, name);
+	close(fd);
+	debug_return_bool(false);
+    }
+    if ((iol->fd.f = fdopen(fd, "a")) == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to fdopen %s/%s", closure->evlog->iolog_path, name);
+	close(fd);
+	debug_return_bool(false);
+    }
+    iol->enabled = true;
+    iol->compressed = IOLOG_COMPRESS_NONE;
+    iol->writable = true;
+
+    id->passthru = true;
+    id->crc = crc32(0, NULL, 0);
+    id->isize = 0;
+
+    debug_return_bool(iolog_buffer(iofd, gzip_header, sizeof(gzip_header),
+	closure));
+}
+
+/*
+ * Complete the gzip member started by iolog_passthru_start() with
+ * a final empty block, the CRC-32 and the length of the data.
+ * Buffered data must already have been written.
+ */
+static void
+iolog_passthru_finish(int iofd, struct connection_closure *closure)
+{
+    struct iolog_deflate *id = &closure->iolog_deflate[iofd];
+    unsigned char trailer[10];
+    const char *errstr;
+    debug_decl(iolog_passthru_finish, SUDO_DEBUG_UTIL);
+
+    /* Fixed Huffman block with BFINAL set and only an end-of-block code. */
+    trailer[0] = 0x03;
+    trailer[1] = 0x00;
+    trailer[2] = id->crc & 0xff;
+    trailer[3] = (id->crc >> 8) & 0xff;
+    trailer[4] = (id->crc >> 16) & 0xff;
+    trailer[5] = (id->crc >> 24) & 0xff;
+    trailer[6] = id->isize & 0xff;
+    trailer[7] = (id->isize >> 8) & 0xff;
+    trailer[8] = (id->isize >> 16) & 0xff;
+    trailer[9] = (id->isize >> 24) & 0xff;
+    if (!iolog_write(&closure->iolog_files[iofd], trailer, sizeof(trailer),
+	    &errstr)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to write to %s/%s: %s", closure->evlog->iolog_path,
+	    iolog_fd_to_name(iofd), errstr);
+    }
+    id->passthru = false;
+
+    debug_return;
+}
+
+/*
+ * Inflate the deflate data in msg into closure->inflate_buf using
+ * the stream's raw inflate state and verify the length and CRC-32.
+ */
+static bool
+iolog_inflate(int iofd, IoBuffer *msg, struct connection_closure *closure)
+{
+    struct iolog_deflate *id = &closure->iolog_deflate[iofd];
+    struct connection_buffer *buf = &closure->inflate_buf;
+    z_stream *zs = id->zs;
+    int zerr;
+    debug_decl(iolog_inflate, SUDO_DEBUG_UTIL);
+
+    if (msg->uncompressed_len > MESSAGE_SIZE_MAX) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "IoBuffer too large: %u", msg->uncompressed_len);
+	debug_return_bool(false);
+    }
+    if (zs == NULL) {
+	if ((zs = calloc(1, sizeof(*zs))) == NULL) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+		"unable to allocate z_stream");
+	    debug_return_bool(false);
+	}
+	if ((zerr = inflateInit2(zs, -MAX_WBITS)) != Z_OK) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"inflateInit2: %s", zError(zerr));
+	    free(zs);
+	    debug_return_bool(false);
+	}
+	id->zs = zs;
+    }
+
+    /* Inflate needs an output buffer even if there is no data. */
+    buf->len = buf->off = 0;
+    if (!expand_buf(buf, MAX(msg->uncompressed_len, 1)))
+	debug_return_bool(false);
+
+    zs->next_in = msg->data.data;
+    zs->avail_in = msg->data.len;
+    zs->next_out = buf->data;
+    zs->avail_out = msg->uncompressed_len;
+    zerr = inflate(zs, Z_SYNC_FLUSH);
+    if ((zerr != Z_OK && zerr != Z_BUF_ERROR) || zs->avail_in != 0 ||
+	    zs->avail_out != 0) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to inflate IoBuffer: %s",
+	    zs->msg ? zs->msg : zError(zerr));
+	debug_return_bool(false);
+    }
+    buf->len = msg->uncompressed_len;
+    if (crc32(0, buf->data, buf->len) != msg->checksum) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "IoBuffer checksum mismatch");
+	debug_return_bool(false);
+    }
+
+    debug_return_bool(true);
+}
+#endif /* HAVE_ZLIB_H */
+
+/*
+ * Write an I/O log index entry if one is due.  Buffered data is written
+ * first so the offsets in the entry refer to data in the log files.
+ * Failure to write the entry itself is not fatal, replay just has to
+ * start from an earlier entry.
+ */
+static bool
+iolog_update_index(struct connection_closure *closure)
+{
+    struct iolog_index_entry entry;
+    struct timespec since;
+    const char *errstr;
+    int iofd;
+    debug_decl(iolog_update_index, SUDO_DEBUG_UTIL);
+
+    sudo_timespecsub(&closure->elapsed_time, &closure->index_time, &since);
+    if (since.tv_sec < IOLOG_INDEX_INTERVAL)
+	debug_return_bool(true);
+    closure->index_time = closure->elapsed_time;
+
+    if (!iolog_flush_all(closure, false))
+	debug_return_bool(false);
+
+    memset(&entry, 0, sizeof(entry));
+    entry.elapsed = closure->elapsed_time;
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	if (!closure->iolog_files[iofd].enabled)
+	    continue;
+#ifdef HAVE_ZLIB_H
+	if (closure->iolog_deflate[iofd].passthru) {
+	    /*
+	     * The client's deflate stream can't be split into gzip members
+	     * since later buffers may refer back to earlier data.  The
+	     * reader must decompress from the start of the member.
+	     */
+	    entry.offset[iofd] = closure->iolog_deflate[iofd].start;
+	    entry.skip[iofd] = (off_t)closure->iolog_deflate[iofd].isize;
+	    continue;
+	}
+#endif
+#ifdef HAVE_IO_URING
+	if (iolog_async(iofd, closure) && closure->iolog_offsets[iofd] != -1) {
+	    /* Offset of the next queued write. */
+	    entry.offset[iofd] = closure->iolog_offsets[iofd];
+	    continue;
+	}
+#endif
+	if (!iolog_checkpoint(&closure->iolog_files[iofd], &entry.offset[iofd],
+		&errstr)) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to checkpoint %s/%s: %s", closure->evlog->iolog_path,
+		iolog_fd_to_name(iofd), errstr);
+	    debug_return_bool(false);
+	}
+    }
+    if (!iolog_index_append(closure->iolog_dir_fd, &entry)) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "unable to write index entry for %s", closure->evlog->iolog_path);
+    }
+
+    debug_return_bool(true);
+}
+
 void
 iolog_close_all(struct connection_closure *closure)
 {
@@ -654,14 +1019,40 @@ iolog_close_all(struct connection_closure *closure)
     int i;
     debug_decl(iolog_close, SUDO_DEBUG_UTIL);
 
+    if (!iolog_flush_all(closure, false)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to write buffered I/O log data");
+    }
     for (i = 0; i < IOFD_MAX; i++) {
+	free(closure->iolog_bufs[i].data);
+#ifdef HAVE_ZLIB_H
+	if (closure->iolog_deflate[i].zs != NULL) {
+	    inflateEnd(closure->iolog_deflate[i].zs);
+	    free(closure->iolog_deflate[i].zs);
+	}
+#endif
 	if (!closure->iolog_files[i].enabled)
 	    continue;
+#ifdef HAVE_ZLIB_H
+	if (closure->iolog_deflate[i].passthru)
+	    iolog_passthru_finish(i, closure);
+#endif
+#ifdef HAVE_IO_URING
+	/* Closed by the ring once its queued writes have completed. */
+	if (closure->uring != NULL && uring_close(closure, i))
+	    continue;
+#endif
 	if (!iolog_close(&closure->iolog_files[i], &errstr)) {
 	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 		"error closing iofd %d: %s", i, errstr);
 	}
     }
+#ifdef HAVE_IO_URING
+    uring_detach(closure);
+#endif
+#ifdef HAVE_ZLIB_H
+    free(closure->inflate_buf.data);
+#endif
     if (closure->iolog_dir_fd != -1)
 	close(closure->iolog_dir_fd);
 
@@ -727,23 +1118,85 @@ iolog_copy(struct iolog_file *src, struct iolog_file *dst, off_t remainder,
     debug_return_bool(true);
 }
 
-/* Compressed logs don't support random access, need to rewrite them. */
+/*
+ * Copy the first len bytes of the I/O log file for iofd in src_dfd
+ * to a new file in dst_dfd without decompressing them.
+ */
+static bool
+iolog_copy_raw(int src_dfd, int dst_dfd, int iofd, off_t remainder)
+{
+    const char *name = iolog_fd_to_name(iofd);
+    int src_fd = -1, dst_fd = -1;
+    char buf[64 * 1024];
+    bool ret = false;
+    ssize_t nread;
+    debug_decl(iolog_copy_raw, SUDO_DEBUG_UTIL);
+
+    src_fd = iolog_openat(src_dfd, name, O_RDONLY);
+    if (src_fd == -1)
+	goto done;
+    dst_fd = iolog_openat(dst_dfd, name, O_CREAT|O_TRUNC|O_WRONLY);
+    if (dst_fd == -1)
+	goto done;
+
+    while (remainder > 0) {
+	const ssize_t toread = MIN(remainder, ssizeof(buf));
+	nread = read(src_fd, buf, toread);
+	if (nread <= 0)
+	    goto done;
+	remainder -= nread;
+
+	do {
+	    ssize_t nwritten = write(dst_fd, buf, nread);
+	    if (nwritten == -1)
+		goto done;
+	    nread -= nwritten;
+	} while (nread > 0);
+    }
+    ret = true;
+
+done:
+    if (src_fd != -1)
+	close(src_fd);
+    if (dst_fd != -1)
+	close(dst_fd);
+    debug_return_bool(ret);
+}
+
+/*
+ * Compressed logs don't support random access, need to rewrite them.
+ * Only the data after the closest index entry is decompressed, the
+ * gzip members or zstd frames before it are copied as-is.
+ */
 static bool
 iolog_rewrite(const struct timespec *target, struct connection_closure *closure)
 {
     const struct eventlog *evlog = closure->evlog;
     struct iolog_file new_iolog_files[IOFD_MAX];
-    off_t iolog_file_sizes[IOFD_MAX] = { 0 };
+    off_t iolog_file_sizes[IOFD_MAX];
+    struct iolog_index_entry entry;
     struct timing_closure timing;
     int iofd, len, tmpdir_fd = -1;
     const char *name, *errstr;
     char tmpdir[PATH_MAX];
+    off_t offset, timing_start;
     bool ret = false;
     debug_decl(iolog_rewrite, SUDO_DEBUG_UTIL);
 
+    /* Start at the closest index entry, if any. */
+    if (!iolog_index_find(closure->iolog_dir_fd, target, &entry) ||
+	    !iolog_index_seek(closure->iolog_dir_fd, closure->iolog_files,
+	    &entry, false))
+	memset(&entry, 0, sizeof(entry));
+    closure->elapsed_time = entry.elapsed;
+    for (iofd = 0; iofd < IOFD_MAX; iofd++)
+	iolog_file_sizes[iofd] = entry.skip[iofd];
+    timing_start = iolog_seek(&closure->iolog_files[IOFD_TIMING], 0, SEEK_CUR);
+    if (timing_start == -1)
+	goto done;
+
     /* Parse timing file until we reach the target point. */
-    /* TODO: use iolog_seekto with a callback? */
-    for (;;) {
+    while (sudo_timespeccmp(&closure->elapsed_time, target, <)) {
 	/* Read next record from timing file. */
 	if (iolog_read_timing_record(&closure->iolog_files[IOFD_TIMING], &timing) != 0)
 	    goto done;
@@ -759,10 +1212,7 @@ iolog_rewrite(const struct timespec *target, struct connection_closure *closure)
 	    iolog_file_sizes[timing.event] += timing.u.nbytes;
 	}
 
-	if (sudo_timespeccmp(&closure->elapsed_time, target, >=)) {
-	    if (sudo_timespeccmp(&closure->elapsed_time, target, ==))
-		break;
-
+	if (sudo_timespeccmp(&closure->elapsed_time, target, >)) {
 	    /* Mismatch between resume point and stored log. */
 	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 		"resume point mismatch, target [%lld, %ld], have [%lld, %ld]",
@@ -773,8 +1223,11 @@ iolog_rewrite(const struct timespec *target, struct connection_closure *closure)
 	}
     }
     iolog_file_sizes[IOFD_TIMING] =
-	iolog_seek(&closure->iolog_files[IOFD_TIMING], 0, SEEK_CUR);
-    iolog_rewind(&closure->iolog_files[IOFD_TIMING]);
+	iolog_seek(&closure->iolog_files[IOFD_TIMING], 0, SEEK_CUR) -
+	timing_start;
+    if (iolog_seek(&closure->iolog_files[IOFD_TIMING], timing_start,
+	    SEEK_SET) == -1)
+	goto done;
 
     /* Create new I/O log files in a temporary directory. */
     len = snprintf(tmpdir, sizeof(tmpdir), "%s/restart.XXXXXX",
@@ -801,7 +1254,19 @@ iolog_rewrite(const struct timespec *target, struct connection_closure *closure)
 	if (!closure->iolog_files[iofd].enabled)
 	    continue;
 	new_iolog_files[iofd].enabled = true;
-	if (!iolog_open(&new_iolog_files[iofd], tmpdir_fd, iofd, "w")) {
+	if (entry.offset[iofd] != 0) {
+	    /* Data before the index entry is unchanged. */
+	    if (!iolog_copy_raw(closure->iolog_dir_fd, tmpdir_fd, iofd,
+		    entry.offset[iofd])) {
+		sudo_debug_printf(
+		    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		    "unable to copy %s/%s to %s", evlog->iolog_path,
+		    iolog_fd_to_name(iofd), tmpdir);
+		goto done;
+	    }
+	}
+	if (!iolog_open(&new_iolog_files[iofd], tmpdir_fd, iofd,
+		entry.offset[iofd] != 0 ? "a" : "w")) {
 	    if (errno != ENOENT) {
 		sudo_debug_printf(
 		    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
@@ -809,6 +1274,8 @@ iolog_rewrite(const struct timespec *target, struct connection_closure *closure)
 		goto done;
 	    }
 	}
+	/* The copy keeps the existing timing record format. */
+	new_iolog_files[iofd].binary = closure->iolog_files[iofd].binary;
     }
 
     for (iofd = 0; iofd < IOFD_MAX; iofd++) {
@@ -822,6 +1289,16 @@ iolog_rewrite(const struct timespec *target, struct connection_closure *closure)
 		evlog->iolog_path, name, tmpdir, name, errstr);
 	    goto done;
 	}
+	/*
+	 * The compression thread may still hold data for the new file,
+	 * which must be written before the struct is copied below.
+	 */
+	if (!iolog_checkpoint(&new_iolog_files[iofd], &offset, &errstr)) {
+	    name = iolog_fd_to_name(iofd);
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to flush %s/%s: %s", tmpdir, name, errstr);
+	    goto done;
+	}
     }
 
     /* Move copied log files into place. */
@@ -862,6 +1339,10 @@ iolog_rewrite(const struct timespec *target, struct connection_closure *closure)
 	new_iolog_files[iofd].enabled = false;
     }
 
+    /* Index entries past the resume point are no longer valid. */
+    (void)iolog_index_truncate(closure->iolog_dir_fd, target);
+    closure->index_time = *target;
+
     /* Ready to log I/O buffers. */
     ret = true;
 done:
@@ -892,7 +1373,18 @@ iolog_restart(RestartMessage *msg, struct connection_closure *closure)
     target.tv_sec = msg->resume_point->tv_sec;
     target.tv_nsec = msg->resume_point->tv_nsec;
 
-    if ((evlog->iolog_path = strdup(msg->log_id)) == NULL) {
+    /* There is no AcceptMessage, only the I/O log path is known. */
+    if (evlog == NULL) {
+	evlog = arena_calloc(&closure->arena, 1, sizeof(*evlog));
+	if (evlog == NULL) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"arena_calloc(1, %zu)", sizeof(*evlog));
+	    goto bad;
+	}
+	closure->evlog = evlog;
+    }
+    evlog->iolog_path = arena_strdup(&closure->arena, msg->log_id);
+    if (evlog->iolog_path == NULL) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
 	    "strdup");
 	goto bad;
@@ -935,6 +1427,8 @@ iolog_restart(RestartMessage *msg, struct connection_closure *closure)
     if (!iolog_seekto(closure->iolog_dir_fd, evlog->iolog_path,
 	    closure->iolog_files, &closure->elapsed_time, &target))
 	goto bad;
+    (void)iolog_index_truncate(closure->iolog_dir_fd, &target);
+    closure->index_time = target;
 
     /* Must seek or flush before switching from read -> write. */
     if (iolog_seek(&closure->iolog_files[IOFD_TIMING], 0, SEEK_CUR) == -1) {
@@ -955,7 +1449,7 @@ bad:
  * Add given delta to elapsed time.
  * We cannot use timespecadd here since delta is not struct timespec.
  */
-static void
+void
 update_elapsed_time(TimeSpec *delta, struct timespec *elapsed)
 {
     debug_decl(update_elapsed_time, SUDO_DEBUG_UTIL);
@@ -975,47 +1469,89 @@ int
 store_iobuf(int iofd, IoBuffer *msg, struct connection_closure *closure)
 {
     const struct eventlog *evlog = closure->evlog;
+    const void *data = msg->data.data;
+    size_t datalen = msg->data.len;
+    size_t nbytes = msg->data.len;
     const char *errstr;
+    struct timespec delay;
     char tbuf[1024];
     int len;
     debug_decl(store_iobuf, SUDO_DEBUG_UTIL);
 
     /* Open log file as needed. */
     if (!closure->iolog_files[iofd].enabled) {
-	if (!iolog_create(iofd, closure))
+	bool created;
+
+	logsrvd_lock();
+	created = iolog_create(iofd, closure);
+	logsrvd_unlock();
+	if (!created)
+	    debug_return_int(-1);
+    }
+
+#ifdef HAVE_ZLIB_H
+    if (closure->compression) {
+	struct iolog_deflate *id = &closure->iolog_deflate[iofd];
+
+	/*
+	 * Always inflate the data to check the client's length and CRC,
+	 * the gzip trailer is computed from them.
+	 */
+	if (!iolog_inflate(iofd, msg, closure))
 	    debug_return_int(-1);
+	nbytes = msg->uncompressed_len;
+	if (id->passthru ||
+		closure->iolog_files[iofd].compressed == IOLOG_COMPRESS_GZIP) {
+	    /* Store the verified deflate data as-is in a gzip member. */
+	    if (!id->passthru) {
+		if (!iolog_passthru_start(iofd, closure))
+		    debug_return_int(-1);
+	    }
+	    id->crc = crc32_combine(id->crc, msg->checksum, nbytes);
+	    id->isize += nbytes;
+	} else {
+	    data = closure->inflate_buf.data;
+	    datalen = closure->inflate_buf.len;
+	}
     }
+#endif
 
     /* Format timing data. */
     /* FIXME - assumes IOFD_* matches IO_EVENT_* */
-    len = snprintf(tbuf, sizeof(tbuf), "%d %lld.%09d %zu\n",
-	iofd, (long long)msg->delay->tv_sec, (int)msg->delay->tv_nsec,
-	msg->data.len);
-    if (len < 0 || len >= ssizeof(tbuf)) {
+    delay.tv_sec = (time_t)msg->delay->tv_sec;
+    delay.tv_nsec = (long)msg->delay->tv_nsec;
+    len = iolog_fmt_timing_io(tbuf, sizeof(tbuf),
+	closure->iolog_files[IOFD_TIMING].binary, iofd, &delay, nbytes);
+    if (len == -1) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 	    "unable to format timing buffer, len %d", len);
 	debug_return_int(-1);
     }
 
-    /* Write to specified I/O log file. */
-    if (!iolog_write(&closure->iolog_files[iofd], msg->data.data,
-	    msg->data.len, &errstr)) {
-	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-	    "unable to write to %s/%s: %s", evlog->iolog_path,
-	    iolog_fd_to_name(iofd), errstr);
-	debug_return_int(-1);
+    if (datalen >= IOLOG_BUFSIZ && !iolog_async(iofd, closure)) {
+	/* Too big to buffer, write directly after any pending data. */
+	if (!iolog_flush_all(closure, false))
+	    debug_return_int(-1);
+	if (!iolog_write(&closure->iolog_files[iofd], data, datalen,
+		&errstr)) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to write to %s/%s: %s", evlog->iolog_path,
+		iolog_fd_to_name(iofd), errstr);
+	    debug_return_int(-1);
+	}
+    } else {
+	/* Buffer data for the specified I/O log file. */
+	if (!iolog_buffer(iofd, data, datalen, closure))
+	    debug_return_int(-1);
     }
 
-    /* Write timing data. */
-    if (!iolog_write(&closure->iolog_files[IOFD_TIMING], tbuf,
-	    len, &errstr)) {
-	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-	    "unable to write to %s/%s: %s", evlog->iolog_path,
-	    iolog_fd_to_name(IOFD_TIMING), errstr);
+    /* Buffer timing data. */
+    if (!iolog_buffer_timing(tbuf, len, closure))
 	debug_return_int(-1);
-    }
 
     update_elapsed_time(msg->delay, &closure->elapsed_time);
+    if (!iolog_update_index(closure))
+	debug_return_int(-1);
 
     debug_return_int(0);
 }
@@ -1023,33 +1559,30 @@ store_iobuf(int iofd, IoBuffer *msg, struct connection_closure *closure)
 int
 store_suspend(CommandSuspend *msg, struct connection_closure *closure)
 {
-    const struct eventlog *evlog = closure->evlog;
-    const char *errstr;
+    struct timespec delay;
     char tbuf[1024];
     int len;
     debug_decl(store_suspend, SUDO_DEBUG_UTIL);
 
     /* Format timing data including suspend signal. */
-    len = snprintf(tbuf, sizeof(tbuf), "%d %lld.%09d %s\n", IO_EVENT_SUSPEND,
-	(long long)msg->delay->tv_sec, (int)msg->delay->tv_nsec,
-	msg->signal);
-    if (len < 0 || len >= ssizeof(tbuf)) {
+    delay.tv_sec = (time_t)msg->delay->tv_sec;
+    delay.tv_nsec = (long)msg->delay->tv_nsec;
+    len = iolog_fmt_timing_suspend(tbuf, sizeof(tbuf),
+	closure->iolog_files[IOFD_TIMING].binary, &delay, msg->signal);
+    if (len == -1) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 	    "unable to format timing buffer, len %d, signal %s",
 	    len, msg->signal);
 	debug_return_int(-1);
     }
 
-    /* Write timing data. */
-    if (!iolog_write(&closure->iolog_files[IOFD_TIMING], tbuf,
-	    len, &errstr)) {
-	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-	    "unable to write to %s/%s: %s", evlog->iolog_path,
-	    iolog_fd_to_name(IOFD_TIMING), errstr);
+    /* Buffer timing data. */
+    if (!iolog_buffer_timing(tbuf, len, closure))
 	debug_return_int(-1);
-    }
 
     update_elapsed_time(msg->delay, &closure->elapsed_time);
+    if (!iolog_update_index(closure))
+	debug_return_int(-1);
 
     debug_return_int(0);
 }
@@ -1057,32 +1590,30 @@ store_suspend(CommandSuspend *msg, struct connection_closure *closure)
 int
 store_winsize(ChangeWindowSize *msg, struct connection_closure *closure)
 {
-    const struct eventlog *evlog = closure->evlog;
-    const char *errstr;
+    struct timespec delay;
     char tbuf[1024];
     int len;
     debug_decl(store_winsize, SUDO_DEBUG_UTIL);
 
     /* Format timing data including new window size. */
-    len = snprintf(tbuf, sizeof(tbuf), "%d %lld.%09d %d %d\n", IO_EVENT_WINSIZE,
-	(long long)msg->delay->tv_sec, (int)msg->delay->tv_nsec,
-	msg->rows, msg->cols);
-    if (len < 0 || len >= ssizeof(tbuf)) {
+    delay.tv_sec = (time_t)msg->delay->tv_sec;
+    delay.tv_nsec = (long)msg->delay->tv_nsec;
+    len = iolog_fmt_timing_winsize(tbuf, sizeof(tbuf),
+	closure->iolog_files[IOFD_TIMING].binary, &delay, msg->rows,
+	msg->cols);
+    if (len == -1) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 	    "unable to format timing buffer, len %d", len);
 	debug_return_int(-1);
     }
 
-    /* Write timing data. */
-    if (!iolog_write(&closure->iolog_files[IOFD_TIMING], tbuf,
-	    len, &errstr)) {
-	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-	    "unable to write to %s/%s: %s", evlog->iolog_path,
-	    iolog_fd_to_name(IOFD_TIMING), errstr);
+    /* Buffer timing data. */
+    if (!iolog_buffer_timing(tbuf, len, closure))
 	debug_return_int(-1);
-    }
 
     update_elapsed_time(msg->delay, &closure->elapsed_time);
+    if (!iolog_update_index(closure))
+	debug_return_int(-1);
 
     debug_return_int(0);
 }
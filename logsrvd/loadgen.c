@@ -0,0 +1,1626 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Load generator for sudo_logsrvd.
+ * Opens a number of concurrent synthetic sessions, each of which sends
+ * an AcceptMessage followed by a stream of fixed-size IoBuffer messages
+ * and an ExitMessage.  Sessions may be multiplexed over fewer connections.
+ * When all sessions are done, the message rate, commit point latency
+ * and, optionally, the server's CPU use is reported.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <signal.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef HAVE_GETADDRINFO
+# include "compat/getaddrinfo.h"
+#endif
+#ifdef HAVE_GETOPT_LONG
+# include <getopt.h>
+# else
+# include "compat/getopt.h"
+#endif /* HAVE_GETOPT_LONG */
+
+#if defined(HAVE_OPENSSL)
+# include <openssl/ssl.h>
+# include <openssl/err.h>
+#endif
+
+#include "sudo_compat.h"
+#include "sudo_conf.h"
+#include "sudo_debug.h"
+#include "sudo_event.h"
+#include "sudo_fatal.h"
+#include "sudo_gettext.h"
+#include "sudo_queue.h"
+#include "sudo_rand.h"
+#include "sudo_util.h"
+
+#include "hostcheck.h"
+#include "log_server.pb-c.h"
+#include "logsrv_util.h"
+
+/* Stop queueing IoBuffers when this much data is waiting to be sent. */
+#define WRITE_HIGHWAT	(64 * 1024)
+
+/* Commit latency histogram: 16 sub-buckets per power of two usecs. */
+#define LATENCY_SUBBUCKETS	16
+#define LATENCY_NBUCKETS	(LATENCY_SUBBUCKETS * 64)
+
+enum session_state {
+    ERROR,
+    RECV_HELLO,
+    RUNNING,
+    CLOSING,
+    FINISHED
+};
+
+struct loadgen_conn;
+struct loadgen_session {
+    TAILQ_ENTRY(loadgen_session) entries;
+    struct loadgen_conn *conn;
+    uint32_t session_id;	/* non-zero if multiplexed */
+    enum session_state state;
+    struct sudo_event *rate_ev;
+    unsigned int nqueued;	/* IoBuffers queued for sending */
+    unsigned int ncommitted;	/* IoBuffers acknowledged by the server */
+    /* Time each uncommitted IoBuffer was queued, oldest first. */
+    struct timespec *pending;
+    unsigned int pending_off;
+    unsigned int pending_len;
+    unsigned int pending_size;
+};
+TAILQ_HEAD(session_list, loadgen_session);
+
+struct loadgen_conn {
+    TAILQ_ENTRY(loadgen_conn) entries;
+    struct session_list sessions;
+    int sock;
+    enum session_state state;
+    unsigned int nactive;	/* sessions not yet finished */
+    bool want_write;
+#if defined(HAVE_OPENSSL)
+    SSL *ssl;
+#endif
+    struct sudo_event_base *evbase;
+    struct sudo_event *read_ev;
+    struct sudo_event *write_ev;
+    struct connection_buffer read_buf;
+    struct connection_buffer write_buf;
+};
+TAILQ_HEAD(conn_list, loadgen_conn);
+static struct conn_list conns = TAILQ_HEAD_INITIALIZER(conns);
+
+static const char *server_name = "localhost";
+#if defined(HAVE_STRUCT_IN6_ADDR)
+static char server_ip[INET6_ADDRSTRLEN];
+#else
+static char server_ip[INET_ADDRSTRLEN];
+#endif
+static unsigned int nsessions = 100;
+static unsigned int nconns;
+static unsigned int nactive;
+static unsigned int nmessages = 1000;
+static unsigned int msg_rate;
+static unsigned int iobuf_size = 128;
+static struct timespec msg_delay = { 0, 1000000 };
+static struct timespec rate_interval;
+
+/* Every IoBuffer is identical so it is only packed once. */
+static uint8_t *iobuf_wire;
+static size_t iobuf_wire_len;
+
+static struct loadgen_stats {
+    unsigned long long messages;
+    unsigned long long bytes;
+    unsigned long long commit_points;
+    unsigned int finished;
+    unsigned int failed;
+    unsigned long long latency[LATENCY_NBUCKETS];
+    unsigned long long nlatency;
+    uint64_t latency_max;
+} stats;
+
+#if defined(HAVE_OPENSSL)
+static SSL_CTX *ssl_ctx = NULL;
+static bool use_tls = false;
+static const char *ca_bundle = NULL;
+static const char *cert = NULL;
+static const char *key = NULL;
+static bool verify_server = true;
+#endif
+
+static bool conn_write(struct loadgen_conn *c);
+
+static void
+usage(bool fatal)
+{
+#if defined(HAVE_OPENSSL)
+    fprintf(stderr, "usage: %s [-nTV] [-b ca_bundle] [-c cert_file] "
+	"[-C connections] [-k key_file] [-h host] [-m messages] [-p port] "
+	"[-P server_pid] [-r rate] [-s sessions] [-S size]\n",
+#else
+    fprintf(stderr, "usage: %s [-V] [-C connections] [-h host] "
+	"[-m messages] [-p port] [-P server_pid] [-r rate] [-s sessions] "
+	"[-S size]\n",
+#endif
+	getprogname());
+    if (fatal)
+	exit(EXIT_FAILURE);
+}
+
+static void
+help(void)
+{
+    printf("%s - %s\n\n", getprogname(),
+	_("generate load on a sudo log server"));
+    usage(false);
+    printf("\n%s\n", _("Options:"));
+    printf("      --help            %s\n",
+	_("display help message and exit"));
+#if defined(HAVE_OPENSSL)
+    printf("  -b, --ca-bundle       %s\n",
+	_("certificate bundle file to verify server's cert against"));
+    printf("  -c, --cert            %s\n",
+	_("certificate file for TLS handshake"));
+#endif
+    printf("  -C, --connections     %s\n",
+	_("number of connections to multiplex the sessions over"));
+    printf("  -h, --host            %s\n",
+	_("host to send logs to"));
+#if defined(HAVE_OPENSSL)
+    printf("  -k, --key             %s\n",
+	_("private key file"));
+#endif
+    printf("  -m, --messages        %s\n",
+	_("number of I/O buffers to send per session"));
+#if defined(HAVE_OPENSSL)
+    printf("  -n, --no-verify       %s\n",
+	_("do not verify server certificate"));
+#endif
+    printf("  -p, --port            %s\n",
+	_("port to use when connecting to host"));
+    printf("  -P, --server-pid      %s\n",
+	_("report CPU time used by the server with this process ID"));
+    printf("  -r, --rate            %s\n",
+	_("I/O buffers per second per session (0 for no limit)"));
+    printf("  -s, --sessions        %s\n",
+	_("number of concurrent sessions"));
+    printf("  -S, --size            %s\n",
+	_("size of each I/O buffer in bytes"));
+#if defined(HAVE_OPENSSL)
+    printf("  -T, --tls             %s\n",
+	_("use TLS even if no client certificate is specified"));
+#endif
+    printf("  -V, --version         %s\n",
+	_("display version information and exit"));
+    putchar('\n');
+    exit(EXIT_SUCCESS);
+}
+
+/*
+ * Connect to specified host:port
+ * If host has multiple addresses, the first one that connects is used.
+ * Returns open socket or -1 on error.
+ */
+static int
+connect_server(const char *host, const char *port)
+{
+    struct addrinfo hints, *res, *res0;
+    const char *addr, *cause = "getaddrinfo";
+    int error, sock, save_errno;
+    debug_decl(connect_server, SUDO_DEBUG_UTIL);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    error = getaddrinfo(host, port, &hints, &res0);
+    if (error != 0) {
+	sudo_warnx(U_("unable to look up %s:%s: %s"), host, port,
+	    gai_strerror(error));
+	debug_return_int(-1);
+    }
+
+    sock = -1;
+    for (res = res0; res; res = res->ai_next) {
+	sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (sock == -1) {
+	    cause = "socket";
+	    continue;
+	}
+	if (connect(sock, res->ai_addr, res->ai_addrlen) == -1) {
+	    cause = "connect";
+	    save_errno = errno;
+	    close(sock);
+	    errno = save_errno;
+	    sock = -1;
+	    continue;
+	}
+	if (*server_ip == '\0') {
+	    switch (res->ai_family) {
+	    case AF_INET:
+		addr = (char *)&((struct sockaddr_in *)res->ai_addr)->sin_addr;
+		break;
+	    case AF_INET6:
+		addr = (char *)&((struct sockaddr_in6 *)res->ai_addr)->sin6_addr;
+		break;
+	    default:
+		cause = "ai_family";
+		save_errno = EAFNOSUPPORT;
+		close(sock);
+		errno = save_errno;
+		sock = -1;
+		continue;
+	    }
+	    if (inet_ntop(res->ai_family, addr, server_ip,
+		    sizeof(server_ip)) == NULL) {
+		sudo_warnx("%s", U_("unable to get server IP addr"));
+	    }
+	}
+	break;	/* success */
+    }
+    freeaddrinfo(res0);
+
+    if (sock != -1) {
+	int flags = fcntl(sock, F_GETFL, 0);
+	if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+	    cause = "fcntl(O_NONBLOCK)";
+	    save_errno = errno;
+	    close(sock);
+	    errno = save_errno;
+	    sock = -1;
+	}
+    }
+    if (sock == -1)
+	sudo_warn("%s", cause);
+
+    debug_return_int(sock);
+}
+
+/*
+ * Pack a ClientMessage and append the wire format message to buf.
+ * Returns true on success, false on failure.
+ */
+static bool
+queue_client_message(struct connection_buffer *buf, ClientMessage *msg)
+{
+    uint32_t msg_len;
+    size_t len;
+    debug_decl(queue_client_message, SUDO_DEBUG_UTIL);
+
+    len = client_message__get_packed_size(msg);
+    if (len > MESSAGE_SIZE_MAX) {
+    	sudo_warnx(U_("client message too large: %zu"), len);
+	debug_return_bool(false);
+    }
+    if (!expand_buf(buf, buf->len - buf->off + sizeof(msg_len) + len)) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+
+    /* Wire message size is used for length encoding, precedes message. */
+    msg_len = htonl((uint32_t)len);
+    memcpy(buf->data + buf->len, &msg_len, sizeof(msg_len));
+    client_message__pack(msg, buf->data + buf->len + sizeof(msg_len));
+    buf->len += sizeof(msg_len) + len;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Pack the IoBuffer sent by every session.  The delay is the same
+ * for each message so the wire format never changes.
+ */
+static bool
+fmt_io_buf(void)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    IoBuffer iobuf_msg = IO_BUFFER__INIT;
+    TimeSpec delay = TIME_SPEC__INIT;
+    struct connection_buffer buf = { NULL };
+    uint8_t *data;
+    unsigned int i;
+    debug_decl(fmt_io_buf, SUDO_DEBUG_UTIL);
+
+    /* Printable data that looks a bit like terminal output. */
+    if ((data = malloc(iobuf_size)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    for (i = 0; i < iobuf_size; i++)
+	data[i] = (i % 80) == 79 ? '\n' : 'a' + (i % 26);
+
+    delay.tv_sec = msg_delay.tv_sec;
+    delay.tv_nsec = msg_delay.tv_nsec;
+    iobuf_msg.delay = &delay;
+    iobuf_msg.data.data = data;
+    iobuf_msg.data.len = iobuf_size;
+    client_msg.u.ttyout_buf = &iobuf_msg;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_TTYOUT_BUF;
+
+    if (!queue_client_message(&buf, &client_msg)) {
+	free(data);
+	debug_return_bool(false);
+    }
+    free(data);
+    iobuf_wire = buf.data;
+    iobuf_wire_len = buf.len;
+
+    debug_return_bool(true);
+}
+
+static bool
+fmt_client_hello(struct loadgen_conn *c)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    ClientHello hello_msg = CLIENT_HELLO__INIT;
+    debug_decl(fmt_client_hello, SUDO_DEBUG_UTIL);
+
+    hello_msg.client_id = "Sudo Loadgen " PACKAGE_VERSION;
+    client_msg.u.hello_msg = &hello_msg;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_HELLO_MSG;
+
+    debug_return_bool(queue_client_message(&c->write_buf, &client_msg));
+}
+
+/*
+ * Build an AcceptMessage for a synthetic session with the settings
+ * that sudo_logsrvd requires.
+ */
+static bool
+fmt_accept_message(struct loadgen_session *s)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    AcceptMessage accept_msg = ACCEPT_MESSAGE__INIT;
+    InfoMessage__StringList runargv = INFO_MESSAGE__STRING_LIST__INIT;
+    InfoMessage info_msgs[9], *info_ptrs[9];
+    TimeSpec tv = TIME_SPEC__INIT;
+    char *argv[] = { "/bin/cat", "loadgen" };
+    struct timespec now;
+    size_t n;
+    debug_decl(fmt_accept_message, SUDO_DEBUG_UTIL);
+
+    for (n = 0; n < 9; n++) {
+	info_message__init(&info_msgs[n]);
+	info_ptrs[n] = &info_msgs[n];
+    }
+    runargv.strings = argv;
+    runargv.n_strings = 2;
+
+    n = 0;
+    info_msgs[n].key = "command";
+    info_msgs[n].u.strval = "/bin/cat";
+    info_msgs[n++].value_case = INFO_MESSAGE__VALUE_STRVAL;
+    info_msgs[n].key = "columns";
+    info_msgs[n].u.numval = 80;
+    info_msgs[n++].value_case = INFO_MESSAGE__VALUE_NUMVAL;
+    info_msgs[n].key = "lines";
+    info_msgs[n].u.numval = 24;
+    info_msgs[n++].value_case = INFO_MESSAGE__VALUE_NUMVAL;
+    info_msgs[n].key = "runargv";
+    info_msgs[n].u.strlistval = &runargv;
+    info_msgs[n++].value_case = INFO_MESSAGE__VALUE_STRLISTVAL;
+    info_msgs[n].key = "runuser";
+    info_msgs[n].u.strval = "root";
+    info_msgs[n++].value_case = INFO_MESSAGE__VALUE_STRVAL;
+    info_msgs[n].key = "submitcwd";
+    info_msgs[n].u.strval = "/";
+    info_msgs[n++].value_case = INFO_MESSAGE__VALUE_STRVAL;
+    info_msgs[n].key = "submithost";
+    info_msgs[n].u.strval = "loadgen";
+    info_msgs[n++].value_case = INFO_MESSAGE__VALUE_STRVAL;
+    info_msgs[n].key = "submituser";
+    info_msgs[n].u.strval = "loadgen";
+    info_msgs[n++].value_case = INFO_MESSAGE__VALUE_STRVAL;
+    info_msgs[n].key = "ttyname";
+    info_msgs[n].u.strval = "/dev/null";
+    info_msgs[n++].value_case = INFO_MESSAGE__VALUE_STRVAL;
+
+    sudo_gettime_real(&now);
+    tv.tv_sec = now.tv_sec;
+    tv.tv_nsec = now.tv_nsec;
+    accept_msg.submit_time = &tv;
+    accept_msg.expect_iobufs = true;
+    accept_msg.info_msgs = info_ptrs;
+    accept_msg.n_info_msgs = n;
+
+    client_msg.u.accept_msg = &accept_msg;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_ACCEPT_MSG;
+    client_msg.session_id = s->session_id;
+
+    debug_return_bool(queue_client_message(&s->conn->write_buf, &client_msg));
+}
+
+static bool
+fmt_exit_message(struct loadgen_session *s)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    ExitMessage exit_msg = EXIT_MESSAGE__INIT;
+    debug_decl(fmt_exit_message, SUDO_DEBUG_UTIL);
+
+    client_msg.u.exit_msg = &exit_msg;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_EXIT_MSG;
+    client_msg.session_id = s->session_id;
+
+    debug_return_bool(queue_client_message(&s->conn->write_buf, &client_msg));
+}
+
+/*
+ * Append the next IoBuffer to the write buffer and remember when
+ * it was queued so the commit latency can be computed.
+ * Once all IoBuffers have been queued, an ExitMessage is sent.
+ * Returns true on success, false on failure.
+ */
+static bool
+queue_io_buf(struct loadgen_session *s)
+{
+    struct connection_buffer *buf = &s->conn->write_buf;
+    debug_decl(queue_io_buf, SUDO_DEBUG_UTIL);
+
+    if (s->nqueued == nmessages) {
+	s->state = CLOSING;
+	debug_return_bool(fmt_exit_message(s));
+    }
+
+    if (s->pending_off + s->pending_len == s->pending_size) {
+	if (s->pending_off > 0) {
+	    memmove(s->pending, s->pending + s->pending_off,
+		s->pending_len * sizeof(*s->pending));
+	    s->pending_off = 0;
+	} else {
+	    unsigned int newsize = s->pending_size ? s->pending_size * 2 : 64;
+	    struct timespec *pending = reallocarray(s->pending, newsize,
+		sizeof(*s->pending));
+	    if (pending == NULL) {
+		sudo_warnx(U_("%s: %s"), __func__,
+		    U_("unable to allocate memory"));
+		debug_return_bool(false);
+	    }
+	    s->pending = pending;
+	    s->pending_size = newsize;
+	}
+    }
+
+    /* Room for a session ID field: a one-byte tag and up to 5 bytes. */
+    if (!expand_buf(buf, buf->len - buf->off + iobuf_wire_len + 6)) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    if (s->session_id == 0) {
+	memcpy(buf->data + buf->len, iobuf_wire, iobuf_wire_len);
+	buf->len += iobuf_wire_len;
+    } else {
+	/* Field order does not matter, append the session ID field. */
+	uint8_t *start = buf->data + buf->len, *cp = start;
+	uint32_t id = s->session_id, msg_len;
+
+	cp += sizeof(msg_len);
+	memcpy(cp, iobuf_wire + sizeof(msg_len),
+	    iobuf_wire_len - sizeof(msg_len));
+	cp += iobuf_wire_len - sizeof(msg_len);
+	*cp++ = (14 << 3) | 0;
+	for (; id >= 0x80; id >>= 7)
+	    *cp++ = (uint8_t)(id | 0x80);
+	*cp++ = (uint8_t)id;
+	msg_len = htonl((uint32_t)(cp - start - sizeof(msg_len)));
+	memcpy(start, &msg_len, sizeof(msg_len));
+	buf->len += (unsigned int)(cp - start);
+    }
+
+    sudo_gettime_mono(&s->pending[s->pending_off + s->pending_len]);
+    s->pending_len++;
+    s->nqueued++;
+    stats.messages++;
+    stats.bytes += iobuf_size;
+
+    debug_return_bool(true);
+}
+
+/*
+ * When there is no rate limit, keep the write buffer topped up,
+ * taking turns between the sessions on the connection.
+ */
+static bool
+conn_fill(struct loadgen_conn *c)
+{
+    struct connection_buffer *buf = &c->write_buf;
+    struct loadgen_session *s;
+    bool queued = true;
+    debug_decl(conn_fill, SUDO_DEBUG_UTIL);
+
+    if (msg_rate != 0)
+	debug_return_bool(true);
+
+    while (queued && buf->len - buf->off < WRITE_HIGHWAT) {
+	queued = false;
+	TAILQ_FOREACH(s, &c->sessions, entries) {
+	    if (s->state != RUNNING)
+		continue;
+	    if (!queue_io_buf(s))
+		debug_return_bool(false);
+	    queued = true;
+	}
+    }
+    debug_return_bool(true);
+}
+
+static void
+latency_record(const struct timespec *ts)
+{
+    uint64_t usec = (ts->tv_sec * 1000000) + (ts->tv_nsec / 1000);
+    unsigned int shift = 0;
+    uint64_t mantissa = usec;
+
+    while (mantissa >= 2 * LATENCY_SUBBUCKETS) {
+	mantissa >>= 1;
+	shift++;
+    }
+    stats.latency[shift * LATENCY_SUBBUCKETS + mantissa]++;
+    stats.nlatency++;
+    if (usec > stats.latency_max)
+	stats.latency_max = usec;
+}
+
+/*
+ * Return the latency in usecs below which the given fraction of
+ * samples fall, rounded down to the nearest histogram bucket.
+ */
+static uint64_t
+latency_percentile(double fraction)
+{
+    unsigned long long target, seen = 0;
+    unsigned int i;
+
+    target = (unsigned long long)(stats.nlatency * fraction);
+    for (i = 0; i < LATENCY_NBUCKETS; i++) {
+	seen += stats.latency[i];
+	if (seen > target)
+	    break;
+    }
+    if (i < 2 * LATENCY_SUBBUCKETS)
+	return i;
+    return (uint64_t)(i % LATENCY_SUBBUCKETS + LATENCY_SUBBUCKETS) <<
+	(i / LATENCY_SUBBUCKETS - 1);
+}
+
+/*
+ * Stop a session, exiting the event loop if it was the last one.
+ * The connection is stopped once all of its sessions are done.
+ */
+static void
+session_done(struct loadgen_session *s, bool success)
+{
+    struct loadgen_conn *c = s->conn;
+    debug_decl(session_done, SUDO_DEBUG_UTIL);
+
+    sudo_ev_del(c->evbase, s->rate_ev);
+    if (success) {
+	s->state = FINISHED;
+	stats.finished++;
+    } else {
+	s->state = ERROR;
+	stats.failed++;
+    }
+    if (--c->nactive == 0) {
+	sudo_ev_del(c->evbase, c->read_ev);
+	sudo_ev_del(c->evbase, c->write_ev);
+	if (c->state != ERROR)
+	    c->state = FINISHED;
+    }
+    if (--nactive == 0)
+	sudo_ev_loopexit(c->evbase);
+
+    debug_return;
+}
+
+/*
+ * Stop a connection and fail any sessions on it that are not done.
+ */
+static void
+conn_done(struct loadgen_conn *c)
+{
+    struct loadgen_session *s;
+    debug_decl(conn_done, SUDO_DEBUG_UTIL);
+
+    c->state = ERROR;
+    TAILQ_FOREACH(s, &c->sessions, entries) {
+	if (s->state != FINISHED && s->state != ERROR)
+	    session_done(s, false);
+    }
+    sudo_ev_del(c->evbase, c->read_ev);
+    sudo_ev_del(c->evbase, c->write_ev);
+
+    debug_return;
+}
+
+/*
+ * Start sending a session's messages once the ServerHello is received.
+ */
+static bool
+session_start(struct loadgen_session *s)
+{
+    debug_decl(session_start, SUDO_DEBUG_UTIL);
+
+    s->state = RUNNING;
+    if (!fmt_accept_message(s))
+	debug_return_bool(false);
+    if (msg_rate != 0) {
+	/* Stagger the sessions so they don't all send at once. */
+	struct timespec timeo = { 0, 0 };
+	timeo.tv_nsec = arc4random_uniform(rate_interval.tv_sec ?
+	    999999999 : (uint32_t)rate_interval.tv_nsec);
+	if (sudo_ev_add(s->conn->evbase, s->rate_ev, &timeo, false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	    debug_return_bool(false);
+	}
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Handle a CommitPoint from the server.  Every IoBuffer covered by
+ * the commit point has its latency recorded.
+ */
+static void
+handle_commit_point(TimeSpec *commit_point, struct loadgen_session *s)
+{
+    unsigned long long committed_ns, delay_ns;
+    unsigned int ncommitted;
+    struct timespec now, lag;
+    debug_decl(handle_commit_point, SUDO_DEBUG_UTIL);
+
+    stats.commit_points++;
+
+    /* Each IoBuffer advances the elapsed time by exactly msg_delay. */
+    committed_ns = (unsigned long long)commit_point->tv_sec * 1000000000ULL +
+	commit_point->tv_nsec;
+    delay_ns = (unsigned long long)msg_delay.tv_sec * 1000000000ULL +
+	msg_delay.tv_nsec;
+    ncommitted = committed_ns / delay_ns;
+    if (ncommitted > s->nqueued)
+	ncommitted = s->nqueued;
+
+    sudo_gettime_mono(&now);
+    while (s->ncommitted < ncommitted) {
+	sudo_timespecsub(&now, &s->pending[s->pending_off], &lag);
+	latency_record(&lag);
+	s->pending_off++;
+	s->pending_len--;
+	s->ncommitted++;
+    }
+
+    debug_return;
+}
+
+/*
+ * Handle the ServerHello and start the sessions on the connection.
+ * Returns true on success, false on error.
+ */
+static bool
+handle_server_hello(ServerHello *msg, struct loadgen_conn *c)
+{
+    struct loadgen_session *s;
+    debug_decl(handle_server_hello, SUDO_DEBUG_UTIL);
+
+    if (c->state != RECV_HELLO) {
+	sudo_warnx(U_("%s: unexpected state %d"), __func__, c->state);
+	debug_return_bool(false);
+    }
+    if (TAILQ_FIRST(&c->sessions)->session_id != 0 && !msg->multiplex) {
+	sudo_warnx("%s", U_("server does not support multiplexed sessions"));
+	debug_return_bool(false);
+    }
+    c->state = RUNNING;
+    TAILQ_FOREACH(s, &c->sessions, entries) {
+	if (!session_start(s))
+	    debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Respond to a ServerMessage from the server.
+ * Returns true on success, false on error.
+ */
+static bool
+handle_server_message(uint8_t *buf, size_t len, struct loadgen_conn *c)
+{
+    struct loadgen_session *s = NULL;
+    ServerMessage *msg;
+    bool ret = true;
+    debug_decl(handle_server_message, SUDO_DEBUG_UTIL);
+
+    msg = server_message__unpack(NULL, len, buf);
+    if (msg == NULL) {
+	sudo_warnx("%s", U_("unable to unpack ServerMessage"));
+	debug_return_bool(false);
+    }
+
+    /* Every message but the ServerHello is for a session. */
+    if (msg->type_case != SERVER_MESSAGE__TYPE_HELLO) {
+	TAILQ_FOREACH(s, &c->sessions, entries) {
+	    if (s->session_id == msg->session_id)
+		break;
+	}
+	if (s == NULL) {
+	    sudo_warnx(U_("%s: unexpected session ID %u"), __func__,
+		msg->session_id);
+	    server_message__free_unpacked(msg, NULL);
+	    debug_return_bool(false);
+	}
+    }
+
+    switch (msg->type_case) {
+    case SERVER_MESSAGE__TYPE_HELLO:
+	ret = handle_server_hello(msg->u.hello, c);
+	break;
+    case SERVER_MESSAGE__TYPE_COMMIT_POINT:
+	handle_commit_point(msg->u.commit_point, s);
+	if (s->state == CLOSING && s->ncommitted == nmessages)
+	    session_done(s, true);
+	break;
+    case SERVER_MESSAGE__TYPE_LOG_ID:
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: remote log ID %s",
+	    __func__, msg->u.log_id);
+	break;
+    case SERVER_MESSAGE__TYPE_ERROR:
+	sudo_warnx(U_("error message received from server: %s"),
+	    msg->u.error);
+	/* An error for a multiplexed session only ends that session. */
+	if (s->session_id == 0)
+	    ret = false;
+	else if (s->state != ERROR)
+	    session_done(s, false);
+	break;
+    case SERVER_MESSAGE__TYPE_ABORT:
+	sudo_warnx(U_("abort message received from server: %s"),
+	    msg->u.abort);
+	ret = false;
+	break;
+    default:
+	sudo_warnx(U_("%s: unexpected type_case value %d"),
+	    __func__, msg->type_case);
+	ret = false;
+	break;
+    }
+
+    server_message__free_unpacked(msg, NULL);
+    debug_return_bool(ret);
+}
+
+/*
+ * Read as many ServerMessages as are available.
+ * Returns true on success, false on error or EOF.
+ */
+static bool
+conn_read(struct loadgen_conn *c)
+{
+    struct connection_buffer *buf = &c->read_buf;
+    uint32_t msg_len;
+    ssize_t nread;
+    debug_decl(conn_read, SUDO_DEBUG_UTIL);
+
+    while (c->state != FINISHED) {
+#if defined(HAVE_OPENSSL)
+	if (c->ssl != NULL) {
+	    nread = SSL_read(c->ssl, buf->data + buf->len,
+		buf->size - buf->len);
+	    if (nread <= 0) {
+		switch (SSL_get_error(c->ssl, nread)) {
+		case SSL_ERROR_ZERO_RETURN:
+		    nread = 0;
+		    break;
+		case SSL_ERROR_WANT_READ:
+		    debug_return_bool(true);
+		case SSL_ERROR_WANT_WRITE:
+		    c->want_write = true;
+		    debug_return_bool(true);
+		case SSL_ERROR_SYSCALL:
+		    sudo_warn("recv");
+		    debug_return_bool(false);
+		default:
+		    sudo_warnx("recv: %s",
+			ERR_reason_error_string(ERR_get_error()));
+		    debug_return_bool(false);
+		}
+	    }
+	} else
+#endif
+	{
+	    nread = recv(c->sock, buf->data + buf->len,
+		buf->size - buf->len, 0);
+	}
+	switch (nread) {
+	case -1:
+	    if (errno == EAGAIN || errno == EINTR)
+		debug_return_bool(true);
+	    sudo_warn("recv");
+	    debug_return_bool(false);
+	case 0:
+	    sudo_warnx("%s", U_("premature EOF"));
+	    debug_return_bool(false);
+	default:
+	    break;
+	}
+	buf->len += nread;
+
+	while (buf->len - buf->off >= sizeof(msg_len)) {
+	    /* Read wire message size (uint32_t in network byte order). */
+	    memcpy(&msg_len, buf->data + buf->off, sizeof(msg_len));
+	    msg_len = ntohl(msg_len);
+
+	    if (msg_len > MESSAGE_SIZE_MAX) {
+		sudo_warnx(U_("server message too large: %u"), msg_len);
+		debug_return_bool(false);
+	    }
+	    if (msg_len + sizeof(msg_len) > buf->len - buf->off)
+		break;
+
+	    buf->off += sizeof(msg_len);
+	    if (!handle_server_message(buf->data + buf->off, msg_len, c))
+		debug_return_bool(false);
+	    buf->off += msg_len;
+	    if (c->state == FINISHED)
+		debug_return_bool(true);
+	}
+
+	/* Move any partial message to the front, growing buf as needed. */
+	if (buf->off + sizeof(msg_len) <= buf->len) {
+	    memcpy(&msg_len, buf->data + buf->off, sizeof(msg_len));
+	    msg_len = ntohl(msg_len);
+	} else {
+	    msg_len = 0;
+	}
+	if (!expand_buf(buf, msg_len + sizeof(msg_len))) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    debug_return_bool(false);
+	}
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Write as much queued data as the socket will take, queueing
+ * more IoBuffers as space frees up when there is no rate limit.
+ * Returns true on success, false on error.
+ */
+static bool
+conn_write(struct loadgen_conn *c)
+{
+    struct connection_buffer *buf = &c->write_buf;
+    ssize_t nwritten;
+    debug_decl(conn_write, SUDO_DEBUG_UTIL);
+
+    for (;;) {
+	if (buf->off == buf->len) {
+	    buf->off = buf->len = 0;
+	    if (!conn_fill(c))
+		debug_return_bool(false);
+	    if (buf->len == 0)
+		break;
+	}
+#if defined(HAVE_OPENSSL)
+	if (c->ssl != NULL) {
+	    nwritten = SSL_write(c->ssl, buf->data + buf->off,
+		buf->len - buf->off);
+	    if (nwritten <= 0) {
+		switch (SSL_get_error(c->ssl, nwritten)) {
+		case SSL_ERROR_WANT_READ:
+		    /* The read event is always active. */
+		    debug_return_bool(true);
+		case SSL_ERROR_WANT_WRITE:
+		    debug_return_bool(true);
+		case SSL_ERROR_SYSCALL:
+		    sudo_warn("send");
+		    debug_return_bool(false);
+		default:
+		    sudo_warnx("send: %s",
+			ERR_reason_error_string(ERR_get_error()));
+		    debug_return_bool(false);
+		}
+	    }
+	} else
+#endif
+	{
+	    nwritten = send(c->sock, buf->data + buf->off,
+		buf->len - buf->off, 0);
+	    if (nwritten == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+		    break;
+		sudo_warn("send");
+		debug_return_bool(false);
+	    }
+	}
+	buf->off += nwritten;
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Only poll for write when there is something to send.
+ */
+static bool
+conn_update_events(struct loadgen_conn *c)
+{
+    const bool need_write = c->want_write || c->write_buf.off != c->write_buf.len;
+    debug_decl(conn_update_events, SUDO_DEBUG_UTIL);
+
+    if (need_write) {
+	if (!ISSET(c->write_ev->flags, SUDO_EVQ_INSERTED)) {
+	    if (sudo_ev_add(c->evbase, c->write_ev, NULL, false) == -1) {
+		sudo_warnx("%s", U_("unable to add event to queue"));
+		debug_return_bool(false);
+	    }
+	}
+    } else {
+	if (ISSET(c->write_ev->flags, SUDO_EVQ_INSERTED))
+	    sudo_ev_del(c->evbase, c->write_ev);
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Read and write callback.  With TLS, either direction may be
+ * needed to make progress so both are attempted.
+ */
+static void
+conn_cb(int fd, int what, void *v)
+{
+    struct loadgen_conn *c = v;
+    bool tls = false;
+    debug_decl(conn_cb, SUDO_DEBUG_UTIL);
+
+#if defined(HAVE_OPENSSL)
+    tls = c->ssl != NULL;
+#endif
+    c->want_write = false;
+    if (ISSET(what, SUDO_EV_READ) || tls) {
+	if (!conn_read(c))
+	    goto bad;
+	if (c->state == FINISHED)
+	    debug_return;
+    }
+    if (!conn_write(c))
+	goto bad;
+    if (!conn_update_events(c))
+	goto bad;
+    debug_return;
+bad:
+    conn_done(c);
+    debug_return;
+}
+
+/*
+ * Timer callback used to send IoBuffers at a fixed rate.
+ */
+static void
+rate_cb(int unused, int what, void *v)
+{
+    struct loadgen_session *s = v;
+    debug_decl(rate_cb, SUDO_DEBUG_UTIL);
+
+    if (s->state != RUNNING)
+	debug_return;
+    if (!queue_io_buf(s))
+	goto bad;
+    if (!conn_write(s->conn) || !conn_update_events(s->conn)) {
+	conn_done(s->conn);
+	debug_return;
+    }
+    if (s->state == RUNNING) {
+	if (sudo_ev_add(s->conn->evbase, s->rate_ev, &rate_interval,
+		false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	    goto bad;
+	}
+    }
+    debug_return;
+bad:
+    session_done(s, false);
+    debug_return;
+}
+
+#if defined(HAVE_OPENSSL)
+/*
+ * Check that the server's certificate is valid that it contains the
+ * server name or IP address.
+ * Returns 0 if the cert is invalid, else 1.
+ */
+static int
+verify_peer_identity(int preverify_ok, X509_STORE_CTX *ctx)
+{
+    X509 *current_cert;
+    X509 *peer_cert;
+    debug_decl(verify_peer_identity, SUDO_DEBUG_UTIL);
+
+    /* if pre-verification of the cert failed, just propagate that result back */
+    if (preverify_ok != 1) {
+        debug_return_int(0);
+    }
+
+    /* since this callback is called for each cert in the chain,
+     * check that current cert is the peer's certificate
+     */
+    current_cert = X509_STORE_CTX_get_current_cert(ctx);
+    peer_cert = X509_STORE_CTX_get0_cert(ctx);
+    if (current_cert != peer_cert) {
+        debug_return_int(1);
+    }
+
+    if (validate_hostname(peer_cert, server_name, server_ip, 0) == MatchFound) {
+        debug_return_int(1);
+    }
+
+    debug_return_int(0);
+}
+
+static SSL_CTX *
+init_tls_client_context(const char *ca_bundle_file, const char *cert_file, const char *key_file)
+{
+    const SSL_METHOD *method;
+    SSL_CTX *ctx = NULL;
+    debug_decl(init_tls_client_context, SUDO_DEBUG_UTIL);
+
+    SSL_library_init();
+    OpenSSL_add_all_algorithms();
+    SSL_load_error_strings();
+
+    if ((method = TLS_client_method()) == NULL) {
+        sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+            "creation of SSL_METHOD failed: %s",
+            ERR_error_string(ERR_get_error(), NULL));
+        goto bad;
+    }
+    if ((ctx = SSL_CTX_new(method)) == NULL) {
+        sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+            "creation of new SSL_CTX object failed: %s",
+            ERR_error_string(ERR_get_error(), NULL));
+        goto bad;
+    }
+#ifdef HAVE_SSL_CTX_SET_MIN_PROTO_VERSION
+    if (!SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION)) {
+        sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+            "unable to restrict min. protocol version: %s",
+            ERR_error_string(ERR_get_error(), NULL));
+        goto bad;
+    }
+#else
+    SSL_CTX_set_options(ctx,
+        SSL_OP_NO_SSLv2|SSL_OP_NO_SSLv3|SSL_OP_NO_TLSv1|SSL_OP_NO_TLSv1_1);
+#endif
+
+    /* The write buffer may be reallocated between SSL_write() retries. */
+    SSL_CTX_set_mode(ctx,
+	SSL_MODE_ENABLE_PARTIAL_WRITE|SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    if (cert_file) {
+        if (!SSL_CTX_use_certificate_chain_file(ctx, cert_file)) {
+            sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+                "unable to load cert to the ssl context: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+            goto bad;
+        }
+        if (!SSL_CTX_use_PrivateKey_file(ctx, key_file, X509_FILETYPE_PEM)) {
+            sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+                "unable to load key to the ssl context: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+            goto bad;
+        }
+    }
+
+    if (ca_bundle_file != NULL) {
+        /* sets the location of the CA bundle file for verification purposes */
+        if (SSL_CTX_load_verify_locations(ctx, ca_bundle_file, NULL) <= 0) {
+            sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+                "calling SSL_CTX_load_verify_locations() failed: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+            goto bad;
+        }
+    }
+
+    if (verify_server) {
+        /* verify server cert during the handshake */
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, verify_peer_identity);
+    }
+
+    goto done;
+
+bad:
+    SSL_CTX_free(ctx);
+    ctx = NULL;
+
+done:
+    debug_return_ptr(ctx);
+}
+#endif /* HAVE_OPENSSL */
+
+/*
+ * Free a connection, its sessions and their resources.
+ */
+static void
+conn_free(struct loadgen_conn *c)
+{
+    struct loadgen_session *s;
+    debug_decl(conn_free, SUDO_DEBUG_UTIL);
+
+    if (c != NULL) {
+	TAILQ_REMOVE(&conns, c, entries);
+	while ((s = TAILQ_FIRST(&c->sessions)) != NULL) {
+	    TAILQ_REMOVE(&c->sessions, s, entries);
+	    sudo_ev_free(s->rate_ev);
+	    free(s->pending);
+	    free(s);
+	}
+#if defined(HAVE_OPENSSL)
+	if (c->ssl != NULL) {
+	    SSL_shutdown(c->ssl);
+	    SSL_free(c->ssl);
+	}
+#endif
+	sudo_ev_free(c->read_ev);
+	sudo_ev_free(c->write_ev);
+	free(c->read_buf.data);
+	free(c->write_buf.data);
+	if (c->sock != -1)
+	    close(c->sock);
+	free(c);
+    }
+
+    debug_return;
+}
+
+/*
+ * Add a session to a connection.  The session ID is only
+ * sent when sessions are multiplexed.
+ */
+static struct loadgen_session *
+session_alloc(struct loadgen_conn *c, uint32_t session_id)
+{
+    struct loadgen_session *s;
+    debug_decl(session_alloc, SUDO_DEBUG_UTIL);
+
+    if ((s = calloc(1, sizeof(*s))) == NULL)
+	debug_return_ptr(NULL);
+    TAILQ_INSERT_TAIL(&c->sessions, s, entries);
+    s->conn = c;
+    s->session_id = session_id;
+    s->state = RECV_HELLO;
+    c->nactive++;
+
+    s->rate_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT, rate_cb, s);
+    if (s->rate_ev == NULL)
+	debug_return_ptr(NULL);
+
+    debug_return_ptr(s);
+}
+
+/*
+ * Allocate a new connection for a connected socket and queue the
+ * ClientHello.  For TLS, the handshake is performed by the first
+ * SSL_write().
+ */
+static struct loadgen_conn *
+conn_alloc(int sock, struct sudo_event_base *evbase)
+{
+    struct loadgen_conn *c;
+    debug_decl(conn_alloc, SUDO_DEBUG_UTIL);
+
+    if ((c = calloc(1, sizeof(*c))) == NULL) {
+	close(sock);
+	debug_return_ptr(NULL);
+    }
+    TAILQ_INSERT_TAIL(&conns, c, entries);
+    TAILQ_INIT(&c->sessions);
+    c->sock = sock;
+    c->evbase = evbase;
+    c->state = RECV_HELLO;
+
+    c->read_buf.size = 8 * 1024;
+    if ((c->read_buf.data = malloc(c->read_buf.size)) == NULL)
+	goto bad;
+
+    c->read_ev = sudo_ev_alloc(sock, SUDO_EV_READ|SUDO_EV_PERSIST,
+	conn_cb, c);
+    c->write_ev = sudo_ev_alloc(sock, SUDO_EV_WRITE|SUDO_EV_PERSIST,
+	conn_cb, c);
+    if (c->read_ev == NULL || c->write_ev == NULL)
+	goto bad;
+
+#if defined(HAVE_OPENSSL)
+    if (use_tls) {
+	if ((c->ssl = SSL_new(ssl_ctx)) == NULL) {
+	    sudo_warnx(U_("Unable to allocate ssl object: %s"),
+		ERR_reason_error_string(ERR_get_error()));
+	    goto bad;
+	}
+	if (SSL_set_fd(c->ssl, sock) <= 0) {
+	    sudo_warnx(U_("Unable to attach socket to the ssl object: %s"),
+		ERR_reason_error_string(ERR_get_error()));
+	    goto bad;
+	}
+	SSL_set_connect_state(c->ssl);
+    }
+#endif
+
+    if (!fmt_client_hello(c))
+	goto bad;
+    if (sudo_ev_add(evbase, c->read_ev, NULL, false) == -1)
+	goto bad;
+    if (sudo_ev_add(evbase, c->write_ev, NULL, false) == -1)
+	goto bad;
+
+    debug_return_ptr(c);
+bad:
+    conn_free(c);
+    debug_return_ptr(NULL);
+}
+
+/*
+ * Get the user and system CPU time, in clock ticks, used by the
+ * server process.  The sudo_logsrvd workers are threads, so their
+ * time is included.  Only supported on systems with a Linux-style /proc.
+ */
+static bool
+server_cpu_time(pid_t server_pid, unsigned long long *utimep,
+    unsigned long long *stimep)
+{
+    char path[PATH_MAX], line[1024];
+    char *cp;
+    FILE *fp;
+    debug_decl(server_cpu_time, SUDO_DEBUG_UTIL);
+
+    (void)snprintf(path, sizeof(path), "/proc/%d/stat", (int)server_pid);
+    if ((fp = fopen(path, "r")) == NULL)
+	debug_return_bool(false);
+    cp = fgets(line, sizeof(line), fp);
+    fclose(fp);
+    if (cp == NULL)
+	debug_return_bool(false);
+
+    /*
+     * The command name may contain spaces, skip past it.
+     * Fields 14 and 15 are utime and stime; cutime and cstime,
+     * the time of waited-for children, are not included.
+     */
+    if ((cp = strrchr(line, ')')) == NULL)
+	debug_return_bool(false);
+    if (sscanf(cp + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+	    utimep, stimep) != 2)
+	debug_return_bool(false);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Raise the open file limit so thousands of sessions can be opened.
+ */
+static void
+raise_nofile_limit(void)
+{
+    struct rlimit rl;
+    debug_decl(raise_nofile_limit, SUDO_DEBUG_UTIL);
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+	rl.rlim_cur = rl.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rl) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_ERRNO,
+		"unable to raise open file limit");
+	}
+    }
+
+    debug_return;
+}
+
+static void
+report(struct timespec *wall, pid_t server_pid, unsigned long long utime,
+    unsigned long long stime)
+{
+    const double secs = wall->tv_sec + (wall->tv_nsec / 1000000000.0);
+    debug_decl(report, SUDO_DEBUG_UTIL);
+
+    printf("sessions:        %u finished, %u failed\n",
+	stats.finished, stats.failed);
+    printf("elapsed time:    %.3f seconds\n", secs);
+    printf("messages sent:   %llu (%llu bytes of I/O)\n",
+	stats.messages, stats.bytes);
+    if (secs > 0) {
+	printf("throughput:      %.0f messages/sec, %.2f MB/sec\n",
+	    stats.messages / secs, stats.bytes / secs / (1024 * 1024));
+    }
+    printf("commit points:   %llu\n", stats.commit_points);
+    if (stats.nlatency != 0) {
+	printf("commit latency:  p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+	    latency_percentile(0.50) / 1000.0,
+	    latency_percentile(0.99) / 1000.0,
+	    stats.latency_max / 1000.0);
+    }
+    if (server_pid != 0) {
+	const long ticks = sysconf(_SC_CLK_TCK);
+
+	if (ticks > 0) {
+	    const double cpu = (double)(utime + stime) / ticks;
+	    printf("server CPU:      %.2f user, %.2f system (%.1f%% of one CPU)",
+		(double)utime / ticks, (double)stime / ticks,
+		secs > 0 ? cpu * 100.0 / secs : 0.0);
+	    if (stats.messages != 0)
+		printf(", %.2f usec/message", cpu * 1000000.0 / stats.messages);
+	    putchar('\n');
+	}
+    }
+
+    debug_return;
+}
+
+#if defined(HAVE_OPENSSL)
+static const char short_opts[] = "b:c:C:h:k:m:np:P:r:s:S:TV";
+#else
+static const char short_opts[] = "C:h:m:p:P:r:s:S:V";
+#endif
+static struct option long_opts[] = {
+    { "help",		no_argument,		NULL,	1 },
+    { "connections",	required_argument,	NULL,	'C' },
+    { "host",		required_argument,	NULL,	'h' },
+    { "messages",	required_argument,	NULL,	'm' },
+    { "port",		required_argument,	NULL,	'p' },
+    { "server-pid",	required_argument,	NULL,	'P' },
+    { "rate",		required_argument,	NULL,	'r' },
+    { "sessions",	required_argument,	NULL,	's' },
+    { "size",		required_argument,	NULL,	'S' },
+#if defined(HAVE_OPENSSL)
+    { "ca-bundle",	required_argument,	NULL,	'b' },
+    { "cert",		required_argument,	NULL,	'c' },
+    { "key",		required_argument,	NULL,	'k' },
+    { "no-verify",	no_argument,		NULL,	'n' },
+    { "tls",		no_argument,		NULL,	'T' },
+#endif
+    { "version",	no_argument,		NULL,	'V' },
+    { NULL,		no_argument,		NULL,	0 },
+};
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+int
+main(int argc, char *argv[])
+{
+    struct loadgen_conn *c, **conn_array;
+    struct sudo_event_base *evbase;
+    struct timespec t_start, t_end, t_result;
+    unsigned long long utime0 = 0, stime0 = 0, utime1 = 0, stime1 = 0;
+    const char *port = NULL;
+    const char *errstr;
+    pid_t server_pid = 0;
+    unsigned int i;
+    int ch, sock;
+    debug_decl_vars(main, SUDO_DEBUG_MAIN);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    initprogname(argc > 0 ? argv[0] : "sudo_loadgen");
+    setlocale(LC_ALL, "");
+    bindtextdomain("sudo", LOCALEDIR); /* XXX - add logsrvd domain */
+    textdomain("sudo");
+
+    /* Read sudo.conf and initialize the debug subsystem. */
+    if (sudo_conf_read(NULL, SUDO_CONF_DEBUG) == -1)
+        exit(EXIT_FAILURE);
+    sudo_debug_register(getprogname(), NULL, NULL,
+        sudo_conf_debug_files(getprogname()));
+
+    if (protobuf_c_version_number() < 1003000)
+	sudo_fatalx("%s", U_("Protobuf-C version 1.3 or higher required"));
+
+    while ((ch = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+	switch (ch) {
+	case 'C':
+	    nconns = sudo_strtonum(optarg, 1, INT_MAX, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx(U_("%s: %s"), optarg, U_(errstr));
+	    break;
+	case 'h':
+	    server_name = optarg;
+	    break;
+	case 'm':
+	    nmessages = sudo_strtonum(optarg, 1, UINT_MAX, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx(U_("%s: %s"), optarg, U_(errstr));
+	    break;
+	case 'p':
+	    port = optarg;
+	    break;
+	case 'P':
+	    server_pid = sudo_strtonum(optarg, 1, INT_MAX, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx(U_("%s: %s"), optarg, U_(errstr));
+	    break;
+	case 'r':
+	    msg_rate = sudo_strtonum(optarg, 0, 1000000000, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx(U_("%s: %s"), optarg, U_(errstr));
+	    break;
+	case 's':
+	    nsessions = sudo_strtonum(optarg, 1, INT_MAX, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx(U_("%s: %s"), optarg, U_(errstr));
+	    break;
+	case 'S':
+	    iobuf_size = sudo_strtonum(optarg, 1, MESSAGE_SIZE_MAX / 2,
+		&errstr);
+	    if (errstr != NULL)
+		sudo_fatalx(U_("%s: %s"), optarg, U_(errstr));
+	    break;
+	case 1:
+	    help();
+	    break;
+#if defined(HAVE_OPENSSL)
+	case 'b':
+	    ca_bundle = optarg;
+	    break;
+	case 'c':
+	    cert = optarg;
+	    break;
+	case 'k':
+	    key = optarg;
+	    break;
+	case 'n':
+	    verify_server = false;
+	    break;
+	case 'T':
+	    use_tls = true;
+	    break;
+#endif
+	case 'V':
+	    (void)printf(_("%s version %s\n"), getprogname(),
+		PACKAGE_VERSION);
+	    return 0;
+	default:
+	    usage(true);
+	}
+    }
+    if (argc != optind)
+	usage(true);
+
+#if defined(HAVE_OPENSSL)
+    /* if no key file is given explicitly, try to load the key from the cert */
+    if (cert != NULL) {
+	if (key == NULL)
+	    key = cert;
+	use_tls = true;
+    }
+    if (use_tls) {
+	if (port == NULL)
+	    port = DEFAULT_PORT_TLS;
+	if ((ssl_ctx = init_tls_client_context(ca_bundle, cert, key)) == NULL) {
+	    sudo_fatalx(U_("Unable to initialize ssl context: %s"),
+		ERR_reason_error_string(ERR_get_error()));
+	}
+    }
+#endif
+    if (port == NULL)
+	port = DEFAULT_PORT;
+
+    /*
+     * The IoBuffer delay is only used to match commit points to messages.
+     * When rate limited it matches the interval between messages.
+     */
+    if (msg_rate != 0) {
+	rate_interval.tv_sec = 1 / msg_rate;
+	rate_interval.tv_nsec = msg_rate == 1 ? 0 : 1000000000 / msg_rate;
+	msg_delay = rate_interval;
+    }
+    if (!fmt_io_buf())
+	goto bad;
+
+    raise_nofile_limit();
+
+    if ((evbase = sudo_ev_base_alloc()) == NULL)
+	sudo_fatal(NULL);
+
+    /* By default, each session has a connection of its own. */
+    if (nconns == 0 || nconns > nsessions)
+	nconns = nsessions;
+    printf("connecting %u session%s over %u connection%s to %s:%s%s\n",
+	nsessions, nsessions == 1 ? "" : "s", nconns, nconns == 1 ? "" : "s",
+	server_name, port,
+#if defined(HAVE_OPENSSL)
+	use_tls ? " (TLS)" :
+#endif
+	"");
+    if ((conn_array = reallocarray(NULL, nconns, sizeof(*conn_array))) == NULL)
+	sudo_fatalx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    for (i = 0; i < nconns; i++) {
+	if ((sock = connect_server(server_name, port)) == -1)
+	    goto bad;
+	if ((conn_array[i] = conn_alloc(sock, evbase)) == NULL)
+	    goto bad;
+    }
+    /* Sessions are multiplexed if there are fewer connections. */
+    for (i = 0; i < nsessions; i++) {
+	const uint32_t session_id = nconns < nsessions ? i / nconns + 1 : 0;
+	if (session_alloc(conn_array[i % nconns], session_id) == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    goto bad;
+	}
+	nactive++;
+    }
+    free(conn_array);
+
+    if (server_pid != 0) {
+	if (!server_cpu_time(server_pid, &utime0, &stime0)) {
+	    sudo_warnx(U_("unable to get CPU time for process %d"),
+		(int)server_pid);
+	    server_pid = 0;
+	}
+    }
+    sudo_gettime_mono(&t_start);
+
+    sudo_ev_dispatch(evbase);
+
+    sudo_gettime_mono(&t_end);
+    sudo_timespecsub(&t_end, &t_start, &t_result);
+    if (server_pid != 0) {
+	if (!server_cpu_time(server_pid, &utime1, &stime1)) {
+	    sudo_warnx(U_("unable to get CPU time for process %d"),
+		(int)server_pid);
+	    server_pid = 0;
+	}
+    }
+
+    while ((c = TAILQ_FIRST(&conns)) != NULL)
+	conn_free(c);
+    sudo_ev_base_free(evbase);
+#if defined(HAVE_OPENSSL)
+    SSL_CTX_free(ssl_ctx);
+#endif
+    free(iobuf_wire);
+
+    report(&t_result, server_pid, utime1 - utime0, stime1 - stime0);
+
+    if (stats.failed == 0)
+	debug_return_int(EXIT_SUCCESS);
+
+bad:
+    debug_return_int(EXIT_FAILURE);
+}
@@ -0,0 +1,2315 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Per-host log forwarding agent for sudo_logsrvd.
+ * The sudoers plugin connects to the agent over a UNIX domain socket
+ * and speaks the usual log server protocol.  Each local connection is
+ * forwarded as a session multiplexed over one of a small number of
+ * persistent connections to the log server, so sudo does not have to
+ * wait for a DNS lookup, TCP connection and TLS handshake of its own.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <signal.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef HAVE_GETADDRINFO
+# include "compat/getaddrinfo.h"
+#endif
+#ifdef HAVE_GETOPT_LONG
+# include <getopt.h>
+# else
+# include "compat/getopt.h"
+#endif /* HAVE_GETOPT_LONG */
+
+#if defined(HAVE_OPENSSL)
+# include <openssl/ssl.h>
+# include <openssl/err.h>
+#endif
+
+#include "pathnames.h"
+#include "sudo_compat.h"
+#include "sudo_conf.h"
+#include "sudo_debug.h"
+#include "sudo_event.h"
+#include "sudo_fatal.h"
+#include "sudo_gettext.h"
+#include "sudo_iolog.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+
+#include "hostcheck.h"
+#include "log_server.pb-c.h"
+#include "logsrv_util.h"
+
+/* Stop reading from local clients when this much is waiting upstream. */
+#define UPSTREAM_HIGHWAT	(256 * 1024)
+
+/* Sessions per upstream connection, see SESSIONS_MAX in logsrvd.h. */
+#define UPSTREAM_SESSIONS_MAX	1024
+
+/* Time allowed to connect to the log server and receive its ServerHello. */
+#define UPSTREAM_TIMEOUT	30
+
+/* Reconnect delay in seconds, doubled after each failed attempt. */
+#define RETRY_DELAY_MIN		1
+#define RETRY_DELAY_MAX		60
+
+/* Uncommitted data kept per session to replay it on a new connection. */
+#define REPLAY_MAX		(1024 * 1024)
+
+/* Time a session may wait for the log server to come back. */
+#define RESUME_TIMEOUT		300
+
+enum upstream_state {
+    UPSTREAM_IDLE,
+    UPSTREAM_CONNECTING,
+    UPSTREAM_RECV_HELLO,
+    UPSTREAM_READY
+};
+
+enum client_state {
+    CLIENT_RECV_HELLO,
+    CLIENT_WAIT_UPSTREAM,
+    CLIENT_RUNNING,
+    CLIENT_CLOSING
+};
+
+/*
+ * Header of a message in a local client's replay buffer.
+ * For I/O buffers and other timed messages, elapsed is the time
+ * after the message, otherwise it is the time the message was sent.
+ */
+struct replay_header {
+    struct timespec elapsed;
+    uint32_t len;
+    unsigned int field;
+};
+
+/*
+ * A log server from the command line.
+ */
+struct agent_server {
+    TAILQ_ENTRY(agent_server) entries;
+    char *copy;
+    char *host;
+    char *port;
+    bool tls;
+};
+TAILQ_HEAD(server_list, agent_server);
+
+/*
+ * A local connection from sudo, forwarded as a single session.
+ */
+struct agent_upstream;
+struct agent_client {
+    TAILQ_ENTRY(agent_client) entries;
+    struct agent_upstream *upstream;
+    struct sudo_event *read_ev;
+    struct sudo_event *write_ev;
+    struct connection_buffer read_buf;
+    struct connection_buffer write_buf;
+    struct connection_buffer replay_buf;	/* messages not yet committed */
+    struct timespec elapsed;	/* elapsed time of messages sent */
+    struct timespec committed;	/* last commit point from the server */
+    struct timespec resume_by;	/* when to give up waiting to resume */
+    enum client_state state;
+    char *log_id;		/* ID of the server-side I/O log */
+    uint32_t session_id;
+    int sock;
+    bool compression;	/* client offered to compress I/O buffers */
+    bool compressed;	/* client was told to compress I/O buffers */
+    bool exited;	/* ExitMessage has been forwarded */
+    bool complete;	/* final commit point has been received */
+    bool resumed;	/* waiting to be replayed on a new connection */
+    bool no_replay;	/* too much uncommitted data to replay */
+};
+TAILQ_HEAD(client_list, agent_client);
+
+/*
+ * A persistent connection to the log server that local sessions are
+ * multiplexed over.  It is re-established whenever it is lost.
+ */
+struct agent_upstream {
+    struct client_list clients;
+    struct agent_server *server;	/* server being connected to */
+    struct addrinfo *res0;
+    struct addrinfo *res;		/* next address to try */
+    struct sudo_event *connect_ev;
+    struct sudo_event *read_ev;
+    struct sudo_event *write_ev;
+    struct sudo_event *retry_ev;
+    struct connection_buffer read_buf;
+    struct connection_buffer write_buf;
+#if defined(HAVE_OPENSSL)
+    SSL *ssl;
+#endif
+    enum upstream_state state;
+    unsigned int nclients;
+    unsigned int retry_delay;
+    uint32_t next_id;
+    int sock;
+    bool compression;	/* server accepts compressed I/O buffers */
+    bool throttled;	/* not reading from local clients */
+    bool want_write;
+#if defined(HAVE_STRUCT_IN6_ADDR)
+    char server_ip[INET6_ADDRSTRLEN];
+#else
+    char server_ip[INET_ADDRSTRLEN];
+#endif
+};
+
+static struct server_list servers = TAILQ_HEAD_INITIALIZER(servers);
+static struct client_list unbound = TAILQ_HEAD_INITIALIZER(unbound);
+static struct agent_upstream *upstreams;
+static unsigned int nupstreams = 1;
+static unsigned int nclients;
+static struct sudo_event_base *evbase;
+static struct sudo_event *listen_ev;
+static const char *socket_path = _PATH_SUDO_LOGAGENT_SOCK;
+static bool shutting_down;
+
+#if defined(HAVE_OPENSSL)
+static SSL_CTX *ssl_ctx = NULL;
+static const char *ca_bundle = NULL;
+static const char *cert = NULL;
+static const char *key = NULL;
+static bool verify_server = true;
+#endif
+
+static void client_close(struct agent_client *c);
+static bool client_process(struct agent_client *c);
+static void upstream_fail(struct agent_upstream *u);
+
+static void
+usage(bool fatal)
+{
+#if defined(HAVE_OPENSSL)
+    fprintf(stderr, "usage: %s [-nNV] [-b ca_bundle] [-c cert_file] "
+	"[-C connections] [-k key_file] [-s socket] -h host ...\n",
+#else
+    fprintf(stderr, "usage: %s [-nV] [-C connections] [-s socket] "
+	"-h host ...\n",
+#endif
+	getprogname());
+    if (fatal)
+	exit(EXIT_FAILURE);
+}
+
+static void
+help(void)
+{
+    printf("%s - %s\n\n", getprogname(),
+	_("forward logs from sudo to a log server"));
+    usage(false);
+    printf("\n%s\n", _("Options:"));
+    printf("      --help            %s\n",
+	_("display help message and exit"));
+#if defined(HAVE_OPENSSL)
+    printf("  -b, --ca-bundle       %s\n",
+	_("certificate bundle file to verify server's cert against"));
+    printf("  -c, --cert            %s\n",
+	_("certificate file for TLS handshake"));
+#endif
+    printf("  -C, --connections     %s\n",
+	_("number of connections to keep open to the log server"));
+    printf("  -h, --host            %s\n",
+	_("log server to forward to, may be repeated"));
+#if defined(HAVE_OPENSSL)
+    printf("  -k, --key             %s\n",
+	_("private key file"));
+#endif
+    printf("  -n, --no-fork         %s\n",
+	_("do not fork, run in the foreground"));
+#if defined(HAVE_OPENSSL)
+    printf("  -N, --no-verify       %s\n",
+	_("do not verify server certificate"));
+#endif
+    printf("  -s, --socket          %s\n",
+	_("path to the socket to listen on"));
+    printf("  -V, --version         %s\n",
+	_("display version information and exit"));
+    putchar('\n');
+    exit(EXIT_SUCCESS);
+}
+
+/*
+ * Append a length-prefixed message to buf.  If session_id is non-zero
+ * a session_id field is appended to the message; since field order
+ * does not matter this avoids unpacking and repacking the message.
+ * An empty message with a session ID ends that session.
+ * Returns true on success, false on failure.
+ */
+static bool
+queue_message(struct connection_buffer *buf, const uint8_t *data,
+    size_t len, uint32_t session_id)
+{
+    uint8_t *start, *cp;
+    uint32_t msg_len;
+    debug_decl(queue_message, SUDO_DEBUG_UTIL);
+
+    /* Room for a session ID field: a one-byte tag and up to 5 bytes. */
+    if (!expand_buf(buf, buf->len - buf->off + sizeof(msg_len) + len + 6)) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    start = cp = buf->data + buf->len;
+    cp += sizeof(msg_len);
+    if (len != 0) {
+	memcpy(cp, data, len);
+	cp += len;
+    }
+    if (session_id != 0) {
+	*cp++ = (14 << 3) | 0;
+	for (; session_id >= 0x80; session_id >>= 7)
+	    *cp++ = (uint8_t)(session_id | 0x80);
+	*cp++ = (uint8_t)session_id;
+    }
+    msg_len = htonl((uint32_t)(cp - start - sizeof(msg_len)));
+    memcpy(start, &msg_len, sizeof(msg_len));
+    buf->len += (unsigned int)(cp - start);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Return the number of the first field in a packed ClientMessage.
+ * Clients set only one of the type fields, so this identifies the
+ * message without unpacking it.  Returns 0 if there are no fields.
+ */
+static unsigned int
+client_message_field(const uint8_t *buf, size_t len)
+{
+    unsigned int shift = 0;
+    uint32_t tag = 0;
+    size_t i;
+
+    for (i = 0; i < len && shift < 32; i++) {
+	tag |= (uint32_t)(buf[i] & 0x7f) << shift;
+	if ((buf[i] & 0x80) == 0)
+	    return tag >> 3;
+	shift += 7;
+    }
+    return 0;
+}
+
+/*
+ * Decode a varint at *cpp, advancing *cpp past it.
+ * Returns false if the varint is truncated.
+ */
+static bool
+get_varint(const uint8_t **cpp, const uint8_t *end, uint64_t *valp)
+{
+    const uint8_t *cp = *cpp;
+    unsigned int shift;
+    uint64_t val = 0;
+
+    for (shift = 0; cp < end && shift < 64; shift += 7) {
+	val |= (uint64_t)(*cp & 0x7f) << shift;
+	if ((*cp++ & 0x80) == 0) {
+	    *cpp = cp;
+	    *valp = val;
+	    return true;
+	}
+    }
+    return false;
+}
+
+/*
+ * Find a field in a packed message.  For a varint field, *valp is set
+ * to its value.  For a length-delimited field, *valp is set to its
+ * length and *datap to its contents.
+ * Returns the field's wire type, or -1 if it is not present.
+ */
+static int
+find_field(const uint8_t *buf, size_t len, unsigned int field,
+    uint64_t *valp, const uint8_t **datap)
+{
+    const uint8_t *cp = buf, *end = buf + len;
+    uint64_t tag, val;
+
+    while (cp < end) {
+	if (!get_varint(&cp, end, &tag))
+	    return -1;
+	switch (tag & 7) {
+	case 0:
+	    if (!get_varint(&cp, end, &val))
+		return -1;
+	    break;
+	case 1:
+	    if (end - cp < 8)
+		return -1;
+	    cp += 8;
+	    continue;
+	case 2:
+	    if (!get_varint(&cp, end, &val) || val > (uint64_t)(end - cp))
+		return -1;
+	    if (datap != NULL)
+		*datap = cp;
+	    cp += val;
+	    break;
+	case 5:
+	    if (end - cp < 4)
+		return -1;
+	    cp += 4;
+	    continue;
+	default:
+	    return -1;
+	}
+	if (tag >> 3 == field) {
+	    *valp = val;
+	    return (int)(tag & 7);
+	}
+    }
+    return -1;
+}
+
+/*
+ * Get the delay of an I/O buffer, window size change or suspend
+ * message, which all store it as the first field.  Other messages
+ * do not advance the elapsed time.
+ * Returns true if the message has a delay, else false.
+ */
+static bool
+client_message_delay(const uint8_t *buf, size_t len, unsigned int field,
+    struct timespec *delay)
+{
+    const uint8_t *msg = NULL, *ts = NULL;
+    uint64_t msg_len, ts_len, val;
+
+    sudo_timespecclear(delay);
+    if (field < 6 || field > 12)
+	return false;
+    if (find_field(buf, len, field, &msg_len, &msg) != 2)
+	return false;
+    if (find_field(msg, msg_len, 1, &ts_len, &ts) != 2)
+	return true;
+    if (find_field(ts, ts_len, 1, &val, NULL) == 0)
+	delay->tv_sec = (time_t)val;
+    if (find_field(ts, ts_len, 2, &val, NULL) == 0)
+	delay->tv_nsec = (long)(int32_t)val;
+    return true;
+}
+
+/*
+ * Pack a ServerMessage and append it to a local client's write buffer.
+ * Returns true on success, false on failure.
+ */
+static bool
+fmt_server_message(struct agent_client *c, ServerMessage *msg)
+{
+    struct connection_buffer *buf = &c->write_buf;
+    uint32_t msg_len;
+    size_t len;
+    debug_decl(fmt_server_message, SUDO_DEBUG_UTIL);
+
+    len = server_message__get_packed_size(msg);
+    if (len > MESSAGE_SIZE_MAX) {
+	sudo_warnx(U_("server message too large: %zu"), len);
+	debug_return_bool(false);
+    }
+    if (!expand_buf(buf, buf->len - buf->off + sizeof(msg_len) + len)) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    msg_len = htonl((uint32_t)len);
+    memcpy(buf->data + buf->len, &msg_len, sizeof(msg_len));
+    server_message__pack(msg, buf->data + buf->len + sizeof(msg_len));
+    buf->len += sizeof(msg_len) + len;
+
+    if (sudo_ev_add(evbase, c->write_ev, NULL, false) == -1) {
+	sudo_warnx("%s", U_("unable to add event to queue"));
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Send the ServerHello once the client has an upstream connection.
+ * Compression is only offered if the log server accepts it.
+ */
+static bool
+fmt_hello_message(struct agent_client *c)
+{
+    ServerMessage msg = SERVER_MESSAGE__INIT;
+    ServerHello hello = SERVER_HELLO__INIT;
+    char *compression_types[] = { "deflate" };
+    debug_decl(fmt_hello_message, SUDO_DEBUG_UTIL);
+
+    hello.server_id = "Sudo Log Agent " PACKAGE_VERSION;
+    if (c->compressed) {
+	hello.compression = compression_types;
+	hello.n_compression = nitems(compression_types);
+    }
+    msg.u.hello = &hello;
+    msg.type_case = SERVER_MESSAGE__TYPE_HELLO;
+
+    debug_return_bool(fmt_server_message(c, &msg));
+}
+
+/*
+ * Send an error to a local client and close the connection once
+ * it has been written.
+ */
+static void
+client_error(struct agent_client *c, const char *errstr)
+{
+    ServerMessage msg = SERVER_MESSAGE__INIT;
+    debug_decl(client_error, SUDO_DEBUG_UTIL);
+
+    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	"closing client connection: %s", errstr);
+
+    msg.u.error = (char *)errstr;
+    msg.type_case = SERVER_MESSAGE__TYPE_ERROR;
+    sudo_ev_del(evbase, c->read_ev);
+    c->state = CLIENT_CLOSING;
+
+    /* The client is freed by client_write_cb() once the buffer is empty. */
+    (void)fmt_server_message(c, &msg);
+    if (sudo_ev_add(evbase, c->write_ev, NULL, false) == -1)
+	sudo_warnx("%s", U_("unable to add event to queue"));
+
+    debug_return;
+}
+
+/*
+ * Free a local client, ending its session on the upstream connection.
+ */
+static void
+client_close(struct agent_client *c)
+{
+    struct agent_upstream *u = c->upstream;
+    debug_decl(client_close, SUDO_DEBUG_UTIL);
+
+    if (u != NULL) {
+	TAILQ_REMOVE(&u->clients, c, entries);
+	u->nclients--;
+	/* An empty message ends the session, as closing the connection would. */
+	if (u->state == UPSTREAM_READY) {
+	    if (queue_message(&u->write_buf, NULL, 0, c->session_id)) {
+		if (sudo_ev_add(evbase, u->write_ev, NULL, false) == -1)
+		    sudo_warnx("%s", U_("unable to add event to queue"));
+	    }
+	}
+    } else {
+	TAILQ_REMOVE(&unbound, c, entries);
+    }
+    sudo_ev_free(c->read_ev);
+    sudo_ev_free(c->write_ev);
+    free(c->read_buf.data);
+    free(c->write_buf.data);
+    free(c->replay_buf.data);
+    free(c->log_id);
+    close(c->sock);
+    free(c);
+
+    if (--nclients == 0 && shutting_down)
+	sudo_ev_loopexit(evbase);
+
+    debug_return;
+}
+
+/*
+ * Find the ready upstream connection with the fewest sessions.
+ */
+static struct agent_upstream *
+upstream_pick(void)
+{
+    struct agent_upstream *best = NULL;
+    unsigned int i;
+    debug_decl(upstream_pick, SUDO_DEBUG_UTIL);
+
+    for (i = 0; i < nupstreams; i++) {
+	struct agent_upstream *u = &upstreams[i];
+
+	if (u->state != UPSTREAM_READY || u->nclients >= UPSTREAM_SESSIONS_MAX)
+	    continue;
+	if (best == NULL || u->nclients < best->nclients)
+	    best = u;
+    }
+    debug_return_ptr(best);
+}
+
+/*
+ * Returns true if an upstream connection is being established.
+ */
+static bool
+upstream_pending(void)
+{
+    unsigned int i;
+    debug_decl(upstream_pending, SUDO_DEBUG_UTIL);
+
+    for (i = 0; i < nupstreams; i++) {
+	switch (upstreams[i].state) {
+	case UPSTREAM_CONNECTING:
+	case UPSTREAM_RECV_HELLO:
+	    debug_return_bool(true);
+	default:
+	    break;
+	}
+    }
+    debug_return_bool(false);
+}
+
+/*
+ * Queue a RestartMessage for a resumed session, continuing the
+ * server-side I/O log from the last commit point.
+ */
+static bool
+fmt_restart_message(struct agent_client *c)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    RestartMessage restart_msg = RESTART_MESSAGE__INIT;
+    TimeSpec tv = TIME_SPEC__INIT;
+    uint8_t *data;
+    size_t len;
+    bool ret;
+    debug_decl(fmt_restart_message, SUDO_DEBUG_UTIL);
+
+    tv.tv_sec = c->committed.tv_sec;
+    tv.tv_nsec = (int32_t)c->committed.tv_nsec;
+    restart_msg.resume_point = &tv;
+    restart_msg.log_id = c->log_id;
+    client_msg.u.restart_msg = &restart_msg;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_RESTART_MSG;
+
+    len = client_message__get_packed_size(&client_msg);
+    if ((data = malloc(len)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    client_message__pack(&client_msg, data);
+    ret = queue_message(&c->upstream->write_buf, data, len, c->session_id);
+    free(data);
+
+    debug_return_bool(ret);
+}
+
+/*
+ * Replay a session that was in progress when its upstream connection
+ * was lost.  If the server has assigned an I/O log ID, the session is
+ * restarted at the last commit point and only uncommitted messages
+ * are sent.  Compressed I/O buffers depend on the ones before them,
+ * so those sessions are sent again from the beginning instead.
+ * Returns false if the client should be closed.
+ */
+static bool
+client_replay(struct agent_client *c)
+{
+    struct connection_buffer *buf = &c->replay_buf;
+    struct agent_upstream *u = c->upstream;
+    struct replay_header hdr;
+    unsigned int off;
+    bool restart;
+    debug_decl(client_replay, SUDO_DEBUG_UTIL);
+
+    /* All sessions on a connection must use the same I/O buffer format. */
+    if (c->compressed != u->compression) {
+	client_error(c, _("unable to resume session on the new connection"));
+	debug_return_bool(true);
+    }
+
+    restart = c->log_id != NULL && !c->compressed;
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: %s session %u from [%lld, %ld]",
+	__func__, restart ? "restarting" : "replaying", c->session_id,
+	restart ? (long long)c->committed.tv_sec : 0LL,
+	restart ? c->committed.tv_nsec : 0L);
+    if (restart) {
+	if (!fmt_restart_message(c))
+	    debug_return_bool(false);
+    } else {
+	/* The server will assign a new I/O log ID. */
+	free(c->log_id);
+	c->log_id = NULL;
+    }
+
+    for (off = buf->off; off < buf->len; off += hdr.len) {
+	memcpy(&hdr, buf->data + off, sizeof(hdr));
+	off += sizeof(hdr);
+	/* A restarted session already has its AcceptMessage. */
+	if (restart && hdr.field == 1)
+	    continue;
+	if (!queue_message(&u->write_buf, buf->data + off, hdr.len,
+		c->session_id))
+	    debug_return_bool(false);
+    }
+    if (sudo_ev_add(evbase, u->write_ev, NULL, false) == -1) {
+	sudo_warnx("%s", U_("unable to add event to queue"));
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Attach a local client to an upstream connection as a new session.
+ * A session that was interrupted by the loss of its previous
+ * connection is replayed on the new one.
+ */
+static bool
+client_bind(struct agent_client *c, struct agent_upstream *u)
+{
+    debug_decl(client_bind, SUDO_DEBUG_UTIL);
+
+    TAILQ_REMOVE(&unbound, c, entries);
+    TAILQ_INSERT_TAIL(&u->clients, c, entries);
+    c->upstream = u;
+    u->nclients++;
+    if (++u->next_id == 0)
+	u->next_id = 1;
+    c->session_id = u->next_id;
+    c->state = CLIENT_RUNNING;
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: session %u on %s",
+	__func__, c->session_id, u->server->host);
+
+    if (c->resumed) {
+	c->resumed = false;
+	if (!client_replay(c))
+	    debug_return_bool(false);
+	if (c->state != CLIENT_RUNNING)
+	    debug_return_bool(true);
+    } else {
+	c->compressed = c->compression && u->compression;
+	if (!fmt_hello_message(c))
+	    debug_return_bool(false);
+    }
+    if (!u->throttled) {
+	if (sudo_ev_add(evbase, c->read_ev, NULL, false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	    debug_return_bool(false);
+	}
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Assign a local client to an upstream connection once its
+ * ClientHello has been received.  If no connection is ready the
+ * client waits for one, unless none are being established, in
+ * which case it fails immediately so sudo can fall back.
+ */
+static bool
+client_start(struct agent_client *c)
+{
+    struct agent_upstream *u;
+    debug_decl(client_start, SUDO_DEBUG_UTIL);
+
+    if ((u = upstream_pick()) != NULL)
+	debug_return_bool(client_bind(c, u));
+
+    if (upstream_pending() && !shutting_down) {
+	c->state = CLIENT_WAIT_UPSTREAM;
+	sudo_ev_del(evbase, c->read_ev);
+    } else {
+	client_error(c, _("log server unavailable"));
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Fail clients that are waiting for an upstream connection if
+ * there is no longer any prospect of one.  Sessions that were
+ * interrupted keep waiting until RESUME_TIMEOUT has passed.
+ */
+static void
+fail_waiting_clients(void)
+{
+    struct agent_client *c, *next;
+    struct timespec now;
+    debug_decl(fail_waiting_clients, SUDO_DEBUG_UTIL);
+
+    if (upstream_pending() && !shutting_down)
+	debug_return;
+
+    sudo_gettime_mono(&now);
+    TAILQ_FOREACH_SAFE(c, &unbound, entries, next) {
+	if (c->state != CLIENT_WAIT_UPSTREAM)
+	    continue;
+	if (c->resumed && !shutting_down &&
+		sudo_timespeccmp(&now, &c->resume_by, <))
+	    continue;
+	client_error(c, _("log server unavailable"));
+    }
+    debug_return;
+}
+
+/*
+ * Start clients that are waiting for an upstream connection on the
+ * ready connections, including sessions being resumed.
+ */
+static void
+start_waiting_clients(void)
+{
+    struct agent_client *c, *next;
+    struct agent_upstream *u;
+    debug_decl(start_waiting_clients, SUDO_DEBUG_UTIL);
+
+    TAILQ_FOREACH_SAFE(c, &unbound, entries, next) {
+	if (c->state != CLIENT_WAIT_UPSTREAM)
+	    continue;
+	if ((u = upstream_pick()) == NULL)
+	    break;
+	if (!client_bind(c, u) || !client_process(c))
+	    client_close(c);
+    }
+    debug_return;
+}
+
+/*
+ * Keep a copy of a message sent upstream until the server commits it,
+ * so the session can be replayed if the connection is lost.
+ * Returns false on memory allocation failure.
+ */
+static bool
+client_record(struct agent_client *c, const uint8_t *buf, size_t len,
+    unsigned int field)
+{
+    struct connection_buffer *rbuf = &c->replay_buf;
+    struct replay_header hdr;
+    struct timespec delay;
+    debug_decl(client_record, SUDO_DEBUG_UTIL);
+
+    if (field == 3)	/* exit_msg */
+	c->exited = true;
+    hdr.elapsed = c->elapsed;
+    if (client_message_delay(buf, len, field, &delay)) {
+	sudo_timespecadd(&c->elapsed, &delay, &c->elapsed);
+	hdr.elapsed = c->elapsed;
+    }
+    if (c->no_replay)
+	debug_return_bool(true);
+
+    if (rbuf->len - rbuf->off + sizeof(hdr) + len > REPLAY_MAX) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "session %u: too much uncommitted data to replay", c->session_id);
+	free(rbuf->data);
+	memset(rbuf, 0, sizeof(*rbuf));
+	c->no_replay = true;
+	debug_return_bool(true);
+    }
+    if (!expand_buf(rbuf, rbuf->len - rbuf->off + sizeof(hdr) + len)) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    hdr.len = (uint32_t)len;
+    hdr.field = field;
+    memcpy(rbuf->data + rbuf->len, &hdr, sizeof(hdr));
+    memcpy(rbuf->data + rbuf->len + sizeof(hdr), buf, len);
+    rbuf->len += sizeof(hdr) + len;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Discard messages the server has committed from a local client's
+ * replay buffer.  Messages after an I/O buffer that was compressed
+ * depend on it, so compressed sessions are kept in full.
+ */
+static void
+client_commit(struct agent_client *c, TimeSpec *commit_point)
+{
+    struct connection_buffer *rbuf = &c->replay_buf;
+    struct replay_header hdr;
+    bool timed;
+    debug_decl(client_commit, SUDO_DEBUG_UTIL);
+
+    c->committed.tv_sec = commit_point->tv_sec;
+    c->committed.tv_nsec = commit_point->tv_nsec;
+
+    /* As in sudoers, the commit point after ExitMessage is the last. */
+    if (c->exited && sudo_timespeccmp(&c->elapsed, &c->committed, ==))
+	c->complete = true;
+    if (c->compressed)
+	debug_return;
+
+    while (rbuf->off < rbuf->len) {
+	memcpy(&hdr, rbuf->data + rbuf->off, sizeof(hdr));
+	timed = hdr.field >= 6 && hdr.field <= 12;
+	if (timed ? sudo_timespeccmp(&hdr.elapsed, &c->committed, >) :
+		!sudo_timespeccmp(&hdr.elapsed, &c->committed, <))
+	    break;
+	rbuf->off += sizeof(hdr) + hdr.len;
+    }
+    if (rbuf->off == rbuf->len)
+	rbuf->off = rbuf->len = 0;
+
+    debug_return;
+}
+
+/*
+ * Handle the ClientHello from a local client, noting whether it
+ * can compress I/O buffers.
+ */
+static bool
+handle_client_hello(struct agent_client *c, uint8_t *buf, size_t len)
+{
+    ClientMessage *msg;
+    size_t n;
+    debug_decl(handle_client_hello, SUDO_DEBUG_UTIL);
+
+    msg = client_message__unpack(NULL, len, buf);
+    if (msg == NULL || msg->type_case != CLIENT_MESSAGE__TYPE_HELLO_MSG) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "expected ClientHello from local client");
+	client_message__free_unpacked(msg, NULL);
+	client_error(c, _("protocol error"));
+	debug_return_bool(true);
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: client ID %s", __func__,
+	msg->u.hello_msg->client_id ? msg->u.hello_msg->client_id : "");
+    for (n = 0; n < msg->u.hello_msg->n_compression; n++) {
+	if (strcmp(msg->u.hello_msg->compression[n], "deflate") == 0)
+	    c->compression = true;
+    }
+    client_message__free_unpacked(msg, NULL);
+
+    debug_return_bool(client_start(c));
+}
+
+/*
+ * Forward a message from a local client to its upstream connection.
+ * Returns false if the client should be closed.
+ */
+static bool
+handle_client_message(struct agent_client *c, uint8_t *buf, size_t len)
+{
+    struct agent_upstream *u = c->upstream;
+    const unsigned int field = client_message_field(buf, len);
+    debug_decl(handle_client_message, SUDO_DEBUG_UTIL);
+
+    if (c->state == CLIENT_RECV_HELLO)
+	debug_return_bool(handle_client_hello(c, buf, len));
+
+    switch (field) {
+    case 0:
+    case 13:	/* hello_msg */
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unexpected message field %u from local client", field);
+	client_error(c, _("protocol error"));
+	debug_return_bool(true);
+    case 6:	/* ttyin_buf */
+    case 7:	/* ttyout_buf */
+    case 8:	/* stdin_buf */
+    case 9:	/* stdout_buf */
+    case 10:	/* stderr_buf */
+	/* I/O buffers are passed through as-is, compressed or not. */
+	if (u->compression && !c->compression) {
+	    client_error(c, _("I/O buffer compression required"));
+	    debug_return_bool(true);
+	}
+	break;
+    default:
+	break;
+    }
+
+    if (!queue_message(&u->write_buf, buf, len, c->session_id))
+	debug_return_bool(false);
+    if (!client_record(c, buf, len, field))
+	debug_return_bool(false);
+    if (sudo_ev_add(evbase, u->write_ev, NULL, false) == -1) {
+	sudo_warnx("%s", U_("unable to add event to queue"));
+	debug_return_bool(false);
+    }
+
+    /* Apply back pressure if the log server is not keeping up. */
+    if (!u->throttled && u->write_buf.len - u->write_buf.off > UPSTREAM_HIGHWAT) {
+	struct agent_client *other;
+
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: throttling %u clients",
+	    __func__, u->nclients);
+	u->throttled = true;
+	TAILQ_FOREACH(other, &u->clients, entries) {
+	    if (other->state == CLIENT_RUNNING)
+		sudo_ev_del(evbase, other->read_ev);
+	}
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Handle all complete messages in a local client's read buffer.
+ * Stops early if the client is waiting for an upstream connection.
+ * Returns false if the client should be closed.
+ */
+static bool
+client_process(struct agent_client *c)
+{
+    struct connection_buffer *buf = &c->read_buf;
+    uint32_t msg_len;
+    debug_decl(client_process, SUDO_DEBUG_UTIL);
+
+    while (buf->len - buf->off >= sizeof(msg_len)) {
+	if (c->state != CLIENT_RECV_HELLO && c->state != CLIENT_RUNNING)
+	    break;
+
+	memcpy(&msg_len, buf->data + buf->off, sizeof(msg_len));
+	msg_len = ntohl(msg_len);
+	if (msg_len > MESSAGE_SIZE_MAX) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"client message too large: %u", msg_len);
+	    debug_return_bool(false);
+	}
+	if (msg_len + sizeof(msg_len) > buf->len - buf->off)
+	    break;
+
+	buf->off += sizeof(msg_len);
+	if (!handle_client_message(c, buf->data + buf->off, msg_len))
+	    debug_return_bool(false);
+	buf->off += msg_len;
+    }
+
+    /* Move any partial message to the front, growing buf as needed. */
+    if (buf->off + sizeof(msg_len) <= buf->len) {
+	memcpy(&msg_len, buf->data + buf->off, sizeof(msg_len));
+	msg_len = ntohl(msg_len);
+	if (msg_len > MESSAGE_SIZE_MAX)
+	    msg_len = 0;
+    } else {
+	msg_len = 0;
+    }
+    if (!expand_buf(buf, msg_len + sizeof(msg_len))) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+static void
+client_read_cb(int fd, int what, void *v)
+{
+    struct agent_client *c = v;
+    struct connection_buffer *buf = &c->read_buf;
+    ssize_t nread;
+    debug_decl(client_read_cb, SUDO_DEBUG_UTIL);
+
+    nread = recv(fd, buf->data + buf->len, buf->size - buf->len, 0);
+    switch (nread) {
+    case -1:
+	if (errno == EAGAIN || errno == EINTR)
+	    debug_return;
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to read from local client");
+	goto close;
+    case 0:
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "local client closed connection");
+	goto close;
+    default:
+	break;
+    }
+    buf->len += nread;
+
+    if (!client_process(c))
+	goto close;
+    debug_return;
+close:
+    client_close(c);
+    debug_return;
+}
+
+static void
+client_write_cb(int fd, int what, void *v)
+{
+    struct agent_client *c = v;
+    struct connection_buffer *buf = &c->write_buf;
+    ssize_t nwritten;
+    debug_decl(client_write_cb, SUDO_DEBUG_UTIL);
+
+    if (buf->off != buf->len) {
+	nwritten = send(fd, buf->data + buf->off, buf->len - buf->off, 0);
+	if (nwritten == -1) {
+	    if (errno == EAGAIN || errno == EINTR)
+		debug_return;
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+		"unable to write to local client");
+	    client_close(c);
+	    debug_return;
+	}
+	buf->off += nwritten;
+    }
+    if (buf->off == buf->len) {
+	buf->off = buf->len = 0;
+	sudo_ev_del(evbase, c->write_ev);
+	if (c->state == CLIENT_CLOSING)
+	    client_close(c);
+    }
+    debug_return;
+}
+
+/*
+ * Accept a new connection from sudo on the local socket.
+ */
+static void
+listener_cb(int fd, int what, void *v)
+{
+    struct agent_client *c = NULL;
+    int flags, sock;
+    debug_decl(listener_cb, SUDO_DEBUG_UTIL);
+
+    sock = accept(fd, NULL, NULL);
+    if (sock == -1) {
+	if (errno != EAGAIN && errno != EINTR) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+		"unable to accept new connection");
+	}
+	debug_return;
+    }
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1 ||
+	    fcntl(sock, F_SETFD, FD_CLOEXEC) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to set socket flags");
+	close(sock);
+	debug_return;
+    }
+
+    if ((c = calloc(1, sizeof(*c))) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	close(sock);
+	debug_return;
+    }
+    TAILQ_INSERT_TAIL(&unbound, c, entries);
+    nclients++;
+    c->sock = sock;
+    c->state = CLIENT_RECV_HELLO;
+    c->read_buf.size = 64 * 1024;
+    if ((c->read_buf.data = malloc(c->read_buf.size)) == NULL)
+	goto bad;
+    c->read_ev = sudo_ev_alloc(sock, SUDO_EV_READ|SUDO_EV_PERSIST,
+	client_read_cb, c);
+    c->write_ev = sudo_ev_alloc(sock, SUDO_EV_WRITE|SUDO_EV_PERSIST,
+	client_write_cb, c);
+    if (c->read_ev == NULL || c->write_ev == NULL)
+	goto bad;
+    if (sudo_ev_add(evbase, c->read_ev, NULL, false) == -1) {
+	sudo_warnx("%s", U_("unable to add event to queue"));
+	goto bad;
+    }
+    debug_return;
+bad:
+    client_close(c);
+    debug_return;
+}
+
+/*
+ * Queue the agent's ClientHello on a new upstream connection.
+ * I/O buffers are forwarded as-is so compression is only offered
+ * if sudo itself is able to compress them.
+ */
+static bool
+fmt_client_hello(struct agent_upstream *u)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    ClientHello hello_msg = CLIENT_HELLO__INIT;
+#if defined(HAVE_ZLIB_H)
+    char *compression[] = { "deflate" };
+#endif
+    uint8_t *data;
+    size_t len;
+    bool ret;
+    debug_decl(fmt_client_hello, SUDO_DEBUG_UTIL);
+
+    hello_msg.client_id = "Sudo Log Agent " PACKAGE_VERSION;
+#if defined(HAVE_ZLIB_H)
+    hello_msg.compression = compression;
+    hello_msg.n_compression = nitems(compression);
+#endif
+    client_msg.u.hello_msg = &hello_msg;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_HELLO_MSG;
+
+    len = client_message__get_packed_size(&client_msg);
+    if ((data = malloc(len)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    client_message__pack(&client_msg, data);
+    ret = queue_message(&u->write_buf, data, len, 0);
+    free(data);
+
+    debug_return_bool(ret);
+}
+
+/*
+ * Handle the ServerHello on an upstream connection.  The log server
+ * must support multiplexed sessions.  Clients waiting for a connection
+ * are started on this one.
+ */
+static bool
+handle_server_hello(ServerHello *msg, struct agent_upstream *u)
+{
+#if defined(HAVE_ZLIB_H)
+    size_t n;
+#endif
+    debug_decl(handle_server_hello, SUDO_DEBUG_UTIL);
+
+    if (u->state != UPSTREAM_RECV_HELLO) {
+	sudo_warnx(U_("%s: unexpected state %d"), __func__, u->state);
+	debug_return_bool(false);
+    }
+    if (!msg->multiplex) {
+	sudo_warnx(U_("%s: server does not support multiplexed sessions"),
+	    u->server->host);
+	debug_return_bool(false);
+    }
+#if defined(HAVE_ZLIB_H)
+    for (n = 0; n < msg->n_compression; n++) {
+	if (strcmp(msg->compression[n], "deflate") == 0)
+	    u->compression = true;
+    }
+#endif
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: connected to %s (%s)%s",
+	__func__, u->server->host, msg->server_id ? msg->server_id : "",
+	u->compression ? ", compressed" : "");
+
+    /* No read timeout once the connection is established. */
+    u->state = UPSTREAM_READY;
+    u->retry_delay = RETRY_DELAY_MIN;
+    if (sudo_ev_add(evbase, u->read_ev, NULL, false) == -1) {
+	sudo_warnx("%s", U_("unable to add event to queue"));
+	debug_return_bool(false);
+    }
+
+    start_waiting_clients();
+    debug_return_bool(true);
+}
+
+/*
+ * Handle a ServerMessage on an upstream connection, passing it on
+ * to the local client whose session it is for.
+ * Returns true on success, false if the connection should be dropped.
+ */
+static bool
+handle_server_message(struct agent_upstream *u, uint8_t *buf, size_t len)
+{
+    struct agent_client *c;
+    ServerMessage *msg;
+    bool ret = true;
+    debug_decl(handle_server_message, SUDO_DEBUG_UTIL);
+
+    msg = server_message__unpack(NULL, len, buf);
+    if (msg == NULL) {
+	sudo_warnx("%s", U_("unable to unpack ServerMessage"));
+	debug_return_bool(false);
+    }
+
+    if (msg->type_case == SERVER_MESSAGE__TYPE_HELLO) {
+	ret = handle_server_hello(msg->u.hello, u);
+	goto done;
+    }
+    if (msg->session_id == 0) {
+	/* A message that is not for a session applies to the connection. */
+	switch (msg->type_case) {
+	case SERVER_MESSAGE__TYPE_ERROR:
+	    sudo_warnx(U_("error message received from server: %s"),
+		msg->u.error);
+	    break;
+	case SERVER_MESSAGE__TYPE_ABORT:
+	    sudo_warnx(U_("abort message received from server: %s"),
+		msg->u.abort);
+	    break;
+	default:
+	    sudo_warnx(U_("%s: unexpected type_case value %d"),
+		__func__, msg->type_case);
+	    break;
+	}
+	ret = false;
+	goto done;
+    }
+
+    TAILQ_FOREACH(c, &u->clients, entries) {
+	if (c->session_id == msg->session_id)
+	    break;
+    }
+    if (c == NULL || c->state == CLIENT_CLOSING) {
+	/* The local client has already gone away. */
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "ignoring message type %d for session %u", msg->type_case,
+	    msg->session_id);
+	goto done;
+    }
+
+    switch (msg->type_case) {
+    case SERVER_MESSAGE__TYPE_COMMIT_POINT:
+	client_commit(c, msg->u.commit_point);
+	break;
+    case SERVER_MESSAGE__TYPE_LOG_ID:
+	/* Needed to restart the session on a new connection. */
+	free(c->log_id);
+	if ((c->log_id = strdup(msg->u.log_id)) == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    client_close(c);
+	    goto done;
+	}
+	break;
+    default:
+	break;
+    }
+
+    /* Local clients do not know about session IDs. */
+    msg->session_id = 0;
+    if (!fmt_server_message(c, msg))
+	client_close(c);
+
+done:
+    server_message__free_unpacked(msg, NULL);
+    debug_return_bool(ret);
+}
+
+/*
+ * Read as many ServerMessages as are available.
+ * Returns true on success, false on error or EOF.
+ */
+static bool
+upstream_read(struct agent_upstream *u)
+{
+    struct connection_buffer *buf = &u->read_buf;
+    uint32_t msg_len;
+    ssize_t nread;
+    debug_decl(upstream_read, SUDO_DEBUG_UTIL);
+
+    for (;;) {
+#if defined(HAVE_OPENSSL)
+	if (u->ssl != NULL) {
+	    nread = SSL_read(u->ssl, buf->data + buf->len,
+		buf->size - buf->len);
+	    if (nread <= 0) {
+		switch (SSL_get_error(u->ssl, nread)) {
+		case SSL_ERROR_ZERO_RETURN:
+		    nread = 0;
+		    break;
+		case SSL_ERROR_WANT_READ:
+		    debug_return_bool(true);
+		case SSL_ERROR_WANT_WRITE:
+		    u->want_write = true;
+		    debug_return_bool(true);
+		case SSL_ERROR_SYSCALL:
+		    sudo_warn("%s: recv", u->server->host);
+		    debug_return_bool(false);
+		default:
+		    sudo_warnx("%s: recv: %s", u->server->host,
+			ERR_reason_error_string(ERR_get_error()));
+		    debug_return_bool(false);
+		}
+	    }
+	} else
+#endif
+	{
+	    nread = recv(u->sock, buf->data + buf->len,
+		buf->size - buf->len, 0);
+	}
+	switch (nread) {
+	case -1:
+	    if (errno == EAGAIN || errno == EINTR)
+		debug_return_bool(true);
+	    sudo_warn("%s: recv", u->server->host);
+	    debug_return_bool(false);
+	case 0:
+	    sudo_warnx(U_("%s: connection closed by log server"),
+		u->server->host);
+	    debug_return_bool(false);
+	default:
+	    break;
+	}
+	buf->len += nread;
+
+	while (buf->len - buf->off >= sizeof(msg_len)) {
+	    /* Read wire message size (uint32_t in network byte order). */
+	    memcpy(&msg_len, buf->data + buf->off, sizeof(msg_len));
+	    msg_len = ntohl(msg_len);
+
+	    if (msg_len > MESSAGE_SIZE_MAX) {
+		sudo_warnx(U_("server message too large: %u"), msg_len);
+		debug_return_bool(false);
+	    }
+	    if (msg_len + sizeof(msg_len) > buf->len - buf->off)
+		break;
+
+	    buf->off += sizeof(msg_len);
+	    if (!handle_server_message(u, buf->data + buf->off, msg_len))
+		debug_return_bool(false);
+	    buf->off += msg_len;
+	}
+
+	/* Move any partial message to the front, growing buf as needed. */
+	if (buf->off + sizeof(msg_len) <= buf->len) {
+	    memcpy(&msg_len, buf->data + buf->off, sizeof(msg_len));
+	    msg_len = ntohl(msg_len);
+	} else {
+	    msg_len = 0;
+	}
+	if (!expand_buf(buf, msg_len + sizeof(msg_len))) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    debug_return_bool(false);
+	}
+    }
+}
+
+/*
+ * Write as much queued data as the socket will take, resuming reads
+ * from local clients once the backlog has drained.
+ * Returns true on success, false on error.
+ */
+static bool
+upstream_write(struct agent_upstream *u)
+{
+    struct connection_buffer *buf = &u->write_buf;
+    struct agent_client *c;
+    ssize_t nwritten;
+    debug_decl(upstream_write, SUDO_DEBUG_UTIL);
+
+    while (buf->off != buf->len) {
+#if defined(HAVE_OPENSSL)
+	if (u->ssl != NULL) {
+	    nwritten = SSL_write(u->ssl, buf->data + buf->off,
+		buf->len - buf->off);
+	    if (nwritten <= 0) {
+		switch (SSL_get_error(u->ssl, nwritten)) {
+		case SSL_ERROR_WANT_READ:
+		    /* The read event is always active. */
+		    debug_return_bool(true);
+		case SSL_ERROR_WANT_WRITE:
+		    debug_return_bool(true);
+		case SSL_ERROR_SYSCALL:
+		    sudo_warn("%s: send", u->server->host);
+		    debug_return_bool(false);
+		default:
+		    sudo_warnx("%s: send: %s", u->server->host,
+			ERR_reason_error_string(ERR_get_error()));
+		    debug_return_bool(false);
+		}
+	    }
+	} else
+#endif
+	{
+	    nwritten = send(u->sock, buf->data + buf->off,
+		buf->len - buf->off, 0);
+	    if (nwritten == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+		    break;
+		sudo_warn("%s: send", u->server->host);
+		debug_return_bool(false);
+	    }
+	}
+	buf->off += nwritten;
+    }
+    if (buf->off == buf->len)
+	buf->off = buf->len = 0;
+
+    if (u->throttled && buf->len - buf->off < UPSTREAM_HIGHWAT / 2) {
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: resuming %u clients",
+	    __func__, u->nclients);
+	u->throttled = false;
+	TAILQ_FOREACH(c, &u->clients, entries) {
+	    if (c->state != CLIENT_RUNNING)
+		continue;
+	    if (sudo_ev_add(evbase, c->read_ev, NULL, false) == -1) {
+		sudo_warnx("%s", U_("unable to add event to queue"));
+		debug_return_bool(false);
+	    }
+	}
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Read and write callback for an upstream connection.  With TLS,
+ * either direction may be needed to make progress so both are tried.
+ */
+static void
+upstream_cb(int fd, int what, void *v)
+{
+    struct agent_upstream *u = v;
+    bool tls = false;
+    debug_decl(upstream_cb, SUDO_DEBUG_UTIL);
+
+    if (what == SUDO_EV_TIMEOUT) {
+	sudo_warnx(U_("%s: timed out waiting for log server"),
+	    u->server->host);
+	goto bad;
+    }
+#if defined(HAVE_OPENSSL)
+    tls = u->ssl != NULL;
+#endif
+    u->want_write = false;
+    if (ISSET(what, SUDO_EV_READ) || tls) {
+	if (!upstream_read(u))
+	    goto bad;
+    }
+    if (!upstream_write(u))
+	goto bad;
+
+    /* Only poll for write when there is something to send. */
+    if (u->want_write || u->write_buf.off != u->write_buf.len) {
+	if (sudo_ev_add(evbase, u->write_ev, NULL, false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	    goto bad;
+	}
+    } else {
+	sudo_ev_del(evbase, u->write_ev);
+    }
+    debug_return;
+bad:
+    upstream_fail(u);
+    debug_return;
+}
+
+#if defined(HAVE_OPENSSL)
+/*
+ * Check that the server's certificate is valid and that it contains
+ * the server name or IP address.
+ * Returns 0 if the cert is invalid, else 1.
+ */
+static int
+verify_peer_identity(int preverify_ok, X509_STORE_CTX *ctx)
+{
+    struct agent_upstream *u;
+    X509 *current_cert;
+    X509 *peer_cert;
+    SSL *ssl;
+    debug_decl(verify_peer_identity, SUDO_DEBUG_UTIL);
+
+    /* if pre-verification of the cert failed, just propagate that result back */
+    if (preverify_ok != 1) {
+        debug_return_int(0);
+    }
+
+    /* since this callback is called for each cert in the chain,
+     * check that current cert is the peer's certificate
+     */
+    current_cert = X509_STORE_CTX_get_current_cert(ctx);
+    peer_cert = X509_STORE_CTX_get0_cert(ctx);
+    if (current_cert != peer_cert) {
+        debug_return_int(1);
+    }
+
+    ssl = X509_STORE_CTX_get_ex_data(ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
+    u = SSL_get_ex_data(ssl, 1);
+    if (validate_hostname(peer_cert, u->server->host, u->server_ip, 0) == MatchFound) {
+        debug_return_int(1);
+    }
+
+    debug_return_int(0);
+}
+
+static SSL_CTX *
+init_tls_client_context(const char *ca_bundle_file, const char *cert_file, const char *key_file)
+{
+    const SSL_METHOD *method;
+    SSL_CTX *ctx = NULL;
+    debug_decl(init_tls_client_context, SUDO_DEBUG_UTIL);
+
+    SSL_library_init();
+    OpenSSL_add_all_algorithms();
+    SSL_load_error_strings();
+
+    if ((method = TLS_client_method()) == NULL) {
+        sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+            "creation of SSL_METHOD failed: %s",
+            ERR_error_string(ERR_get_error(), NULL));
+        goto bad;
+    }
+    if ((ctx = SSL_CTX_new(method)) == NULL) {
+        sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+            "creation of new SSL_CTX object failed: %s",
+            ERR_error_string(ERR_get_error(), NULL));
+        goto bad;
+    }
+#ifdef HAVE_SSL_CTX_SET_MIN_PROTO_VERSION
+    if (!SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION)) {
+        sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+            "unable to restrict min. protocol version: %s",
+            ERR_error_string(ERR_get_error(), NULL));
+        goto bad;
+    }
+#else
+    SSL_CTX_set_options(ctx,
+        SSL_OP_NO_SSLv2|SSL_OP_NO_SSLv3|SSL_OP_NO_TLSv1|SSL_OP_NO_TLSv1_1);
+#endif
+
+    /* The write buffer may be reallocated between SSL_write() retries. */
+    SSL_CTX_set_mode(ctx,
+	SSL_MODE_ENABLE_PARTIAL_WRITE|SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    if (cert_file) {
+        if (!SSL_CTX_use_certificate_chain_file(ctx, cert_file)) {
+            sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+                "unable to load cert to the ssl context: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+            goto bad;
+        }
+        if (!SSL_CTX_use_PrivateKey_file(ctx, key_file, X509_FILETYPE_PEM)) {
+            sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+                "unable to load key to the ssl context: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+            goto bad;
+        }
+    }
+
+    if (ca_bundle_file != NULL) {
+        /* sets the location of the CA bundle file for verification purposes */
+        if (SSL_CTX_load_verify_locations(ctx, ca_bundle_file, NULL) <= 0) {
+            sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+                "calling SSL_CTX_load_verify_locations() failed: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+            goto bad;
+        }
+    }
+
+    if (verify_server) {
+        /* verify server cert during the handshake */
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, verify_peer_identity);
+    }
+
+    goto done;
+
+bad:
+    SSL_CTX_free(ctx);
+    ctx = NULL;
+
+done:
+    debug_return_ptr(ctx);
+}
+#endif /* HAVE_OPENSSL */
+
+/*
+ * Close an upstream connection's socket, leaving it idle.
+ */
+static void
+upstream_close(struct agent_upstream *u)
+{
+    debug_decl(upstream_close, SUDO_DEBUG_UTIL);
+
+    sudo_ev_del(evbase, u->connect_ev);
+    sudo_ev_del(evbase, u->read_ev);
+    sudo_ev_del(evbase, u->write_ev);
+#if defined(HAVE_OPENSSL)
+    if (u->ssl != NULL) {
+	SSL_shutdown(u->ssl);
+	SSL_free(u->ssl);
+	u->ssl = NULL;
+    }
+#endif
+    if (u->sock != -1) {
+	close(u->sock);
+	u->sock = -1;
+    }
+    u->read_buf.off = u->read_buf.len = 0;
+    u->write_buf.off = u->write_buf.len = 0;
+    u->compression = false;
+    u->throttled = false;
+    u->want_write = false;
+    u->state = UPSTREAM_IDLE;
+
+    debug_return;
+}
+
+static void upstream_connect_cb(int sock, int what, void *v);
+
+/*
+ * Start connecting to the next address of the current log server,
+ * moving on to the next server as each one is exhausted.
+ * Returns true if a connection is in progress, false if every
+ * server has been tried.
+ */
+static bool
+upstream_connect(struct agent_upstream *u)
+{
+    const struct timespec timeo = { UPSTREAM_TIMEOUT, 0 };
+    struct addrinfo hints, *res;
+    int error, flags, sock;
+    debug_decl(upstream_connect, SUDO_DEBUG_UTIL);
+
+    for (;;) {
+	if (u->res == NULL) {
+	    if (u->res0 != NULL) {
+		freeaddrinfo(u->res0);
+		u->res0 = NULL;
+	    }
+	    u->server = u->server ? TAILQ_NEXT(u->server, entries) :
+		TAILQ_FIRST(&servers);
+	    if (u->server == NULL)
+		debug_return_bool(false);
+
+	    memset(&hints, 0, sizeof(hints));
+	    hints.ai_family = AF_UNSPEC;
+	    hints.ai_socktype = SOCK_STREAM;
+	    error = getaddrinfo(u->server->host, u->server->port, &hints,
+		&u->res0);
+	    if (error != 0) {
+		sudo_warnx(U_("unable to look up %s:%s: %s"), u->server->host,
+		    u->server->port, gai_strerror(error));
+		u->res0 = NULL;
+		continue;
+	    }
+	    u->res = u->res0;
+	}
+	res = u->res;
+	u->res = res->ai_next;
+
+	switch (res->ai_family) {
+	case AF_INET:
+	    inet_ntop(AF_INET, &((struct sockaddr_in *)res->ai_addr)->sin_addr,
+		u->server_ip, sizeof(u->server_ip));
+	    break;
+#if defined(HAVE_STRUCT_IN6_ADDR)
+	case AF_INET6:
+	    inet_ntop(AF_INET6,
+		&((struct sockaddr_in6 *)res->ai_addr)->sin6_addr,
+		u->server_ip, sizeof(u->server_ip));
+	    break;
+#endif
+	default:
+	    continue;
+	}
+
+	sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (sock == -1) {
+	    sudo_warn("socket");
+	    continue;
+	}
+	flags = fcntl(sock, F_GETFL, 0);
+	if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1 ||
+		fcntl(sock, F_SETFD, FD_CLOEXEC) == -1) {
+	    sudo_warn("fcntl");
+	    close(sock);
+	    continue;
+	}
+	/* Detect a log server that has gone away while idle. */
+	flags = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &flags,
+		sizeof(flags)) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+		"unable to set SO_KEEPALIVE");
+	}
+	if (connect(sock, res->ai_addr, res->ai_addrlen) == -1 &&
+		errno != EINPROGRESS) {
+	    sudo_warn(U_("unable to connect to %s port %s"), u->server_ip,
+		u->server->port);
+	    close(sock);
+	    continue;
+	}
+
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: connecting to %s (%s) port %s",
+	    __func__, u->server->host, u->server_ip, u->server->port);
+	u->sock = sock;
+	u->state = UPSTREAM_CONNECTING;
+	if (sudo_ev_set(u->connect_ev, sock, SUDO_EV_WRITE,
+		upstream_connect_cb, u) == -1 ||
+		sudo_ev_add(evbase, u->connect_ev, &timeo, false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	    upstream_close(u);
+	    continue;
+	}
+	debug_return_bool(true);
+    }
+}
+
+/*
+ * No log server could be reached, try again later.  Clients waiting
+ * for a connection are failed if no other connection is pending.
+ */
+static void
+upstream_backoff(struct agent_upstream *u)
+{
+    struct timespec delay = { 0, 0 };
+    debug_decl(upstream_backoff, SUDO_DEBUG_UTIL);
+
+    if (!shutting_down) {
+	delay.tv_sec = u->retry_delay;
+	sudo_debug_printf(SUDO_DEBUG_INFO,
+	    "%s: no log server available, retrying in %u seconds",
+	    __func__, u->retry_delay);
+	if (sudo_ev_add(evbase, u->retry_ev, &delay, false) == -1)
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	u->retry_delay *= 2;
+	if (u->retry_delay > RETRY_DELAY_MAX)
+	    u->retry_delay = RETRY_DELAY_MAX;
+    }
+    fail_waiting_clients();
+
+    debug_return;
+}
+
+/*
+ * Begin a round of connection attempts, starting with the first server.
+ */
+static void
+upstream_start(int unused, int what, void *v)
+{
+    struct agent_upstream *u = v;
+    debug_decl(upstream_start, SUDO_DEBUG_UTIL);
+
+    if (!upstream_connect(u))
+	upstream_backoff(u);
+
+    debug_return;
+}
+
+/*
+ * Detach a local client from an upstream connection that was lost.
+ * A session in progress waits to be replayed on a new connection.
+ * A completed session is closed once its final commit point has
+ * been written, anything else is closed right away.
+ */
+static void
+client_detach(struct agent_client *c)
+{
+    debug_decl(client_detach, SUDO_DEBUG_UTIL);
+
+    TAILQ_REMOVE(&c->upstream->clients, c, entries);
+    TAILQ_INSERT_TAIL(&unbound, c, entries);
+    c->upstream = NULL;
+
+    if (c->complete && c->state == CLIENT_RUNNING) {
+	sudo_ev_del(evbase, c->read_ev);
+	c->state = CLIENT_CLOSING;
+	if (c->write_buf.off == c->write_buf.len)
+	    client_close(c);
+	debug_return;
+    }
+    if (c->state != CLIENT_RUNNING || c->no_replay || shutting_down) {
+	client_close(c);
+	debug_return;
+    }
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: session %u waiting to resume",
+	__func__, c->session_id);
+    sudo_ev_del(evbase, c->read_ev);
+    c->state = CLIENT_WAIT_UPSTREAM;
+    c->resumed = true;
+    sudo_gettime_mono(&c->resume_by);
+    c->resume_by.tv_sec += RESUME_TIMEOUT;
+
+    debug_return;
+}
+
+/*
+ * The upstream connection was lost or could not be established.
+ * Sessions on it are moved to another ready connection, or wait
+ * for this one to be re-established.
+ * Other addresses and servers are tried before backing off.
+ */
+static void
+upstream_fail(struct agent_upstream *u)
+{
+    struct agent_client *c;
+    const bool was_ready = u->state == UPSTREAM_READY;
+    debug_decl(upstream_fail, SUDO_DEBUG_UTIL);
+
+    upstream_close(u);
+    while ((c = TAILQ_FIRST(&u->clients)) != NULL)
+	client_detach(c);
+    u->nclients = 0;
+    start_waiting_clients();
+
+    if (was_ready) {
+	/* Reconnect to the preferred server right away. */
+	if (u->res0 != NULL) {
+	    freeaddrinfo(u->res0);
+	    u->res0 = NULL;
+	}
+	u->res = NULL;
+	u->server = NULL;
+    }
+    if (shutting_down || !upstream_connect(u))
+	upstream_backoff(u);
+    debug_return;
+}
+
+/*
+ * The TCP connection to the log server has completed or timed out.
+ * For TLS, the handshake is performed by the first SSL_write().
+ */
+static void
+upstream_connect_cb(int sock, int what, void *v)
+{
+    struct agent_upstream *u = v;
+    const struct timespec timeo = { UPSTREAM_TIMEOUT, 0 };
+    socklen_t optlen = sizeof(int);
+    int errnum;
+    debug_decl(upstream_connect_cb, SUDO_DEBUG_UTIL);
+
+    if (what == SUDO_EV_TIMEOUT) {
+	errnum = ETIMEDOUT;
+    } else if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &errnum, &optlen) == -1) {
+	errnum = errno;
+    }
+    if (errnum != 0) {
+	errno = errnum;
+	sudo_warn(U_("unable to connect to %s port %s"), u->server_ip,
+	    u->server->port);
+	goto bad;
+    }
+
+#if defined(HAVE_OPENSSL)
+    if (u->server->tls) {
+	if ((u->ssl = SSL_new(ssl_ctx)) == NULL) {
+	    sudo_warnx(U_("Unable to allocate ssl object: %s"),
+		ERR_reason_error_string(ERR_get_error()));
+	    goto bad;
+	}
+	if (SSL_set_fd(u->ssl, sock) <= 0 ||
+		SSL_set_ex_data(u->ssl, 1, u) <= 0) {
+	    sudo_warnx(U_("Unable to attach socket to the ssl object: %s"),
+		ERR_reason_error_string(ERR_get_error()));
+	    goto bad;
+	}
+	SSL_set_connect_state(u->ssl);
+    }
+#endif
+
+    if (!fmt_client_hello(u))
+	goto bad;
+    u->state = UPSTREAM_RECV_HELLO;
+    if (sudo_ev_set(u->read_ev, sock, SUDO_EV_READ|SUDO_EV_PERSIST,
+	    upstream_cb, u) == -1 ||
+	    sudo_ev_set(u->write_ev, sock, SUDO_EV_WRITE|SUDO_EV_PERSIST,
+	    upstream_cb, u) == -1) {
+	goto bad;
+    }
+    if (sudo_ev_add(evbase, u->read_ev, &timeo, false) == -1 ||
+	    sudo_ev_add(evbase, u->write_ev, NULL, false) == -1) {
+	sudo_warnx("%s", U_("unable to add event to queue"));
+	goto bad;
+    }
+    debug_return;
+bad:
+    upstream_fail(u);
+    debug_return;
+}
+
+/*
+ * Allocate the upstream connections and start connecting them.
+ */
+static bool
+upstreams_init(void)
+{
+    unsigned int i;
+    debug_decl(upstreams_init, SUDO_DEBUG_UTIL);
+
+    upstreams = calloc(nupstreams, sizeof(*upstreams));
+    if (upstreams == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    for (i = 0; i < nupstreams; i++) {
+	struct agent_upstream *u = &upstreams[i];
+
+	TAILQ_INIT(&u->clients);
+	u->sock = -1;
+	u->retry_delay = RETRY_DELAY_MIN;
+	u->read_buf.size = 64 * 1024;
+	if ((u->read_buf.data = malloc(u->read_buf.size)) == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    debug_return_bool(false);
+	}
+	u->connect_ev = sudo_ev_alloc(-1, SUDO_EV_WRITE, upstream_connect_cb, u);
+	u->read_ev = sudo_ev_alloc(-1, SUDO_EV_READ|SUDO_EV_PERSIST,
+	    upstream_cb, u);
+	u->write_ev = sudo_ev_alloc(-1, SUDO_EV_WRITE|SUDO_EV_PERSIST,
+	    upstream_cb, u);
+	u->retry_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT, upstream_start, u);
+	if (u->connect_ev == NULL || u->read_ev == NULL ||
+		u->write_ev == NULL || u->retry_ev == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    debug_return_bool(false);
+	}
+	upstream_start(-1, SUDO_EV_TIMEOUT, u);
+    }
+    debug_return_bool(true);
+}
+
+static void
+upstreams_free(void)
+{
+    unsigned int i;
+    debug_decl(upstreams_free, SUDO_DEBUG_UTIL);
+
+    for (i = 0; i < nupstreams; i++) {
+	struct agent_upstream *u = &upstreams[i];
+	struct agent_client *c;
+
+	while ((c = TAILQ_FIRST(&u->clients)) != NULL) {
+	    TAILQ_REMOVE(&u->clients, c, entries);
+	    TAILQ_INSERT_TAIL(&unbound, c, entries);
+	    c->upstream = NULL;
+	    client_close(c);
+	}
+	upstream_close(u);
+	if (u->res0 != NULL)
+	    freeaddrinfo(u->res0);
+	sudo_ev_free(u->connect_ev);
+	sudo_ev_free(u->read_ev);
+	sudo_ev_free(u->write_ev);
+	sudo_ev_free(u->retry_ev);
+	free(u->read_buf.data);
+	free(u->write_buf.data);
+    }
+    free(upstreams);
+
+    debug_return;
+}
+
+/*
+ * Create the UNIX domain socket that sudo connects to.  Only root
+ * may connect to it.  A stale socket from a previous run is removed.
+ */
+static int
+create_listener(const char *path)
+{
+    struct sockaddr_un sa_un;
+    struct stat sb;
+    mode_t omask;
+    int flags, sock;
+    debug_decl(create_listener, SUDO_DEBUG_UTIL);
+
+    memset(&sa_un, 0, sizeof(sa_un));
+    sa_un.sun_family = AF_UNIX;
+    if (strlcpy(sa_un.sun_path, path, sizeof(sa_un.sun_path)) >= sizeof(sa_un.sun_path)) {
+	errno = ENAMETOOLONG;
+	sudo_warn("%s", path);
+	debug_return_int(-1);
+    }
+
+    /* sudo_mkdir_parents() modifies the path but restores it before return. */
+    if (!sudo_mkdir_parents(sa_un.sun_path, ROOT_UID, ROOT_GID,
+	    S_IRWXU|S_IXGRP|S_IXOTH, false))
+	debug_return_int(-1);
+    if (lstat(path, &sb) == 0 && S_ISSOCK(sb.st_mode))
+	unlink(path);
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+	sudo_warn("socket");
+	debug_return_int(-1);
+    }
+    omask = umask(S_IRWXG|S_IRWXO);
+    if (bind(sock, (struct sockaddr *)&sa_un, sizeof(sa_un)) == -1) {
+	sudo_warn("%s", path);
+	umask(omask);
+	goto bad;
+    }
+    umask(omask);
+    if (listen(sock, SOMAXCONN) == -1) {
+	sudo_warn("listen");
+	goto bad;
+    }
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1 ||
+	    fcntl(sock, F_SETFD, FD_CLOEXEC) == -1) {
+	sudo_warn("fcntl");
+	goto bad;
+    }
+    debug_return_int(sock);
+bad:
+    close(sock);
+    debug_return_int(-1);
+}
+
+/*
+ * On the first SIGINT or SIGTERM, stop accepting new connections and
+ * exit once the active sessions have finished.  A second signal
+ * exits immediately.
+ */
+static void
+signal_cb(int signo, int what, void *v)
+{
+    unsigned int i;
+    debug_decl(signal_cb, SUDO_DEBUG_UTIL);
+
+    if (shutting_down) {
+	sudo_ev_loopexit(evbase);
+	debug_return;
+    }
+    shutting_down = true;
+    sudo_ev_del(evbase, listen_ev);
+    close(sudo_ev_get_fd(listen_ev));
+    unlink(socket_path);
+    for (i = 0; i < nupstreams; i++)
+	sudo_ev_del(evbase, upstreams[i].retry_ev);
+    fail_waiting_clients();
+    if (nclients == 0)
+	sudo_ev_loopexit(evbase);
+
+    debug_return;
+}
+
+static void
+register_signal(int signo)
+{
+    struct sudo_event *ev;
+    debug_decl(register_signal, SUDO_DEBUG_UTIL);
+
+    ev = sudo_ev_alloc(signo, SUDO_EV_SIGNAL, signal_cb, NULL);
+    if (ev == NULL)
+	sudo_fatal(NULL);
+    if (sudo_ev_add(evbase, ev, NULL, false) == -1)
+	sudo_fatal("%s", U_("unable to add event to queue"));
+
+    debug_return;
+}
+
+/*
+ * Fork and detach from the terminal unless nofork is set.
+ */
+static void
+daemonize(bool nofork)
+{
+    int fd;
+    debug_decl(daemonize, SUDO_DEBUG_UTIL);
+
+    if (!nofork) {
+	switch (fork()) {
+	case -1:
+	    sudo_fatal("fork");
+	case 0:
+	    /* child */
+	    break;
+	default:
+	    /* parent, exit */
+	    _exit(EXIT_SUCCESS);
+	}
+
+	/* detach from terminal */
+	if (setsid() == -1)
+	    sudo_fatal("setsid");
+    }
+
+    if (chdir("/") == -1)
+	sudo_warn("chdir(\"/\")");
+    if (!nofork) {
+	if ((fd = open(_PATH_DEVNULL, O_RDWR)) != -1) {
+	    (void) dup2(fd, STDIN_FILENO);
+	    (void) dup2(fd, STDOUT_FILENO);
+	    (void) dup2(fd, STDERR_FILENO);
+	    if (fd > STDERR_FILENO)
+		(void) close(fd);
+	}
+    }
+
+    debug_return;
+}
+
+/*
+ * Add a log server in the same host[:port][(tls)] form used by the
+ * sudoers log_servers setting.
+ */
+static void
+add_server(const char *str)
+{
+    struct agent_server *server;
+    debug_decl(add_server, SUDO_DEBUG_UTIL);
+
+    if ((server = calloc(1, sizeof(*server))) == NULL ||
+	    (server->copy = strdup(str)) == NULL) {
+	sudo_fatalx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    }
+    if (!iolog_parse_host_port(server->copy, &server->host, &server->port,
+	    &server->tls, DEFAULT_PORT, DEFAULT_PORT_TLS)) {
+	sudo_fatalx(U_("invalid log server: %s"), str);
+    }
+#if !defined(HAVE_OPENSSL)
+    if (server->tls)
+	sudo_fatalx(U_("%s: TLS is not supported"), str);
+#endif
+    TAILQ_INSERT_TAIL(&servers, server, entries);
+
+    debug_return;
+}
+
+#if defined(HAVE_OPENSSL)
+static const char short_opts[] = "b:c:C:h:k:nNs:V";
+#else
+static const char short_opts[] = "C:h:ns:V";
+#endif
+static struct option long_opts[] = {
+    { "help",		no_argument,		NULL,	1 },
+    { "connections",	required_argument,	NULL,	'C' },
+    { "host",		required_argument,	NULL,	'h' },
+    { "no-fork",	no_argument,		NULL,	'n' },
+    { "socket",		required_argument,	NULL,	's' },
+#if defined(HAVE_OPENSSL)
+    { "ca-bundle",	required_argument,	NULL,	'b' },
+    { "cert",		required_argument,	NULL,	'c' },
+    { "key",		required_argument,	NULL,	'k' },
+    { "no-verify",	no_argument,		NULL,	'N' },
+#endif
+    { "version",	no_argument,		NULL,	'V' },
+    { NULL,		no_argument,		NULL,	0 },
+};
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+int
+main(int argc, char *argv[])
+{
+    struct agent_server *server;
+    struct agent_client *c;
+    const char *errstr;
+    bool nofork = false;
+    int ch, sock;
+    debug_decl_vars(main, SUDO_DEBUG_MAIN);
+
+    initprogname(argc > 0 ? argv[0] : "sudo_logagent");
+    setlocale(LC_ALL, "");
+    bindtextdomain("sudo", LOCALEDIR); /* XXX - add logsrvd domain */
+    textdomain("sudo");
+
+    /* Read sudo.conf and initialize the debug subsystem. */
+    if (sudo_conf_read(NULL, SUDO_CONF_DEBUG) == -1)
+        exit(EXIT_FAILURE);
+    sudo_debug_register(getprogname(), NULL, NULL,
+        sudo_conf_debug_files(getprogname()));
+
+    if (protobuf_c_version_number() < 1003000)
+	sudo_fatalx("%s", U_("Protobuf-C version 1.3 or higher required"));
+
+    while ((ch = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+	switch (ch) {
+	case 'C':
+	    nupstreams = sudo_strtonum(optarg, 1, 64, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx(U_("%s: %s"), optarg, U_(errstr));
+	    break;
+	case 'h':
+	    add_server(optarg);
+	    break;
+	case 'n':
+	    nofork = true;
+	    break;
+	case 's':
+	    socket_path = optarg;
+	    break;
+	case 1:
+	    help();
+	    break;
+#if defined(HAVE_OPENSSL)
+	case 'b':
+	    ca_bundle = optarg;
+	    break;
+	case 'c':
+	    cert = optarg;
+	    break;
+	case 'k':
+	    key = optarg;
+	    break;
+	case 'N':
+	    verify_server = false;
+	    break;
+#endif
+	case 'V':
+	    (void)printf(_("%s version %s\n"), getprogname(),
+		PACKAGE_VERSION);
+	    return 0;
+	default:
+	    usage(true);
+	}
+    }
+    if (argc != optind || TAILQ_EMPTY(&servers))
+	usage(true);
+    if (*socket_path != '/')
+	sudo_fatalx(U_("%s: socket path must be fully-qualified"), socket_path);
+
+#if defined(HAVE_OPENSSL)
+    /* if no key file is given explicitly, try to load the key from the cert */
+    if (cert != NULL && key == NULL)
+	key = cert;
+    TAILQ_FOREACH(server, &servers, entries) {
+	if (server->tls)
+	    break;
+    }
+    if (server != NULL) {
+	if ((ssl_ctx = init_tls_client_context(ca_bundle, cert, key)) == NULL) {
+	    sudo_fatalx(U_("Unable to initialize ssl context: %s"),
+		ERR_reason_error_string(ERR_get_error()));
+	}
+    }
+#endif
+
+    if ((evbase = sudo_ev_base_alloc()) == NULL)
+	sudo_fatal(NULL);
+    if ((sock = create_listener(socket_path)) == -1)
+	exit(EXIT_FAILURE);
+    listen_ev = sudo_ev_alloc(sock, SUDO_EV_READ|SUDO_EV_PERSIST,
+	listener_cb, NULL);
+    if (listen_ev == NULL)
+	sudo_fatal(NULL);
+    if (sudo_ev_add(evbase, listen_ev, NULL, false) == -1)
+	sudo_fatal("%s", U_("unable to add event to queue"));
+
+    register_signal(SIGINT);
+    register_signal(SIGTERM);
+
+    /* Point of no return. */
+    daemonize(nofork);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!upstreams_init())
+	exit(EXIT_FAILURE);
+
+    sudo_ev_dispatch(evbase);
+
+    if (!shutting_down) {
+	close(sock);
+	unlink(socket_path);
+    }
+    while ((c = TAILQ_FIRST(&unbound)) != NULL)
+	client_close(c);
+    upstreams_free();
+    while ((server = TAILQ_FIRST(&servers)) != NULL) {
+	TAILQ_REMOVE(&servers, server, entries);
+	free(server->copy);
+	free(server);
+    }
+    sudo_ev_free(listen_ev);
+    sudo_ev_base_free(evbase);
+#if defined(HAVE_OPENSSL)
+    SSL_CTX_free(ssl_ctx);
+#endif
+
+    debug_return_int(EXIT_SUCCESS);
+}
@@ -63,7 +63,7 @@ expand_buf(struct connection_buffer *buf, unsigned int needed)
 		"%s: unable to malloc %u", __func__, needed);
 	    debug_return_bool(false);
 	}
-	if (buf->off > 0)
+	if (buf->len > buf->off)
 	    memcpy(newdata, buf->data + buf->off, buf->len - buf->off);
 	free(buf->data);
 	buf->data = newdata;
@@ -112,16 +112,25 @@ iolog_open_all(int dfd, const char *iolog_dir, struct iolog_file *iolog_files,
 
 /*
  * Seek to the specified point in time in the I/O logs.
+ * Starts from the closest preceding index entry, if there is one.
  */
 bool
 iolog_seekto(int iolog_dir_fd, const char *iolog_path,
     struct iolog_file *iolog_files, struct timespec *elapsed_time,
     const struct timespec *target)
 {
+    struct iolog_index_entry entry;
     struct timing_closure timing;
     off_t pos;
     debug_decl(iolog_seekto, SUDO_DEBUG_UTIL);
 
+    if (iolog_index_find(iolog_dir_fd, target, &entry)) {
+	if (iolog_index_seek(iolog_dir_fd, iolog_files, &entry, true))
+	    *elapsed_time = entry.elapsed;
+    }
+    if (sudo_timespeccmp(elapsed_time, target, ==))
+	debug_return_bool(true);
+
     /* Parse timing file until we reach the target point. */
     for (;;) {
 	if (iolog_read_timing_record(&iolog_files[IOFD_TIMING], &timing) != 0)
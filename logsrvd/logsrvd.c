@@ -21,6 +21,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -28,6 +29,10 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <signal.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 #ifdef HAVE_STDBOOL_H
 # include <stdbool.h>
 #else
@@ -41,6 +46,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <syslog.h>
 #include <time.h>
 #include <unistd.h>
 #ifdef HAVE_GETOPT_LONG
@@ -86,30 +92,154 @@
 /*
  * Sudo I/O audit server.
  */
+
+/*
+ * Worker state.  Each worker has its own event base and services the
+ * connections handed to it by the main thread.  When there is only a
+ * single worker, it shares the main thread's event base.
+ */
+struct logsrvd_worker {
+    struct connection_list connections;
+    struct listener_list listeners;	/* only used with reuse_port */
+    struct logsrvd_metrics metrics;
+    struct sudo_event_base *evbase;
+    struct sudo_event *cmd_ev;
+    int cmd_pipe[2];
+    unsigned int id;
+#ifdef HAVE_IO_URING
+    struct logsrvd_uring *uring;
+#endif
+#ifdef HAVE_PTHREAD_H
+    pthread_t thread;
+#endif
+};
+
+/*
+ * Commands sent from the main thread to a worker thread.
+ * These are small enough that a write(2) to the pipe is atomic.
+ */
+enum worker_cmd_type {
+    WORKER_CMD_CONNECTION,
+    WORKER_CMD_LISTEN,
+    WORKER_CMD_PAUSE,
+    WORKER_CMD_SHUTDOWN
+};
+
+struct worker_cmd {
+    enum worker_cmd_type type;
+    int sock;
+    bool tls;
+    union sockaddr_union s_un;
+};
+
 static int logsrvd_debug_instance = SUDO_DEBUG_INSTANCE_INITIALIZER;
-TAILQ_HEAD(connection_list, connection_closure);
-static struct connection_list connections = TAILQ_HEAD_INITIALIZER(connections);
 static struct listener_list listeners = TAILQ_HEAD_INITIALIZER(listeners);
+static struct logsrvd_worker *workers;
+static unsigned int nworkers;
+static bool reuse_port;
 static const char server_id[] = "Sudo Audit Server " PACKAGE_VERSION;
 static const char *conf_file = _PATH_SUDO_LOGSRVD_CONF;
 static double random_drop;
+#ifdef HAVE_PTHREAD_H
+static unsigned int next_worker;
+static pthread_mutex_t logsrvd_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pause_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pause_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int pause_generation;
+static unsigned int workers_paused;
+#endif
 
 /* Server callback may redirect to client callback for TLS. */
 static void client_msg_cb(int fd, int what, void *v);
 
+/* Multiplexed sessions get their own commit point event. */
+static void server_commit_cb(int fd, int what, void *v);
+
+/* With reuse_port, each worker creates its own listeners. */
+static int worker_listen(struct logsrvd_worker *worker);
+
+/*
+ * Serialize operations that depend on process-wide state, such as
+ * the umask, effective uid, fcntl(2) locks and the event log files.
+ */
+void
+logsrvd_lock(void)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&logsrvd_mutex);
+#endif
+}
+
+void
+logsrvd_unlock(void)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&logsrvd_mutex);
+#endif
+}
+
+/*
+ * Free a multiplexed session.  The connection it is on remains open.
+ */
+static void
+session_closure_free(struct connection_closure *closure)
+{
+    struct connection_closure *conn = closure->mux;
+    debug_decl(session_closure_free, SUDO_DEBUG_UTIL);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: session %u",
+	__func__, closure->session_id);
+
+    TAILQ_REMOVE(&conn->sessions, closure, entries);
+    iolog_close_all(closure);
+    sudo_ev_free(closure->commit_ev);
+    METRICS_ADD(closure->metrics->arena_allocs, closure->arena.nallocs);
+    METRICS_ADD(closure->metrics->arena_mallocs, closure->arena.nmallocs);
+    arena_free(&closure->arena);
+    arena_free(&closure->msg_arena);
+    free(closure);
+
+    debug_return;
+}
+
 /*
- * Free a struct connection_closure container and its contents.
+ * Free a struct connection_closure container and its contents,
+ * including any sessions multiplexed over it.
  */
 static void
 connection_closure_free(struct connection_closure *closure)
 {
+    struct connection_closure *session;
     debug_decl(connection_closure_free, SUDO_DEBUG_UTIL);
 
     if (closure != NULL) {
 	bool shutting_down = closure->state == SHUTDOWN;
-	struct sudo_event_base *evbase = closure->evbase;
+	struct logsrvd_worker *worker = closure->worker;
+
+	if (closure->mux != NULL) {
+	    session_closure_free(closure);
+	    debug_return;
+	}
+
+	/* Count connections that end before their sessions complete. */
+	switch (closure->state) {
+	case FINISHED:
+	case SHUTDOWN:
+	    break;
+	case INITIAL:
+	    /* A multiplexing client may close once its sessions are done. */
+	    if (closure->multiplex && TAILQ_EMPTY(&closure->sessions))
+		break;
+	    FALLTHROUGH;
+	default:
+	    METRICS_ADD(closure->metrics->connection_errors, 1);
+	    break;
+	}
+	while ((session = TAILQ_FIRST(&closure->sessions)) != NULL)
+	    session_closure_free(session);
 
-	TAILQ_REMOVE(&connections, closure, entries);
+	TAILQ_REMOVE(&worker->connections, closure, entries);
+	METRICS_SUB(closure->metrics->connections_active, 1);
 #if defined(HAVE_OPENSSL)
 	if (closure->tls) {
 	    SSL_shutdown(closure->ssl);
@@ -118,37 +248,45 @@ connection_closure_free(struct connection_closure *closure)
 #endif
 	close(closure->sock);
 	iolog_close_all(closure);
+	journal_finish(closure);
 	sudo_ev_free(closure->commit_ev);
 	sudo_ev_free(closure->read_ev);
 	sudo_ev_free(closure->write_ev);
 #if defined(HAVE_OPENSSL)
 	sudo_ev_free(closure->ssl_accept_ev);
 #endif
-	eventlog_free(closure->evlog);
 	free(closure->read_buf.data);
 	free(closure->write_buf.data);
+	arena_stats(&closure->arena, "connection");
+	arena_stats(&closure->msg_arena, "message");
+	METRICS_ADD(closure->metrics->arena_allocs,
+	    closure->arena.nallocs + closure->msg_arena.nallocs);
+	METRICS_ADD(closure->metrics->arena_mallocs,
+	    closure->arena.nmallocs + closure->msg_arena.nmallocs);
+	arena_free(&closure->arena);
+	arena_free(&closure->msg_arena);
 	free(closure);
 
-	if (shutting_down && TAILQ_EMPTY(&connections))
-	    sudo_ev_loopbreak(evbase);
+	if (shutting_down && TAILQ_EMPTY(&worker->connections))
+	    sudo_ev_loopbreak(worker->evbase);
     }
 
     debug_return;
 }
 
+/*
+ * Format a ServerMessage and schedule it to be written to the client
+ * on connection conn.  The message is appended to any pending data,
+ * which may move the write buffer.
+ */
 static bool
-fmt_server_message(struct connection_buffer *buf, ServerMessage *msg)
+queue_server_message(struct connection_closure *conn, ServerMessage *msg)
 {
+    struct connection_buffer *buf = &conn->write_buf;
     uint32_t msg_len;
     bool ret = false;
     size_t len;
-    debug_decl(fmt_server_message, SUDO_DEBUG_UTIL);
-
-    if (buf->len != 0) {
-	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-	    "pending write, unable to format ServerMessage");
-	debug_return_bool(false);
-    }
+    debug_decl(queue_server_message, SUDO_DEBUG_UTIL);
 
     len = server_message__get_packed_size(msg);
     if (len > MESSAGE_SIZE_MAX) {
@@ -162,45 +300,93 @@ fmt_server_message(struct connection_buffer *buf, ServerMessage *msg)
     len += sizeof(msg_len);
 
     /* Resize buffer as needed. */
-    if (len > buf->size) {
-	free(buf->data);
-	buf->size = sudo_pow2_roundup(len);
-	if ((buf->data = malloc(buf->size)) == NULL) {
+    if (buf->len + len > buf->size) {
+	const unsigned int newsize = sudo_pow2_roundup(buf->len + len);
+	uint8_t *newdata = realloc(buf->data, newsize);
+	if (newdata == NULL) {
 	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-		"unable to malloc %u", buf->size);
-	    buf->size = 0;
+		"unable to realloc %u", newsize);
 	    goto done;
 	}
+	buf->data = newdata;
+	buf->size = newsize;
     }
     sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
-	"size + server message %zu bytes", len);
+	"size + server message %zu bytes, session %u", len, msg->session_id);
+
+    memcpy(buf->data + buf->len, &msg_len, sizeof(msg_len));
+    server_message__pack(msg, buf->data + buf->len + sizeof(msg_len));
+    buf->len += len;
 
-    memcpy(buf->data, &msg_len, sizeof(msg_len));
-    server_message__pack(msg, buf->data + sizeof(msg_len));
-    buf->len = len;
+    /* The write event is no longer only needed to finish SSL_read(). */
+    conn->temporary_write_event = false;
+
+    if (sudo_ev_add(conn->evbase, conn->write_ev,
+	    logsrvd_conf_get_sock_timeout(), false) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to add server write event");
+	goto done;
+    }
     ret = true;
 
 done:
     debug_return_bool(ret);
 }
 
+/*
+ * Format a ServerMessage and schedule it to be written to the client.
+ * Messages for a multiplexed session are tagged with its ID and
+ * queued on the connection the session is on.
+ */
+static bool
+fmt_server_message(struct connection_closure *closure, ServerMessage *msg)
+{
+    debug_decl(fmt_server_message, SUDO_DEBUG_UTIL);
+
+    msg->session_id = closure->session_id;
+    debug_return_bool(queue_server_message(
+	closure->mux ? closure->mux : closure, msg));
+}
+
+/*
+ * Acknowledge the end of a multiplexed session with a message that
+ * contains only its ID.  Since messages are handled in order, the
+ * client knows that everything it sent for the session has been
+ * processed.
+ */
+static bool
+fmt_session_end(struct connection_closure *conn, uint32_t session_id)
+{
+    ServerMessage msg = SERVER_MESSAGE__INIT;
+    debug_decl(fmt_session_end, SUDO_DEBUG_UTIL);
+
+    msg.session_id = session_id;
+    debug_return_bool(queue_server_message(conn, &msg));
+}
+
 static bool
-fmt_hello_message(struct connection_buffer *buf, bool tls)
+fmt_hello_message(struct connection_closure *closure)
 {
     ServerMessage msg = SERVER_MESSAGE__INIT;
     ServerHello hello = SERVER_HELLO__INIT;
+    char *compression_types[] = { "deflate" };
     debug_decl(fmt_hello_message, SUDO_DEBUG_UTIL);
 
     /* TODO: implement redirect and servers array.  */
     hello.server_id = (char *)server_id;
+    if (closure->compression_offered) {
+	hello.compression = compression_types;
+	hello.n_compression = nitems(compression_types);
+    }
+    hello.multiplex = closure->multiplex;
     msg.u.hello = &hello;
     msg.type_case = SERVER_MESSAGE__TYPE_HELLO;
 
-    debug_return_bool(fmt_server_message(buf, &msg));
+    debug_return_bool(fmt_server_message(closure, &msg));
 }
 
 static bool
-fmt_log_id_message(const char *id, struct connection_buffer *buf)
+fmt_log_id_message(const char *id, struct connection_closure *closure)
 {
     ServerMessage msg = SERVER_MESSAGE__INIT;
     debug_decl(fmt_log_id_message, SUDO_DEBUG_UTIL);
@@ -208,11 +394,11 @@ fmt_log_id_message(const char *id, struct connection_buffer *buf)
     msg.u.log_id = (char *)id;
     msg.type_case = SERVER_MESSAGE__TYPE_LOG_ID;
 
-    debug_return_bool(fmt_server_message(buf, &msg));
+    debug_return_bool(fmt_server_message(closure, &msg));
 }
 
 static bool
-fmt_error_message(const char *errstr, struct connection_buffer *buf)
+fmt_error_message(const char *errstr, struct connection_closure *closure)
 {
     ServerMessage msg = SERVER_MESSAGE__INIT;
     debug_decl(fmt_error_message, SUDO_DEBUG_UTIL);
@@ -220,7 +406,7 @@ fmt_error_message(const char *errstr, struct connection_buffer *buf)
     msg.u.error = (char *)errstr;
     msg.type_case = SERVER_MESSAGE__TYPE_ERROR;
 
-    debug_return_bool(fmt_server_message(buf, &msg));
+    debug_return_bool(fmt_server_message(closure, &msg));
 }
 
 struct logsrvd_info_closure {
@@ -286,6 +472,7 @@ static bool
 handle_accept(AcceptMessage *msg, struct connection_closure *closure)
 {
     struct logsrvd_info_closure info = { msg->info_msgs, msg->n_info_msgs };
+    const char *log_id;
     debug_decl(handle_accept, SUDO_DEBUG_UTIL);
 
     if (closure->state != INITIAL) {
@@ -305,16 +492,25 @@ handle_accept(AcceptMessage *msg, struct connection_closure *closure)
     }
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: received AcceptMessage", __func__);
 
-    closure->evlog = evlog_new(msg->submit_time, msg->info_msgs,
-	msg->n_info_msgs);
+    if (logsrvd_conf_relay_host() != NULL) {
+	/* The upstream server does the logging, the journal is the log ID. */
+	closure->log_io = msg->expect_iobufs;
+	log_id = strrchr(closure->journal_path, '/') + 1;
+	goto send_log_id;
+    }
+
+    closure->evlog = evlog_new(&closure->arena, msg->submit_time,
+	msg->info_msgs, msg->n_info_msgs);
     if (closure->evlog == NULL) {
 	closure->errstr = _("error parsing AcceptMessage");
 	debug_return_bool(false);
     }
 
     /* Create I/O log info file and parent directories. */
+    logsrvd_lock();
     if (msg->expect_iobufs) {
 	if (!iolog_init(msg, closure)) {
+	    logsrvd_unlock();
 	    closure->errstr = _("error creating I/O log");
 	    debug_return_bool(false);
 	}
@@ -322,20 +518,18 @@ handle_accept(AcceptMessage *msg, struct connection_closure *closure)
     }
 
     if (!eventlog_accept(closure->evlog, 0, logsrvd_json_log_cb, &info)) {
+	logsrvd_unlock();
 	closure->errstr = _("error logging accept event");
 	debug_return_bool(false);
     }
+    logsrvd_unlock();
+    log_id = closure->evlog->iolog_path;
 
+send_log_id:
     if (msg->expect_iobufs) {
 	/* Send log ID to client for restarting connections. */
-	if (!fmt_log_id_message(closure->evlog->iolog_path, &closure->write_buf))
-	    debug_return_bool(false);
-	if (sudo_ev_add(closure->evbase, closure->write_ev,
-		logsrvd_conf_get_sock_timeout(), false) == -1) {
-	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-		"unable to add server write event");
+	if (!fmt_log_id_message(log_id, closure))
 	    debug_return_bool(false);
-	}
     }
 
     closure->state = RUNNING;
@@ -349,6 +543,7 @@ static bool
 handle_reject(RejectMessage *msg, struct connection_closure *closure)
 {
     struct logsrvd_info_closure info = { msg->info_msgs, msg->n_info_msgs };
+    bool ret;
     debug_decl(handle_reject, SUDO_DEBUG_UTIL);
 
     if (closure->state != INITIAL) {
@@ -368,15 +563,24 @@ handle_reject(RejectMessage *msg, struct connection_closure *closure)
     }
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: received RejectMessage", __func__);
 
-    closure->evlog = evlog_new(msg->submit_time, msg->info_msgs,
-	msg->n_info_msgs);
+    if (logsrvd_conf_relay_host() != NULL) {
+	/* The upstream server will log the reject event. */
+	closure->state = FINISHED;
+	debug_return_bool(true);
+    }
+
+    closure->evlog = evlog_new(&closure->arena, msg->submit_time,
+	msg->info_msgs, msg->n_info_msgs);
     if (closure->evlog == NULL) {
 	closure->errstr = _("error parsing RejectMessage");
 	debug_return_bool(false);
     }
 
-    if (!eventlog_reject(closure->evlog, 0, msg->reason,
-	    logsrvd_json_log_cb, &info)) {
+    logsrvd_lock();
+    ret = eventlog_reject(closure->evlog, 0, msg->reason,
+	logsrvd_json_log_cb, &info);
+    logsrvd_unlock();
+    if (!ret) {
 	closure->errstr = _("error logging reject event");
 	debug_return_bool(false);
     }
@@ -389,7 +593,6 @@ static bool
 handle_exit(ExitMessage *msg, struct connection_closure *closure)
 {
     struct timespec tv = { 0, 0 };
-    mode_t mode;
     debug_decl(handle_exit, SUDO_DEBUG_UTIL);
 
     if (closure->state != RUNNING) {
@@ -414,21 +617,17 @@ handle_exit(ExitMessage *msg, struct connection_closure *closure)
     if (closure->log_io) {
 	/* No more data, command exited. */
 	closure->state = EXITED;
-	sudo_ev_del(closure->evbase, closure->read_ev);
+	if (closure->mux == NULL)
+	    sudo_ev_del(closure->evbase, closure->read_ev);
 
 	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: elapsed time: %lld, %ld",
 	    __func__, (long long)closure->elapsed_time.tv_sec,
 	    closure->elapsed_time.tv_nsec);
 
-	/* Clear write bits from I/O timing file to indicate completion. */
-	mode = logsrvd_conf_iolog_mode();
-	CLR(mode, S_IWUSR|S_IWGRP|S_IWOTH);
-	if (fchmodat(closure->iolog_dir_fd, "timing", mode, 0) == -1) {
-	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
-		"unable to fchmodat timing file");
-	}
-
-	/* Schedule the final commit point event immediately. */
+	/*
+	 * Schedule the final commit point event immediately.
+	 * The I/O log is marked complete once it has been written.
+	 */
 	if (sudo_ev_add(closure->evbase, closure->commit_ev, &tv, false) == -1) {
 	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 		"unable to add commit point event");
@@ -445,6 +644,7 @@ handle_exit(ExitMessage *msg, struct connection_closure *closure)
 static bool
 handle_restart(RestartMessage *msg, struct connection_closure *closure)
 {
+    bool ret;
     debug_decl(handle_restart, SUDO_DEBUG_UTIL);
 
     if (closure->state != INITIAL) {
@@ -456,22 +656,27 @@ handle_restart(RestartMessage *msg, struct connection_closure *closure)
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: received RestartMessage for %s",
 	__func__, msg->log_id);
 
-    if (!iolog_restart(msg, closure)) {
+    if (logsrvd_conf_relay_host() != NULL) {
+	/* Journals are always forwarded from the beginning. */
+	closure->errstr = _("unable to restart log in relay mode");
+	ret = false;
+    } else {
+	logsrvd_lock();
+	ret = iolog_restart(msg, closure);
+	logsrvd_unlock();
+    }
+    if (!ret) {
 	sudo_debug_printf(SUDO_DEBUG_WARN, "%s: unable to restart I/O log", __func__);
 	/* XXX - structured error message so client can send from beginning */
-	if (!fmt_error_message(closure->errstr, &closure->write_buf))
-	    debug_return_bool(false);
-	sudo_ev_del(closure->evbase, closure->read_ev);
-	if (sudo_ev_add(closure->evbase, closure->write_ev,
-		logsrvd_conf_get_sock_timeout(), false) == -1) {
-	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-		"unable to add server write event");
+	if (!fmt_error_message(closure->errstr, closure))
 	    debug_return_bool(false);
-	}
+	if (closure->mux == NULL)
+	    sudo_ev_del(closure->evbase, closure->read_ev);
 	closure->state = ERROR;
 	debug_return_bool(true);
     }
 
+    closure->log_io = true;
     closure->state = RUNNING;
     debug_return_bool(true);
 }
@@ -480,6 +685,7 @@ static bool
 handle_alert(AlertMessage *msg, struct connection_closure *closure)
 {
     struct timespec alert_time;
+    bool ret;
     debug_decl(handle_alert, SUDO_DEBUG_UTIL);
 
     /* Check that message is valid. */
@@ -492,8 +698,13 @@ handle_alert(AlertMessage *msg, struct connection_closure *closure)
     }
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: received AlertMessage", __func__);
 
+    /* The upstream server will log the alert. */
+    if (logsrvd_conf_relay_host() != NULL)
+	debug_return_bool(true);
+
     if (msg->info_msgs != NULL && msg->n_info_msgs != 0) {
-	closure->evlog = evlog_new(NULL, msg->info_msgs, msg->n_info_msgs);
+	closure->evlog = evlog_new(&closure->arena, NULL, msg->info_msgs,
+	    msg->n_info_msgs);
 	if (closure->evlog == NULL) {
 	    closure->errstr = _("error parsing AlertMessage");
 	    debug_return_bool(false);
@@ -502,7 +713,10 @@ handle_alert(AlertMessage *msg, struct connection_closure *closure)
 
     alert_time.tv_sec = msg->alert_time->tv_sec;
     alert_time.tv_nsec = msg->alert_time->tv_nsec;
-    if (!eventlog_alert(closure->evlog, 0, &alert_time, msg->reason, NULL)) {
+    logsrvd_lock();
+    ret = eventlog_alert(closure->evlog, 0, &alert_time, msg->reason, NULL);
+    logsrvd_unlock();
+    if (!ret) {
 	closure->errstr = _("error logging alert event");
 	debug_return_bool(false);
     }
@@ -530,8 +744,16 @@ handle_iobuf(int iofd, IoBuffer *msg, struct connection_closure *closure)
 
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: received IoBuffer", __func__);
 
+    METRICS_ADD(closure->metrics->iobuf_messages[iofd], 1);
+    METRICS_ADD(closure->metrics->iobuf_bytes[iofd], msg->data.len);
+    if (!sudo_timespecisset(&closure->uncommitted_time))
+	sudo_gettime_mono(&closure->uncommitted_time);
+
     /* Store IoBuffer in log. */
-    if (store_iobuf(iofd, msg, closure) == -1) {
+    if (logsrvd_conf_relay_host() != NULL) {
+	/* Relay mode, only the elapsed time is needed for commit points. */
+	update_elapsed_time(msg->delay, &closure->elapsed_time);
+    } else if (store_iobuf(iofd, msg, closure) == -1) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 	    "failed to store IoBuffer");
 	closure->errstr = _("error writing IoBuffer");
@@ -583,7 +805,10 @@ handle_winsize(ChangeWindowSize *msg, struct connection_closure *closure)
 	__func__);
 
     /* Store new window size in log. */
-    if (store_winsize(msg, closure) == -1) {
+    if (logsrvd_conf_relay_host() != NULL) {
+	/* Relay mode, only the elapsed time is needed for commit points. */
+	update_elapsed_time(msg->delay, &closure->elapsed_time);
+    } else if (store_winsize(msg, closure) == -1) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 	    "failed to store ChangeWindowSize");
 	closure->errstr = _("error writing ChangeWindowSize");
@@ -615,7 +840,10 @@ handle_suspend(CommandSuspend *msg, struct connection_closure *closure)
 	__func__);
 
     /* Store suspend signal in log. */
-    if (store_suspend(msg, closure) == -1) {
+    if (logsrvd_conf_relay_host() != NULL) {
+	/* Relay mode, only the elapsed time is needed for commit points. */
+	update_elapsed_time(msg->delay, &closure->elapsed_time);
+    } else if (store_suspend(msg, closure) == -1) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 	    "failed to store CommandSuspend");
 	closure->errstr = _("error writing CommandSuspend");
@@ -642,23 +870,183 @@ handle_client_hello(ClientHello *msg, struct connection_closure *closure)
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: client ID %s",
 	__func__, msg->client_id);
 
+    /*
+     * Our ServerHello may cross the ClientHello on the wire, so both
+     * sides enable compression if the client offered deflate and we
+     * advertised it.  The client does not wait for our reply.
+     */
+    if (closure->compression_offered) {
+	size_t n;
+
+	for (n = 0; n < msg->n_compression; n++) {
+	    if (strcmp(msg->compression[n], "deflate") == 0) {
+		sudo_debug_printf(SUDO_DEBUG_INFO,
+		    "%s: I/O buffers are compressed", __func__);
+		closure->compression = true;
+		break;
+	    }
+	}
+    }
+
     debug_return_bool(true);
 }
 
+/*
+ * Parse a base 128 varint, advancing *cpp past it.
+ */
 static bool
-handle_client_message(uint8_t *buf, size_t len,
-    struct connection_closure *closure)
+read_varint(const uint8_t **cpp, const uint8_t *end, uint64_t *valp)
 {
-    ClientMessage *msg;
-    bool ret = false;
-    debug_decl(handle_client_message, SUDO_DEBUG_UTIL);
+    const uint8_t *cp = *cpp;
+    uint64_t val = 0;
+    unsigned int shift;
+
+    for (shift = 0; shift < 64 && cp < end; shift += 7) {
+	const uint8_t ch = *cp++;
+	val |= (uint64_t)(ch & 0x7f) << shift;
+	if ((ch & 0x80) == 0) {
+	    *valp = val;
+	    *cpp = cp;
+	    return true;
+	}
+    }
+    return false;
+}
 
-    msg = client_message__unpack(NULL, len, buf);
-    if (msg == NULL) {
-	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-	    "unable to unpack ClientMessage size %zu", len);
+/*
+ * Parse a length-delimited field, advancing *cpp past the length.
+ */
+static bool
+read_length(const uint8_t **cpp, const uint8_t *end, size_t *lenp)
+{
+    uint64_t len;
+
+    if (!read_varint(cpp, end, &len) || len > (uint64_t)(end - *cpp))
+	return false;
+    *lenp = (size_t)len;
+    return true;
+}
+
+/*
+ * Decode a ClientMessage that contains an IoBuffer without copying
+ * the I/O data, which is left pointing into buf.  This is by far the
+ * most common message type.  Returns false if the message is of
+ * another type or has fields we don't expect, in which case it
+ * should be unpacked by protobuf-c instead.
+ */
+static bool
+client_message_iobuf(const uint8_t *buf, size_t len, ClientMessage *msg,
+    IoBuffer *iobuf, TimeSpec *delay)
+{
+    const uint8_t *cp = buf, *end = buf + len, *ep;
+    uint64_t tag, val;
+    size_t flen;
+    debug_decl(client_message_iobuf, SUDO_DEBUG_UTIL);
+
+    /*
+     * ClientMessage must consist of a single IoBuffer and an optional
+     * session ID, which may come before or after it.
+     */
+    for (;;) {
+	if (!read_varint(&cp, end, &tag))
+	    debug_return_bool(false);
+	if (tag != ((14 << 3) | 0))
+	    break;
+	if (!read_varint(&cp, end, &val))
+	    debug_return_bool(false);
+	msg->session_id = (uint32_t)val;
+    }
+    if ((tag & 0x7) != 2)
+	debug_return_bool(false);
+    switch (tag >> 3) {
+    case CLIENT_MESSAGE__TYPE_TTYIN_BUF:
+    case CLIENT_MESSAGE__TYPE_TTYOUT_BUF:
+    case CLIENT_MESSAGE__TYPE_STDIN_BUF:
+    case CLIENT_MESSAGE__TYPE_STDOUT_BUF:
+    case CLIENT_MESSAGE__TYPE_STDERR_BUF:
+	msg->type_case = tag >> 3;
+	break;
+    default:
+	debug_return_bool(false);
+    }
+    if (!read_length(&cp, end, &flen))
 	debug_return_bool(false);
+    ep = cp + flen;
+    if (ep != end) {
+	/* Trailing session ID */
+	const uint8_t *tp = ep;
+	if (!read_varint(&tp, end, &tag) || tag != ((14 << 3) | 0) ||
+		!read_varint(&tp, end, &val) || tp != end)
+	    debug_return_bool(false);
+	msg->session_id = (uint32_t)val;
+	end = ep;
+    }
+
+    /*
+     * IoBuffer fields: delay = 1, data = 2, uncompressed_len = 3,
+     * checksum = 4
+     */
+    while (cp < end) {
+	if (!read_varint(&cp, end, &tag))
+	    debug_return_bool(false);
+	switch (tag) {
+	case (1 << 3) | 2:
+	    if (iobuf->delay != NULL || !read_length(&cp, end, &flen))
+		debug_return_bool(false);
+	    /* TimeSpec fields: tv_sec = 1, tv_nsec = 2 */
+	    for (ep = cp + flen; cp < ep; ) {
+		if (!read_varint(&cp, ep, &tag) || !read_varint(&cp, ep, &val))
+		    debug_return_bool(false);
+		switch (tag) {
+		case (1 << 3) | 0:
+		    delay->tv_sec = (int64_t)val;
+		    break;
+		case (2 << 3) | 0:
+		    delay->tv_nsec = (int32_t)val;
+		    break;
+		default:
+		    debug_return_bool(false);
+		}
+	    }
+	    iobuf->delay = delay;
+	    break;
+	case (2 << 3) | 2:
+	    if (iobuf->data.data != NULL || !read_length(&cp, end, &flen))
+		debug_return_bool(false);
+	    iobuf->data.data = (uint8_t *)cp;
+	    iobuf->data.len = flen;
+	    cp += flen;
+	    break;
+	case (3 << 3) | 0:
+	    if (!read_varint(&cp, end, &val))
+		debug_return_bool(false);
+	    iobuf->uncompressed_len = (uint32_t)val;
+	    break;
+	case (4 << 3) | 0:
+	    if (!read_varint(&cp, end, &val))
+		debug_return_bool(false);
+	    iobuf->checksum = (uint32_t)val;
+	    break;
+	default:
+	    debug_return_bool(false);
+	}
     }
+    if (iobuf->delay == NULL)
+	debug_return_bool(false);
+
+    /* All IoBuffer members of the union share the same type. */
+    msg->u.ttyout_buf = iobuf;
+    debug_return_bool(true);
+}
+
+/*
+ * Dispatch a decoded ClientMessage to its handler.
+ */
+static bool
+dispatch_client_message(ClientMessage *msg, struct connection_closure *closure)
+{
+    bool ret = false;
+    debug_decl(dispatch_client_message, SUDO_DEBUG_UTIL);
 
     switch (msg->type_case) {
     case CLIENT_MESSAGE__TYPE_ACCEPT_MSG:
@@ -706,81 +1094,299 @@ handle_client_message(uint8_t *buf, size_t len,
 	closure->errstr = _("unrecognized ClientMessage type");
 	break;
     }
-    client_message__free_unpacked(msg, NULL);
 
     debug_return_bool(ret);
 }
 
-static void
-shutdown_cb(int unused, int what, void *v)
+/*
+ * Allocate a closure for a session multiplexed over a connection.
+ * It shares the connection's socket, buffers and events.
+ */
+static struct connection_closure *
+session_closure_alloc(struct connection_closure *conn, uint32_t session_id)
 {
-    struct sudo_event_base *base = v;
-    debug_decl(shutdown_cb, SUDO_DEBUG_UTIL);
+    struct connection_closure *closure;
+#ifdef HAVE_IO_URING
+    int i;
+#endif
+    debug_decl(session_closure_alloc, SUDO_DEBUG_UTIL);
 
-#if defined(HAVE_OPENSSL)
-    /* deallocate server's SSL context object */
-    struct logsrvd_tls_runtime *tls_runtime = logsrvd_get_tls_runtime();
-    if (tls_runtime != NULL) {
-        SSL_CTX_free(tls_runtime->ssl_ctx);
-    }
+    if ((closure = calloc(1, sizeof(*closure))) == NULL)
+	debug_return_ptr(NULL);
+
+    arena_init(&closure->arena);
+    arena_init(&closure->msg_arena);
+    TAILQ_INIT(&closure->sessions);
+    closure->mux = conn;
+    closure->session_id = session_id;
+    closure->iolog_dir_fd = -1;
+    closure->journal_fd = -1;
+    closure->sock = -1;
+    closure->tls = conn->tls;
+    closure->compression = conn->compression;
+    closure->worker = conn->worker;
+    closure->metrics = conn->metrics;
+    closure->evbase = conn->evbase;
+    sudo_gettime_mono(&closure->start_time);
+#ifdef HAVE_IO_URING
+    closure->uring = conn->uring;
+    for (i = 0; i < IOFD_MAX; i++)
+	closure->iolog_offsets[i] = -1;
 #endif
-    sudo_ev_loopbreak(base);
+    memcpy(closure->ipaddr, conn->ipaddr, sizeof(closure->ipaddr));
+    TAILQ_INSERT_TAIL(&conn->sessions, closure, entries);
 
-    debug_return;
+    closure->commit_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT,
+	server_commit_cb, closure);
+    if (closure->commit_ev == NULL) {
+	connection_closure_free(closure);
+	debug_return_ptr(NULL);
+    }
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: new session %u from %s",
+	__func__, session_id, closure->ipaddr);
+
+    debug_return_ptr(closure);
 }
 
 /*
- * Shut down active client connections if any, or exit immediately.
+ * Handle a ClientMessage for a session multiplexed over a connection.
+ * A session starts with an AcceptMessage, RejectMessage, RestartMessage
+ * or AlertMessage that uses a new ID and ends when it is complete or
+ * when a message with only the session ID is received.  An error in
+ * one session is sent to the client tagged with its ID and only ends
+ * that session.
  */
-static void
-server_shutdown(struct sudo_event_base *base)
+static bool
+handle_session_message(ClientMessage *msg, struct connection_closure *conn)
 {
-    struct connection_closure *closure, *next;
-    struct sudo_event *ev;
-    struct timespec tv = { 0, 0 };
-    debug_decl(server_shutdown, SUDO_DEBUG_UTIL);
+    struct connection_closure *closure;
+    unsigned int nsessions = 0;
+    debug_decl(handle_session_message, SUDO_DEBUG_UTIL);
 
-    if (TAILQ_EMPTY(&connections)) {
-	sudo_ev_loopbreak(base);
-	debug_return;
+    if (!conn->multiplex || msg->type_case == CLIENT_MESSAGE__TYPE_HELLO_MSG) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unexpected session ID %u", msg->session_id);
+	conn->errstr = _("protocol error");
+	debug_return_bool(false);
     }
 
-    TAILQ_FOREACH_SAFE(closure, &connections, entries, next) {
-	closure->state = SHUTDOWN;
-	sudo_ev_del(base, closure->read_ev);
-	if (closure->log_io) {
-	    /* Schedule final commit point for the connection. */
-	    if (sudo_ev_add(base, closure->commit_ev, &tv, false) == -1) {
-		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-		    "unable to add commit point event");
+    TAILQ_FOREACH(closure, &conn->sessions, entries) {
+	if (closure->session_id == msg->session_id)
+	    break;
+	nsessions++;
+    }
+
+    /*
+     * A message with no type ends the session, like closing a connection.
+     * An I/O log that is waiting for its final commit point is completed
+     * first.  The end of the session is acknowledged once it is gone.
+     */
+    if (msg->type_case == CLIENT_MESSAGE__TYPE__NOT_SET) {
+	if (closure != NULL) {
+	    if (closure->state == EXITED) {
+		closure->end_requested = true;
+		debug_return_bool(true);
 	    }
-	} else {
-	    /* No commit point, close connection immediately. */
-	    sudo_ev_del(closure->evbase, closure->write_ev);
 	    connection_closure_free(closure);
 	}
+	debug_return_bool(fmt_session_end(conn, msg->session_id));
     }
 
-    if (!TAILQ_EMPTY(&connections)) {
-	/* We need a timed event to exit even if clients time out. */
-	ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT, shutdown_cb, base);
-	if (ev != NULL) {
-	    tv.tv_sec = SHUTDOWN_TIMEO;
-	    if (sudo_ev_add(base, ev, &tv, false) == -1) {
-		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-		    "unable to add shutdown event");
-	    }
+    if (closure == NULL) {
+	switch (msg->type_case) {
+	case CLIENT_MESSAGE__TYPE_ACCEPT_MSG:
+	case CLIENT_MESSAGE__TYPE_REJECT_MSG:
+	case CLIENT_MESSAGE__TYPE_RESTART_MSG:
+	case CLIENT_MESSAGE__TYPE_ALERT_MSG:
+	    break;
+	default:
+	    /* The session ended with an error the client has not seen yet. */
+	    sudo_debug_printf(SUDO_DEBUG_NOTICE|SUDO_DEBUG_LINENO,
+		"ignoring message type %d for unknown session %u",
+		msg->type_case, msg->session_id);
+	    debug_return_bool(true);
+	}
+	if (nsessions >= SESSIONS_MAX) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"too many sessions (%u)", nsessions);
+	    conn->errstr = _("too many sessions");
+	    debug_return_bool(false);
 	}
+	closure = session_closure_alloc(conn, msg->session_id);
+	if (closure == NULL)
+	    debug_return_bool(false);
     }
 
-    debug_return;
+    if (!dispatch_client_message(msg, closure)) {
+	/* Errors without a message drop the connection so it restarts. */
+	if (closure->errstr == NULL)
+	    debug_return_bool(false);
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "session %u: %s", closure->session_id, closure->errstr);
+	if (!fmt_error_message(closure->errstr, closure))
+	    debug_return_bool(false);
+	closure->state = ERROR;
+    }
+
+    /* An alert outside of a session does not start one. */
+    switch (closure->state) {
+    case INITIAL:
+	if (msg->type_case != CLIENT_MESSAGE__TYPE_ALERT_MSG)
+	    break;
+	FALLTHROUGH;
+    case FINISHED:
+    case ERROR:
+	connection_closure_free(closure);
+	break;
+    default:
+	break;
+    }
+
+    debug_return_bool(true);
 }
 
-/*
- * Send a server message to the client.
- */
-static void
-server_msg_cb(int fd, int what, void *v)
+static bool
+handle_client_message(uint8_t *buf, size_t len,
+    struct connection_closure *closure)
+{
+    ClientMessage iobuf_msg = CLIENT_MESSAGE__INIT;
+    IoBuffer iobuf = IO_BUFFER__INIT;
+    TimeSpec delay = TIME_SPEC__INIT;
+    ClientMessage *msg = &iobuf_msg;
+    bool ret = false;
+    debug_decl(handle_client_message, SUDO_DEBUG_UTIL);
+
+    /*
+     * I/O buffers are decoded in place, other messages are unpacked
+     * using the connection's arena which is reset after each message.
+     */
+    if (!client_message_iobuf(buf, len, &iobuf_msg, &iobuf, &delay)) {
+	msg = client_message__unpack(&closure->msg_arena.allocator, len, buf);
+	if (msg == NULL) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to unpack ClientMessage size %zu", len);
+	    arena_reset(&closure->msg_arena);
+	    debug_return_bool(false);
+	}
+    }
+
+    /* Sessions multiplexed over the connection have their own state. */
+    if (msg->session_id != 0) {
+	ret = handle_session_message(msg, closure);
+	goto done;
+    }
+
+    /*
+     * In relay mode, store the message in the journal to be forwarded.
+     * The relay sends its own ClientHello and cannot restart a session.
+     */
+    if (logsrvd_conf_relay_host() != NULL &&
+	    (closure->state == INITIAL || closure->state == RUNNING)) {
+	switch (msg->type_case) {
+	case CLIENT_MESSAGE__TYPE_HELLO_MSG:
+	case CLIENT_MESSAGE__TYPE_RESTART_MSG:
+	    break;
+	default:
+	    if (!journal_write(buf, len, closure))
+		goto done;
+	    break;
+	}
+    }
+
+    ret = dispatch_client_message(msg, closure);
+
+    /* Queue the journal for forwarding once the session is complete. */
+    if (ret && (closure->state == EXITED || closure->state == FINISHED)) {
+	if (!journal_finish(closure)) {
+	    closure->errstr = _("unable to write journal file");
+	    ret = false;
+	}
+    }
+
+done:
+    arena_reset(&closure->msg_arena);
+
+    debug_return_bool(ret);
+}
+
+static void
+shutdown_cb(int unused, int what, void *v)
+{
+    struct sudo_event_base *base = v;
+    debug_decl(shutdown_cb, SUDO_DEBUG_UTIL);
+
+    sudo_ev_loopbreak(base);
+
+    debug_return;
+}
+
+/*
+ * Shut down a worker's active client connections if any,
+ * or exit its event loop immediately.
+ */
+static void
+server_shutdown(struct logsrvd_worker *worker)
+{
+    struct sudo_event_base *base = worker->evbase;
+    struct connection_closure *closure, *next, *session, *snext;
+    struct sudo_event *ev;
+    struct timespec tv = { 0, 0 };
+    debug_decl(server_shutdown, SUDO_DEBUG_UTIL);
+
+    if (TAILQ_EMPTY(&worker->connections)) {
+	sudo_ev_loopbreak(base);
+	debug_return;
+    }
+
+    TAILQ_FOREACH_SAFE(closure, &worker->connections, entries, next) {
+	closure->state = SHUTDOWN;
+	sudo_ev_del(base, closure->read_ev);
+	TAILQ_FOREACH_SAFE(session, &closure->sessions, entries, snext) {
+	    session->state = SHUTDOWN;
+	    if (!session->log_io) {
+		connection_closure_free(session);
+		continue;
+	    }
+	    /* Schedule final commit point for the session. */
+	    if (sudo_ev_add(base, session->commit_ev, &tv, false) == -1) {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		    "unable to add commit point event");
+	    }
+	}
+	if (closure->log_io) {
+	    /* Schedule final commit point for the connection. */
+	    if (sudo_ev_add(base, closure->commit_ev, &tv, false) == -1) {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		    "unable to add commit point event");
+	    }
+	} else if (TAILQ_EMPTY(&closure->sessions)) {
+	    /* No commit point, close connection immediately. */
+	    sudo_ev_del(closure->evbase, closure->write_ev);
+	    connection_closure_free(closure);
+	}
+    }
+
+    if (!TAILQ_EMPTY(&worker->connections)) {
+	/* We need a timed event to exit even if clients time out. */
+	ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT, shutdown_cb, base);
+	if (ev != NULL) {
+	    tv.tv_sec = SHUTDOWN_TIMEO;
+	    if (sudo_ev_add(base, ev, &tv, false) == -1) {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		    "unable to add shutdown event");
+	    }
+	}
+    }
+
+    debug_return;
+}
+
+/*
+ * Send a server message to the client.
+ */
+static void
+server_msg_cb(int fd, int what, void *v)
 {
     struct connection_closure *closure = v;
     struct connection_buffer *buf = &closure->write_buf;
@@ -859,8 +1465,10 @@ server_msg_cb(int fd, int what, void *v)
 	buf->off = 0;
 	buf->len = 0;
 	sudo_ev_del(closure->evbase, closure->write_ev);
-	if (closure->state == FINISHED || closure->state == SHUTDOWN ||
-		closure->state == ERROR)
+	if (closure->state == FINISHED || closure->state == ERROR)
+	    goto finished;
+	/* Wait for the final commit point of any multiplexed sessions. */
+	if (closure->state == SHUTDOWN && TAILQ_EMPTY(&closure->sessions))
 	    goto finished;
     }
     debug_return;
@@ -996,6 +1604,9 @@ client_msg_cb(int fd, int what, void *v)
 	}
 	buf->off += msg_len;
     }
+    /* Move any partial message to the start of the buffer. */
+    if (buf->len > buf->off && buf->off > 0)
+	memmove(buf->data, buf->data + buf->off, buf->len - buf->off);
     buf->len -= buf->off;
     buf->off = 0;
 
@@ -1004,16 +1615,11 @@ client_msg_cb(int fd, int what, void *v)
 
     debug_return;
 send_error:
+    closure->state = ERROR;
     if (closure->errstr == NULL)
 	goto finished;
-    if (fmt_error_message(closure->errstr, &closure->write_buf)) {
+    if (fmt_error_message(closure->errstr, closure))
 	sudo_ev_del(closure->evbase, closure->read_ev);
-	if (sudo_ev_add(closure->evbase, closure->write_ev,
-		logsrvd_conf_get_sock_timeout(), false) == -1) {
-	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-		"unable to add server write event");
-	}
-    }
 finished:
     connection_closure_free(closure);
     debug_return;
@@ -1028,37 +1634,119 @@ server_commit_cb(int unused, int what, void *v)
     ServerMessage msg = SERVER_MESSAGE__INIT;
     TimeSpec commit_point = TIME_SPEC__INIT;
     struct connection_closure *closure = v;
-
+    struct timespec commit_time = closure->elapsed_time;
+    mode_t mode;
     debug_decl(server_commit_cb, SUDO_DEBUG_UTIL);
 
+#ifdef HAVE_IO_URING
+    if (closure->commit_deferred) {
+	if (closure->uring_pending != 0) {
+	    /* Rescheduled by the io_uring completion handler. */
+	    debug_return;
+	}
+	/*
+	 * The writes queued for this commit point are on disk.  Data that
+	 * arrived since is acknowledged by a later commit point, flushing
+	 * it now could defer the commit point indefinitely.
+	 */
+	closure->commit_deferred = false;
+	commit_time = closure->commit_time;
+    } else
+#endif
+    {
+	/* Buffered I/O log data must be written before it is acknowledged. */
+	if (!iolog_flush_all(closure, true)) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to write buffered I/O log data");
+	    goto bad;
+	}
+#ifdef HAVE_IO_URING
+	if (closure->uring_pending != 0) {
+	    /* Rescheduled by the io_uring completion handler. */
+	    sudo_debug_printf(SUDO_DEBUG_INFO,
+		"%s: deferring commit point, %u operations pending", __func__,
+		closure->uring_pending);
+	    closure->commit_time = closure->elapsed_time;
+	    closure->commit_deferred = true;
+	    debug_return;
+	}
+#endif
+    }
+#ifdef HAVE_IO_URING
+    if (closure->uring_error) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to write buffered I/O log data");
+	goto bad;
+    }
+#endif
+
+    /* In relay mode, the journal must be on disk before it is acknowledged. */
+    if (!journal_sync(closure))
+	goto bad;
+
     /* Send the client an acknowledgement of what has been committed to disk. */
-    commit_point.tv_sec = closure->elapsed_time.tv_sec;
-    commit_point.tv_nsec = closure->elapsed_time.tv_nsec;
+    commit_point.tv_sec = commit_time.tv_sec;
+    commit_point.tv_nsec = commit_time.tv_nsec;
     msg.u.commit_point = &commit_point;
     msg.type_case = SERVER_MESSAGE__TYPE_COMMIT_POINT;
 
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: sending commit point [%lld, %ld]",
-	__func__, (long long)closure->elapsed_time.tv_sec,
-	closure->elapsed_time.tv_nsec);
+	__func__, (long long)commit_time.tv_sec, commit_time.tv_nsec);
 
-    /* XXX - assumes no other server message pending, use a queue instead? */
-    if (!fmt_server_message(&closure->write_buf, &msg)) {
+    if (!fmt_server_message(closure, &msg)) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 	    "unable to format ServerMessage (commit point)");
 	goto bad;
     }
-    if (sudo_ev_add(closure->evbase, closure->write_ev,
-        logsrvd_conf_get_sock_timeout(), false) == -1) {
-        sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-            "unable to add server write event");
-        goto bad;
+    METRICS_ADD(closure->metrics->commit_points, 1);
+    if (sudo_timespecisset(&closure->uncommitted_time)) {
+	metrics_observe(&closure->metrics->commit_lag,
+	    &closure->uncommitted_time);
+	sudo_timespecclear(&closure->uncommitted_time);
+    }
+
+    if (sudo_timespeccmp(&commit_time, &closure->elapsed_time, !=)) {
+	/* Acknowledge the rest once it has been written too. */
+	struct timespec tv = { ACK_FREQUENCY, 0 };
+
+	if (closure->state == EXITED)
+	    sudo_timespecclear(&tv);
+	if (sudo_ev_add(closure->evbase, closure->commit_ev, &tv, false) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to add commit point event");
+	    goto bad;
+	}
+	debug_return;
     }
 
-    if (closure->state == EXITED)
+    if (closure->state == EXITED) {
+	/* Clear write bits from I/O timing file to indicate completion. */
+	if (closure->iolog_dir_fd != -1) {
+	    mode = logsrvd_conf_iolog_mode();
+	    CLR(mode, S_IWUSR|S_IWGRP|S_IWOTH);
+	    if (fchmodat(closure->iolog_dir_fd, "timing", mode, 0) == -1) {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		    "unable to fchmodat timing file");
+	    }
+	}
 	closure->state = FINISHED;
+    }
+
+    /* A multiplexed session is done once its final commit point is queued. */
+    if (closure->mux != NULL &&
+	    (closure->state == FINISHED || closure->state == SHUTDOWN)) {
+	struct connection_closure *conn = closure->mux;
+	const uint32_t session_id = closure->session_id;
+	const bool end_requested = closure->end_requested;
+
+	connection_closure_free(closure);
+	if (end_requested && !fmt_session_end(conn, session_id))
+	    connection_closure_free(conn);
+    }
     debug_return;
 bad:
-    connection_closure_free(closure);
+    /* The client restarts all sessions on a connection that is dropped. */
+    connection_closure_free(closure->mux ? closure->mux : closure);
     debug_return;
 }
 
@@ -1070,13 +1758,19 @@ bad:
 static bool
 start_protocol(struct connection_closure *closure)
 {
-    const struct timespec *timeout = logsrvd_conf_get_sock_timeout();
     debug_decl(start_protocol, SUDO_DEBUG_UTIL);
 
-    if (!fmt_hello_message(&closure->write_buf, closure->tls))
-	debug_return_bool(false);
-
-    if (sudo_ev_add(closure->evbase, closure->write_ev, timeout, false) == -1)
+    /*
+     * Compressed I/O buffers are not offered in relay mode since the
+     * messages are forwarded as-is.
+     */
+#ifdef HAVE_ZLIB_H
+    closure->compression_offered = logsrvd_conf_compression() &&
+	logsrvd_conf_relay_host() == NULL;
+#endif
+    /* Each journal holds a single session so relays do not multiplex. */
+    closure->multiplex = logsrvd_conf_relay_host() == NULL;
+    if (!fmt_hello_message(closure))
 	debug_return_bool(false);
 
     /* No read timeout, client messages may happen at arbitrary times. */
@@ -1189,7 +1883,7 @@ exit:
 #endif /* HAVE_SSL_CTX_GET0_CERTIFICATE */
 }
 
-static bool
+bool
 init_tls_ciphersuites(SSL_CTX *ctx, const struct logsrvd_tls_config *tls_config)
 {
     const char *errstr;
@@ -1254,6 +1948,47 @@ init_tls_ciphersuites(SSL_CTX *ctx, const struct logsrvd_tls_config *tls_config)
     debug_return_bool(true);
 }
 
+/*
+ * Enable TLS session resumption so that clients which connect often,
+ * such as the sudoers plugin, can skip the full handshake.
+ * Session tickets are used where the client supports them, otherwise
+ * sessions are kept in the context's cache, which is shared by all
+ * workers.  A session timeout of zero disables resumption.
+ */
+static bool
+init_tls_session_cache(SSL_CTX *ctx, const struct logsrvd_tls_config *tls_config)
+{
+    static const unsigned char sid_ctx[] = "sudo_logsrvd";
+    const char *errstr;
+    debug_decl(init_tls_session_cache, SUDO_DEBUG_UTIL);
+
+    if (tls_config->session_timeout == 0) {
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+#ifdef HAVE_SSL_CTX_SET_NUM_TICKETS
+	SSL_CTX_set_num_tickets(ctx, 0);
+#endif
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "TLS session resumption disabled");
+	debug_return_bool(true);
+    }
+
+    /* A session ID context is required to resume with client certs. */
+    if (!SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1)) {
+	errstr = ERR_reason_error_string(ERR_get_error());
+	sudo_warnx(U_("unable to set TLS session ID context: %s"), errstr);
+	debug_return_bool(false);
+    }
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_timeout(ctx, tls_config->session_timeout);
+#ifdef HAVE_SSL_CTX_SET_NUM_TICKETS
+    /* The sudoers plugin only stores a single session. */
+    SSL_CTX_set_num_tickets(ctx, 1);
+#endif
+
+    debug_return_bool(true);
+}
+
 /*
  * Calls series of openssl initialization functions in order to
  * be able to establish configured network connections over TLS
@@ -1285,6 +2020,9 @@ init_tls_server_context(void)
         goto bad;
     }
 
+    /* Server messages may be appended to a pending write. */
+    SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
     if (SSL_CTX_use_certificate_chain_file(ctx, tls_config->cert_path) <= 0) {
 	errstr = ERR_reason_error_string(ERR_get_error());
 	sudo_warnx(U_("%s: %s"), tls_config->cert_path, errstr);
@@ -1394,6 +2132,21 @@ init_tls_server_context(void)
 	SSL_OP_NO_SSLv2|SSL_OP_NO_SSLv3|SSL_OP_NO_TLSv1|SSL_OP_NO_TLSv1_1);
 #endif
 
+    if (!init_tls_session_cache(ctx, tls_config))
+	goto bad;
+
+    if (tls_config->ktls) {
+#ifdef SSL_OP_ENABLE_KTLS
+	/*
+	 * OpenSSL falls back to user-space crypto on a per-connection
+	 * basis if the kernel does not support the negotiated cipher.
+	 */
+	SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+	sudo_warnx("%s", U_("kernel TLS is not supported by this version of OpenSSL"));
+#endif
+    }
+
     tls_runtime->ssl_ctx = ctx;
 
     debug_return_bool(true);
@@ -1475,9 +2228,23 @@ tls_handshake_cb(int fd, int what, void *v)
     }
 
     sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
-        "TLS version: %s, negotiated cipher suite: %s",
+        "TLS version: %s, negotiated cipher suite: %s%s",
         SSL_get_version(closure->ssl),
-        SSL_get_cipher(closure->ssl));
+        SSL_get_cipher(closure->ssl),
+        SSL_session_reused(closure->ssl) ? " (resumed)" : "");
+
+    if (SSL_session_reused(closure->ssl))
+	METRICS_ADD(closure->metrics->tls_resumed, 1);
+#ifdef SSL_OP_ENABLE_KTLS
+    /* With kTLS receive offload, SSL_read() is a plain recvmsg(). */
+    if (BIO_get_ktls_recv(SSL_get_rbio(closure->ssl))) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "kernel TLS enabled for receive%s",
+	    BIO_get_ktls_send(SSL_get_wbio(closure->ssl)) ? " and send" : "");
+	METRICS_ADD(closure->metrics->tls_ktls, 1);
+    }
+#endif
+    metrics_observe(&closure->metrics->tls_handshake, &closure->start_time);
 
     /* Start the actual protocol now that the TLS handshake is complete. */
     if (!start_protocol(closure))
@@ -1485,6 +2252,7 @@ tls_handshake_cb(int fd, int what, void *v)
 
     debug_return;
 bad:
+    closure->state = ERROR;
     connection_closure_free(closure);
     debug_return;
 }
@@ -1494,20 +2262,37 @@ bad:
  * Allocate a new connection closure.
  */
 static struct connection_closure *
-connection_closure_alloc(int sock, bool tls, struct sudo_event_base *base)
+connection_closure_alloc(int sock, bool tls, struct logsrvd_worker *worker)
 {
     struct connection_closure *closure;
+#ifdef HAVE_IO_URING
+    int i;
+#endif
     debug_decl(connection_closure_alloc, SUDO_DEBUG_UTIL);
 
     if ((closure = calloc(1, sizeof(*closure))) == NULL)
 	debug_return_ptr(NULL);
 
+    arena_init(&closure->arena);
+    arena_init(&closure->msg_arena);
+    TAILQ_INIT(&closure->sessions);
     closure->iolog_dir_fd = -1;
+    closure->journal_fd = -1;
     closure->sock = sock;
     closure->tls = tls;
-    closure->evbase = base;
+    closure->worker = worker;
+    closure->metrics = &worker->metrics;
+    closure->evbase = worker->evbase;
+    sudo_gettime_mono(&closure->start_time);
+#ifdef HAVE_IO_URING
+    closure->uring = worker->uring;
+    for (i = 0; i < IOFD_MAX; i++)
+	closure->iolog_offsets[i] = -1;
+#endif
 
-    TAILQ_INSERT_TAIL(&connections, closure, entries);
+    TAILQ_INSERT_TAIL(&worker->connections, closure, entries);
+    METRICS_ADD(closure->metrics->connections_active, 1);
+    METRICS_ADD(closure->metrics->connections_total, 1);
 
     closure->read_buf.size = 64 * 1024;
     closure->read_buf.data = malloc(closure->read_buf.size);
@@ -1550,12 +2335,12 @@ bad:
  */
 static bool
 new_connection(int sock, bool tls, const struct sockaddr *sa,
-    struct sudo_event_base *evbase)
+    struct logsrvd_worker *worker)
 {
     struct connection_closure *closure;
     debug_decl(new_connection, SUDO_DEBUG_UTIL);
 
-    if ((closure = connection_closure_alloc(sock, tls, evbase)) == NULL)
+    if ((closure = connection_closure_alloc(sock, tls, worker)) == NULL)
 	goto bad;
 
     /* store the peer's IP address in the closure object */
@@ -1604,7 +2389,7 @@ new_connection(int sock, bool tls, const struct sockaddr *sa,
         }
 
         /* Enable SSL_accept to begin handshake with client. */
-        if (sudo_ev_add(evbase, closure->ssl_accept_ev,
+        if (sudo_ev_add(closure->evbase, closure->ssl_accept_ev,
 		logsrvd_conf_get_sock_timeout(), false) == -1) {
             sudo_fatal("%s", U_("unable to add event to queue"));
             goto bad;
@@ -1623,13 +2408,61 @@ bad:
     debug_return_bool(false);
 }
 
+/*
+ * Create a UNIX domain socket listener for the path in addr->sa_str.
+ * A stale socket from a previous run is removed.  Only the owner and
+ * group may connect to it.
+ */
+static int
+create_unix_listener(struct listen_address *addr)
+{
+    struct sockaddr_un sa_un;
+    struct stat sb;
+    mode_t omask;
+    int sock;
+    debug_decl(create_unix_listener, SUDO_DEBUG_UTIL);
+
+    memset(&sa_un, 0, sizeof(sa_un));
+    sa_un.sun_family = AF_UNIX;
+    if (strlcpy(sa_un.sun_path, addr->sa_str, sizeof(sa_un.sun_path)) >=
+	    sizeof(sa_un.sun_path)) {
+	errno = ENAMETOOLONG;
+	sudo_warn("%s", addr->sa_str);
+	debug_return_int(-1);
+    }
+    if (lstat(sa_un.sun_path, &sb) == 0 && S_ISSOCK(sb.st_mode))
+	unlink(sa_un.sun_path);
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+	sudo_warn("socket");
+	debug_return_int(-1);
+    }
+    omask = umask(S_IRWXO);
+    if (bind(sock, (struct sockaddr *)&sa_un, sizeof(sa_un)) == -1) {
+	sudo_warn("%s", addr->sa_str);
+	umask(omask);
+	close(sock);
+	debug_return_int(-1);
+    }
+    umask(omask);
+
+    debug_return_int(sock);
+}
+
 static int
-create_listener(struct listen_address *addr)
+create_listener(struct listen_address *addr, bool reuse_port)
 {
     int flags, on, sock;
     const char *family = "inet4";
     debug_decl(create_listener, SUDO_DEBUG_UTIL);
 
+    if (addr->sa_un.sa.sa_family == AF_UNIX) {
+	family = "unix";
+	if ((sock = create_unix_listener(addr)) == -1)
+	    goto bad;
+	goto bound;
+    }
+
     if ((sock = socket(addr->sa_un.sa.sa_family, SOCK_STREAM, 0)) == -1) {
 	sudo_warn("socket");
 	goto bad;
@@ -1647,11 +2480,21 @@ create_listener(struct listen_address *addr)
 #endif
     if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1)
 	sudo_warn("SO_REUSEADDR");
+#ifdef SO_REUSEPORT
+    if (reuse_port) {
+	/* Multiple sockets bound to the same address share the load. */
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+	    sudo_warn("SO_REUSEPORT");
+	    goto bad;
+	}
+    }
+#endif
     if (bind(sock, &addr->sa_un.sa, addr->sa_size) == -1) {
 	/* TODO: only warn once for IPv4 and IPv6 or disambiguate */
 	sudo_warn("%s (%s)", addr->sa_str, family);
 	goto bad;
     }
+bound:
     if (listen(sock, SOMAXCONN) == -1) {
 	sudo_warn("listen");
 	goto bad;
@@ -1671,11 +2514,413 @@ bad:
     debug_return_int(-1);
 }
 
+#ifdef HAVE_PTHREAD_H
+/*
+ * Send a command to a worker thread.
+ */
+static bool
+worker_send_cmd(struct logsrvd_worker *worker, struct worker_cmd *cmd)
+{
+    ssize_t nwritten;
+    debug_decl(worker_send_cmd, SUDO_DEBUG_UTIL);
+
+    for (;;) {
+	nwritten = write(worker->cmd_pipe[1], cmd, sizeof(*cmd));
+	if (nwritten == sizeof(*cmd))
+	    debug_return_bool(true);
+	if (nwritten == -1 && errno == EINTR)
+	    continue;
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to send command %d to worker %u", cmd->type, worker->id);
+	debug_return_bool(false);
+    }
+}
+
+/*
+ * Called by a worker thread in response to WORKER_CMD_PAUSE.
+ * Blocks until the main thread calls workers_resume().
+ */
+static void
+worker_pause(struct logsrvd_worker *worker)
+{
+    unsigned int generation;
+    debug_decl(worker_pause, SUDO_DEBUG_UTIL);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: pausing worker %u",
+	__func__, worker->id);
+
+    pthread_mutex_lock(&pause_mutex);
+    generation = pause_generation;
+    workers_paused++;
+    pthread_cond_broadcast(&pause_cond);
+    while (generation == pause_generation)
+	pthread_cond_wait(&pause_cond, &pause_mutex);
+    pthread_mutex_unlock(&pause_mutex);
+
+    debug_return;
+}
+
+/*
+ * Read commands sent by the main thread.
+ */
+static void
+worker_cmd_cb(int fd, int what, void *v)
+{
+    struct logsrvd_worker *worker = v;
+    struct worker_cmd cmd;
+    struct listener *l;
+    ssize_t nread;
+    debug_decl(worker_cmd_cb, SUDO_DEBUG_UTIL);
+
+    for (;;) {
+	nread = read(fd, &cmd, sizeof(cmd));
+	if (nread != sizeof(cmd)) {
+	    if (nread == -1 && errno == EINTR)
+		continue;
+	    if (nread == -1 && errno != EAGAIN) {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		    "unable to read command for worker %u", worker->id);
+	    } else if (nread > 0) {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		    "short read (%zd) of command for worker %u",
+		    nread, worker->id);
+	    }
+	    break;
+	}
+
+	switch (cmd.type) {
+	case WORKER_CMD_CONNECTION:
+	    if (!new_connection(cmd.sock, cmd.tls, &cmd.s_un.sa, worker)) {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		    "unable to start new connection");
+	    }
+	    break;
+	case WORKER_CMD_LISTEN:
+	    if (worker_listen(worker) == 0)
+		sudo_warnx("%s", U_("unable setup listen socket"));
+	    break;
+	case WORKER_CMD_PAUSE:
+	    worker_pause(worker);
+	    break;
+	case WORKER_CMD_SHUTDOWN:
+	    /* Stop accepting connections on our own listeners. */
+	    sudo_ev_del(worker->evbase, worker->cmd_ev);
+	    TAILQ_FOREACH(l, &worker->listeners, entries)
+		sudo_ev_del(worker->evbase, l->ev);
+	    server_shutdown(worker);
+	    debug_return;
+	default:
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unexpected command %d for worker %u", cmd.type, worker->id);
+	    break;
+	}
+    }
+
+    debug_return;
+}
+
+/*
+ * Worker thread main loop.
+ */
+static void *
+worker_thread(void *v)
+{
+    struct logsrvd_worker *worker = v;
+    debug_decl(worker_thread, SUDO_DEBUG_UTIL);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: worker %u starting",
+	__func__, worker->id);
+    sudo_ev_dispatch(worker->evbase);
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: worker %u exiting",
+	__func__, worker->id);
+
+    debug_return_ptr(NULL);
+}
+#endif /* HAVE_PTHREAD_H */
+
+/*
+ * Allocate the workers along with their event bases and command pipes.
+ * The worker threads are not started until workers_start() is called.
+ */
+static void
+workers_init(struct sudo_event_base *base)
+{
+    unsigned int i;
+#ifdef HAVE_PTHREAD_H
+    int flags;
+#endif
+    debug_decl(workers_init, SUDO_DEBUG_UTIL);
+
+    nworkers = logsrvd_conf_workers();
+#ifndef HAVE_PTHREAD_H
+    if (nworkers > 1) {
+	sudo_warnx(U_("worker threads are not supported on this system"));
+	nworkers = 1;
+    }
+#endif
+    workers = calloc(nworkers, sizeof(*workers));
+    if (workers == NULL)
+	sudo_fatal(NULL);
+    for (i = 0; i < nworkers; i++) {
+	if (!metrics_register(&workers[i].metrics))
+	    sudo_fatal(NULL);
+    }
+
+    /* With SO_REUSEPORT, each worker gets its own listener per address. */
+    if (logsrvd_conf_reuse_port() && nworkers > 1) {
+#ifdef SO_REUSEPORT
+	reuse_port = true;
+#else
+	sudo_warnx(U_("%s not supported on this system, ignoring"),
+	    "reuse_port");
+#endif
+    }
+
+    if (nworkers == 1) {
+	/* A single worker runs in the main thread. */
+	TAILQ_INIT(&workers[0].connections);
+	TAILQ_INIT(&workers[0].listeners);
+	workers[0].evbase = base;
+	workers[0].cmd_pipe[0] = -1;
+	workers[0].cmd_pipe[1] = -1;
+	debug_return;
+    }
+
+#ifdef HAVE_PTHREAD_H
+    for (i = 0; i < nworkers; i++) {
+	struct logsrvd_worker *worker = &workers[i];
+
+	worker->id = i;
+	TAILQ_INIT(&worker->connections);
+	TAILQ_INIT(&worker->listeners);
+	if ((worker->evbase = sudo_ev_base_alloc()) == NULL)
+	    sudo_fatal(NULL);
+	if (pipe(worker->cmd_pipe) == -1)
+	    sudo_fatal("pipe");
+	flags = fcntl(worker->cmd_pipe[0], F_GETFL, 0);
+	if (flags == -1 ||
+		fcntl(worker->cmd_pipe[0], F_SETFL, flags | O_NONBLOCK) == -1)
+	    sudo_fatal("fcntl(O_NONBLOCK)");
+	worker->cmd_ev = sudo_ev_alloc(worker->cmd_pipe[0],
+	    SUDO_EV_READ|SUDO_EV_PERSIST, worker_cmd_cb, worker);
+	if (worker->cmd_ev == NULL)
+	    sudo_fatal(NULL);
+	if (sudo_ev_add(worker->evbase, worker->cmd_ev, NULL, false) == -1)
+	    sudo_fatal("%s", U_("unable to add event to queue"));
+    }
+#endif /* HAVE_PTHREAD_H */
+
+    debug_return;
+}
+
+/*
+ * Start the worker threads, if any.
+ * Must be called after daemonize() since fork(2) only
+ * duplicates the calling thread.
+ */
+static void
+workers_start(void)
+{
+#if defined(HAVE_PTHREAD_H) || defined(HAVE_IO_URING)
+    unsigned int i;
+#endif
+#ifdef HAVE_PTHREAD_H
+    sigset_t mask, omask;
+    int error;
+#endif
+    debug_decl(workers_start, SUDO_DEBUG_UTIL);
+
+#ifdef HAVE_IO_URING
+    /* An io_uring instance is not shared with the child after fork(2). */
+    for (i = 0; i < nworkers; i++)
+	workers[i].uring = uring_alloc(workers[i].evbase);
+#endif
+
+#ifdef HAVE_PTHREAD_H
+    if (nworkers < 2)
+	debug_return;
+
+    /* Signals are handled by the main thread only. */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, &omask);
+
+    for (i = 0; i < nworkers; i++) {
+	struct logsrvd_worker *worker = &workers[i];
+
+	error = pthread_create(&worker->thread, NULL, worker_thread, worker);
+	if (error != 0) {
+	    errno = error;
+	    sudo_fatal("pthread_create");
+	}
+    }
+
+    pthread_sigmask(SIG_SETMASK, &omask, NULL);
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: started %u workers",
+	__func__, nworkers);
+#endif /* HAVE_PTHREAD_H */
+
+    debug_return;
+}
+
+/*
+ * Stop all workers so that the configuration can be safely replaced.
+ * Does not return until every worker thread is blocked in worker_pause().
+ */
+static void
+workers_pause(void)
+{
+#ifdef HAVE_PTHREAD_H
+    struct worker_cmd cmd;
+    unsigned int i, nsent = 0;
+    debug_decl(workers_pause, SUDO_DEBUG_UTIL);
+
+    if (nworkers < 2)
+	debug_return;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.type = WORKER_CMD_PAUSE;
+    for (i = 0; i < nworkers; i++) {
+	if (worker_send_cmd(&workers[i], &cmd))
+	    nsent++;
+    }
+
+    pthread_mutex_lock(&pause_mutex);
+    while (workers_paused != nsent)
+	pthread_cond_wait(&pause_cond, &pause_mutex);
+    pthread_mutex_unlock(&pause_mutex);
+
+    debug_return;
+#endif /* HAVE_PTHREAD_H */
+}
+
+/*
+ * Restart workers stopped by workers_pause().
+ */
+static void
+workers_resume(void)
+{
+#ifdef HAVE_PTHREAD_H
+    debug_decl(workers_resume, SUDO_DEBUG_UTIL);
+
+    if (nworkers < 2)
+	debug_return;
+
+    pthread_mutex_lock(&pause_mutex);
+    workers_paused = 0;
+    pause_generation++;
+    pthread_cond_broadcast(&pause_cond);
+    pthread_mutex_unlock(&pause_mutex);
+
+    debug_return;
+#endif /* HAVE_PTHREAD_H */
+}
+
+/*
+ * Shut down the workers' active connections.
+ * With worker threads, the main event loop exits immediately
+ * and the caller must wait for the threads using workers_join().
+ */
+static void
+workers_shutdown(struct sudo_event_base *base)
+{
+#ifdef HAVE_PTHREAD_H
+    struct worker_cmd cmd;
+    unsigned int i;
+#endif
+    debug_decl(workers_shutdown, SUDO_DEBUG_UTIL);
+
+    if (nworkers == 1) {
+	server_shutdown(&workers[0]);
+	debug_return;
+    }
+
+#ifdef HAVE_PTHREAD_H
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.type = WORKER_CMD_SHUTDOWN;
+    for (i = 0; i < nworkers; i++)
+	worker_send_cmd(&workers[i], &cmd);
+
+    /* Stop accepting new connections. */
+    sudo_ev_loopbreak(base);
+#endif
+
+    debug_return;
+}
+
+/*
+ * Wait for the worker threads (if any) to exit.
+ * Pending I/O log writes are completed before returning.
+ */
+static void
+workers_join(void)
+{
+#if defined(HAVE_PTHREAD_H) || defined(HAVE_IO_URING)
+    unsigned int i;
+#endif
+#ifdef HAVE_PTHREAD_H
+    int error;
+#endif
+    debug_decl(workers_join, SUDO_DEBUG_UTIL);
+
+#ifdef HAVE_PTHREAD_H
+    if (nworkers > 1) {
+	for (i = 0; i < nworkers; i++) {
+	    error = pthread_join(workers[i].thread, NULL);
+	    if (error != 0) {
+		errno = error;
+		sudo_warn("pthread_join");
+	    }
+	}
+    }
+#endif /* HAVE_PTHREAD_H */
+
+#ifdef HAVE_IO_URING
+    for (i = 0; i < nworkers; i++) {
+	uring_free(workers[i].uring);
+	workers[i].uring = NULL;
+    }
+#endif
+
+    debug_return;
+}
+
+/*
+ * Hand off a newly-accepted connection to a worker.
+ */
+static bool
+dispatch_connection(int sock, bool tls, union sockaddr_union *s_un)
+{
+#ifdef HAVE_PTHREAD_H
+    struct logsrvd_worker *worker;
+    struct worker_cmd cmd;
+#endif
+    debug_decl(dispatch_connection, SUDO_DEBUG_UTIL);
+
+    if (nworkers == 1)
+	debug_return_bool(new_connection(sock, tls, &s_un->sa, &workers[0]));
+
+#ifdef HAVE_PTHREAD_H
+    /* Distribute connections among the workers round-robin. */
+    worker = &workers[next_worker];
+    next_worker = (next_worker + 1) % nworkers;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.type = WORKER_CMD_CONNECTION;
+    cmd.sock = sock;
+    cmd.tls = tls;
+    cmd.s_un = *s_un;
+    if (worker_send_cmd(worker, &cmd))
+	debug_return_bool(true);
+    close(sock);
+#endif
+
+    debug_return_bool(false);
+}
+
 static void
 listener_cb(int fd, int what, void *v)
 {
     struct listener *l = v;
-    struct sudo_event_base *evbase = sudo_ev_get_base(l->ev);
     union sockaddr_union s_un;
     socklen_t salen = sizeof(s_un);
     int sock;
@@ -1692,7 +2937,13 @@ listener_cb(int fd, int what, void *v)
 		    "unable to set SO_KEEPALIVE option");
 	    }
 	}
-	if (!new_connection(sock, l->tls, &s_un.sa, evbase)) {
+	if (l->worker != NULL) {
+	    /* Listener belongs to a worker, no need to dispatch. */
+	    if (!new_connection(sock, l->tls, &s_un.sa, l->worker)) {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		    "unable to start new connection");
+	    }
+	} else if (!dispatch_connection(sock, l->tls, &s_un)) {
 	    /* TODO: pause accepting on ENOMEM */
 	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 		"unable to start new connection");
@@ -1708,14 +2959,40 @@ listener_cb(int fd, int what, void *v)
     debug_return;
 }
 
+/*
+ * Accept a connection to the metrics listener.
+ */
+static void
+metrics_listener_cb(int fd, int what, void *v)
+{
+    struct listener *l = v;
+    int sock;
+    debug_decl(metrics_listener_cb, SUDO_DEBUG_UTIL);
+
+    sock = accept(fd, NULL, NULL);
+    if (sock != -1) {
+	metrics_serve(sock, sudo_ev_get_base(l->ev));
+    } else if (errno != EAGAIN) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to accept new metrics connection");
+    }
+
+    debug_return;
+}
+
+/*
+ * Register a listener for addr.  If worker is non-NULL, the listener
+ * uses SO_REUSEPORT and connections are accepted by the worker itself.
+ */
 static bool
-register_listener(struct listen_address *addr, struct sudo_event_base *evbase)
+register_listener(struct listen_address *addr, struct sudo_event_base *evbase,
+    struct logsrvd_worker *worker, sudo_ev_callback_t callback)
 {
     struct listener *l;
     int sock;
     debug_decl(register_listener, SUDO_DEBUG_UTIL);
 
-    sock = create_listener(addr);
+    sock = create_listener(addr, worker != NULL);
     if (sock == -1)
 	debug_return_bool(false);
 
@@ -1724,42 +3001,120 @@ register_listener(struct listen_address *addr, struct sudo_event_base *evbase)
 	sudo_fatal(NULL);
     l->sock = sock;
     l->tls = addr->tls;
-    l->ev = sudo_ev_alloc(sock, SUDO_EV_READ|SUDO_EV_PERSIST, listener_cb, l);
+    l->worker = worker;
+    l->ev = sudo_ev_alloc(sock, SUDO_EV_READ|SUDO_EV_PERSIST, callback, l);
     if (l->ev == NULL)
 	sudo_fatal(NULL);
     if (sudo_ev_add(evbase, l->ev, NULL, false) == -1)
 	sudo_fatal("%s", U_("unable to add event to queue"));
-    TAILQ_INSERT_TAIL(&listeners, l, entries);
+    TAILQ_INSERT_TAIL(worker ? &worker->listeners : &listeners, l, entries);
 
     debug_return_bool(true);
 }
 
+/*
+ * Close the listeners in list and free them.
+ * Must be called by the thread that owns the listeners' event base.
+ */
+static void
+listeners_free(struct listener_list *list)
+{
+    struct listener *l;
+    debug_decl(listeners_free, SUDO_DEBUG_UTIL);
+
+    while ((l = TAILQ_FIRST(list)) != NULL) {
+	TAILQ_REMOVE(list, l, entries);
+	sudo_ev_free(l->ev);
+	close(l->sock);
+	free(l);
+    }
+
+    debug_return;
+}
+
+/*
+ * Replace a worker's listeners with a new set, one per listen address,
+ * using SO_REUSEPORT.  Only the worker itself may do this once its
+ * thread is running since the listener events are in its event base.
+ * Returns the number of listeners created.
+ */
+static int
+worker_listen(struct logsrvd_worker *worker)
+{
+    struct listen_address *addr;
+    int nlisteners = 0;
+    debug_decl(worker_listen, SUDO_DEBUG_UTIL);
+
+    listeners_free(&worker->listeners);
+    TAILQ_FOREACH(addr, logsrvd_conf_listen_address(), entries) {
+	nlisteners += register_listener(addr, worker->evbase, worker,
+	    listener_cb);
+    }
+
+    debug_return_int(nlisteners);
+}
+
+/*
+ * Tell the running workers to replace their listeners after the
+ * configuration has been reloaded.
+ */
+static void
+workers_listen(void)
+{
+#ifdef HAVE_PTHREAD_H
+    struct worker_cmd cmd;
+    unsigned int i;
+    debug_decl(workers_listen, SUDO_DEBUG_UTIL);
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.type = WORKER_CMD_LISTEN;
+    for (i = 0; i < nworkers; i++) {
+	if (!worker_send_cmd(&workers[i], &cmd))
+	    sudo_warnx(U_("unable to update listeners for worker %u"), i);
+    }
+
+    debug_return;
+#endif /* HAVE_PTHREAD_H */
+}
+
 /*
  * Register listeners and init the TLS context.
+ * With reuse_port, running workers replace their own listeners,
+ * see workers_listen(), so only the first call sets them up.
  */
 static bool
-server_setup(struct sudo_event_base *base)
+server_setup(struct sudo_event_base *base, bool reload)
 {
     struct listen_address *addr;
-    struct listener *l;
     int nlisteners = 0;
     bool ret, config_tls = false;
+    unsigned int i;
     debug_decl(server_setup, SUDO_DEBUG_UTIL);
 
     /* Free old listeners (if any) and register new ones. */
-    while ((l = TAILQ_FIRST(&listeners)) != NULL) {
-	TAILQ_REMOVE(&listeners, l, entries);
-	sudo_ev_free(l->ev);
-	close(l->sock);
-	free(l);
-    }
+    listeners_free(&listeners);
     TAILQ_FOREACH(addr, logsrvd_conf_listen_address(), entries) {
-	nlisteners += register_listener(addr, base);
+	if (!reuse_port) {
+	    nlisteners += register_listener(addr, base, NULL, listener_cb);
+	} else if (reload) {
+	    /* Checked by the workers themselves. */
+	    nlisteners++;
+	}
 	if (addr->tls)
 	    config_tls = true;
     }
+    if (reuse_port && !reload) {
+	for (i = 0; i < nworkers; i++)
+	    nlisteners += worker_listen(&workers[i]);
+    }
     ret = nlisteners > 0;
 
+    /* Metrics are served by the main thread. */
+    TAILQ_FOREACH(addr, logsrvd_conf_metrics_address(), entries) {
+	if (!register_listener(addr, base, NULL, metrics_listener_cb))
+	    ret = false;
+    }
+
     if (ret && config_tls) {
 #if defined(HAVE_OPENSSL)
 	if (!init_tls_server_context())
@@ -1776,14 +3131,37 @@ server_setup(struct sudo_event_base *base)
 static void
 server_reload(struct sudo_event_base *base)
 {
+    bool reloaded = false;
     debug_decl(server_reload, SUDO_DEBUG_UTIL);
 
     sudo_debug_printf(SUDO_DEBUG_INFO, "reloading server config");
+
+    /* The workers must not use the old config while we replace it. */
+    workers_pause();
     if (logsrvd_conf_read(conf_file)) {
+	reloaded = true;
+
 	/* Re-initialize listeners and TLS context. */
-	if (!server_setup(base))
+	if (!server_setup(base, true))
 	    sudo_fatalx("%s", U_("unable setup listen socket"));
 
+	/* Start the relay if it was enabled. */
+	if (!relay_init(base))
+	    sudo_fatalx("%s", U_("unable to initialize relay"));
+
+	/* The worker threads and their listeners are fixed at startup. */
+	if (logsrvd_conf_workers() != nworkers) {
+	    sudo_warnx(U_("%s changed from %u to %u, restart %s to apply"),
+		"workers", nworkers, logsrvd_conf_workers(), getprogname());
+	}
+#ifdef SO_REUSEPORT
+	if (nworkers > 1 && logsrvd_conf_reuse_port() != reuse_port) {
+	    sudo_warnx(U_("%s changed from %s to %s, restart %s to apply"),
+		"reuse_port", reuse_port ? "true" : "false",
+		reuse_port ? "false" : "true", getprogname());
+	}
+#endif
+
 	/* Re-read sudo.conf and re-initialize debugging. */
 	sudo_debug_deregister(logsrvd_debug_instance);
 	logsrvd_debug_instance = SUDO_DEBUG_INSTANCE_INITIALIZER;
@@ -1792,6 +3170,11 @@ server_reload(struct sudo_event_base *base)
 		NULL, NULL, sudo_conf_debug_files(getprogname()));
 	}
     }
+    workers_resume();
+
+    /* Each worker replaces the listeners in its own event base. */
+    if (reloaded && reuse_port)
+	workers_listen();
 
     debug_return;
 }
@@ -1808,8 +3191,9 @@ signal_cb(int signo, int what, void *v)
 	    break;
 	case SIGINT:
 	case SIGTERM:
-	    /* Shut down active connections. */
-	    server_shutdown(base);
+	    /* Shut down the relay and active connections. */
+	    relay_shutdown();
+	    workers_shutdown(base);
 	    break;
 	default:
 	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
@@ -1878,6 +3262,34 @@ write_pidfile(void)
     debug_return;
 }
 
+/*
+ * Conversation function used by sudo_warn() and sudo_fatal() once the
+ * standard error has been redirected to /dev/null; logs to syslog.
+ */
+static int
+logsrvd_conv_syslog(int num_msgs, const struct sudo_conv_message msgs[],
+    struct sudo_conv_reply replies[], struct sudo_conv_callback *callback)
+{
+    char buf[4096];
+    size_t len = 0;
+    int i;
+
+    /*
+     * The first two messages are the program name and ": ", which
+     * syslog already provides.  Skip the trailing newline too.
+     */
+    buf[0] = '\0';
+    for (i = 2; i < num_msgs && len < sizeof(buf) - 1; i++) {
+	if (strcmp(msgs[i].msg, "\n") == 0)
+	    continue;
+	len += strlcpy(buf + len, msgs[i].msg, sizeof(buf) - len);
+    }
+    if (len != 0)
+	syslog(LOG_ERR, "%s", buf);
+
+    return 0;
+}
+
 /*
  * Fork, detach from the terminal and write pid file unless nofork set.
  */
@@ -1913,6 +3325,9 @@ daemonize(bool nofork)
 	(void) dup2(fd, STDERR_FILENO);
 	if (fd > STDERR_FILENO)
 	    (void) close(fd);
+
+	/* Warnings, such as those on reload, must still be seen. */
+	sudo_warn_set_conversation(logsrvd_conv_syslog);
     }
 
     debug_return;
@@ -2028,8 +3443,11 @@ main(int argc, char *argv[])
 	sudo_fatal(NULL);
 
     /* Initialize listeners and TLS context. */
-    if (!server_setup(evbase))
+    workers_init(evbase);
+    if (!server_setup(evbase, false))
 	sudo_fatalx("%s", U_("unable setup listen socket"));
+    if (!relay_init(evbase))
+	sudo_fatalx("%s", U_("unable to initialize relay"));
 
     register_signal(SIGHUP, evbase);
     register_signal(SIGINT, evbase);
@@ -2039,7 +3457,17 @@ main(int argc, char *argv[])
     daemonize(nofork);
     signal(SIGPIPE, SIG_IGN);
 
+    /* Start worker threads, if any. */
+    workers_start();
+
     sudo_ev_dispatch(evbase);
+    workers_join();
+    relay_free();
+#if defined(HAVE_OPENSSL)
+    /* deallocate server's SSL context object */
+    if (logsrvd_get_tls_runtime() != NULL)
+	SSL_CTX_free(logsrvd_get_tls_runtime()->ssl_ctx);
+#endif
     if (!nofork && logsrvd_conf_pid_file() != NULL)
 	unlink(logsrvd_conf_pid_file());
 
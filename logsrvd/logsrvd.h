@@ -33,6 +33,7 @@
 
 /* Default timeout value for server socket */
 #define DEFAULT_SOCKET_TIMEOUT_SEC 30
+#define DEFAULT_TLS_SESSION_TIMEOUT 3600
 
 /* How often to send an ACK to the client (commit point) in seconds */
 #define ACK_FREQUENCY	10
@@ -40,6 +41,25 @@
 /* Shutdown timeout (in seconds) in case client connections time out. */
 #define SHUTDOWN_TIMEO	10
 
+/* Upper bound on the number of sessions multiplexed over a connection. */
+#define SESSIONS_MAX	1024
+
+/* Upper bound on the number of worker threads. */
+#define LOGSRVD_WORKERS_MAX	256
+
+/* Write buffered I/O log data when it exceeds this many bytes. */
+#define IOLOG_BUFSIZ	(64 * 1024)
+
+/* Size of a protobuf arena chunk and the most an idle arena may retain. */
+#define ARENA_CHUNK_SIZE	(8 * 1024)
+#define ARENA_SIZE_MAX		(64 * 1024)
+
+/* Default port for the metrics listener, which has no TLS variant. */
+#define DEFAULT_METRICS_PORT	"30345"
+
+/* How long to wait (in seconds) before retrying a failed relay. */
+#define RELAY_RETRY_INTERVAL	30
+
 /*
  * Connection status.
  * In the RUNNING state we expect I/O log buffers.
@@ -53,15 +73,102 @@ enum connection_status {
     ERROR
 };
 
+/*
+ * Region allocator for per-connection and per-message data.
+ * Also used as a protobuf-c allocator to unpack messages.
+ */
+struct arena_chunk;
+struct logsrvd_arena {
+    struct arena_chunk *chunks;
+    size_t size;
+    unsigned long long nallocs;		/* allocations from the arena */
+    unsigned long long nbytes;		/* bytes allocated from the arena */
+    unsigned long long nmallocs;	/* chunks allocated via malloc(3) */
+    ProtobufCAllocator allocator;
+};
+
+/*
+ * Latency histogram, bucket upper bounds are in logsrvd_metrics.c.
+ */
+#define METRICS_NBUCKETS	12
+struct metrics_histogram {
+    unsigned long long buckets[METRICS_NBUCKETS];
+    unsigned long long count;
+    unsigned long long sum_ns;
+};
+
+/*
+ * Counters for the metrics listener.  Each worker has its own set
+ * that is only updated by that worker and summed when read by the
+ * main thread.  Relaxed atomics are enough since the counters are
+ * independent of each other.
+ */
+#ifdef HAVE___ATOMIC_COMPARE_EXCHANGE_N
+# define METRICS_ADD(_v, _n)	__atomic_fetch_add(&(_v), (_n), __ATOMIC_RELAXED)
+# define METRICS_SUB(_v, _n)	__atomic_fetch_sub(&(_v), (_n), __ATOMIC_RELAXED)
+# define METRICS_GET(_v)	__atomic_load_n(&(_v), __ATOMIC_RELAXED)
+#else
+# define METRICS_ADD(_v, _n)	((_v) += (_n))
+# define METRICS_SUB(_v, _n)	((_v) -= (_n))
+# define METRICS_GET(_v)	(_v)
+#endif
+struct logsrvd_metrics {
+    unsigned long long connections_active;
+    unsigned long long connections_total;
+    unsigned long long connection_errors;
+    unsigned long long tls_resumed;
+    unsigned long long tls_ktls;
+    unsigned long long commit_points;
+    unsigned long long iobuf_messages[IOFD_MAX];
+    unsigned long long iobuf_bytes[IOFD_MAX];
+    unsigned long long arena_allocs;
+    unsigned long long arena_mallocs;
+    struct metrics_histogram tls_handshake;
+    struct metrics_histogram commit_lag;
+    struct metrics_histogram iolog_flush;
+};
+
+#ifdef HAVE_ZLIB_H
+/*
+ * State for an I/O log stream the client sends as raw deflate data.
+ * The data is always inflated to verify it, then either appended as-is
+ * to a gzip member we frame ourselves or, if the I/O log is not
+ * compressed, stored inflated.
+ */
+struct iolog_deflate {
+    z_stream *zs;		/* inflate state for the client's stream */
+    uLong crc;			/* CRC-32 of the current gzip member */
+    uLong isize;		/* uncompressed size of the gzip member */
+    off_t start;		/* file offset of the gzip member */
+    bool passthru;		/* writing deflate data to a gzip member */
+};
+#endif
+
 /*
  * Per-connection state.
+ * Sessions multiplexed over a connection have their own closure
+ * that shares the connection's socket, buffers and events.
  */
+struct logsrvd_worker;
+struct logsrvd_uring;
+struct connection_closure;
+TAILQ_HEAD(connection_list, connection_closure);
 struct connection_closure {
     TAILQ_ENTRY(connection_closure) entries;
+    struct connection_closure *mux;	/* connection the session is on */
+    struct connection_list sessions;	/* multiplexed sessions */
+    uint32_t session_id;		/* non-zero if multiplexed */
+    struct logsrvd_worker *worker;
+    struct logsrvd_metrics *metrics;
     struct eventlog *evlog;
     struct timespec elapsed_time;
+    struct timespec index_time;		/* elapsed time of last index entry */
+    struct timespec start_time;		/* when the connection was accepted */
+    struct timespec uncommitted_time;	/* oldest I/O not yet committed */
     struct connection_buffer read_buf;
     struct connection_buffer write_buf;
+    struct logsrvd_arena arena;		/* freed with the connection */
+    struct logsrvd_arena msg_arena;	/* reset after each message */
     struct sudo_event_base *evbase;
     struct sudo_event *commit_ev;
     struct sudo_event *read_ev;
@@ -72,12 +179,33 @@ struct connection_closure {
 #endif
     const char *errstr;
     struct iolog_file iolog_files[IOFD_MAX];
+    struct connection_buffer iolog_bufs[IOFD_MAX];
+    unsigned int iolog_buffered;
+#ifdef HAVE_ZLIB_H
+    struct iolog_deflate iolog_deflate[IOFD_MAX];
+    struct connection_buffer inflate_buf;
+#endif
+#ifdef HAVE_IO_URING
+    struct logsrvd_uring *uring;
+    off_t iolog_offsets[IOFD_MAX];
+    unsigned int uring_pending;
+    unsigned int uring_unsynced;	/* IOFD bits written since last sync */
+    struct timespec commit_time;	/* elapsed time of deferred commit */
+    bool uring_error;
+    bool commit_deferred;
+#endif
     bool tls;
     bool log_io;
+    bool compression_offered;	/* ServerHello advertised deflate */
+    bool compression;		/* I/O buffers are deflate compressed */
+    bool multiplex;		/* ServerHello advertised sessions */
+    bool end_requested;		/* client ended the session, ack when done */
     bool read_instead_of_write;
     bool write_instead_of_read;
     bool temporary_write_event;
     int iolog_dir_fd;
+    int journal_fd;
+    char *journal_path;
     int sock;
 #ifdef HAVE_STRUCT_IN6_ADDR
     char ipaddr[INET6_ADDRSTRLEN];
@@ -112,6 +240,7 @@ TAILQ_HEAD(listen_address_list, listen_address);
  */
 struct listener {
     TAILQ_ENTRY(listener) entries;
+    struct logsrvd_worker *worker;	/* non-NULL for SO_REUSEPORT */
     struct sudo_event *ev;
     int sock;
     bool tls;
@@ -127,6 +256,8 @@ struct logsrvd_tls_config {
     char *dhparams_path;
     char *ciphers_v12;
     char *ciphers_v13;
+    unsigned int session_timeout;
+    bool ktls;
     bool verify;
     bool check_peer;
 };
@@ -136,24 +267,79 @@ struct logsrvd_tls_runtime {
 };
 #endif
 
+/* logsrvd.c */
+void logsrvd_lock(void);
+void logsrvd_unlock(void);
+#if defined(HAVE_OPENSSL)
+bool init_tls_ciphersuites(SSL_CTX *ctx, const struct logsrvd_tls_config *tls_config);
+#endif
+
 /* iolog_writer.c */
-struct eventlog *evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen);
+struct eventlog *evlog_new(struct logsrvd_arena *arena, TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen);
 bool iolog_init(AcceptMessage *msg, struct connection_closure *closure);
 bool iolog_restart(RestartMessage *msg, struct connection_closure *closure);
 int store_iobuf(int iofd, IoBuffer *msg, struct connection_closure *closure);
 int store_suspend(CommandSuspend *msg, struct connection_closure *closure);
 int store_winsize(ChangeWindowSize *msg, struct connection_closure *closure);
+bool iolog_flush_all(struct connection_closure *closure, bool sync);
 void iolog_close_all(struct connection_closure *closure);
+void update_elapsed_time(TimeSpec *delta, struct timespec *elapsed);
+
+/* logsrvd_arena.c */
+void arena_init(struct logsrvd_arena *arena);
+void *arena_alloc(struct logsrvd_arena *arena, size_t size);
+void *arena_calloc(struct logsrvd_arena *arena, size_t nmemb, size_t size);
+char *arena_strdup(struct logsrvd_arena *arena, const char *src);
+void arena_reset(struct logsrvd_arena *arena);
+void arena_stats(struct logsrvd_arena *arena, const char *name);
+void arena_free(struct logsrvd_arena *arena);
+
+/* logsrvd_metrics.c */
+bool metrics_register(struct logsrvd_metrics *metrics);
+void metrics_observe(struct metrics_histogram *hist, const struct timespec *start);
+void metrics_serve(int sock, struct sudo_event_base *base);
+
+/* logsrvd_journal.c */
+bool journal_create(struct connection_closure *closure);
+bool journal_write(uint8_t *buf, size_t len, struct connection_closure *closure);
+bool journal_sync(struct connection_closure *closure);
+bool journal_finish(struct connection_closure *closure);
+
+/* logsrvd_relay.c */
+bool relay_init(struct sudo_event_base *base);
+void relay_wakeup(void);
+void relay_shutdown(void);
+void relay_free(void);
+
+#ifdef HAVE_IO_URING
+/* logsrvd_uring.c */
+struct logsrvd_uring *uring_alloc(struct sudo_event_base *base);
+void uring_free(struct logsrvd_uring *ring);
+bool uring_flush(struct connection_closure *closure, bool sync);
+bool uring_close(struct connection_closure *closure, int iofd);
+void uring_detach(struct connection_closure *closure);
+#endif
 
 /* logsrvd_conf.c */
 bool logsrvd_conf_read(const char *path);
 const char *logsrvd_conf_iolog_dir(void);
 const char *logsrvd_conf_iolog_file(void);
+bool logsrvd_conf_iolog_flush(void);
 struct listen_address_list *logsrvd_conf_listen_address(void);
+struct listen_address_list *logsrvd_conf_metrics_address(void);
 bool logsrvd_conf_tcp_keepalive(void);
+bool logsrvd_conf_compression(void);
+unsigned int logsrvd_conf_workers(void);
+bool logsrvd_conf_reuse_port(void);
 const char *logsrvd_conf_pid_file(void);
 struct timespec *logsrvd_conf_get_sock_timeout(void);
+const char *logsrvd_conf_relay_host(void);
+const char *logsrvd_conf_relay_port(void);
+const char *logsrvd_conf_relay_dir(void);
+struct timespec *logsrvd_conf_relay_retry_interval(void);
 #if defined(HAVE_OPENSSL)
+bool logsrvd_conf_relay_tls(void);
+const struct logsrvd_tls_config *logsrvd_conf_relay_tls_config(void);
 const struct logsrvd_tls_config *logsrvd_get_tls_config(void);
 struct logsrvd_tls_runtime *logsrvd_get_tls_runtime(void);
 #endif
@@ -0,0 +1,238 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sudo_compat.h"
+#include "sudo_debug.h"
+#include "sudo_event.h"
+#include "sudo_eventlog.h"
+#include "sudo_iolog.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+
+#include "log_server.pb-c.h"
+#include "logsrvd.h"
+
+/*
+ * Simple region allocator.  Memory is carved out of large chunks
+ * and is only released when the arena is reset or freed.
+ * Used to unpack protobuf messages without a malloc/free per field.
+ */
+
+#define ARENA_ALIGN(_n)	(((_n) + 15) & ~(size_t)15)
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    /* data follows, 16-byte aligned */
+};
+#define ARENA_HDRSIZE	ARENA_ALIGN(sizeof(struct arena_chunk))
+
+static void *
+arena_pb_alloc(void *v, size_t size)
+{
+    return arena_alloc(v, size);
+}
+
+static void
+arena_pb_free(void *v, void *ptr)
+{
+    /* Memory is released by arena_reset(). */
+    return;
+}
+
+void
+arena_init(struct logsrvd_arena *arena)
+{
+    debug_decl(arena_init, SUDO_DEBUG_UTIL);
+
+    memset(arena, 0, sizeof(*arena));
+    arena->allocator.alloc = arena_pb_alloc;
+    arena->allocator.free = arena_pb_free;
+    arena->allocator.allocator_data = arena;
+
+    debug_return;
+}
+
+/*
+ * Allocate size bytes from the arena, adding a new chunk if needed.
+ */
+void *
+arena_alloc(struct logsrvd_arena *arena, size_t size)
+{
+    struct arena_chunk *chunk = arena->chunks;
+    void *ptr;
+    debug_decl(arena_alloc, SUDO_DEBUG_UTIL);
+
+    arena->nallocs++;
+    arena->nbytes += size;
+    size = ARENA_ALIGN(size);
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+	size_t chunk_size = ARENA_CHUNK_SIZE;
+
+	while (chunk_size < size)
+	    chunk_size *= 2;
+	chunk = malloc(ARENA_HDRSIZE + chunk_size);
+	if (chunk == NULL) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to allocate %zu byte arena chunk", chunk_size);
+	    debug_return_ptr(NULL);
+	}
+	chunk->size = chunk_size;
+	chunk->used = 0;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	arena->size += chunk_size;
+	arena->nmallocs++;
+    }
+    ptr = (char *)chunk + ARENA_HDRSIZE + chunk->used;
+    chunk->used += size;
+
+    debug_return_ptr(ptr);
+}
+
+/*
+ * Allocate zero-filled memory for an array of nmemb elements.
+ */
+void *
+arena_calloc(struct logsrvd_arena *arena, size_t nmemb, size_t size)
+{
+    void *ptr;
+    debug_decl(arena_calloc, SUDO_DEBUG_UTIL);
+
+    if (nmemb > 0 && SIZE_MAX / nmemb < size) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%zu * %zu overflows", nmemb, size);
+	debug_return_ptr(NULL);
+    }
+    size *= nmemb;
+    if ((ptr = arena_alloc(arena, size)) != NULL)
+	memset(ptr, 0, size);
+
+    debug_return_ptr(ptr);
+}
+
+/*
+ * Copy a string into the arena.
+ */
+char *
+arena_strdup(struct logsrvd_arena *arena, const char *src)
+{
+    const size_t len = strlen(src) + 1;
+    char *dst;
+    debug_decl(arena_strdup, SUDO_DEBUG_UTIL);
+
+    if ((dst = arena_alloc(arena, len)) != NULL)
+	memcpy(dst, src, len);
+
+    debug_return_str(dst);
+}
+
+/*
+ * Release everything allocated from the arena.
+ * If more than one chunk was needed, they are replaced by a single
+ * chunk big enough for the total so the next use needs no malloc.
+ * Memory used for an unusually large message is not retained.
+ */
+void
+arena_reset(struct logsrvd_arena *arena)
+{
+    struct arena_chunk *chunk = arena->chunks;
+    debug_decl(arena_reset, SUDO_DEBUG_UTIL);
+
+    if (chunk == NULL)
+	debug_return;
+
+    if (arena->size > ARENA_SIZE_MAX) {
+	arena_free(arena);
+	debug_return;
+    }
+    if (chunk->next != NULL) {
+	const size_t total = arena->size;
+
+	arena_free(arena);
+	chunk = malloc(ARENA_HDRSIZE + total);
+	if (chunk == NULL)
+	    debug_return;
+	chunk->size = total;
+	chunk->next = NULL;
+	arena->chunks = chunk;
+	arena->size = total;
+	arena->nmallocs++;
+    }
+    chunk->used = 0;
+
+    debug_return;
+}
+
+/*
+ * Log how many allocations the arena satisfied compared to
+ * the number of times it actually had to call malloc(3).
+ */
+void
+arena_stats(struct logsrvd_arena *arena, const char *name)
+{
+    debug_decl(arena_stats, SUDO_DEBUG_UTIL);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO,
+	"%s arena: %llu allocations, %llu bytes, %llu calls to malloc saved",
+	name, arena->nallocs, arena->nbytes,
+	arena->nallocs > arena->nmallocs ? arena->nallocs - arena->nmallocs : 0);
+
+    debug_return;
+}
+
+/*
+ * Free all memory associated with the arena.
+ */
+void
+arena_free(struct logsrvd_arena *arena)
+{
+    struct arena_chunk *chunk;
+    debug_decl(arena_free, SUDO_DEBUG_UTIL);
+
+    while ((chunk = arena->chunks) != NULL) {
+	arena->chunks = chunk->next;
+	free(chunk);
+    }
+    arena->size = 0;
+
+    debug_return;
+}
@@ -21,7 +21,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include <errno.h>
 #include <ctype.h>
@@ -78,8 +80,12 @@ struct logsrvd_config_section {
 static struct logsrvd_config {
     struct logsrvd_config_server {
         struct listen_address_list addresses;
+        struct listen_address_list metrics_addresses;
         struct timespec timeout;
         bool tcp_keepalive;
+	bool compression;
+	unsigned int workers;
+	bool reuse_port;
 	char *pid_file;
 #if defined(HAVE_OPENSSL)
         bool tls;
@@ -87,9 +93,22 @@ static struct logsrvd_config {
         struct logsrvd_tls_runtime tls_runtime;
 #endif
     } server;
+    struct logsrvd_config_relay {
+	char *relay_str;
+	char *host;
+	char *port;
+	char *relay_dir;
+	struct timespec retry_interval;
+#if defined(HAVE_OPENSSL)
+	bool tls;
+	struct logsrvd_tls_config tls_config;
+#endif
+    } relay;
     struct logsrvd_config_iolog {
-	bool compress;
+	int compress;
+	bool compress_thread;
 	bool flush;
+	bool binary_timing;
 	bool gid_set;
 	uid_t uid;
 	gid_t gid;
@@ -123,6 +142,12 @@ logsrvd_conf_iolog_mode(void)
     return logsrvd_config->iolog.mode;
 }
 
+bool
+logsrvd_conf_iolog_flush(void)
+{
+    return logsrvd_config->iolog.flush;
+}
+
 const char *
 logsrvd_conf_iolog_dir(void)
 {
@@ -142,12 +167,36 @@ logsrvd_conf_listen_address(void)
     return &logsrvd_config->server.addresses;
 }
 
+struct listen_address_list *
+logsrvd_conf_metrics_address(void)
+{
+    return &logsrvd_config->server.metrics_addresses;
+}
+
 bool
 logsrvd_conf_tcp_keepalive(void)
 {
     return logsrvd_config->server.tcp_keepalive;
 }
 
+bool
+logsrvd_conf_compression(void)
+{
+    return logsrvd_config->server.compression;
+}
+
+unsigned int
+logsrvd_conf_workers(void)
+{
+    return logsrvd_config->server.workers;
+}
+
+bool
+logsrvd_conf_reuse_port(void)
+{
+    return logsrvd_config->server.reuse_port;
+}
+
 const char *
 logsrvd_conf_pid_file(void)
 {
@@ -164,6 +213,45 @@ logsrvd_conf_get_sock_timeout(void)
     return NULL;
 }
 
+/* relay getters */
+const char *
+logsrvd_conf_relay_host(void)
+{
+    return logsrvd_config->relay.host;
+}
+
+const char *
+logsrvd_conf_relay_port(void)
+{
+    return logsrvd_config->relay.port;
+}
+
+const char *
+logsrvd_conf_relay_dir(void)
+{
+    return logsrvd_config->relay.relay_dir;
+}
+
+struct timespec *
+logsrvd_conf_relay_retry_interval(void)
+{
+    return &logsrvd_config->relay.retry_interval;
+}
+
+#if defined(HAVE_OPENSSL)
+bool
+logsrvd_conf_relay_tls(void)
+{
+    return logsrvd_config->relay.tls;
+}
+
+const struct logsrvd_tls_config *
+logsrvd_conf_relay_tls_config(void)
+{
+    return &logsrvd_config->relay.tls_config;
+}
+#endif
+
 #if defined(HAVE_OPENSSL)
 const struct logsrvd_tls_config *
 logsrvd_get_tls_config(void)
@@ -211,10 +299,34 @@ cb_iolog_compress(struct logsrvd_config *config, const char *str)
     int val;
     debug_decl(cb_iolog_compress, SUDO_DEBUG_UTIL);
 
+    if (strcmp(str, "gzip") == 0) {
+	config->iolog.compress = IOLOG_COMPRESS_GZIP;
+    } else if (strcmp(str, "zstd") == 0) {
+#ifndef HAVE_ZSTD_H
+	sudo_warnx("%s", U_("zstd compression not supported"));
+	debug_return_bool(false);
+#endif
+	config->iolog.compress = IOLOG_COMPRESS_ZSTD;
+    } else {
+	/* A boolean true value selects gzip for compatibility. */
+	if ((val = sudo_strtobool(str)) == -1)
+	    debug_return_bool(false);
+	config->iolog.compress =
+	    val ? IOLOG_COMPRESS_GZIP : IOLOG_COMPRESS_NONE;
+    }
+    debug_return_bool(true);
+}
+
+static bool
+cb_iolog_compress_thread(struct logsrvd_config *config, const char *str)
+{
+    int val;
+    debug_decl(cb_iolog_compress_thread, SUDO_DEBUG_UTIL);
+
     if ((val = sudo_strtobool(str)) == -1)
 	debug_return_bool(false);
 
-    config->iolog.compress = val;
+    config->iolog.compress_thread = val;
     debug_return_bool(true);
 }
 
@@ -231,6 +343,19 @@ cb_iolog_flush(struct logsrvd_config *config, const char *str)
     debug_return_bool(true);
 }
 
+static bool
+cb_iolog_binary_timing(struct logsrvd_config *config, const char *str)
+{
+    int val;
+    debug_decl(cb_iolog_binary_timing, SUDO_DEBUG_UTIL);
+
+    if ((val = sudo_strtobool(str)) == -1)
+	debug_return_bool(false);
+
+    config->iolog.binary_timing = val;
+    debug_return_bool(true);
+}
+
 static bool
 cb_iolog_user(struct logsrvd_config *config, const char *user)
 {
@@ -304,15 +429,170 @@ cb_iolog_maxseq(struct logsrvd_config *config, const char *str)
     debug_return_bool(true);
 }
 
+/* Relay callbacks */
+static bool
+cb_relay_host(struct logsrvd_config *config, const char *str)
+{
+    char *copy, *host, *port;
+    bool tls;
+    debug_decl(cb_relay_host, SUDO_DEBUG_UTIL);
+
+    if ((copy = strdup(str)) == NULL) {
+	sudo_warn(NULL);
+	debug_return_bool(false);
+    }
+
+    /* Parse host[:port], the address is resolved at connect time. */
+    if (!iolog_parse_host_port(copy, &host, &port, &tls, DEFAULT_PORT,
+	    DEFAULT_PORT_TLS)) {
+	free(copy);
+	debug_return_bool(false);
+    }
+#if defined(HAVE_OPENSSL)
+    config->relay.tls = tls;
+#else
+    if (tls) {
+	sudo_warnx("%s", U_("TLS not supported"));
+	free(copy);
+	debug_return_bool(false);
+    }
+#endif
+
+    free(config->relay.relay_str);
+    config->relay.relay_str = copy;
+    config->relay.host = host;
+    config->relay.port = port;
+
+    debug_return_bool(true);
+}
+
+static bool
+cb_relay_dir(struct logsrvd_config *config, const char *path)
+{
+    debug_decl(cb_relay_dir, SUDO_DEBUG_UTIL);
+
+    if (*path != '/') {
+	sudo_warnx(U_("%s: not a fully qualified path"), path);
+	debug_return_bool(false);
+    }
+    free(config->relay.relay_dir);
+    if ((config->relay.relay_dir = strdup(path)) == NULL) {
+	sudo_warn(NULL);
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+static bool
+cb_relay_retry_interval(struct logsrvd_config *config, const char *str)
+{
+    const char *errstr;
+    int value;
+    debug_decl(cb_relay_retry_interval, SUDO_DEBUG_UTIL);
+
+    value = sudo_strtonum(str, 1, INT_MAX, &errstr);
+    if (errstr != NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "bad retry_interval: %s: %s", str, errstr);
+	debug_return_bool(false);
+    }
+    config->relay.retry_interval.tv_sec = value;
+    debug_return_bool(true);
+}
+
+#if defined(HAVE_OPENSSL)
+static bool
+cb_relay_tls_key(struct logsrvd_config *config, const char *path)
+{
+    debug_decl(cb_relay_tls_key, SUDO_DEBUG_UTIL);
+
+    free(config->relay.tls_config.pkey_path);
+    if ((config->relay.tls_config.pkey_path = strdup(path)) == NULL) {
+        sudo_warn(NULL);
+        debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+static bool
+cb_relay_tls_cacert(struct logsrvd_config *config, const char *path)
+{
+    debug_decl(cb_relay_tls_cacert, SUDO_DEBUG_UTIL);
+
+    free(config->relay.tls_config.cacert_path);
+    if ((config->relay.tls_config.cacert_path = strdup(path)) == NULL) {
+        sudo_warn(NULL);
+        debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+static bool
+cb_relay_tls_cert(struct logsrvd_config *config, const char *path)
+{
+    debug_decl(cb_relay_tls_cert, SUDO_DEBUG_UTIL);
+
+    free(config->relay.tls_config.cert_path);
+    if ((config->relay.tls_config.cert_path = strdup(path)) == NULL) {
+        sudo_warn(NULL);
+        debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+static bool
+cb_relay_tls_ciphers12(struct logsrvd_config *config, const char *str)
+{
+    debug_decl(cb_relay_tls_ciphers12, SUDO_DEBUG_UTIL);
+
+    free(config->relay.tls_config.ciphers_v12);
+    if ((config->relay.tls_config.ciphers_v12 = strdup(str)) == NULL) {
+        sudo_warn(NULL);
+        debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+static bool
+cb_relay_tls_ciphers13(struct logsrvd_config *config, const char *str)
+{
+    debug_decl(cb_relay_tls_ciphers13, SUDO_DEBUG_UTIL);
+
+    free(config->relay.tls_config.ciphers_v13);
+    if ((config->relay.tls_config.ciphers_v13 = strdup(str)) == NULL) {
+        sudo_warn(NULL);
+        debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+static bool
+cb_relay_tls_verify(struct logsrvd_config *config, const char *str)
+{
+    int val;
+    debug_decl(cb_relay_tls_verify, SUDO_DEBUG_UTIL);
+
+    if ((val = sudo_strtobool(str)) == -1)
+	debug_return_bool(false);
+
+    config->relay.tls_config.verify = val;
+    debug_return_bool(true);
+}
+#endif
+
 /* Server callbacks */
+/*
+ * Resolve str as a host[:port] to listen on and add it to addresses.
+ */
 static bool
-cb_listen_address(struct logsrvd_config *config, const char *str)
+add_listen_address(struct listen_address_list *addresses, const char *str,
+    char *defport, char *defport_tls)
 {
     struct addrinfo hints, *res, *res0 = NULL;
     char *copy, *host, *port;
     bool tls, ret = false;
     int error;
-    debug_decl(cb_iolog_mode, SUDO_DEBUG_UTIL);
+    debug_decl(add_listen_address, SUDO_DEBUG_UTIL);
 
     if ((copy = strdup(str)) == NULL) {
 	sudo_warn(NULL);
@@ -320,8 +600,8 @@ cb_listen_address(struct logsrvd_config *config, const char *str)
     }
 
     /* Parse host[:port] */
-    if (!iolog_parse_host_port(copy, &host, &port, &tls, DEFAULT_PORT,
-	    DEFAULT_PORT_TLS))
+    if (!iolog_parse_host_port(copy, &host, &port, &tls, defport,
+	    defport_tls))
 	goto done;
     if (host[0] == '*' && host[1] == '\0')
 	host = NULL;
@@ -358,7 +638,7 @@ cb_listen_address(struct logsrvd_config *config, const char *str)
 	memcpy(&addr->sa_un, res->ai_addr, res->ai_addrlen);
 	addr->sa_size = res->ai_addrlen;
 	addr->tls = tls;
-	TAILQ_INSERT_TAIL(&config->server.addresses, addr, entries);
+	TAILQ_INSERT_TAIL(addresses, addr, entries);
     }
 
     ret = true;
@@ -369,6 +649,106 @@ done:
     debug_return_bool(ret);
 }
 
+static bool
+cb_listen_address(struct logsrvd_config *config, const char *str)
+{
+    debug_decl(cb_listen_address, SUDO_DEBUG_UTIL);
+
+    debug_return_bool(add_listen_address(&config->server.addresses, str,
+	DEFAULT_PORT, DEFAULT_PORT_TLS));
+}
+
+/*
+ * Returns true if addr is a loopback address.
+ */
+static bool
+is_loopback(const struct listen_address *addr)
+{
+    debug_decl(is_loopback, SUDO_DEBUG_UTIL);
+
+    switch (addr->sa_un.sa.sa_family) {
+    case AF_INET:
+	/* 127.0.0.0/8 */
+	if ((ntohl(addr->sa_un.sin.sin_addr.s_addr) >> 24) == 127)
+	    debug_return_bool(true);
+	break;
+#ifdef HAVE_STRUCT_IN6_ADDR
+    case AF_INET6:
+	if (IN6_IS_ADDR_LOOPBACK(&addr->sa_un.sin6.sin6_addr))
+	    debug_return_bool(true);
+	break;
+#endif
+    }
+    debug_return_bool(false);
+}
+
+/*
+ * Add a UNIX domain socket path to listen on.  The socket address
+ * is filled in by the listener from sa_str.
+ */
+static bool
+add_listen_path(struct listen_address_list *addresses, const char *path)
+{
+    struct sockaddr_un sa_un;
+    struct listen_address *addr;
+    debug_decl(add_listen_path, SUDO_DEBUG_UTIL);
+
+    if (strlen(path) >= sizeof(sa_un.sun_path)) {
+	errno = ENAMETOOLONG;
+	sudo_warn("%s", path);
+	debug_return_bool(false);
+    }
+    if ((addr = calloc(1, sizeof(*addr))) == NULL) {
+	sudo_warn(NULL);
+	debug_return_bool(false);
+    }
+    if ((addr->sa_str = strdup(path)) == NULL) {
+	sudo_warn(NULL);
+	free(addr);
+	debug_return_bool(false);
+    }
+    addr->sa_un.sa.sa_family = AF_UNIX;
+    addr->sa_size = sizeof(sa_un);
+    TAILQ_INSERT_TAIL(addresses, addr, entries);
+
+    debug_return_bool(true);
+}
+
+static bool
+cb_metrics_address(struct logsrvd_config *config, const char *str)
+{
+    struct listen_address *addr;
+    debug_decl(cb_metrics_address, SUDO_DEBUG_UTIL);
+
+    if (str[0] == '/') {
+	debug_return_bool(add_listen_path(&config->server.metrics_addresses,
+	    str));
+    }
+
+    if (!add_listen_address(&config->server.metrics_addresses, str,
+	    DEFAULT_METRICS_PORT, DEFAULT_METRICS_PORT))
+	debug_return_bool(false);
+
+    /*
+     * Metrics are served via plain HTTP without authentication,
+     * only local clients may connect.
+     */
+    TAILQ_FOREACH(addr, &config->server.metrics_addresses, entries) {
+	if (addr->sa_un.sa.sa_family == AF_UNIX)
+	    continue;
+	if (addr->tls) {
+	    sudo_warnx(U_("%s: TLS not supported for metrics"), str);
+	    debug_return_bool(false);
+	}
+	if (!is_loopback(addr)) {
+	    sudo_warnx(U_("%s: metrics must be served on a loopback address or UNIX domain socket"),
+		str);
+	    debug_return_bool(false);
+	}
+    }
+    debug_return_bool(true);
+}
+
 static bool
 cb_timeout(struct logsrvd_config *config, const char *str)
 {
@@ -398,6 +778,49 @@ cb_keepalive(struct logsrvd_config *config, const char *str)
     debug_return_bool(true);
 }
 
+static bool
+cb_compression(struct logsrvd_config *config, const char *str)
+{
+    int val;
+    debug_decl(cb_compression, SUDO_DEBUG_UTIL);
+
+    if ((val = sudo_strtobool(str)) == -1)
+	debug_return_bool(false);
+
+    config->server.compression = val;
+    debug_return_bool(true);
+}
+
+static bool
+cb_workers(struct logsrvd_config *config, const char *str)
+{
+    const char *errstr;
+    unsigned int value;
+    debug_decl(cb_workers, SUDO_DEBUG_UTIL);
+
+    value = sudo_strtonum(str, 1, LOGSRVD_WORKERS_MAX, &errstr);
+    if (errstr != NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "bad workers: %s: %s", str, errstr);
+	debug_return_bool(false);
+    }
+    config->server.workers = value;
+    debug_return_bool(true);
+}
+
+static bool
+cb_reuse_port(struct logsrvd_config *config, const char *str)
+{
+    int val;
+    debug_decl(cb_reuse_port, SUDO_DEBUG_UTIL);
+
+    if ((val = sudo_strtobool(str)) == -1)
+	debug_return_bool(false);
+
+    config->server.reuse_port = val;
+    debug_return_bool(true);
+}
+
 static bool
 cb_pid_file(struct logsrvd_config *config, const char *str)
 {
@@ -501,6 +924,34 @@ cb_tls_ciphers13(struct logsrvd_config *config, const char *str)
     debug_return_bool(true);
 }
 
+static bool
+cb_tls_session_timeout(struct logsrvd_config *config, const char *str)
+{
+    unsigned int timeout;
+    const char *errstr;
+    debug_decl(cb_tls_session_timeout, SUDO_DEBUG_UTIL);
+
+    timeout = sudo_strtonum(str, 0, INT_MAX, &errstr);
+    if (errstr != NULL)
+	debug_return_bool(false);
+
+    config->server.tls_config.session_timeout = timeout;
+    debug_return_bool(true);
+}
+
+static bool
+cb_tls_ktls(struct logsrvd_config *config, const char *str)
+{
+    int val;
+    debug_decl(cb_tls_ktls, SUDO_DEBUG_UTIL);
+
+    if ((val = sudo_strtobool(str)) == -1)
+	debug_return_bool(false);
+
+    config->server.tls_config.ktls = val;
+    debug_return_bool(true);
+}
+
 static bool
 cb_tls_verify(struct logsrvd_config *config, const char *str)
 {
@@ -685,8 +1136,12 @@ cb_logfile_time_format(struct logsrvd_config *config, const char *str)
 
 static struct logsrvd_config_entry server_conf_entries[] = {
     { "listen_address", cb_listen_address },
+    { "metrics_address", cb_metrics_address },
     { "timeout", cb_timeout },
     { "tcp_keepalive", cb_keepalive },
+    { "compression", cb_compression },
+    { "workers", cb_workers },
+    { "reuse_port", cb_reuse_port },
     { "pid_file", cb_pid_file },
 #if defined(HAVE_OPENSSL)
     { "tls_key", cb_tls_key },
@@ -695,17 +1150,36 @@ static struct logsrvd_config_entry server_conf_entries[] = {
     { "tls_dhparams", cb_tls_dhparam },
     { "tls_ciphers_v12", cb_tls_ciphers12 },
     { "tls_ciphers_v13", cb_tls_ciphers13 },
+    { "tls_session_timeout", cb_tls_session_timeout },
+    { "tls_ktls", cb_tls_ktls },
     { "tls_checkpeer", cb_tls_checkpeer },
     { "tls_verify", cb_tls_verify },
 #endif
     { NULL }
 };
 
+static struct logsrvd_config_entry relay_conf_entries[] = {
+    { "relay_host", cb_relay_host },
+    { "relay_dir", cb_relay_dir },
+    { "retry_interval", cb_relay_retry_interval },
+#if defined(HAVE_OPENSSL)
+    { "tls_key", cb_relay_tls_key },
+    { "tls_cacert", cb_relay_tls_cacert },
+    { "tls_cert", cb_relay_tls_cert },
+    { "tls_ciphers_v12", cb_relay_tls_ciphers12 },
+    { "tls_ciphers_v13", cb_relay_tls_ciphers13 },
+    { "tls_verify", cb_relay_tls_verify },
+#endif
+    { NULL }
+};
+
 static struct logsrvd_config_entry iolog_conf_entries[] = {
     { "iolog_dir", cb_iolog_dir },
     { "iolog_file", cb_iolog_file },
     { "iolog_flush", cb_iolog_flush },
+    { "iolog_binary_timing", cb_iolog_binary_timing },
     { "iolog_compress", cb_iolog_compress },
+    { "iolog_compress_thread", cb_iolog_compress_thread },
     { "iolog_user", cb_iolog_user },
     { "iolog_group", cb_iolog_group },
     { "iolog_mode", cb_iolog_mode },
@@ -736,6 +1210,7 @@ static struct logsrvd_config_entry logfile_conf_entries[] = {
 
 static struct logsrvd_config_section logsrvd_config_sections[] = {
     { "server", server_conf_entries },
+    { "relay", relay_conf_entries },
     { "iolog", iolog_conf_entries },
     { "eventlog", eventlog_conf_entries },
     { "syslog", syslog_conf_entries },
@@ -903,8 +1378,24 @@ logsrvd_conf_free(struct logsrvd_config *config)
 	free(addr->sa_str);
 	free(addr);
     }
+    while ((addr = TAILQ_FIRST(&config->server.metrics_addresses))) {
+	TAILQ_REMOVE(&config->server.metrics_addresses, addr, entries);
+	free(addr->sa_str);
+	free(addr);
+    }
     free(config->server.pid_file);
 
+    /* struct logsrvd_config_relay */
+    free(config->relay.relay_str);
+    free(config->relay.relay_dir);
+#if defined(HAVE_OPENSSL)
+    free(config->relay.tls_config.pkey_path);
+    free(config->relay.tls_config.cert_path);
+    free(config->relay.tls_config.cacert_path);
+    free(config->relay.tls_config.ciphers_v12);
+    free(config->relay.tls_config.ciphers_v13);
+#endif
+
     /* struct logsrvd_config_iolog */
     free(config->iolog.iolog_dir);
     free(config->iolog.iolog_file);
@@ -946,8 +1437,11 @@ logsrvd_conf_alloc(void)
 
     /* Server defaults */
     TAILQ_INIT(&config->server.addresses);
+    TAILQ_INIT(&config->server.metrics_addresses);
     config->server.timeout.tv_sec = DEFAULT_SOCKET_TIMEOUT_SEC;
     config->server.tcp_keepalive = true;
+    config->server.compression = true;
+    config->server.workers = 1;
     config->server.pid_file = strdup(_PATH_SUDO_LOGSRVD_PID);
     if (config->server.pid_file == NULL) {
 	sudo_warn(NULL);
@@ -978,13 +1472,25 @@ logsrvd_conf_alloc(void)
 	sudo_warn(NULL);
 	goto bad;
     }
+    config->server.tls_config.session_timeout = DEFAULT_TLS_SESSION_TIMEOUT;
+    config->server.tls_config.ktls = false;
     config->server.tls_config.verify = true;
     config->server.tls_config.check_peer = false;
 #endif
 
+    /* Relay defaults */
+    config->relay.retry_interval.tv_sec = RELAY_RETRY_INTERVAL;
+    if (!cb_relay_dir(config, _PATH_SUDO_RELAY_DIR))
+	goto bad;
+#if defined(HAVE_OPENSSL)
+    config->relay.tls_config.verify = true;
+#endif
+
     /* I/O log defaults */
-    config->iolog.compress = false;
+    config->iolog.compress = IOLOG_COMPRESS_NONE;
+    config->iolog.compress_thread = false;
     config->iolog.flush = true;
+    config->iolog.binary_timing = false;
     config->iolog.mode = S_IRUSR|S_IWUSR;
     config->iolog.maxseq = SESSID_MAX;
     if (!cb_iolog_dir(config, _PATH_SUDO_IO_LOGDIR))
@@ -1070,6 +1576,32 @@ logsrvd_conf_apply(struct logsrvd_config *config)
 #endif
     }
 
+#if defined(HAVE_OPENSSL)
+    /* Relay TLS settings not in the relay section come from the server. */
+    if (config->relay.tls) {
+	struct logsrvd_tls_config *relay_tls = &config->relay.tls_config;
+	struct logsrvd_tls_config *server_tls = &config->server.tls_config;
+	char **paths[][2] = {
+	    { &relay_tls->pkey_path, &server_tls->pkey_path },
+	    { &relay_tls->cert_path, &server_tls->cert_path },
+	    { &relay_tls->cacert_path, &server_tls->cacert_path },
+	    { &relay_tls->ciphers_v12, &server_tls->ciphers_v12 },
+	    { &relay_tls->ciphers_v13, &server_tls->ciphers_v13 },
+	    { NULL }
+	};
+	int i;
+
+	for (i = 0; paths[i][0] != NULL; i++) {
+	    if (*paths[i][0] != NULL || *paths[i][1] == NULL)
+		continue;
+	    if ((*paths[i][0] = strdup(*paths[i][1])) == NULL) {
+		sudo_warn(NULL);
+		debug_return_bool(false);
+	    }
+	}
+    }
+#endif
+
     /* Open event log if specified. */
     switch (config->eventlog.log_type) {
     case EVLOG_SYSLOG:
@@ -1091,7 +1623,9 @@ logsrvd_conf_apply(struct logsrvd_config *config)
     /* Set I/O log library settings */
     iolog_set_defaults();
     iolog_set_compress(config->iolog.compress);
+    iolog_set_compress_thread(config->iolog.compress_thread);
     iolog_set_flush(config->iolog.flush);
+    iolog_set_binary_timing(config->iolog.binary_timing);
     iolog_set_owner(config->iolog.uid, config->iolog.gid);
     iolog_set_mode(config->iolog.mode);
     iolog_set_maxseq(config->iolog.maxseq);
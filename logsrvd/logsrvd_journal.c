@@ -0,0 +1,216 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sudo_compat.h"
+#include "sudo_debug.h"
+#include "sudo_fatal.h"
+#include "sudo_gettext.h"
+#include "sudo_iolog.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+
+#include "log_server.pb-c.h"
+#include "logsrvd.h"
+
+/*
+ * In relay mode, each session is stored in a journal file in the
+ * incoming spool directory.  The journal contains the ClientMessages
+ * exactly as they appear on the wire: a 32-bit length in network byte
+ * order followed by the packed message.  When the session is complete
+ * the journal is moved to the outgoing directory to be forwarded.
+ */
+
+/*
+ * Create a new journal file for the connection.
+ * The file name starts with the creation time so that journals
+ * sort in the order they were created.
+ */
+bool
+journal_create(struct connection_closure *closure)
+{
+    char path[PATH_MAX];
+    struct timespec now;
+    int fd, len;
+    debug_decl(journal_create, SUDO_DEBUG_UTIL);
+
+    if (sudo_gettime_real(&now) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to get time of day");
+	closure->errstr = _("unable to create journal file");
+	debug_return_bool(false);
+    }
+    len = snprintf(path, sizeof(path), "%s/incoming/%lld.%09ld.XXXXXX",
+	logsrvd_conf_relay_dir(), (long long)now.tv_sec, now.tv_nsec);
+    if (len < 0 || len >= ssizeof(path)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "journal path too long: %s/incoming", logsrvd_conf_relay_dir());
+	closure->errstr = _("unable to create journal file");
+	debug_return_bool(false);
+    }
+    if ((fd = mkstemp(path)) == -1) {
+	sudo_warn("%s", path);
+	closure->errstr = _("unable to create journal file");
+	debug_return_bool(false);
+    }
+    if ((closure->journal_path = strdup(path)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	unlink(path);
+	close(fd);
+	closure->errstr = _("unable to allocate memory");
+	debug_return_bool(false);
+    }
+    closure->journal_fd = fd;
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: created journal %s",
+	__func__, path);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Append a ClientMessage, in wire format, to the journal.
+ */
+bool
+journal_write(uint8_t *buf, size_t len, struct connection_closure *closure)
+{
+    uint32_t msg_len = htonl((uint32_t)len);
+    struct iovec iov[2];
+    size_t total = sizeof(msg_len) + len;
+    ssize_t nwritten;
+    debug_decl(journal_write, SUDO_DEBUG_UTIL);
+
+    if (closure->journal_fd == -1) {
+	if (!journal_create(closure))
+	    debug_return_bool(false);
+    }
+
+    iov[0].iov_base = &msg_len;
+    iov[0].iov_len = sizeof(msg_len);
+    iov[1].iov_base = buf;
+    iov[1].iov_len = len;
+    nwritten = writev(closure->journal_fd, iov, 2);
+    if (nwritten != (ssize_t)total) {
+	if (nwritten == -1) {
+	    sudo_warn(U_("unable to write to %s"), closure->journal_path);
+	} else {
+	    sudo_warnx(U_("unable to write to %s"), closure->journal_path);
+	}
+	closure->errstr = _("unable to write journal file");
+	debug_return_bool(false);
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Flush the journal to stable storage.
+ * Called before sending a commit point to the client.
+ */
+bool
+journal_sync(struct connection_closure *closure)
+{
+    debug_decl(journal_sync, SUDO_DEBUG_UTIL);
+
+    if (closure->journal_fd != -1 && fdatasync(closure->journal_fd) == -1) {
+	sudo_warn(U_("unable to write to %s"), closure->journal_path);
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Close the journal and move it to the outgoing directory where
+ * the relay will pick it up.  Incomplete journals are forwarded
+ * too; the upstream server treats them like a dropped connection.
+ */
+bool
+journal_finish(struct connection_closure *closure)
+{
+    char path[PATH_MAX];
+    const char *base;
+    bool ret = false;
+    int dirlen, len;
+    debug_decl(journal_finish, SUDO_DEBUG_UTIL);
+
+    if (closure->journal_fd == -1)
+	debug_return_bool(true);
+
+    if (fsync(closure->journal_fd) == -1) {
+	sudo_warn(U_("unable to write to %s"), closure->journal_path);
+	goto done;
+    }
+
+    /* The relay_dir setting may have changed, use the journal's spool. */
+    base = strrchr(closure->journal_path, '/') + 1;
+    dirlen = (int)(base - closure->journal_path) - (int)sizeof("incoming/") + 1;
+    len = snprintf(path, sizeof(path), "%.*soutgoing/%s", dirlen,
+	closure->journal_path, base);
+    if (len < 0 || len >= ssizeof(path)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "journal path too long: %.*soutgoing/%s", dirlen,
+	    closure->journal_path, base);
+	goto done;
+    }
+    if (rename(closure->journal_path, path) == -1) {
+	sudo_warn(U_("unable to rename %s to %s"), closure->journal_path,
+	    path);
+	goto done;
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: queued journal %s",
+	__func__, path);
+    ret = true;
+
+    /* Let the relay know there is a new journal to forward. */
+    relay_wakeup();
+
+done:
+    close(closure->journal_fd);
+    closure->journal_fd = -1;
+    free(closure->journal_path);
+    closure->journal_path = NULL;
+
+    debug_return_bool(ret);
+}
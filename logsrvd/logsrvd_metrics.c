@@ -0,0 +1,471 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sudo_compat.h"
+#include "sudo_debug.h"
+#include "sudo_event.h"
+#include "sudo_eventlog.h"
+#include "sudo_iolog.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+
+#include "log_server.pb-c.h"
+#include "logsrvd.h"
+
+/*
+ * Minimal HTTP server that exposes the workers' counters in the
+ * Prometheus text format.  Requests are handled by the main thread
+ * while the counters are updated by the workers using relaxed atomic
+ * operations.  The values in a response are not a consistent snapshot,
+ * a histogram's count may include an observation its buckets do not.
+ */
+
+/* Upper bounds (in seconds) of the histogram buckets. */
+static const double bucket_bounds[METRICS_NBUCKETS] = {
+    0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30
+};
+
+/* Request headers larger than this are not read in full. */
+#define METRICS_REQUEST_MAX	1024
+
+struct metrics_client {
+    struct sudo_event *read_ev;
+    struct sudo_event *write_ev;
+    struct connection_buffer buf;
+    size_t reqlen;
+    char request[METRICS_REQUEST_MAX];
+    int sock;
+};
+
+static struct logsrvd_metrics **registered;
+static unsigned int nregistered;
+
+/*
+ * Add a worker's metrics to the set that is reported.
+ */
+bool
+metrics_register(struct logsrvd_metrics *metrics)
+{
+    struct logsrvd_metrics **tmp;
+    debug_decl(metrics_register, SUDO_DEBUG_UTIL);
+
+    tmp = reallocarray(registered, nregistered + 1, sizeof(*registered));
+    if (tmp == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to allocate memory");
+	debug_return_bool(false);
+    }
+    registered = tmp;
+    registered[nregistered++] = metrics;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Record the time elapsed since start in the specified histogram.
+ */
+void
+metrics_observe(struct metrics_histogram *hist, const struct timespec *start)
+{
+    struct timespec now;
+    double secs;
+    unsigned int i;
+    debug_decl(metrics_observe, SUDO_DEBUG_UTIL);
+
+    if (sudo_gettime_mono(&now) == -1)
+	debug_return;
+    sudo_timespecsub(&now, start, &now);
+    secs = now.tv_sec + (now.tv_nsec / 1000000000.0);
+
+    for (i = 0; i < METRICS_NBUCKETS; i++) {
+	if (secs <= bucket_bounds[i]) {
+	    METRICS_ADD(hist->buckets[i], 1);
+	    break;
+	}
+    }
+    METRICS_ADD(hist->count, 1);
+    METRICS_ADD(hist->sum_ns,
+	(unsigned long long)now.tv_sec * 1000000000 + now.tv_nsec);
+
+    debug_return;
+}
+
+static void
+histogram_add(struct metrics_histogram *dst, const struct metrics_histogram *src)
+{
+    unsigned int i;
+
+    for (i = 0; i < METRICS_NBUCKETS; i++)
+	dst->buckets[i] += METRICS_GET(src->buckets[i]);
+    dst->count += METRICS_GET(src->count);
+    dst->sum_ns += METRICS_GET(src->sum_ns);
+}
+
+/*
+ * Sum the metrics of all registered workers.
+ */
+static void
+metrics_sum(struct logsrvd_metrics *sum)
+{
+    unsigned int i, iofd;
+    debug_decl(metrics_sum, SUDO_DEBUG_UTIL);
+
+    memset(sum, 0, sizeof(*sum));
+    for (i = 0; i < nregistered; i++) {
+	const struct logsrvd_metrics *m = registered[i];
+
+	sum->connections_active += METRICS_GET(m->connections_active);
+	sum->connections_total += METRICS_GET(m->connections_total);
+	sum->connection_errors += METRICS_GET(m->connection_errors);
+	sum->tls_resumed += METRICS_GET(m->tls_resumed);
+	sum->tls_ktls += METRICS_GET(m->tls_ktls);
+	sum->commit_points += METRICS_GET(m->commit_points);
+	for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	    sum->iobuf_messages[iofd] += METRICS_GET(m->iobuf_messages[iofd]);
+	    sum->iobuf_bytes[iofd] += METRICS_GET(m->iobuf_bytes[iofd]);
+	}
+	sum->arena_allocs += METRICS_GET(m->arena_allocs);
+	sum->arena_mallocs += METRICS_GET(m->arena_mallocs);
+	histogram_add(&sum->tls_handshake, &m->tls_handshake);
+	histogram_add(&sum->commit_lag, &m->commit_lag);
+	histogram_add(&sum->iolog_flush, &m->iolog_flush);
+    }
+
+    debug_return;
+}
+
+/*
+ * Append formatted output to buf, expanding it as needed.
+ */
+static bool __printflike(2, 3)
+metrics_printf(struct connection_buffer *buf, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+    debug_decl(metrics_printf, SUDO_DEBUG_UTIL);
+
+    for (;;) {
+	va_start(ap, fmt);
+	len = vsnprintf((char *)buf->data + buf->len, buf->size - buf->len,
+	    fmt, ap);
+	va_end(ap);
+	if (len < 0)
+	    debug_return_bool(false);
+	if ((unsigned int)len < buf->size - buf->len)
+	    break;
+	if (!expand_buf(buf, buf->len + len + 1))
+	    debug_return_bool(false);
+    }
+    buf->len += len;
+
+    debug_return_bool(true);
+}
+
+static bool
+format_counter(struct connection_buffer *buf, const char *name,
+    const char *type, const char *help, unsigned long long val)
+{
+    return metrics_printf(buf, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n",
+	name, help, name, type, name, val);
+}
+
+static bool
+format_histogram(struct connection_buffer *buf, const char *name,
+    const char *help, const struct metrics_histogram *hist)
+{
+    unsigned long long count = 0;
+    unsigned int i;
+
+    if (!metrics_printf(buf, "# HELP %s %s\n# TYPE %s histogram\n",
+	    name, help, name))
+	return false;
+    for (i = 0; i < METRICS_NBUCKETS; i++) {
+	count += hist->buckets[i];
+	if (!metrics_printf(buf, "%s_bucket{le=\"%g\"} %llu\n", name,
+		bucket_bounds[i], count))
+	    return false;
+    }
+    return metrics_printf(buf,
+	"%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9f\n%s_count %llu\n",
+	name, hist->count, name, hist->sum_ns / 1000000000.0, name,
+	hist->count);
+}
+
+static bool
+format_streams(struct connection_buffer *buf, const char *name,
+    const char *help, const unsigned long long *vals)
+{
+    int iofd;
+
+    if (!metrics_printf(buf, "# HELP %s %s\n# TYPE %s counter\n",
+	    name, help, name))
+	return false;
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	if (iofd == IOFD_TIMING)
+	    continue;
+	if (!metrics_printf(buf, "%s{stream=\"%s\"} %llu\n", name,
+		iolog_fd_to_name(iofd), vals[iofd]))
+	    return false;
+    }
+    return true;
+}
+
+/*
+ * Format the current metrics as an HTTP response.
+ */
+static bool
+metrics_format(struct connection_buffer *buf)
+{
+    struct connection_buffer body = { NULL };
+    struct logsrvd_metrics sum;
+    bool ret = false;
+    debug_decl(metrics_format, SUDO_DEBUG_UTIL);
+
+    metrics_sum(&sum);
+
+    if (!format_counter(&body, "sudo_logsrvd_connections_active", "gauge",
+	    "Number of open client connections.", sum.connections_active))
+	goto done;
+    if (!format_counter(&body, "sudo_logsrvd_connections_total", "counter",
+	    "Number of client connections accepted.", sum.connections_total))
+	goto done;
+    if (!format_counter(&body, "sudo_logsrvd_connection_errors_total",
+	    "counter", "Number of client connections closed before completion.",
+	    sum.connection_errors))
+	goto done;
+    if (!format_counter(&body, "sudo_logsrvd_tls_resumed_total", "counter",
+	    "Number of TLS handshakes that resumed a previous session.",
+	    sum.tls_resumed))
+	goto done;
+    if (!format_counter(&body, "sudo_logsrvd_tls_ktls_total", "counter",
+	    "Number of TLS connections decrypted by the kernel.",
+	    sum.tls_ktls))
+	goto done;
+    if (!format_streams(&body, "sudo_logsrvd_iobuf_messages_total",
+	    "Number of I/O buffers received.", sum.iobuf_messages))
+	goto done;
+    if (!format_streams(&body, "sudo_logsrvd_iobuf_bytes_total",
+	    "Number of I/O log bytes received.", sum.iobuf_bytes))
+	goto done;
+    if (!format_counter(&body, "sudo_logsrvd_commit_points_total", "counter",
+	    "Number of commit points sent to clients.", sum.commit_points))
+	goto done;
+    if (!format_counter(&body, "sudo_logsrvd_arena_allocations_total",
+	    "counter", "Number of allocations from connection arenas.",
+	    sum.arena_allocs))
+	goto done;
+    if (!format_counter(&body, "sudo_logsrvd_arena_mallocs_total", "counter",
+	    "Number of malloc calls made by connection arenas.",
+	    sum.arena_mallocs))
+	goto done;
+    if (!format_histogram(&body, "sudo_logsrvd_tls_handshake_seconds",
+	    "Time from accepting a connection to TLS handshake completion.",
+	    &sum.tls_handshake))
+	goto done;
+    if (!format_histogram(&body, "sudo_logsrvd_commit_lag_seconds",
+	    "Time from receiving I/O to sending a commit point for it.",
+	    &sum.commit_lag))
+	goto done;
+    if (!format_histogram(&body, "sudo_logsrvd_iolog_flush_seconds",
+	    "Time spent writing buffered I/O log data.", &sum.iolog_flush))
+	goto done;
+
+    if (!metrics_printf(buf, "HTTP/1.0 200 OK\r\n"
+	    "Content-Type: text/plain; version=0.0.4\r\n"
+	    "Content-Length: %u\r\nConnection: close\r\n\r\n", body.len))
+	goto done;
+    if (!expand_buf(buf, buf->len + body.len))
+	goto done;
+    memcpy(buf->data + buf->len, body.data, body.len);
+    buf->len += body.len;
+
+    ret = true;
+done:
+    free(body.data);
+    debug_return_bool(ret);
+}
+
+static void
+metrics_client_free(struct metrics_client *client)
+{
+    debug_decl(metrics_client_free, SUDO_DEBUG_UTIL);
+
+    sudo_ev_free(client->read_ev);
+    sudo_ev_free(client->write_ev);
+    close(client->sock);
+    free(client->buf.data);
+    free(client);
+
+    debug_return;
+}
+
+static void
+metrics_write_cb(int fd, int what, void *v)
+{
+    struct metrics_client *client = v;
+    struct connection_buffer *buf = &client->buf;
+    ssize_t nwritten;
+    debug_decl(metrics_write_cb, SUDO_DEBUG_UTIL);
+
+    if (what == SUDO_EV_TIMEOUT) {
+	sudo_debug_printf(SUDO_DEBUG_WARN, "%s: timed out writing metrics",
+	    __func__);
+	goto done;
+    }
+
+    nwritten = write(fd, buf->data + buf->off, buf->len - buf->off);
+    if (nwritten == -1) {
+	if (errno == EAGAIN || errno == EINTR)
+	    debug_return;
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to write %u bytes", buf->len - buf->off);
+	goto done;
+    }
+    buf->off += nwritten;
+    if (buf->off != buf->len)
+	debug_return;
+
+done:
+    metrics_client_free(client);
+    debug_return;
+}
+
+static void
+metrics_read_cb(int fd, int what, void *v)
+{
+    struct metrics_client *client = v;
+    struct sudo_event_base *base = sudo_ev_get_base(client->read_ev);
+    ssize_t nread;
+    debug_decl(metrics_read_cb, SUDO_DEBUG_UTIL);
+
+    if (what == SUDO_EV_TIMEOUT) {
+	sudo_debug_printf(SUDO_DEBUG_WARN, "%s: timed out reading request",
+	    __func__);
+	goto bad;
+    }
+
+    nread = read(fd, client->request + client->reqlen,
+	sizeof(client->request) - client->reqlen - 1);
+    switch (nread) {
+    case -1:
+	if (errno == EAGAIN || errno == EINTR)
+	    debug_return;
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to read request");
+	goto bad;
+    case 0:
+	/* EOF, client may have only half-closed the connection. */
+	break;
+    default:
+	client->reqlen += nread;
+	client->request[client->reqlen] = '\0';
+	/* Wait for the end of the request headers unless the buffer is full. */
+	if (strstr(client->request, "\n\r\n") == NULL &&
+		strstr(client->request, "\n\n") == NULL &&
+		client->reqlen < sizeof(client->request) - 1)
+	    debug_return;
+	break;
+    }
+
+    /* The request itself is ignored, any request gets the metrics. */
+    sudo_ev_del(base, client->read_ev);
+    if (!metrics_format(&client->buf)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to format metrics");
+	goto bad;
+    }
+    if (sudo_ev_add(base, client->write_ev, logsrvd_conf_get_sock_timeout(),
+	    false) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to add metrics write event");
+	goto bad;
+    }
+    debug_return;
+
+bad:
+    metrics_client_free(client);
+    debug_return;
+}
+
+/*
+ * Serve the current metrics on a newly accepted socket.
+ */
+void
+metrics_serve(int sock, struct sudo_event_base *base)
+{
+    struct metrics_client *client;
+    int flags;
+    debug_decl(metrics_serve, SUDO_DEBUG_UTIL);
+
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to set O_NONBLOCK");
+	close(sock);
+	debug_return;
+    }
+
+    if ((client = calloc(1, sizeof(*client))) == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to allocate memory");
+	close(sock);
+	debug_return;
+    }
+    client->sock = sock;
+    client->read_ev = sudo_ev_alloc(sock, SUDO_EV_READ|SUDO_EV_PERSIST,
+	metrics_read_cb, client);
+    client->write_ev = sudo_ev_alloc(sock, SUDO_EV_WRITE|SUDO_EV_PERSIST,
+	metrics_write_cb, client);
+    if (client->read_ev == NULL || client->write_ev == NULL)
+	goto bad;
+    if (sudo_ev_add(base, client->read_ev, logsrvd_conf_get_sock_timeout(),
+	    false) == -1)
+	goto bad;
+
+    debug_return;
+bad:
+    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	"unable to set up metrics connection");
+    metrics_client_free(client);
+    debug_return;
+}
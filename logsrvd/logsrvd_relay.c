@@ -0,0 +1,1614 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef HAVE_GETADDRINFO
+# include "compat/getaddrinfo.h"
+#endif
+#if defined(HAVE_OPENSSL)
+# include <openssl/ssl.h>
+# include <openssl/err.h>
+#endif
+
+#include "sudo_compat.h"
+#include "sudo_debug.h"
+#include "sudo_event.h"
+#include "sudo_fatal.h"
+#include "sudo_gettext.h"
+#include "sudo_iolog.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+
+#include "hostcheck.h"
+#include "log_server.pb-c.h"
+#include "logsrvd.h"
+
+/*
+ * Store-and-forward relay.
+ * Journals queued in the outgoing spool directory are sent to the
+ * upstream log server one at a time, oldest first.  If the upstream
+ * server supports multiplexed sessions, each journal is sent as a
+ * session of its own over a single persistent connection, so the
+ * TCP connection and TLS handshake are not repeated for every journal.
+ * Otherwise, since the log server closes the connection at the end of
+ * a session, each journal is sent over its own connection.  Like sudo,
+ * the relay waits for the ServerHello and, for I/O logs, the log ID
+ * before sending the rest of the session.  After that the journal is
+ * streamed in large chunks so many ClientMessages are sent per write.
+ * If relay_host has a (tls) suffix, the connection uses TLS with
+ * the relay section's certificate settings.
+ */
+
+/* Size of the chunks read from the journal and sent upstream. */
+#define RELAY_BUFSIZ	(64 * 1024)
+
+/* The retry interval doubles after each consecutive failure, up to 2^5. */
+#define RELAY_BACKOFF_MAX	5
+
+/* Times a journal may be rejected by the upstream server before it fails. */
+#define RELAY_REJECTS_MAX	5
+
+enum relay_state {
+    RELAY_IDLE,		/* not connected to the upstream server */
+    RELAY_CONNECTING,	/* connecting to the upstream server */
+    RELAY_HELLO,	/* sent ClientHello, waiting for ServerHello */
+    RELAY_READY,	/* connected, no journal being forwarded */
+    RELAY_ACCEPT,	/* sent AcceptMessage, waiting for the log ID */
+    RELAY_SENDING,	/* sending the rest of the journal */
+    RELAY_DRAINING	/* journal sent, waiting for the server to finish */
+};
+
+struct relay_closure {
+    struct sudo_event_base *evbase;
+    struct sudo_event *wakeup_ev;
+    struct sudo_event *retry_ev;
+    struct sudo_event *read_ev;
+    struct sudo_event *write_ev;
+    struct connection_buffer read_buf;
+    struct connection_buffer write_buf;
+    struct connection_buffer journal_buf;
+    struct addrinfo *res0;
+    struct addrinfo *ai;
+    char *journal_path;
+    char *rejected_path;	/* last journal rejected upstream */
+    off_t journal_size;
+    off_t journal_off;
+    int journal_fd;
+    int sock;
+    int wakeup_pipe[2];
+    unsigned int rejects;	/* times rejected_path was rejected */
+    unsigned int failures;	/* consecutive failed attempts */
+    uint32_t session_id;	/* current session if multiplexed */
+    enum relay_state state;
+    bool multiplex;		/* server accepts multiplexed sessions */
+    bool reconnect;		/* config changed, reconnect when idle */
+#if defined(HAVE_OPENSSL)
+    SSL *ssl;
+    bool read_wants_write;
+    bool write_wants_read;
+#endif
+#if defined(HAVE_STRUCT_IN6_ADDR)
+    char server_ip[INET6_ADDRSTRLEN];
+#else
+    char server_ip[INET_ADDRSTRLEN];
+#endif
+};
+
+static struct relay_closure *relay;
+#if defined(HAVE_OPENSSL)
+static SSL_CTX *relay_ssl_ctx;
+#endif
+
+/*
+ * The write end of the wakeup pipe is used by worker threads.
+ * It is only set or cleared when the workers are paused or stopped.
+ */
+static int relay_wakeup_fd = -1;
+static const char relay_client_id[] = "Sudo Audit Server Relay " PACKAGE_VERSION;
+
+static void relay_start(void);
+
+/*
+ * Create the relay spool directories if they don't already exist.
+ */
+static bool
+relay_create_spool(void)
+{
+    static const char *subdirs[] = { "incoming", "outgoing", "failed", NULL };
+    char path[PATH_MAX];
+    int i, len;
+    debug_decl(relay_create_spool, SUDO_DEBUG_UTIL);
+
+    for (i = 0; subdirs[i] != NULL; i++) {
+	len = snprintf(path, sizeof(path), "%s/%s", logsrvd_conf_relay_dir(),
+	    subdirs[i]);
+	if (len < 0 || len >= ssizeof(path)) {
+	    errno = ENAMETOOLONG;
+	    sudo_warn("%s/%s", logsrvd_conf_relay_dir(), subdirs[i]);
+	    debug_return_bool(false);
+	}
+	if (!sudo_mkdir_parents(path, ROOT_UID, ROOT_GID, S_IRWXU, false))
+	    debug_return_bool(false);
+	if (mkdir(path, S_IRWXU) == -1 && errno != EEXIST) {
+	    sudo_warn(U_("unable to mkdir %s"), path);
+	    debug_return_bool(false);
+	}
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Move journals left in the incoming directory by a previous instance
+ * to the outgoing directory.  Only called at startup, before there
+ * are any active connections.
+ */
+static void
+relay_recover_journals(void)
+{
+    char from[PATH_MAX], to[PATH_MAX];
+    struct dirent *dent;
+    DIR *dirp;
+    int len;
+    debug_decl(relay_recover_journals, SUDO_DEBUG_UTIL);
+
+    len = snprintf(from, sizeof(from), "%s/incoming", logsrvd_conf_relay_dir());
+    if (len < 0 || len >= ssizeof(from))
+	debug_return;
+    if ((dirp = opendir(from)) == NULL) {
+	sudo_warn("%s", from);
+	debug_return;
+    }
+    while ((dent = readdir(dirp)) != NULL) {
+	if (dent->d_name[0] == '.')
+	    continue;
+	len = snprintf(from, sizeof(from), "%s/incoming/%s",
+	    logsrvd_conf_relay_dir(), dent->d_name);
+	if (len < 0 || len >= ssizeof(from))
+	    continue;
+	len = snprintf(to, sizeof(to), "%s/outgoing/%s",
+	    logsrvd_conf_relay_dir(), dent->d_name);
+	if (len < 0 || len >= ssizeof(to))
+	    continue;
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: recovering journal %s",
+	    __func__, from);
+	if (rename(from, to) == -1)
+	    sudo_warn(U_("unable to rename %s to %s"), from, to);
+    }
+    closedir(dirp);
+
+    debug_return;
+}
+
+/*
+ * Find the oldest journal in the outgoing directory.
+ * Journal names begin with their creation time so the oldest
+ * journal is the one that sorts first.
+ * Returns a newly allocated path or NULL if there are no journals.
+ */
+static char *
+relay_next_journal(void)
+{
+    char *path = NULL, *oldest = NULL;
+    struct dirent *dent;
+    DIR *dirp;
+    debug_decl(relay_next_journal, SUDO_DEBUG_UTIL);
+
+    if (asprintf(&path, "%s/outgoing", logsrvd_conf_relay_dir()) == -1) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_str(NULL);
+    }
+    if ((dirp = opendir(path)) == NULL) {
+	sudo_warn("%s", path);
+	free(path);
+	debug_return_str(NULL);
+    }
+    while ((dent = readdir(dirp)) != NULL) {
+	if (dent->d_name[0] == '.')
+	    continue;
+	if (oldest == NULL || strcmp(dent->d_name, oldest) < 0) {
+	    free(oldest);
+	    if ((oldest = strdup(dent->d_name)) == NULL) {
+		sudo_warnx(U_("%s: %s"), __func__,
+		    U_("unable to allocate memory"));
+		break;
+	    }
+	}
+    }
+    closedir(dirp);
+    free(path);
+    path = NULL;
+
+    if (oldest != NULL) {
+	if (asprintf(&path, "%s/outgoing/%s", logsrvd_conf_relay_dir(),
+		oldest) == -1) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    path = NULL;
+	}
+	free(oldest);
+    }
+
+    debug_return_str(path);
+}
+
+#if defined(HAVE_OPENSSL)
+/*
+ * Check that the upstream server's certificate is valid and that it
+ * contains the relay host name or IP address.
+ * Returns 0 if the cert is invalid, else 1.
+ */
+static int
+relay_verify_peer(int preverify_ok, X509_STORE_CTX *ctx)
+{
+    X509 *current_cert;
+    X509 *peer_cert;
+    debug_decl(relay_verify_peer, SUDO_DEBUG_UTIL);
+
+    /* if pre-verification of the cert failed, just propagate that result back */
+    if (preverify_ok != 1) {
+        debug_return_int(0);
+    }
+
+    /* since this callback is called for each cert in the chain,
+     * check that current cert is the peer's certificate
+     */
+    current_cert = X509_STORE_CTX_get_current_cert(ctx);
+    peer_cert = X509_STORE_CTX_get0_cert(ctx);
+    if (current_cert != peer_cert) {
+        debug_return_int(1);
+    }
+
+    if (validate_hostname(peer_cert, logsrvd_conf_relay_host(),
+	    relay->server_ip, 0) == MatchFound) {
+        debug_return_int(1);
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"hostname validation failed for %s", logsrvd_conf_relay_host());
+
+    debug_return_int(0);
+}
+
+/*
+ * Create the TLS client context used for upstream connections from
+ * the relay section's TLS settings.
+ */
+static SSL_CTX *
+relay_tls_init(void)
+{
+    const struct logsrvd_tls_config *tls_config =
+	logsrvd_conf_relay_tls_config();
+    const SSL_METHOD *method;
+    SSL_CTX *ctx = NULL;
+    debug_decl(relay_tls_init, SUDO_DEBUG_UTIL);
+
+    SSL_library_init();
+    OpenSSL_add_all_algorithms();
+    SSL_load_error_strings();
+
+    if ((method = TLS_client_method()) == NULL) {
+        sudo_warnx(U_("unable to create TLS context: %s"),
+            ERR_reason_error_string(ERR_get_error()));
+        goto bad;
+    }
+    if ((ctx = SSL_CTX_new(method)) == NULL) {
+        sudo_warnx(U_("unable to create TLS context: %s"),
+            ERR_reason_error_string(ERR_get_error()));
+        goto bad;
+    }
+#ifdef HAVE_SSL_CTX_SET_MIN_PROTO_VERSION
+    if (!SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION)) {
+        sudo_warnx(U_("unable to set minimum protocol version to TLS 1.2: %s"),
+            ERR_reason_error_string(ERR_get_error()));
+        goto bad;
+    }
+#else
+    SSL_CTX_set_options(ctx,
+        SSL_OP_NO_SSLv2|SSL_OP_NO_SSLv3|SSL_OP_NO_TLSv1|SSL_OP_NO_TLSv1_1);
+#endif
+
+    /* The journal is sent in partial writes from the same buffer. */
+    SSL_CTX_set_mode(ctx,
+	SSL_MODE_ENABLE_PARTIAL_WRITE|SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    /* A client certificate is only sent if one is configured. */
+    if (tls_config->cert_path != NULL) {
+	/* If there is no private key file, the cert file contains the key. */
+	const char *pkey = tls_config->pkey_path ?
+	    tls_config->pkey_path : tls_config->cert_path;
+
+        if (!SSL_CTX_use_certificate_chain_file(ctx, tls_config->cert_path)) {
+            sudo_warnx(U_("%s: %s"), tls_config->cert_path,
+                ERR_reason_error_string(ERR_get_error()));
+            goto bad;
+        }
+        if (!SSL_CTX_use_PrivateKey_file(ctx, pkey, SSL_FILETYPE_PEM)) {
+            sudo_warnx(U_("%s: %s"), pkey,
+                ERR_reason_error_string(ERR_get_error()));
+            goto bad;
+        }
+    }
+
+    if (tls_config->cacert_path != NULL) {
+        if (SSL_CTX_load_verify_locations(ctx, tls_config->cacert_path,
+		NULL) <= 0) {
+            sudo_warnx(U_("%s: %s"), tls_config->cacert_path,
+                ERR_reason_error_string(ERR_get_error()));
+            goto bad;
+        }
+    } else if (!SSL_CTX_set_default_verify_paths(ctx)) {
+	sudo_warnx("SSL_CTX_set_default_verify_paths: %s",
+	    ERR_reason_error_string(ERR_get_error()));
+	goto bad;
+    }
+
+    if (!init_tls_ciphersuites(ctx, tls_config))
+	goto bad;
+
+    if (tls_config->verify) {
+        /* verify the upstream server's cert during the handshake */
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, relay_verify_peer);
+    }
+
+    debug_return_ptr(ctx);
+bad:
+    SSL_CTX_free(ctx);
+    debug_return_ptr(NULL);
+}
+
+/*
+ * Set up TLS on the newly-connected upstream socket.
+ */
+static bool
+relay_tls_connect(int sock)
+{
+    debug_decl(relay_tls_connect, SUDO_DEBUG_UTIL);
+
+    if ((relay->ssl = SSL_new(relay_ssl_ctx)) == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to allocate ssl object: %s",
+	    ERR_error_string(ERR_get_error(), NULL));
+	debug_return_bool(false);
+    }
+    if (SSL_set_fd(relay->ssl, sock) <= 0) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to set fd for TLS: %s",
+	    ERR_error_string(ERR_get_error(), NULL));
+	debug_return_bool(false);
+    }
+    SSL_set_connect_state(relay->ssl);
+
+    debug_return_bool(true);
+}
+#endif /* HAVE_OPENSSL */
+
+/*
+ * Close the upstream connection, if any.
+ */
+static void
+relay_disconnect(void)
+{
+    debug_decl(relay_disconnect, SUDO_DEBUG_UTIL);
+
+    sudo_ev_free(relay->read_ev);
+    relay->read_ev = NULL;
+    sudo_ev_free(relay->write_ev);
+    relay->write_ev = NULL;
+#if defined(HAVE_OPENSSL)
+    if (relay->ssl != NULL) {
+	SSL_shutdown(relay->ssl);
+	SSL_free(relay->ssl);
+	relay->ssl = NULL;
+    }
+    relay->read_wants_write = false;
+    relay->write_wants_read = false;
+#endif
+    if (relay->sock != -1) {
+	close(relay->sock);
+	relay->sock = -1;
+    }
+    if (relay->res0 != NULL) {
+	freeaddrinfo(relay->res0);
+	relay->res0 = NULL;
+	relay->ai = NULL;
+    }
+    relay->read_buf.len = relay->read_buf.off = 0;
+    relay->write_buf.len = relay->write_buf.off = 0;
+    relay->multiplex = false;
+    relay->state = RELAY_IDLE;
+
+    debug_return;
+}
+
+/*
+ * Append a length-prefixed ClientMessage to the write buffer.
+ * On a multiplexed connection the current session ID is appended to
+ * the message; since field order does not matter, the message does
+ * not need to be unpacked and packed again.  An empty message ends
+ * the session.
+ */
+static bool
+relay_queue_message(const uint8_t *data, uint32_t len)
+{
+    struct connection_buffer *buf = &relay->write_buf;
+    uint32_t msg_len, session_id = relay->session_id;
+    uint8_t *start, *cp;
+    debug_decl(relay_queue_message, SUDO_DEBUG_UTIL);
+
+    /* Room for a session ID field: a one-byte tag and up to 5 bytes. */
+    if (!expand_buf(buf, buf->len - buf->off + sizeof(msg_len) + len + 6)) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    start = cp = buf->data + buf->len;
+    cp += sizeof(msg_len);
+    if (len != 0) {
+	memcpy(cp, data, len);
+	cp += len;
+    }
+    if (relay->multiplex) {
+	*cp++ = (14 << 3) | 0;
+	for (; session_id >= 0x80; session_id >>= 7)
+	    *cp++ = (uint8_t)(session_id | 0x80);
+	*cp++ = (uint8_t)session_id;
+    }
+    msg_len = htonl((uint32_t)(cp - start - sizeof(msg_len)));
+    memcpy(start, &msg_len, sizeof(msg_len));
+    buf->len += (unsigned int)(cp - start);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Close the current journal, if any.  A session that is still open
+ * on a multiplexed connection is ended so the server discards it.
+ */
+static void
+relay_close_journal(void)
+{
+    debug_decl(relay_close_journal, SUDO_DEBUG_UTIL);
+
+    if (relay->multiplex && relay->state > RELAY_READY) {
+	if (relay->session_id != 0 && relay_queue_message(NULL, 0)) {
+	    if (sudo_ev_add(relay->evbase, relay->write_ev,
+		    logsrvd_conf_get_sock_timeout(), false) == -1) {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		    "unable to add relay write event");
+	    }
+	}
+	relay->state = RELAY_READY;
+
+	/* The connection stays open with no read timeout while idle. */
+	if (sudo_ev_add(relay->evbase, relay->read_ev, NULL, false) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to add relay read event");
+	    relay_disconnect();
+	}
+    }
+    if (relay->journal_fd != -1) {
+	close(relay->journal_fd);
+	relay->journal_fd = -1;
+    }
+    free(relay->journal_path);
+    relay->journal_path = NULL;
+    relay->journal_buf.len = relay->journal_buf.off = 0;
+    relay->session_id = 0;
+
+    debug_return;
+}
+
+/*
+ * Close the current journal and the upstream connection, if any.
+ */
+static void
+relay_close(void)
+{
+    debug_decl(relay_close, SUDO_DEBUG_UTIL);
+
+    relay_disconnect();
+    relay_close_journal();
+
+    debug_return;
+}
+
+/*
+ * Unable to forward the current journal right now; try again after
+ * the retry interval, which doubles after each consecutive failure.
+ * If disconnect is set, or sessions are not multiplexed, the
+ * upstream connection is closed too.
+ */
+static void
+relay_retry(bool disconnect)
+{
+    struct timespec delay = *logsrvd_conf_relay_retry_interval();
+    debug_decl(relay_retry, SUDO_DEBUG_UTIL);
+
+    if (relay->failures < RELAY_BACKOFF_MAX)
+	delay.tv_sec <<= relay->failures;
+    else
+	delay.tv_sec <<= RELAY_BACKOFF_MAX;
+    relay->failures++;
+
+    sudo_debug_printf(SUDO_DEBUG_WARN,
+	"%s: unable to relay %s, retrying in %lld seconds", __func__,
+	relay->journal_path ? relay->journal_path : "journal",
+	(long long)delay.tv_sec);
+
+    if (disconnect || !relay->multiplex)
+	relay_disconnect();
+    relay_close_journal();
+    if (sudo_ev_add(relay->evbase, relay->retry_ev, &delay, false) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to add relay retry event");
+    }
+
+    debug_return;
+}
+
+/*
+ * Done with the current journal.  On success it is removed, if the
+ * upstream server rejected it, it is moved to the failed directory
+ * so that it doesn't block the rest of the queue.
+ */
+static void
+relay_finish(bool success)
+{
+    char *failed_path;
+    const char *base;
+    debug_decl(relay_finish, SUDO_DEBUG_UTIL);
+
+    if (success) {
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: relayed journal %s",
+	    __func__, relay->journal_path);
+	if (unlink(relay->journal_path) == -1)
+	    sudo_warn(U_("unable to remove %s"), relay->journal_path);
+    } else {
+	base = strrchr(relay->journal_path, '/') + 1;
+	if (asprintf(&failed_path, "%s/failed/%s", logsrvd_conf_relay_dir(),
+		base) == -1) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	} else {
+	    if (rename(relay->journal_path, failed_path) == -1) {
+		sudo_warn(U_("unable to rename %s to %s"),
+		    relay->journal_path, failed_path);
+	    }
+	    free(failed_path);
+	}
+    }
+    free(relay->rejected_path);
+    relay->rejected_path = NULL;
+    relay->rejects = 0;
+    relay->failures = 0;
+
+    /* The server has finished with the session, nothing to end. */
+    if (success)
+	relay->session_id = 0;
+    if (!relay->multiplex || relay->reconnect)
+	relay_disconnect();
+    relay_close_journal();
+
+    /* Move on to the next journal, if any, from the event loop. */
+    relay_wakeup();
+
+    debug_return;
+}
+
+/*
+ * The upstream server reported an error for the current journal.
+ * The error may be temporary, such as a full disk on the server, so
+ * the journal is retried.  Once it has been rejected RELAY_REJECTS_MAX
+ * times in a row it is moved to the failed directory instead.
+ */
+static void
+relay_reject(void)
+{
+    debug_decl(relay_reject, SUDO_DEBUG_UTIL);
+
+    if (relay->rejected_path != NULL &&
+	    strcmp(relay->rejected_path, relay->journal_path) == 0) {
+	relay->rejects++;
+    } else {
+	free(relay->rejected_path);
+	relay->rejected_path = strdup(relay->journal_path);
+	relay->rejects = 1;
+    }
+
+    /* The server has already ended the session. */
+    relay->session_id = 0;
+    if (relay->rejects >= RELAY_REJECTS_MAX) {
+	sudo_warnx(U_("%s: rejected by %s %u times, giving up"),
+	    relay->journal_path, logsrvd_conf_relay_host(), relay->rejects);
+	relay_finish(false);
+	debug_return;
+    }
+    relay_retry(false);
+
+    debug_return;
+}
+
+/*
+ * Format a ClientHello message into the relay's write buffer.
+ */
+static bool
+relay_fmt_hello(void)
+{
+    ClientMessage msg = CLIENT_MESSAGE__INIT;
+    ClientHello hello = CLIENT_HELLO__INIT;
+    uint8_t *data;
+    size_t len;
+    bool ret;
+    debug_decl(relay_fmt_hello, SUDO_DEBUG_UTIL);
+
+    hello.client_id = (char *)relay_client_id;
+    msg.u.hello_msg = &hello;
+    msg.type_case = CLIENT_MESSAGE__TYPE_HELLO_MSG;
+
+    len = client_message__get_packed_size(&msg);
+    if ((data = malloc(len)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    client_message__pack(&msg, data);
+    ret = relay_queue_message(data, len);
+    free(data);
+
+    debug_return_bool(ret);
+}
+
+/*
+ * Queue the first ClientMessage in the journal to be sent.
+ * If it is an AcceptMessage for an I/O log, the server will reply
+ * with a log ID that we must wait for.
+ * Returns false if the journal is invalid.
+ */
+static bool
+relay_send_first(void)
+{
+    struct connection_buffer *jbuf = &relay->journal_buf;
+    ClientMessage *msg;
+    uint32_t msg_len;
+    ssize_t nread;
+    debug_decl(relay_send_first, SUDO_DEBUG_UTIL);
+
+    nread = read(relay->journal_fd, &msg_len, sizeof(msg_len));
+    if (nread != sizeof(msg_len))
+	goto bad;
+    msg_len = ntohl(msg_len);
+    if (msg_len > MESSAGE_SIZE_MAX)
+	goto bad;
+    jbuf->len = jbuf->off = 0;
+    if (!expand_buf(jbuf, msg_len))
+	debug_return_bool(false);
+    nread = read(relay->journal_fd, jbuf->data, msg_len);
+    if (nread != (ssize_t)msg_len)
+	goto bad;
+    msg = client_message__unpack(NULL, msg_len, jbuf->data);
+    if (msg == NULL)
+	goto bad;
+    relay->state = RELAY_SENDING;
+    if (msg->type_case == CLIENT_MESSAGE__TYPE_ACCEPT_MSG &&
+	    msg->u.accept_msg->expect_iobufs)
+	relay->state = RELAY_ACCEPT;
+    client_message__free_unpacked(msg, NULL);
+
+    relay->journal_off = sizeof(msg_len) + msg_len;
+    if (!relay_queue_message(jbuf->data, msg_len))
+	debug_return_bool(false);
+
+    debug_return_bool(true);
+bad:
+    if (nread == -1) {
+	sudo_warn(U_("unable to read %s"), relay->journal_path);
+    } else {
+	sudo_warnx(U_("%s: invalid journal file"), relay->journal_path);
+    }
+    debug_return_bool(false);
+}
+
+/*
+ * Start sending the current journal over the connection, as a new
+ * session if it is multiplexed.
+ */
+static void
+relay_begin_journal(void)
+{
+    const struct timespec *timeout = logsrvd_conf_get_sock_timeout();
+    debug_decl(relay_begin_journal, SUDO_DEBUG_UTIL);
+
+    if (relay->multiplex) {
+	static uint32_t next_id;
+
+	if (++next_id == 0)
+	    next_id = 1;
+	relay->session_id = next_id;
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: sending %s as session %u",
+	    __func__, relay->journal_path, relay->session_id);
+    }
+    if (!relay_send_first()) {
+	relay_finish(false);
+	debug_return;
+    }
+
+    /* The server must respond while a journal is being sent. */
+    if (sudo_ev_add(relay->evbase, relay->read_ev, timeout, false) == -1 ||
+	    sudo_ev_add(relay->evbase, relay->write_ev, timeout, false) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to add relay event");
+	relay_retry(true);
+    }
+
+    debug_return;
+}
+
+/*
+ * Handle a ServerMessage from the upstream server.
+ * Returns false if the connection was closed.
+ */
+static bool
+relay_server_message(uint8_t *buf, size_t len)
+{
+    const char *errstr = NULL;
+    ServerMessage *msg;
+    bool ret = true;
+    debug_decl(relay_server_message, SUDO_DEBUG_UTIL);
+
+    msg = server_message__unpack(NULL, len, buf);
+    if (msg == NULL) {
+	sudo_warnx(U_("%s: unable to parse ServerMessage from %s"),
+	    relay->journal_path ? relay->journal_path : "relay",
+	    logsrvd_conf_relay_host());
+	relay_retry(true);
+	debug_return_bool(false);
+    }
+
+    /* Replies for a session that has already ended are ignored. */
+    if (msg->session_id != 0 && msg->session_id != relay->session_id) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "ignoring message type %d for session %u", msg->type_case,
+	    msg->session_id);
+	goto done;
+    }
+
+    switch (msg->type_case) {
+    case SERVER_MESSAGE__TYPE_HELLO:
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: server ID: %s", __func__,
+	    msg->u.hello->server_id);
+	if (relay->state != RELAY_HELLO) {
+	    sudo_warnx(U_("%s: unexpected state %d"), __func__, relay->state);
+	    relay_retry(true);
+	    ret = false;
+	    break;
+	}
+	relay->multiplex = msg->u.hello->multiplex;
+	relay->state = RELAY_READY;
+	if (relay->journal_path != NULL) {
+	    relay_begin_journal();
+	    ret = relay->read_ev != NULL;
+	} else if (sudo_ev_add(relay->evbase, relay->read_ev, NULL,
+		false) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to add relay read event");
+	    relay_disconnect();
+	    ret = false;
+	}
+	break;
+    case SERVER_MESSAGE__TYPE_COMMIT_POINT:
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: commit point [%lld, %d]",
+	    __func__, (long long)msg->u.commit_point->tv_sec,
+	    msg->u.commit_point->tv_nsec);
+	break;
+    case SERVER_MESSAGE__TYPE_LOG_ID:
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: log ID: %s", __func__,
+	    msg->u.log_id);
+	if (relay->state == RELAY_ACCEPT) {
+	    relay->state = RELAY_SENDING;
+	    if (sudo_ev_add(relay->evbase, relay->write_ev,
+		    logsrvd_conf_get_sock_timeout(), false) == -1) {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		    "unable to add relay write event");
+		relay_retry(true);
+		ret = false;
+	    }
+	}
+	break;
+    case SERVER_MESSAGE__TYPE_ERROR:
+	errstr = msg->u.error;
+	break;
+    case SERVER_MESSAGE__TYPE_ABORT:
+	errstr = msg->u.abort;
+	break;
+    case SERVER_MESSAGE__TYPE__NOT_SET:
+	/* The server has processed the entire session. */
+	if (relay->multiplex && relay->state == RELAY_DRAINING) {
+	    relay_finish(true);
+	    ret = relay->read_ev != NULL;
+	    break;
+	}
+	FALLTHROUGH;
+    default:
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unexpected type_case value %d", msg->type_case);
+	break;
+    }
+
+    if (errstr != NULL) {
+	sudo_warnx(U_("%s: error from %s: %s"),
+	    relay->journal_path ? relay->journal_path : "relay",
+	    logsrvd_conf_relay_host(), errstr);
+	if (msg->session_id == 0 &&
+		(relay->multiplex || relay->journal_path == NULL)) {
+	    /* Connection-level error, not specific to this journal. */
+	    relay_retry(true);
+	} else {
+	    relay_reject();
+	}
+	ret = relay->read_ev != NULL;
+    }
+
+done:
+    server_message__free_unpacked(msg, NULL);
+    debug_return_bool(ret);
+}
+
+/*
+ * Read from the upstream server, using TLS if it is enabled.
+ * Returns the number of bytes read, 0 on EOF or -1 on error.
+ * If no data is available, -1 is returned with errno set to EAGAIN.
+ */
+static ssize_t
+relay_recv(void *buf, size_t len)
+{
+    ssize_t nread;
+    debug_decl(relay_recv, SUDO_DEBUG_UTIL);
+
+#if defined(HAVE_OPENSSL)
+    if (relay->ssl != NULL) {
+	nread = SSL_read(relay->ssl, buf, len);
+	if (nread <= 0) {
+	    switch (SSL_get_error(relay->ssl, nread)) {
+	    case SSL_ERROR_ZERO_RETURN:
+		nread = 0;
+		break;
+	    case SSL_ERROR_WANT_WRITE:
+		/* Retry the read once the socket is writable. */
+		relay->read_wants_write = true;
+		if (sudo_ev_add(relay->evbase, relay->write_ev,
+			logsrvd_conf_get_sock_timeout(), false) == -1) {
+		    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+			"unable to add relay write event");
+		    debug_return_ssize_t(-1);
+		}
+		FALLTHROUGH;
+	    case SSL_ERROR_WANT_READ:
+		errno = EAGAIN;
+		nread = -1;
+		break;
+	    case SSL_ERROR_SYSCALL:
+		nread = -1;
+		break;
+	    default:
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		    "SSL_read: %s", ERR_reason_error_string(ERR_get_error()));
+		errno = EIO;
+		nread = -1;
+		break;
+	    }
+	}
+	debug_return_ssize_t(nread);
+    }
+#endif
+    nread = recv(relay->sock, buf, len, 0);
+    debug_return_ssize_t(nread);
+}
+
+/*
+ * Write to the upstream server, using TLS if it is enabled.
+ * Returns the number of bytes written or -1 on error.
+ * If the socket is not ready, -1 is returned with errno set to EAGAIN.
+ */
+static ssize_t
+relay_send(const void *buf, size_t len)
+{
+    ssize_t nwritten;
+    debug_decl(relay_send, SUDO_DEBUG_UTIL);
+
+#if defined(HAVE_OPENSSL)
+    if (relay->ssl != NULL) {
+	nwritten = SSL_write(relay->ssl, buf, len);
+	if (nwritten <= 0) {
+	    switch (SSL_get_error(relay->ssl, nwritten)) {
+	    case SSL_ERROR_WANT_READ:
+		/* Retry the write once the socket is readable. */
+		relay->write_wants_read = true;
+		sudo_ev_del(relay->evbase, relay->write_ev);
+		FALLTHROUGH;
+	    case SSL_ERROR_WANT_WRITE:
+		errno = EAGAIN;
+		nwritten = -1;
+		break;
+	    case SSL_ERROR_SYSCALL:
+		nwritten = -1;
+		break;
+	    default:
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		    "SSL_write: %s", ERR_reason_error_string(ERR_get_error()));
+		errno = EIO;
+		nwritten = -1;
+		break;
+	    }
+	}
+	debug_return_ssize_t(nwritten);
+    }
+#endif
+    nwritten = send(relay->sock, buf, len, 0);
+    debug_return_ssize_t(nwritten);
+}
+
+/*
+ * Read ServerMessages from the upstream server.
+ * Without multiplexing, the server closes the connection when it has
+ * finished with the session.
+ */
+static void
+relay_read_cb(int fd, int what, void *v)
+{
+    struct connection_buffer *buf = &relay->read_buf;
+    uint32_t msg_len;
+    ssize_t nread;
+    debug_decl(relay_read_cb, SUDO_DEBUG_UTIL);
+
+    if (what == SUDO_EV_TIMEOUT) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "timed out reading from relay server");
+	relay_retry(true);
+	debug_return;
+    }
+
+#if defined(HAVE_OPENSSL)
+    if (relay->write_wants_read) {
+	/* SSL_write() was waiting for data from the server. */
+	relay->write_wants_read = false;
+	if (sudo_ev_add(relay->evbase, relay->write_ev,
+		logsrvd_conf_get_sock_timeout(), false) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to add relay write event");
+	    relay_retry(true);
+	    debug_return;
+	}
+    }
+#endif
+
+    nread = relay_recv(buf->data + buf->len, buf->size - buf->len);
+    switch (nread) {
+    case -1:
+	if (errno == EAGAIN || errno == EINTR)
+	    debug_return;
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to read from relay server");
+	goto lost;
+    case 0:
+	/* Success if the server saw the entire journal. */
+	if (!relay->multiplex && relay->state == RELAY_DRAINING) {
+	    relay_finish(true);
+	    debug_return;
+	}
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "relay server closed connection");
+	goto lost;
+    default:
+	break;
+    }
+    buf->len += nread;
+
+    while (buf->len - buf->off >= sizeof(msg_len)) {
+	memcpy(&msg_len, buf->data + buf->off, sizeof(msg_len));
+	msg_len = ntohl(msg_len);
+	if (msg_len > MESSAGE_SIZE_MAX) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"server message too large: %u", msg_len);
+	    relay_retry(true);
+	    debug_return;
+	}
+	if (msg_len + sizeof(msg_len) > buf->len - buf->off) {
+	    /* Incomplete message, we'll read the rest next time. */
+	    if (!expand_buf(buf, msg_len + sizeof(msg_len)))
+		relay_retry(true);
+	    debug_return;
+	}
+	buf->off += sizeof(msg_len);
+	if (!relay_server_message(buf->data + buf->off, msg_len)) {
+	    /* The connection was closed, buf has been reset. */
+	    debug_return;
+	}
+	buf->off += msg_len;
+    }
+    /* Move any partial message to the start of the buffer. */
+    if (buf->len > buf->off && buf->off > 0)
+	memmove(buf->data, buf->data + buf->off, buf->len - buf->off);
+    buf->len -= buf->off;
+    buf->off = 0;
+
+    debug_return;
+lost:
+    if (relay->state == RELAY_READY) {
+	/* Idle connection, reconnect when there is another journal. */
+	relay_disconnect();
+    } else {
+	relay_retry(true);
+    }
+    debug_return;
+}
+
+/*
+ * Queue the next chunk of the journal to be sent.  On a multiplexed
+ * connection each message in the chunk is tagged with the session ID.
+ * Returns the number of bytes read, 0 at the end of the journal
+ * or -1 on error, with errno set to EINVAL if the journal is invalid.
+ */
+static ssize_t
+relay_fill_buf(void)
+{
+    struct connection_buffer *buf = &relay->write_buf;
+    struct connection_buffer *jbuf = &relay->journal_buf;
+    uint32_t msg_len;
+    ssize_t nread;
+    debug_decl(relay_fill_buf, SUDO_DEBUG_UTIL);
+
+    if (!relay->multiplex) {
+	/* Messages are sent as-is, straight from the journal. */
+	buf->len = buf->off = 0;
+	nread = read(relay->journal_fd, buf->data, buf->size);
+	if (nread == -1) {
+	    sudo_warn(U_("unable to read %s"), relay->journal_path);
+	    debug_return_ssize_t(-1);
+	}
+	relay->journal_off += nread;
+	buf->len = nread;
+	debug_return_ssize_t(nread);
+    }
+
+    /* Read after any partial message left over from the last chunk. */
+    if (!expand_buf(jbuf, jbuf->len - jbuf->off + RELAY_BUFSIZ)) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_ssize_t(-1);
+    }
+    nread = read(relay->journal_fd, jbuf->data + jbuf->len,
+	jbuf->size - jbuf->len);
+    if (nread == -1) {
+	sudo_warn(U_("unable to read %s"), relay->journal_path);
+	debug_return_ssize_t(-1);
+    }
+    relay->journal_off += nread;
+    jbuf->len += nread;
+
+    while (jbuf->len - jbuf->off >= sizeof(msg_len)) {
+	memcpy(&msg_len, jbuf->data + jbuf->off, sizeof(msg_len));
+	msg_len = ntohl(msg_len);
+	if (msg_len > MESSAGE_SIZE_MAX)
+	    goto bad;
+	if (msg_len + sizeof(msg_len) > jbuf->len - jbuf->off)
+	    break;
+	jbuf->off += sizeof(msg_len);
+	if (!relay_queue_message(jbuf->data + jbuf->off, msg_len))
+	    debug_return_ssize_t(-1);
+	jbuf->off += msg_len;
+    }
+    if (nread == 0 && jbuf->len != jbuf->off)
+	goto bad;
+
+    debug_return_ssize_t(nread);
+bad:
+    sudo_warnx(U_("%s: invalid journal file"), relay->journal_path);
+    errno = EINVAL;
+    debug_return_ssize_t(-1);
+}
+
+static void relay_connect_next(void);
+
+/*
+ * Send ClientHello followed by the journal contents upstream.
+ */
+static void
+relay_write_cb(int fd, int what, void *v)
+{
+    struct connection_buffer *buf = &relay->write_buf;
+    const struct timespec *timeout = logsrvd_conf_get_sock_timeout();
+    ssize_t nread, nwritten;
+    debug_decl(relay_write_cb, SUDO_DEBUG_UTIL);
+
+    if (what == SUDO_EV_TIMEOUT) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "timed out writing to relay server");
+	if (relay->state == RELAY_CONNECTING) {
+	    relay_connect_next();
+	} else {
+	    relay_retry(true);
+	}
+	debug_return;
+    }
+
+#if defined(HAVE_OPENSSL)
+    if (relay->read_wants_write) {
+	/* SSL_read() was waiting to write to the server. */
+	relay->read_wants_write = false;
+	relay_read_cb(fd, SUDO_EV_READ, v);
+	debug_return;
+    }
+#endif
+
+    if (relay->state == RELAY_CONNECTING) {
+	int optval = 0;
+	socklen_t optlen = sizeof(optval);
+
+	/* Check the result of the non-blocking connect. */
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &optval, &optlen) == -1)
+	    optval = errno;
+	if (optval != 0) {
+	    errno = optval;
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"unable to connect to relay server %s:%s",
+		logsrvd_conf_relay_host(), logsrvd_conf_relay_port());
+	    relay_connect_next();
+	    debug_return;
+	}
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: connected to %s:%s",
+	    __func__, logsrvd_conf_relay_host(), logsrvd_conf_relay_port());
+	freeaddrinfo(relay->res0);
+	relay->res0 = NULL;
+	relay->ai = NULL;
+	relay->reconnect = false;
+
+#if defined(HAVE_OPENSSL)
+	/* The TLS handshake is performed by the first SSL_write(). */
+	if (logsrvd_conf_relay_tls() && !relay_tls_connect(fd)) {
+	    relay_retry(true);
+	    debug_return;
+	}
+#endif
+
+	/* Start the protocol, server messages may arrive at any time. */
+	if (!relay_fmt_hello()) {
+	    relay_retry(true);
+	    debug_return;
+	}
+	if (sudo_ev_add(relay->evbase, relay->read_ev, timeout, false) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to add relay read event");
+	    relay_retry(true);
+	    debug_return;
+	}
+	relay->state = RELAY_HELLO;
+    }
+
+    while (buf->off == buf->len) {
+	if (relay->state != RELAY_SENDING) {
+	    /* Wait for the server's reply before sending more. */
+	    buf->len = buf->off = 0;
+	    sudo_ev_del(relay->evbase, relay->write_ev);
+	    debug_return;
+	}
+	nread = relay_fill_buf();
+	if (nread == -1) {
+	    if (errno == EINVAL) {
+		relay_finish(false);
+	    } else {
+		relay_retry(false);
+	    }
+	    debug_return;
+	}
+	if (nread != 0)
+	    continue;
+
+	/* Sent the whole journal, wait for the server to finish. */
+	sudo_debug_printf(SUDO_DEBUG_INFO,
+	    "%s: sent %lld bytes from %s", __func__,
+	    (long long)relay->journal_off, relay->journal_path);
+	relay->state = RELAY_DRAINING;
+	if (relay->multiplex) {
+	    /* Ending the session is acknowledged once it is complete. */
+	    if (!relay_queue_message(NULL, 0)) {
+		relay_retry(true);
+		debug_return;
+	    }
+	    break;
+	}
+	buf->len = buf->off = 0;
+	sudo_ev_del(relay->evbase, relay->write_ev);
+#if defined(HAVE_OPENSSL)
+	/* TLS has no half-close, the server closes when it is done. */
+	if (relay->ssl == NULL)
+#endif
+	    (void)shutdown(fd, SHUT_WR);
+	debug_return;
+    }
+
+    nwritten = relay_send(buf->data + buf->off, buf->len - buf->off);
+    if (nwritten == -1) {
+	if (errno == EAGAIN || errno == EINTR)
+	    debug_return;
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to send %u bytes to relay server", buf->len - buf->off);
+	relay_retry(true);
+	debug_return;
+    }
+    buf->off += nwritten;
+
+    debug_return;
+}
+
+/*
+ * Start a non-blocking connect to the next upstream address.
+ * Schedules a retry if there are no more addresses to try.
+ */
+static void
+relay_connect_next(void)
+{
+    const struct timespec *timeout = logsrvd_conf_get_sock_timeout();
+    struct addrinfo *ai;
+    int sock, flags;
+    debug_decl(relay_connect_next, SUDO_DEBUG_UTIL);
+
+    /* Close the previous attempt, if any. */
+    sudo_ev_free(relay->write_ev);
+    relay->write_ev = NULL;
+    sudo_ev_free(relay->read_ev);
+    relay->read_ev = NULL;
+    if (relay->sock != -1) {
+	close(relay->sock);
+	relay->sock = -1;
+    }
+
+    while ((ai = relay->ai) != NULL) {
+	relay->ai = ai->ai_next;
+
+	/* The IP address is used to verify the server's certificate. */
+	switch (ai->ai_family) {
+	case AF_INET:
+	    inet_ntop(AF_INET, &((struct sockaddr_in *)ai->ai_addr)->sin_addr,
+		relay->server_ip, sizeof(relay->server_ip));
+	    break;
+#if defined(HAVE_STRUCT_IN6_ADDR)
+	case AF_INET6:
+	    inet_ntop(AF_INET6,
+		&((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr,
+		relay->server_ip, sizeof(relay->server_ip));
+	    break;
+#endif
+	default:
+	    relay->server_ip[0] = '\0';
+	    break;
+	}
+
+	sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (sock == -1)
+	    continue;
+	flags = fcntl(sock, F_GETFL, 0);
+	if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1 ||
+		fcntl(sock, F_SETFD, FD_CLOEXEC) == -1) {
+	    close(sock);
+	    continue;
+	}
+	if (connect(sock, ai->ai_addr, ai->ai_addrlen) == -1 &&
+		errno != EINPROGRESS) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"unable to connect to relay server %s:%s",
+		logsrvd_conf_relay_host(), logsrvd_conf_relay_port());
+	    close(sock);
+	    continue;
+	}
+
+	relay->read_ev = sudo_ev_alloc(sock, SUDO_EV_READ|SUDO_EV_PERSIST,
+	    relay_read_cb, NULL);
+	relay->write_ev = sudo_ev_alloc(sock, SUDO_EV_WRITE|SUDO_EV_PERSIST,
+	    relay_write_cb, NULL);
+	if (relay->read_ev == NULL || relay->write_ev == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    close(sock);
+	    break;
+	}
+	relay->sock = sock;
+
+	/* Connection completes (or fails) when the socket is writable. */
+	if (sudo_ev_add(relay->evbase, relay->write_ev, timeout, false) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to add relay write event");
+	    break;
+	}
+	relay->state = RELAY_CONNECTING;
+	debug_return;
+    }
+
+    /* Unable to connect to any of the addresses. */
+    relay_retry(true);
+    debug_return;
+}
+
+/*
+ * Connect to the upstream server.
+ */
+static void
+relay_connect(void)
+{
+    struct addrinfo hints;
+    int error;
+    debug_decl(relay_connect, SUDO_DEBUG_UTIL);
+
+    /* Resolve the upstream server each time in case its address changed. */
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    error = getaddrinfo(logsrvd_conf_relay_host(), logsrvd_conf_relay_port(),
+	&hints, &relay->res0);
+    if (error != 0) {
+	sudo_gai_warn(error, U_("%s:%s"), logsrvd_conf_relay_host(),
+	    logsrvd_conf_relay_port());
+	relay->res0 = NULL;
+	relay_retry(true);
+	debug_return;
+    }
+    relay->ai = relay->res0;
+    relay_connect_next();
+
+    debug_return;
+}
+
+/*
+ * Begin forwarding the oldest journal in the outgoing directory,
+ * if there is one and the relay is not already busy.  The upstream
+ * connection is established first if needed.
+ */
+static void
+relay_start(void)
+{
+    struct stat sb;
+    debug_decl(relay_start, SUDO_DEBUG_UTIL);
+
+    if (relay->journal_path != NULL || logsrvd_conf_relay_host() == NULL)
+	debug_return;
+
+    /* Wait for the retry timer if the last attempt failed. */
+    if (ISSET(relay->retry_ev->flags, SUDO_EVQ_INSERTED))
+	debug_return;
+
+    if ((relay->journal_path = relay_next_journal()) == NULL)
+	debug_return;
+    relay->journal_fd = open(relay->journal_path, O_RDONLY);
+    if (relay->journal_fd == -1 || fstat(relay->journal_fd, &sb) == -1) {
+	sudo_warn("%s", relay->journal_path);
+	relay_retry(false);
+	debug_return;
+    }
+    (void)fcntl(relay->journal_fd, F_SETFD, FD_CLOEXEC);
+    relay->journal_size = sb.st_size;
+    relay->journal_off = 0;
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: relaying %s (%lld bytes)",
+	__func__, relay->journal_path, (long long)relay->journal_size);
+
+    switch (relay->state) {
+    case RELAY_IDLE:
+	relay_connect();
+	break;
+    case RELAY_READY:
+	relay_begin_journal();
+	break;
+    default:
+	/* Connecting, the journal is sent once the server says hello. */
+	break;
+    }
+
+    debug_return;
+}
+
+static void
+relay_wakeup_cb(int fd, int what, void *v)
+{
+    char buf[64];
+    debug_decl(relay_wakeup_cb, SUDO_DEBUG_UTIL);
+
+    /* Drain the pipe, the actual data is unimportant. */
+    while (read(fd, buf, sizeof(buf)) > 0)
+	continue;
+    relay_start();
+
+    debug_return;
+}
+
+static void
+relay_retry_cb(int fd, int what, void *v)
+{
+    debug_decl(relay_retry_cb, SUDO_DEBUG_UTIL);
+
+    relay_start();
+
+    debug_return;
+}
+
+/*
+ * Notify the relay that a journal was added to the outgoing directory.
+ * May be called from any thread.
+ */
+void
+relay_wakeup(void)
+{
+    const char ch = '\0';
+    debug_decl(relay_wakeup, SUDO_DEBUG_UTIL);
+
+    if (relay_wakeup_fd != -1) {
+	if (write(relay_wakeup_fd, &ch, 1) == -1 && errno != EAGAIN) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"unable to wake up relay");
+	}
+    }
+
+    debug_return;
+}
+
+/*
+ * Set up the relay spool and start forwarding queued journals.
+ * Called at startup and when the configuration is reloaded.
+ */
+bool
+relay_init(struct sudo_event_base *base)
+{
+    debug_decl(relay_init, SUDO_DEBUG_UTIL);
+
+    if (relay != NULL) {
+	/* Use the new settings for the next connection. */
+	relay->reconnect = true;
+	if (relay->state == RELAY_READY)
+	    relay_disconnect();
+    }
+
+    if (logsrvd_conf_relay_host() == NULL)
+	debug_return_bool(true);
+
+    if (!relay_create_spool())
+	debug_return_bool(false);
+
+#if defined(HAVE_OPENSSL)
+    if (logsrvd_conf_relay_tls()) {
+	SSL_CTX *ctx = relay_tls_init();
+
+	if (ctx == NULL)
+	    debug_return_bool(false);
+
+	/* A connection in progress holds its own reference to the old one. */
+	SSL_CTX_free(relay_ssl_ctx);
+	relay_ssl_ctx = ctx;
+    }
+#endif
+
+    if (relay == NULL) {
+	if ((relay = calloc(1, sizeof(*relay))) == NULL)
+	    goto oom;
+	relay->evbase = base;
+	relay->sock = -1;
+	relay->journal_fd = -1;
+	relay->state = RELAY_IDLE;
+	relay->read_buf.size = 64 * 1024;
+	relay->read_buf.data = malloc(relay->read_buf.size);
+	relay->write_buf.size = RELAY_BUFSIZ;
+	relay->write_buf.data = malloc(relay->write_buf.size);
+	if (relay->read_buf.data == NULL || relay->write_buf.data == NULL)
+	    goto oom;
+	if (pipe2(relay->wakeup_pipe, O_NONBLOCK|O_CLOEXEC) == -1) {
+	    sudo_warn("%s", U_("unable to create pipe"));
+	    debug_return_bool(false);
+	}
+	relay->wakeup_ev = sudo_ev_alloc(relay->wakeup_pipe[0],
+	    SUDO_EV_READ|SUDO_EV_PERSIST, relay_wakeup_cb, NULL);
+	relay->retry_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT, relay_retry_cb,
+	    NULL);
+	if (relay->wakeup_ev == NULL || relay->retry_ev == NULL)
+	    goto oom;
+	if (sudo_ev_add(base, relay->wakeup_ev, NULL, false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	    debug_return_bool(false);
+	}
+	relay_wakeup_fd = relay->wakeup_pipe[1];
+
+	/* Journals from a previous run can now be forwarded. */
+	relay_recover_journals();
+    }
+
+    /* Forward anything already queued. */
+    relay_start();
+
+    debug_return_bool(true);
+oom:
+    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    debug_return_bool(false);
+}
+
+/*
+ * Stop forwarding, called when the server shuts down.
+ * The current journal, if any, will be sent again on restart.
+ * Worker threads may still be running so the wakeup pipe is left
+ * open until relay_free() is called.
+ */
+void
+relay_shutdown(void)
+{
+    debug_decl(relay_shutdown, SUDO_DEBUG_UTIL);
+
+    if (relay == NULL)
+	debug_return;
+
+    relay_close();
+    sudo_ev_del(relay->evbase, relay->wakeup_ev);
+    sudo_ev_del(relay->evbase, relay->retry_ev);
+
+    debug_return;
+}
+
+/*
+ * Free the relay after the worker threads have exited.
+ */
+void
+relay_free(void)
+{
+    debug_decl(relay_free, SUDO_DEBUG_UTIL);
+
+    if (relay == NULL)
+	debug_return;
+
+    relay_close();
+    relay_wakeup_fd = -1;
+    sudo_ev_free(relay->wakeup_ev);
+    sudo_ev_free(relay->retry_ev);
+    close(relay->wakeup_pipe[0]);
+    close(relay->wakeup_pipe[1]);
+    free(relay->read_buf.data);
+    free(relay->write_buf.data);
+    free(relay->journal_buf.data);
+    free(relay->rejected_path);
+    free(relay);
+    relay = NULL;
+#if defined(HAVE_OPENSSL)
+    SSL_CTX_free(relay_ssl_ctx);
+    relay_ssl_ctx = NULL;
+#endif
+
+    debug_return;
+}
@@ -0,0 +1,731 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_IO_URING
+
+#include <sys/types.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sudo_compat.h"
+#include "sudo_debug.h"
+#include "sudo_event.h"
+#include "sudo_eventlog.h"
+#include "sudo_iolog.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+
+#include "log_server.pb-c.h"
+#include "logsrvd.h"
+
+/*
+ * Asynchronous I/O log writes using io_uring.
+ * Each worker has its own ring; completions are signaled via an
+ * eventfd that is serviced by the worker's event loop.  Only the
+ * raw system call interface is used, there is no dependency on liburing.
+ * Compressed I/O logs are written by zlib and cannot use the ring.
+ */
+
+#define URING_ENTRIES	128
+
+/* An I/O log file that is closed once the entries using it complete. */
+struct uring_file {
+    FILE *fp;
+    unsigned int refs;
+};
+
+struct uring_request {
+    TAILQ_ENTRY(uring_request) entries;
+    struct connection_closure *closure;
+    struct uring_file *file;
+    uint8_t *data;
+    unsigned int len;
+    int iofd;
+    uint8_t opcode;
+};
+TAILQ_HEAD(uring_request_list, uring_request);
+
+struct logsrvd_uring {
+    struct uring_request_list requests;
+    struct sudo_event *ev;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int sq_mask;
+    unsigned int cq_mask;
+    unsigned int sq_entries;
+    unsigned int cq_entries;
+    unsigned int sqe_tail;	/* local copy of SQ tail, includes unsubmitted */
+    unsigned int inflight;	/* queued or submitted, not yet completed */
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+    int ring_fd;
+    int event_fd;
+};
+
+static int
+sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+    unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+	flags, NULL, 0);
+}
+
+static int
+sys_io_uring_register(int fd, unsigned int opcode, void *arg,
+    unsigned int nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * Free a request that has completed or will never be submitted.
+ */
+static void
+uring_request_free(struct logsrvd_uring *ring, struct uring_request *req)
+{
+    debug_decl(uring_request_free, SUDO_DEBUG_UTIL);
+
+    TAILQ_REMOVE(&ring->requests, req, entries);
+    ring->inflight--;
+    if (req->file != NULL && --req->file->refs == 0) {
+	if (fclose(req->file->fp) != 0) {
+	    sudo_debug_printf(
+		SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"unable to close %s", iolog_fd_to_name(req->iofd));
+	}
+	free(req->file);
+    }
+    free(req->data);
+    free(req);
+
+    debug_return;
+}
+
+/*
+ * Process completed writes.
+ */
+static void
+uring_reap(struct logsrvd_uring *ring)
+{
+    unsigned int head, tail;
+    debug_decl(uring_reap, SUDO_DEBUG_UTIL);
+
+    head = *ring->cq_head;
+    tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+	struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+	struct uring_request *req =
+	    (struct uring_request *)(uintptr_t)cqe->user_data;
+	struct connection_closure *closure = req->closure;
+
+	if (cqe->res != (int)req->len) {
+	    if (cqe->res < 0 && req->opcode == IORING_OP_FSYNC) {
+		errno = -cqe->res;
+		sudo_debug_printf(
+		    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		    "unable to sync %s", iolog_fd_to_name(req->iofd));
+	    } else if (cqe->res < 0) {
+		errno = -cqe->res;
+		sudo_debug_printf(
+		    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		    "unable to write %u bytes to %s", req->len,
+		    iolog_fd_to_name(req->iofd));
+	    } else {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		    "short write to %s, %d of %u bytes",
+		    iolog_fd_to_name(req->iofd), cqe->res, req->len);
+	    }
+	    if (closure != NULL)
+		closure->uring_error = true;
+	}
+
+	if (closure != NULL) {
+	    closure->uring_pending--;
+	    if (closure->uring_pending == 0 && closure->commit_deferred) {
+		/* All I/O log data is on disk, send the commit point. */
+		struct timespec tv = { 0, 0 };
+
+		if (sudo_ev_add(closure->evbase, closure->commit_ev, &tv,
+			false) == -1) {
+		    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+			"unable to add commit point event");
+		}
+	    }
+	}
+	uring_request_free(ring, req);
+	head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    debug_return;
+}
+
+static void
+uring_cb(int fd, int what, void *v)
+{
+    struct logsrvd_uring *ring = v;
+    uint64_t count;
+    debug_decl(uring_cb, SUDO_DEBUG_UTIL);
+
+    /* Reset the eventfd counter, completions are read from the ring. */
+    if (read(fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to read from eventfd");
+    }
+    uring_reap(ring);
+
+    debug_return;
+}
+
+/*
+ * Submit all queued writes to the kernel.
+ */
+static void
+uring_submit(struct logsrvd_uring *ring)
+{
+    unsigned int to_submit;
+    int nsubmitted;
+    debug_decl(uring_submit, SUDO_DEBUG_UTIL);
+
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    for (;;) {
+	to_submit = ring->sqe_tail -
+	    __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (to_submit == 0)
+	    break;
+	nsubmitted = sys_io_uring_enter(ring->ring_fd, to_submit, 0, 0);
+	if (nsubmitted == -1) {
+	    if (errno == EINTR)
+		continue;
+	    /* Unsubmitted entries stay queued until the next call. */
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"unable to submit %u io_uring entries", to_submit);
+	    break;
+	}
+	if (nsubmitted == 0)
+	    break;
+    }
+
+    debug_return;
+}
+
+/*
+ * Submit all queued writes and wait until those that belong to
+ * closure have completed.  Returns false if the ring is unusable.
+ */
+static bool
+uring_wait(struct logsrvd_uring *ring, struct connection_closure *closure)
+{
+    unsigned int to_submit;
+    debug_decl(uring_wait, SUDO_DEBUG_UTIL);
+
+    while (closure->uring_pending > 0) {
+	__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+	to_submit = ring->sqe_tail -
+	    __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (sys_io_uring_enter(ring->ring_fd, to_submit, 1,
+		IORING_ENTER_GETEVENTS) == -1) {
+	    /* EBUSY means the completion queue must be reaped first. */
+	    if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+		sudo_debug_printf(
+		    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		    "unable to wait for %u io_uring completions",
+		    closure->uring_pending);
+		debug_return_bool(false);
+	    }
+	}
+	uring_reap(ring);
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Make room to queue a chain of n linked entries.  The kernel ends a
+ * chain at the end of each submission, so one must never be split
+ * across io_uring_enter(2) calls.  Anything already queued is submitted
+ * first if needed.  Returns false if the ring cannot hold n more entries.
+ */
+static bool
+uring_reserve(struct logsrvd_uring *ring, unsigned int n)
+{
+    unsigned int queued;
+    debug_decl(uring_reserve, SUDO_DEBUG_UTIL);
+
+    queued = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (queued + n > ring->sq_entries) {
+	uring_submit(ring);
+	queued =
+	    ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    }
+    if (queued + n > ring->sq_entries || ring->inflight + n > ring->cq_entries)
+	debug_return_bool(false);
+    debug_return_bool(true);
+}
+
+/*
+ * Get the file offset that the next write to iofd starts at.
+ * Data is written at an explicit offset, bypassing stdio.  The first
+ * write starts at the stream's position, which may have been moved
+ * by iolog_restart().
+ */
+static bool
+uring_offset(struct connection_closure *closure, int iofd)
+{
+    FILE *fp = closure->iolog_files[iofd].fd.f;
+    off_t *offp = &closure->iolog_offsets[iofd];
+    debug_decl(uring_offset, SUDO_DEBUG_UTIL);
+
+    if (*offp == -1) {
+	if (fflush(fp) != 0 || (*offp = ftello(fp)) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"unable to get offset for %s", iolog_fd_to_name(iofd));
+	    debug_return_bool(false);
+	}
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Queue req as a write of buf, or an fdatasync(2) if buf is NULL, to the
+ * I/O log file for iofd.  The caller must have reserved an entry with
+ * uring_reserve().  If link is set, the next entry queued will not start
+ * until this one completes.  The ring takes ownership of buf's data.
+ */
+static void
+uring_queue(struct connection_closure *closure, struct uring_request *req,
+    int iofd, struct connection_buffer *buf, bool link)
+{
+    struct logsrvd_uring *ring = closure->uring;
+    off_t *offp = &closure->iolog_offsets[iofd];
+    struct io_uring_sqe *sqe;
+    unsigned int idx;
+    debug_decl(uring_queue, SUDO_DEBUG_UTIL);
+
+    req->closure = closure;
+    req->file = NULL;
+    req->iofd = iofd;
+
+    idx = ring->sqe_tail & ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = fileno(closure->iolog_files[iofd].fd.f);
+    if (buf != NULL) {
+	req->opcode = IORING_OP_WRITE;
+	req->data = buf->data;
+	req->len = buf->len;
+	sqe->off = *offp;
+	sqe->addr = (uintptr_t)req->data;
+	sqe->len = req->len;
+	*offp += buf->len;
+	closure->iolog_buffered -= buf->len;
+	closure->uring_unsynced |= 1U << iofd;
+
+	/* The buffer now belongs to the request. */
+	buf->data = NULL;
+	buf->size = 0;
+	buf->len = 0;
+    } else {
+	req->opcode = IORING_OP_FSYNC;
+	req->data = NULL;
+	req->len = 0;
+	sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+	closure->uring_unsynced &= ~(1U << iofd);
+    }
+    sqe->opcode = req->opcode;
+    sqe->user_data = (uintptr_t)req;
+    if (link)
+	sqe->flags = IOSQE_IO_LINK;
+    ring->sq_array[idx] = idx;
+    ring->sqe_tail++;
+
+    TAILQ_INSERT_TAIL(&ring->requests, req, entries);
+    ring->inflight++;
+    closure->uring_pending++;
+
+    debug_return;
+}
+
+/*
+ * Write buf, or fdatasync(2) the file if buf is NULL, synchronously.
+ * Used when the ring is full, the caller must wait for the connection's
+ * queued entries first.
+ */
+static bool
+uring_write_sync(struct connection_closure *closure, int iofd,
+    struct connection_buffer *buf)
+{
+    const int fd = fileno(closure->iolog_files[iofd].fd.f);
+    off_t *offp = &closure->iolog_offsets[iofd];
+    unsigned int nwritten = 0;
+    ssize_t n;
+    debug_decl(uring_write_sync, SUDO_DEBUG_UTIL);
+
+    if (buf == NULL) {
+	if (fdatasync(fd) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"unable to sync %s", iolog_fd_to_name(iofd));
+	    debug_return_bool(false);
+	}
+	closure->uring_unsynced &= ~(1U << iofd);
+	debug_return_bool(true);
+    }
+
+    while (nwritten < buf->len) {
+	n = pwrite(fd, buf->data + nwritten, buf->len - nwritten,
+	    *offp + nwritten);
+	if (n == -1) {
+	    if (errno == EINTR)
+		continue;
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"unable to write %u bytes to %s", buf->len - nwritten,
+		iolog_fd_to_name(iofd));
+	    debug_return_bool(false);
+	}
+	nwritten += n;
+    }
+    *offp += buf->len;
+    closure->iolog_buffered -= buf->len;
+    closure->uring_unsynced |= 1U << iofd;
+    buf->len = 0;
+    debug_return_bool(true);
+}
+
+/*
+ * Write the buffered I/O log data of a connection via the ring, the data
+ * files before the timing file so the timing file never refers to data
+ * that is not on disk yet.  If sync is set, an fdatasync(2) of each file
+ * written to since the last one follows the writes.  The entries form a
+ * single linked chain that is submitted in one call.  If the ring cannot
+ * hold the whole chain, the connection's earlier entries are waited for
+ * and the chain is performed synchronously instead.
+ */
+bool
+uring_flush(struct connection_closure *closure, bool sync)
+{
+    struct logsrvd_uring *ring = closure->uring;
+    struct uring_request *reqs[IOFD_MAX * 2];
+    struct connection_buffer *buf;
+    unsigned int i, n = 0, nwrites, unsynced;
+    int iofd, order[IOFD_MAX * 2];
+    debug_decl(uring_flush, SUDO_DEBUG_UTIL);
+
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	if (iofd != IOFD_TIMING && closure->iolog_bufs[iofd].len != 0)
+	    order[n++] = iofd;
+    }
+    if (closure->iolog_bufs[IOFD_TIMING].len != 0)
+	order[n++] = IOFD_TIMING;
+    nwrites = n;
+    if (sync) {
+	unsynced = closure->uring_unsynced;
+	for (i = 0; i < nwrites; i++)
+	    unsynced |= 1U << order[i];
+	for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	    if (unsynced & (1U << iofd))
+		order[n++] = iofd;
+	}
+    }
+    if (n == 0)
+	debug_return_bool(true);
+
+    for (i = 0; i < nwrites; i++) {
+	if (!uring_offset(closure, order[i]))
+	    debug_return_bool(false);
+    }
+
+    if (!uring_reserve(ring, n)) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "io_uring full, performing %u operations synchronously", n);
+	if (!uring_wait(ring, closure) || closure->uring_error)
+	    debug_return_bool(false);
+	for (i = 0; i < n; i++) {
+	    iofd = order[i];
+	    buf = i < nwrites ? &closure->iolog_bufs[iofd] : NULL;
+	    if (!uring_write_sync(closure, iofd, buf))
+		debug_return_bool(false);
+	}
+	debug_return_bool(true);
+    }
+
+    /* Allocate everything first, a partial chain must not be queued. */
+    for (i = 0; i < n; i++) {
+	if ((reqs[i] = malloc(sizeof(struct uring_request))) == NULL) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to allocate memory");
+	    while (i > 0)
+		free(reqs[--i]);
+	    debug_return_bool(false);
+	}
+    }
+    for (i = 0; i < n; i++) {
+	iofd = order[i];
+	buf = i < nwrites ? &closure->iolog_bufs[iofd] : NULL;
+	uring_queue(closure, reqs[i], iofd, buf, i + 1 < n);
+    }
+    uring_submit(ring);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Hand the I/O log file for iofd over to the ring if entries that
+ * refer to it are still outstanding.  The file is closed when the last
+ * of them completes, so the event loop does not wait for the disk and
+ * the descriptor cannot be reused while an entry still refers to it.
+ * Returns true if the ring now owns the file.
+ */
+bool
+uring_close(struct connection_closure *closure, int iofd)
+{
+    struct logsrvd_uring *ring = closure->uring;
+    struct uring_request *req;
+    struct uring_file *file;
+    unsigned int refs = 0;
+    debug_decl(uring_close, SUDO_DEBUG_UTIL);
+
+    TAILQ_FOREACH(req, &ring->requests, entries) {
+	if (req->closure == closure && req->iofd == iofd)
+	    refs++;
+    }
+    if (refs == 0)
+	debug_return_bool(false);
+
+    if ((file = malloc(sizeof(*file))) == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to allocate memory");
+	if (uring_wait(ring, closure))
+	    debug_return_bool(false);
+	/* Leak the file rather than let its descriptor be reused. */
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to wait for writes to %s", iolog_fd_to_name(iofd));
+	closure->iolog_files[iofd].enabled = false;
+	debug_return_bool(true);
+    }
+    file->fp = closure->iolog_files[iofd].fd.f;
+    file->refs = refs;
+    TAILQ_FOREACH(req, &ring->requests, entries) {
+	if (req->closure == closure && req->iofd == iofd)
+	    req->file = file;
+    }
+    closure->iolog_files[iofd].enabled = false;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Disassociate the outstanding entries of a closure that is about to
+ * be freed.  Its I/O log files must have been passed to uring_close().
+ */
+void
+uring_detach(struct connection_closure *closure)
+{
+    struct logsrvd_uring *ring = closure->uring;
+    struct uring_request *req;
+    debug_decl(uring_detach, SUDO_DEBUG_UTIL);
+
+    if (ring == NULL || closure->uring_pending == 0)
+	debug_return;
+
+    /* Don't schedule a commit point for a closure being torn down. */
+    closure->commit_deferred = false;
+    TAILQ_FOREACH(req, &ring->requests, entries) {
+	if (req->closure == closure)
+	    req->closure = NULL;
+    }
+    closure->uring_pending = 0;
+    uring_submit(ring);
+
+    debug_return;
+}
+
+/*
+ * Set up an io_uring instance whose completions are handled by base.
+ * Returns NULL if io_uring is not supported by the running kernel,
+ * in which case synchronous writes should be used.
+ */
+struct logsrvd_uring *
+uring_alloc(struct sudo_event_base *base)
+{
+    struct logsrvd_uring *ring;
+    struct io_uring_params params;
+    const unsigned int features =
+	IORING_FEAT_SINGLE_MMAP|IORING_FEAT_NODROP|IORING_FEAT_RW_CUR_POS;
+    debug_decl(uring_alloc, SUDO_DEBUG_UTIL);
+
+    if ((ring = calloc(1, sizeof(*ring))) == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to allocate memory");
+	debug_return_ptr(NULL);
+    }
+    TAILQ_INIT(&ring->requests);
+    ring->event_fd = -1;
+
+    memset(&params, 0, sizeof(params));
+    ring->ring_fd = sys_io_uring_setup(URING_ENTRIES, &params);
+    if (ring->ring_fd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "io_uring not available, using synchronous I/O log writes");
+	free(ring);
+	debug_return_ptr(NULL);
+    }
+    /* IORING_FEAT_RW_CUR_POS was added with IORING_OP_WRITE (Linux 5.6). */
+    if ((params.features & features) != features) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "io_uring too old (features 0x%x), using synchronous I/O log writes",
+	    params.features);
+	goto bad;
+    }
+
+    /* The SQ and CQ rings share a single mapping. */
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_len = params.cq_off.cqes +
+	params.cq_entries * sizeof(struct io_uring_cqe);
+    if (ring->cq_len > ring->sq_len)
+	ring->sq_len = ring->cq_len;
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ|PROT_WRITE,
+	MAP_SHARED|MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+	ring->sq_ptr = NULL;
+	goto bad;
+    }
+    ring->cq_ptr = ring->sq_ptr;
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ|PROT_WRITE,
+	MAP_SHARED|MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+	ring->sqes = NULL;
+	goto bad;
+    }
+
+    ring->sq_head = (unsigned int *)((char *)ring->sq_ptr + params.sq_off.head);
+    ring->sq_tail = (unsigned int *)((char *)ring->sq_ptr + params.sq_off.tail);
+    ring->sq_array = (unsigned int *)((char *)ring->sq_ptr + params.sq_off.array);
+    ring->sq_mask = *(unsigned int *)((char *)ring->sq_ptr + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned int *)((char *)ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned int *)((char *)ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask = *(unsigned int *)((char *)ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cq_entries = params.cq_entries;
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr + params.cq_off.cqes);
+
+    /* Completions are signaled via an eventfd serviced by the event loop. */
+    ring->event_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (ring->event_fd == -1)
+	goto bad;
+    if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_EVENTFD,
+	    &ring->event_fd, 1) == -1)
+	goto bad;
+    ring->ev = sudo_ev_alloc(ring->event_fd, SUDO_EV_READ|SUDO_EV_PERSIST,
+	uring_cb, ring);
+    if (ring->ev == NULL)
+	goto bad;
+    if (sudo_ev_add(base, ring->ev, NULL, false) == -1)
+	goto bad;
+
+    sudo_debug_printf(SUDO_DEBUG_INFO,
+	"%s: using io_uring for I/O log writes (%u entries)", __func__,
+	ring->sq_entries);
+    debug_return_ptr(ring);
+bad:
+    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	"unable to set up io_uring, using synchronous I/O log writes");
+    uring_free(ring);
+    debug_return_ptr(NULL);
+}
+
+/*
+ * Wait for any pending writes to complete and free the ring.
+ */
+void
+uring_free(struct logsrvd_uring *ring)
+{
+    struct uring_request *req;
+    debug_decl(uring_free, SUDO_DEBUG_UTIL);
+
+    if (ring == NULL)
+	debug_return;
+
+    if (ring->sq_ptr != NULL) {
+	uring_submit(ring);
+	while (ring->inflight > 0) {
+	    if (sys_io_uring_enter(ring->ring_fd, 0, 1,
+		    IORING_ENTER_GETEVENTS) == -1 && errno != EINTR) {
+		sudo_debug_printf(
+		    SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		    "unable to wait for %u io_uring completions",
+		    ring->inflight);
+		break;
+	    }
+	    uring_reap(ring);
+	}
+	munmap(ring->sq_ptr, ring->sq_len);
+    }
+    /* Close any files whose entries could not be completed. */
+    while ((req = TAILQ_FIRST(&ring->requests)) != NULL)
+	uring_request_free(ring, req);
+    if (ring->sqes != NULL)
+	munmap(ring->sqes, ring->sqes_len);
+    sudo_ev_free(ring->ev);
+    if (ring->event_fd != -1)
+	close(ring->event_fd);
+    close(ring->ring_fd);
+    free(ring);
+
+    debug_return;
+}
+
+#endif /* HAVE_IO_URING */
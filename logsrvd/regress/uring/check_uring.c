@@ -0,0 +1,476 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#ifdef HAVE_IO_URING
+# include <sys/prctl.h>
+# include <sys/syscall.h>
+# include <linux/filter.h>
+# include <linux/seccomp.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudo_compat.h"
+#include "sudo_debug.h"
+#include "sudo_event.h"
+#include "sudo_eventlog.h"
+#include "sudo_fatal.h"
+#include "sudo_iolog.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+
+#include "log_server.pb-c.h"
+#include "logsrvd.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+#ifdef HAVE_IO_URING
+
+/*
+ * Exercise the io_uring I/O log writer without a running server:
+ * writes that overflow the ring, commit point syncs, closing files
+ * with writes still outstanding, and falling back to synchronous
+ * writes when the kernel does not allow io_uring.
+ */
+
+#define NRECS	2000
+#define RECSIZE	100
+
+static int ncommits;
+
+static void
+commit_cb(int unused, int what, void *v)
+{
+    ncommits++;
+}
+
+static void
+append(struct connection_closure *closure, int iofd, const char *data,
+    unsigned int len)
+{
+    struct connection_buffer *buf = &closure->iolog_bufs[iofd];
+
+    if (buf->len + len > buf->size) {
+	buf->size = buf->len + len;
+	if ((buf->data = realloc(buf->data, buf->size)) == NULL)
+	    sudo_fatalx("unable to allocate memory");
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    closure->iolog_buffered += len;
+}
+
+/*
+ * Buffer the ttyout data and timing record for record number recno.
+ */
+static void
+add_record(struct connection_closure *closure, int recno)
+{
+    char data[RECSIZE], timing[64];
+    int len;
+
+    memset(data, 'a' + (recno % 26), sizeof(data));
+    append(closure, IOFD_TTYOUT, data, sizeof(data));
+    len = snprintf(timing, sizeof(timing), "%d %d %d\n", IO_EVENT_TTYOUT,
+	recno, RECSIZE);
+    append(closure, IOFD_TIMING, timing, len);
+}
+
+/*
+ * Check that the ttyout and timing files in dfd hold nrecs records.
+ */
+static bool
+check_files(int dfd, int nrecs)
+{
+    char line[64], data[RECSIZE], expected[RECSIZE];
+    FILE *ttyout, *timing;
+    bool ret = false;
+    int fd, recno;
+
+    if ((fd = openat(dfd, "ttyout", O_RDONLY)) == -1 ||
+	    (ttyout = fdopen(fd, "r")) == NULL)
+	sudo_fatal("ttyout");
+    if ((fd = openat(dfd, "timing", O_RDONLY)) == -1 ||
+	    (timing = fdopen(fd, "r")) == NULL)
+	sudo_fatal("timing");
+
+    for (recno = 0; recno < nrecs; recno++) {
+	char want[64];
+
+	memset(expected, 'a' + (recno % 26), sizeof(expected));
+	if (fread(data, 1, sizeof(data), ttyout) != sizeof(data) ||
+		memcmp(data, expected, sizeof(data)) != 0) {
+	    sudo_warnx("ttyout record %d is wrong", recno);
+	    goto done;
+	}
+	(void)snprintf(want, sizeof(want), "%d %d %d\n", IO_EVENT_TTYOUT,
+	    recno, RECSIZE);
+	if (fgets(line, sizeof(line), timing) == NULL ||
+		strcmp(line, want) != 0) {
+	    sudo_warnx("timing record %d is wrong", recno);
+	    goto done;
+	}
+    }
+    if (getc(ttyout) != EOF || getc(timing) != EOF) {
+	sudo_warnx("extra data after %d records", nrecs);
+	goto done;
+    }
+    ret = true;
+done:
+    fclose(ttyout);
+    fclose(timing);
+    return ret;
+}
+
+static struct connection_closure *
+closure_alloc(struct sudo_event_base *base, struct logsrvd_uring *ring,
+    int dfd)
+{
+    struct connection_closure *closure;
+    int iofd;
+
+    if ((closure = calloc(1, sizeof(*closure))) == NULL)
+	sudo_fatalx("unable to allocate memory");
+    closure->evbase = base;
+    closure->uring = ring;
+    closure->commit_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT, commit_cb,
+	closure);
+    if (closure->commit_ev == NULL)
+	sudo_fatalx("unable to allocate memory");
+    for (iofd = 0; iofd < IOFD_MAX; iofd++)
+	closure->iolog_offsets[iofd] = -1;
+    closure->iolog_files[IOFD_TTYOUT].enabled = true;
+    if (!iolog_open(&closure->iolog_files[IOFD_TTYOUT], dfd, IOFD_TTYOUT, "w"))
+	sudo_fatal("unable to create ttyout");
+    closure->iolog_files[IOFD_TIMING].enabled = true;
+    if (!iolog_open(&closure->iolog_files[IOFD_TIMING], dfd, IOFD_TIMING, "w"))
+	sudo_fatal("unable to create timing");
+    return closure;
+}
+
+/*
+ * Close the closure's files, handing those with writes outstanding
+ * to the ring, and free it.
+ */
+static void
+closure_free(struct connection_closure *closure)
+{
+    const char *errstr;
+    int iofd;
+
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	free(closure->iolog_bufs[iofd].data);
+	if (!closure->iolog_files[iofd].enabled)
+	    continue;
+	if (uring_close(closure, iofd))
+	    continue;
+	if (!iolog_close(&closure->iolog_files[iofd], &errstr))
+	    sudo_fatalx("unable to close %s: %s", iolog_fd_to_name(iofd), errstr);
+    }
+    uring_detach(closure);
+    sudo_ev_free(closure->commit_ev);
+    free(closure);
+}
+
+static int
+open_dir(const char *testdir, const char *name)
+{
+    char path[PATH_MAX];
+    int dfd;
+
+    (void)snprintf(path, sizeof(path), "%s/%s", testdir, name);
+    if (mkdir(path, 0700) == -1)
+	sudo_fatal("unable to create %s", path);
+    if ((dfd = open(path, O_RDONLY)) == -1)
+	sudo_fatal("unable to open %s", path);
+    return dfd;
+}
+
+/*
+ * Queue many more writes than the ring can hold without running the
+ * event loop, so completions are never reaped.  Every chain that does
+ * not fit must fall back to synchronous writes after waiting for the
+ * earlier ones, and the files must still come out in order.
+ */
+static void
+test_full_ring(struct sudo_event_base *base, struct logsrvd_uring *ring,
+    const char *testdir, int *ntests, int *nerrors)
+{
+    struct connection_closure *closure;
+    unsigned int max_pending = 0;
+    bool want_commit;
+    int dfd, recno;
+
+    dfd = open_dir(testdir, "full");
+    closure = closure_alloc(base, ring, dfd);
+
+    (*ntests)++;
+    for (recno = 0; recno < NRECS; recno++) {
+	add_record(closure, recno);
+	if (!uring_flush(closure, recno % 16 == 15)) {
+	    sudo_warnx("full ring: unable to write record %d", recno);
+	    (*nerrors)++;
+	    break;
+	}
+	if (closure->uring_pending > max_pending)
+	    max_pending = closure->uring_pending;
+    }
+    if (closure->iolog_buffered != 0) {
+	sudo_warnx("full ring: %u bytes left in buffers",
+	    closure->iolog_buffered);
+	(*nerrors)++;
+    }
+
+    /* Without the fallback, every entry would still be pending. */
+    (*ntests)++;
+    if (max_pending >= NRECS) {
+	sudo_warnx("full ring: %u entries pending, expected fewer than %d",
+	    max_pending, NRECS);
+	(*nerrors)++;
+    }
+
+    /* A deferred commit point is scheduled once everything completes. */
+    (*ntests)++;
+    closure->commit_deferred = true;
+    want_commit = closure->uring_pending != 0;
+    ncommits = 0;
+    while (closure->uring_pending != 0) {
+	if (sudo_ev_loop(base, SUDO_EVLOOP_ONCE) == -1)
+	    sudo_fatal("event loop");
+    }
+    while (want_commit && ncommits == 0) {
+	if (sudo_ev_loop(base, SUDO_EVLOOP_ONCE) == -1)
+	    sudo_fatal("event loop");
+    }
+    if (closure->uring_error || closure->uring_unsynced != 0) {
+	sudo_warnx("full ring: write error %d, unsynced files 0x%x",
+	    closure->uring_error, closure->uring_unsynced);
+	(*nerrors)++;
+    }
+
+    (*ntests)++;
+    closure_free(closure);
+    if (!check_files(dfd, NRECS))
+	(*nerrors)++;
+    close(dfd);
+}
+
+/*
+ * Close the files while their writes are still queued.  The ring must
+ * keep the descriptors open until the writes complete, then close them.
+ */
+static void
+test_close_pending(struct sudo_event_base *base, const char *testdir,
+    int *ntests, int *nerrors)
+{
+    struct connection_closure *closure;
+    struct logsrvd_uring *ring;
+    int dfd, fds[2], i, recno;
+
+    if ((ring = uring_alloc(base)) == NULL)
+	sudo_fatalx("unable to set up io_uring");
+    dfd = open_dir(testdir, "close");
+    closure = closure_alloc(base, ring, dfd);
+    fds[0] = fileno(closure->iolog_files[IOFD_TTYOUT].fd.f);
+    fds[1] = fileno(closure->iolog_files[IOFD_TIMING].fd.f);
+
+    (*ntests)++;
+    for (recno = 0; recno < 10; recno++) {
+	add_record(closure, recno);
+	if (!uring_flush(closure, false)) {
+	    sudo_warnx("close pending: unable to write record %d", recno);
+	    (*nerrors)++;
+	}
+    }
+    if (closure->uring_pending == 0) {
+	sudo_warnx("close pending: no writes outstanding");
+	(*nerrors)++;
+    }
+
+    (*ntests)++;
+    closure_free(closure);
+    for (i = 0; i < 2; i++) {
+	if (fcntl(fds[i], F_GETFD) == -1) {
+	    sudo_warnx("close pending: fd %d closed too early", fds[i]);
+	    (*nerrors)++;
+	    break;
+	}
+    }
+
+    /* Freeing the ring waits for the writes, then closes the files. */
+    (*ntests)++;
+    uring_free(ring);
+    for (i = 0; i < 2; i++) {
+	if (fcntl(fds[i], F_GETFD) != -1 || errno != EBADF) {
+	    sudo_warnx("close pending: fd %d not closed", fds[i]);
+	    (*nerrors)++;
+	    break;
+	}
+    }
+
+    (*ntests)++;
+    if (!check_files(dfd, 10))
+	(*nerrors)++;
+    close(dfd);
+}
+
+/*
+ * Make io_uring_setup(2) fail with error in a child process, the way it
+ * does on kernels without io_uring or with it disabled.  The ring must
+ * not be set up, so logsrvd uses synchronous writes instead.
+ * Returns -1 if seccomp filters are not supported.
+ */
+static int
+test_no_uring(int error)
+{
+    struct sock_filter filter[] = {
+	BPF_STMT(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, nr)),
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, __NR_io_uring_setup, 0, 1),
+	BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ERRNO|(error & SECCOMP_RET_DATA)),
+	BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW)
+    };
+    struct sock_fprog prog = { nitems(filter), filter };
+    struct sudo_event_base *base;
+    struct logsrvd_uring *ring;
+    int status;
+    pid_t pid;
+
+    switch (pid = fork()) {
+    case -1:
+	sudo_fatal("fork");
+    case 0:
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1 ||
+		prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == -1)
+	    _exit(2);
+	if ((base = sudo_ev_base_alloc()) == NULL)
+	    _exit(1);
+	ring = uring_alloc(base);
+	_exit(ring == NULL ? 0 : 1);
+    }
+    if (waitpid(pid, &status, 0) == -1)
+	sudo_fatal("waitpid");
+    if (!WIFEXITED(status))
+	return 1;
+    if (WEXITSTATUS(status) == 2)
+	return -1;
+    return WEXITSTATUS(status);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char testdir[] = "uring.XXXXXX";
+    char *rmargs[] = { "rm", "-rf", NULL, NULL };
+    const int errors[] = { ENOSYS, EPERM };
+    struct sudo_event_base *base;
+    struct logsrvd_uring *ring;
+    int i, ret, status, ntests = 0, nerrors = 0;
+
+    initprogname(argc > 0 ? argv[0] : "check_uring");
+
+    if (mkdtemp(testdir) == NULL)
+	sudo_fatal("unable to create test dir");
+    rmargs[2] = testdir;
+
+    iolog_set_owner(geteuid(), getegid());
+    iolog_set_compress(IOLOG_COMPRESS_NONE);
+
+    if ((base = sudo_ev_base_alloc()) == NULL)
+	sudo_fatalx("unable to allocate event base");
+
+    if ((ring = uring_alloc(base)) == NULL) {
+	printf("%s: io_uring not available, skipping ring tests\n",
+	    getprogname());
+    } else {
+	test_full_ring(base, ring, testdir, &ntests, &nerrors);
+	uring_free(ring);
+	test_close_pending(base, testdir, &ntests, &nerrors);
+    }
+
+    for (i = 0; i < (int)nitems(errors); i++) {
+	ret = test_no_uring(errors[i]);
+	if (ret == -1) {
+	    printf("%s: seccomp not available, skipping fallback test\n",
+		getprogname());
+	    break;
+	}
+	ntests++;
+	if (ret != 0) {
+	    sudo_warnx("io_uring set up even though io_uring_setup failed "
+		"with %s", strerror(errors[i]));
+	    nerrors++;
+	}
+    }
+    sudo_ev_base_free(base);
+
+    if (ntests != 0) {
+	printf("%s: %d test%s run, %d errors, %d%% success rate\n",
+	    getprogname(), ntests, ntests == 1 ? "" : "s", nerrors,
+	    (ntests - nerrors) * 100 / ntests);
+    }
+
+    /* Clean up (avoid running via shell) */
+    switch (fork()) {
+    case -1:
+	sudo_warn("fork");
+	_exit(1);
+    case 0:
+	execvp("rm", rmargs);
+	_exit(1);
+    default:
+	wait(&status);
+	break;
+    }
+
+    return nerrors;
+}
+
+#else
+
+int
+main(int argc, char *argv[])
+{
+    initprogname(argc > 0 ? argv[0] : "check_uring");
+    printf("%s: io_uring support not enabled, skipping tests\n",
+	getprogname());
+    return EXIT_SUCCESS;
+}
+
+#endif /* HAVE_IO_URING */
@@ -134,6 +134,8 @@ fi
 AC_MSG_RESULT([$rundir])
 SUDO_DEFINE_UNQUOTED(_PATH_SUDO_TIMEDIR, "$rundir/ts")
 SUDO_DEFINE_UNQUOTED(_PATH_SUDO_LOGSRVD_PID, "$rundir/sudo_logsrvd.pid")
+SUDO_DEFINE_UNQUOTED(_PATH_SUDO_LOG_SERVER_SESSION, "$rundir/log_server.session")
+SUDO_DEFINE_UNQUOTED(_PATH_SUDO_LOGAGENT_SOCK, "$rundir/sudo_logagent.sock")
 ])dnl
 
 dnl
@@ -44,6 +44,12 @@ static struct def_values def_data_log_format[] = {
     { NULL, 0 },
 };
 
+static struct def_values def_data_iolog_compress_method[] = {
+    { "gzip", gzip },
+    { "zstd", zstd },
+    { NULL, 0 },
+};
+
 struct sudo_defs_types sudo_defs_table[] = {
     {
 	"syslog", T_LOGFAC|T_BOOL,
@@ -351,7 +357,7 @@ struct sudo_defs_types sudo_defs_table[] = {
 	NULL,
     }, {
 	"compress_io", T_FLAG,
-	N_("Compress I/O logs using zlib"),
+	N_("Compress I/O logs"),
 	NULL,
     }, {
 	"use_pty", T_FLAG,
@@ -573,6 +579,30 @@ struct sudo_defs_types sudo_defs_table[] = {
 	"selinux", T_FLAG,
 	N_("Enable SELinux RBAC support"),
 	NULL,
+    }, {
+	"log_server_coalesce_bytes", T_UINT|T_BOOL,
+	N_("Maximum amount of I/O in bytes to combine into a single log server message: %u"),
+	NULL,
+    }, {
+	"log_server_coalesce_delay", T_UINT|T_BOOL,
+	N_("Maximum time in milliseconds to hold I/O for combining before sending it to the log server: %u"),
+	NULL,
+    }, {
+	"log_server_spool", T_STR|T_BOOL|T_PATH,
+	N_("Directory to spool I/O logs in before they are sent to the log server: %s"),
+	NULL,
+    }, {
+	"iolog_binary_timing", T_FLAG,
+	N_("Write I/O log timing records in a compact binary format"),
+	NULL,
+    }, {
+	"iolog_compress_thread", T_FLAG,
+	N_("Compress I/O logs in a separate thread"),
+	NULL,
+    }, {
+	"iolog_compress_method", T_TUPLE,
+	N_("Method used to compress I/O logs: %s"),
+	def_data_iolog_compress_method,
     }, {
 	NULL, 0, NULL
     }
@@ -264,6 +264,18 @@
 #define def_log_format          (sudo_defs_table[I_LOG_FORMAT].sd_un.tuple)
 #define I_SELINUX               131
 #define def_selinux             (sudo_defs_table[I_SELINUX].sd_un.flag)
+#define I_LOG_SERVER_COALESCE_BYTES 132
+#define def_log_server_coalesce_bytes (sudo_defs_table[I_LOG_SERVER_COALESCE_BYTES].sd_un.uival)
+#define I_LOG_SERVER_COALESCE_DELAY 133
+#define def_log_server_coalesce_delay (sudo_defs_table[I_LOG_SERVER_COALESCE_DELAY].sd_un.uival)
+#define I_LOG_SERVER_SPOOL      134
+#define def_log_server_spool    (sudo_defs_table[I_LOG_SERVER_SPOOL].sd_un.str)
+#define I_IOLOG_BINARY_TIMING   135
+#define def_iolog_binary_timing (sudo_defs_table[I_IOLOG_BINARY_TIMING].sd_un.flag)
+#define I_IOLOG_COMPRESS_THREAD 136
+#define def_iolog_compress_thread (sudo_defs_table[I_IOLOG_COMPRESS_THREAD].sd_un.flag)
+#define I_IOLOG_COMPRESS_METHOD 137
+#define def_iolog_compress_method (sudo_defs_table[I_IOLOG_COMPRESS_METHOD].sd_un.tuple)
 
 enum def_tuple {
     never,
@@ -277,5 +289,7 @@ enum def_tuple {
     tty,
     kernel,
     sudo,
-    json
+    json,
+    gzip,
+    zstd
 };
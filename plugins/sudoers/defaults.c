@@ -539,6 +539,7 @@ init_defaults(void)
     def_log_allowed = true;
     def_log_denied = true;
     def_log_format = sudo;
+    def_iolog_compress_method = gzip;
     def_runas_allow_unknown_id = false;
 
     /* Syslog options need special care since they both strings and ints */
@@ -566,6 +567,7 @@ init_defaults(void)
     def_compress_io = true;
 #endif
     def_log_server_timeout = 30;
+    def_log_server_coalesce_bytes = 16384;
     def_log_server_verify = true;
     def_log_server_keepalive = true;
     def_ignore_audit_errors = true;
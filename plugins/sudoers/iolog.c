@@ -71,6 +71,8 @@ static struct log_details iolog_details;
 static bool warned = false;
 static int iolog_dir_fd = -1;
 static struct timespec last_time;
+static struct timespec iolog_elapsed;	/* session time in timing file */
+static struct timespec iolog_indexed;	/* session time of last index entry */
 static void sudoers_io_setops(void);
 
 /* sudoers_io is declared at the end of this file. */
@@ -198,6 +200,7 @@ free_iolog_details(void)
 	eventlog_free(iolog_details.evlog);
     }
     str_list_free(iolog_details.log_servers);
+    free(iolog_details.spool_dir);
 #if defined(HAVE_OPENSSL)
     free(iolog_details.ca_bundle);
     free(iolog_details.cert_file);
@@ -383,9 +386,35 @@ iolog_deserialize_info(struct log_details *details, char * const user_info[],
 		continue;
 	    }
 	    if (strncmp(*cur, "iolog_compress=", sizeof("iolog_compress=") - 1) == 0) {
-		int val = sudo_strtobool(*cur + sizeof("iolog_compress=") - 1);
+		const char *method = *cur + sizeof("iolog_compress=") - 1;
+		int val = sudo_strtobool(method);
 		if (val != -1) {
-		    iolog_set_compress(val);
+		    iolog_set_compress(val ?
+			IOLOG_COMPRESS_GZIP : IOLOG_COMPRESS_NONE);
+		} else if (strcmp(method, "gzip") == 0) {
+		    iolog_set_compress(IOLOG_COMPRESS_GZIP);
+		} else if (strcmp(method, "zstd") == 0) {
+		    iolog_set_compress(IOLOG_COMPRESS_ZSTD);
+		} else {
+		    sudo_debug_printf(SUDO_DEBUG_WARN,
+			"%s: unable to parse %s", __func__, *cur);
+		}
+		continue;
+	    }
+	    if (strncmp(*cur, "iolog_binary_timing=", sizeof("iolog_binary_timing=") - 1) == 0) {
+		int val = sudo_strtobool(*cur + sizeof("iolog_binary_timing=") - 1);
+		if (val != -1) {
+		    iolog_set_binary_timing(val);
+		} else {
+		    sudo_debug_printf(SUDO_DEBUG_WARN,
+			"%s: unable to parse %s", __func__, *cur);
+		}
+		continue;
+	    }
+	    if (strncmp(*cur, "iolog_compress_thread=", sizeof("iolog_compress_thread=") - 1) == 0) {
+		int val = sudo_strtobool(*cur + sizeof("iolog_compress_thread=") - 1);
+		if (val != -1) {
+		    iolog_set_compress_thread(val);
 		} else {
 		    sudo_debug_printf(SUDO_DEBUG_WARN,
 			"%s: unable to parse %s", __func__, *cur);
@@ -443,6 +472,39 @@ iolog_deserialize_info(struct log_details *details, char * const user_info[],
 		    goto oom;
 		continue;
 	    }
+	    if (strncmp(*cur, "log_server_coalesce_bytes=", sizeof("log_server_coalesce_bytes=") - 1) == 0) {
+		const char *errstr;
+		unsigned int bytes = sudo_strtonum(
+		    *cur + sizeof("log_server_coalesce_bytes=") - 1, 0,
+		    MESSAGE_SIZE_MAX / 2, &errstr);
+		if (errstr == NULL) {
+		    details->coalesce_bytes = bytes;
+		} else {
+		    sudo_debug_printf(SUDO_DEBUG_WARN,
+			"%s: unable to parse %s: %s", __func__, *cur, errstr);
+		}
+		continue;
+	    }
+	    if (strncmp(*cur, "log_server_coalesce_delay=", sizeof("log_server_coalesce_delay=") - 1) == 0) {
+		const char *errstr;
+		unsigned int msec = sudo_strtonum(
+		    *cur + sizeof("log_server_coalesce_delay=") - 1, 0,
+		    INT_MAX, &errstr);
+		if (errstr == NULL) {
+		    details->coalesce_delay.tv_sec = msec / 1000;
+		    details->coalesce_delay.tv_nsec = (msec % 1000) * 1000000;
+		} else {
+		    sudo_debug_printf(SUDO_DEBUG_WARN,
+			"%s: unable to parse %s: %s", __func__, *cur, errstr);
+		}
+		continue;
+	    }
+	    if (strncmp(*cur, "log_server_spool=", sizeof("log_server_spool=") - 1) == 0) {
+		details->spool_dir = strdup(*cur + sizeof("log_server_spool=") - 1);
+		if (details->spool_dir == NULL)
+		    goto oom;
+		continue;
+	    }
 	    if (strncmp(*cur, "log_server_timeout=", sizeof("log_server_timeout=") - 1) == 0) {
 		details->server_timeout.tv_sec =
 		    sudo_strtonum(*cur + sizeof("log_server_timeout=") - 1, 1,
@@ -677,6 +739,15 @@ sudoers_io_open_remote(struct timespec *now)
 {
     debug_decl(sudoers_io_open_remote, SUDOERS_DEBUG_PLUGIN);
 
+    /* Spool I/O locally and upload it in the background if configured. */
+    if (iolog_details.spool_dir != NULL) {
+	client_closure = log_spool_open(&iolog_details, now,
+	    sudoers_io.event_alloc);
+	if (client_closure != NULL)
+	    debug_return_int(1);
+	sudo_warnx("%s", U_("unable to spool I/O log, sending it directly"));
+    }
+
     /* Open connection to log server, send hello and accept messages. */
     client_closure = log_server_open(&iolog_details, now, true, SEND_ACCEPT,
 	NULL, sudoers_io.event_alloc);
@@ -861,6 +932,30 @@ sudoers_io_version(int verbose)
     debug_return_int(true);
 }
 
+/*
+ * Add the delay of the timing record just written to the elapsed time
+ * and write an index entry if one is due.  A missing index entry is
+ * not fatal, it just means replay has to start from an earlier one.
+ */
+static void
+sudoers_io_index_local(struct timespec *delay)
+{
+    struct timespec since;
+    debug_decl(sudoers_io_index_local, SUDOERS_DEBUG_PLUGIN);
+
+    sudo_timespecadd(&iolog_elapsed, delay, &iolog_elapsed);
+    sudo_timespecsub(&iolog_elapsed, &iolog_indexed, &since);
+    if (since.tv_sec >= IOLOG_INDEX_INTERVAL) {
+	if (!iolog_write_index(iolog_dir_fd, iolog_files, &iolog_elapsed)) {
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+		"unable to write I/O log index entry");
+	}
+	iolog_indexed = iolog_elapsed;
+    }
+
+    debug_return;
+}
+
 /*
  * Write an I/O log entry to the local file system.
  * Returns 1 on success and -1 on error.
@@ -872,7 +967,7 @@ sudoers_io_log_local(int event, const char *buf, unsigned int len,
 {
     struct iolog_file *iol;
     char tbuf[1024];
-    int ret = -1;
+    int tlen, ret = -1;
     debug_decl(sudoers_io_log_local, SUDOERS_DEBUG_PLUGIN);
 
     if (event < 0 || event >= IOFD_MAX) {
@@ -893,15 +988,16 @@ sudoers_io_log_local(int event, const char *buf, unsigned int len,
 	goto done;
 
     /* Write timing file entry. */
-    len = (unsigned int)snprintf(tbuf, sizeof(tbuf), "%d %lld.%09ld %u\n",
-	event, (long long)delay->tv_sec, delay->tv_nsec, len);
-    if (len >= sizeof(tbuf)) {
+    tlen = iolog_fmt_timing_io(tbuf, sizeof(tbuf),
+	iolog_files[IOFD_TIMING].binary, event, delay, len);
+    if (tlen == -1) {
 	/* Not actually possible due to the size of tbuf[]. */
 	*errstr = strerror(EOVERFLOW);
 	goto done;
     }
-    if (iolog_write(&iolog_files[IOFD_TIMING], tbuf, len, errstr) == -1)
+    if (iolog_write(&iolog_files[IOFD_TIMING], tbuf, tlen, errstr) == -1)
 	goto done;
+    sudoers_io_index_local(delay);
 
     /* Success. */
     ret = 1;
@@ -950,6 +1046,11 @@ sudoers_io_log_remote(int event, const char *buf, unsigned int len,
 	goto done;
     }
     if (fmt_io_buf(client_closure, type, buf, len, delay)) {
+	/* The buffer may have been held for coalescing. */
+	if (TAILQ_EMPTY(&client_closure->write_bufs)) {
+	    ret = 1;
+	    goto done;
+	}
 	ret = client_closure->write_ev->add(client_closure->write_ev,
 	    &iolog_details.server_timeout);
 	if (ret == -1)
@@ -1050,16 +1151,16 @@ sudoers_io_change_winsize_local(unsigned int lines, unsigned int cols,
     debug_decl(sudoers_io_change_winsize_local, SUDOERS_DEBUG_PLUGIN);
 
     /* Write window change event to the timing file. */
-    len = snprintf(tbuf, sizeof(tbuf), "%d %lld.%09ld %u %u\n",
-	IO_EVENT_WINSIZE, (long long)delay->tv_sec, delay->tv_nsec,
-	lines, cols);
-    if (len < 0 || len >= ssizeof(tbuf)) {
+    len = iolog_fmt_timing_winsize(tbuf, sizeof(tbuf),
+	iolog_files[IOFD_TIMING].binary, delay, (int)lines, (int)cols);
+    if (len == -1) {
 	/* Not actually possible due to the size of tbuf[]. */
 	*errstr = strerror(EOVERFLOW);
 	goto done;
     }
     if (iolog_write(&iolog_files[IOFD_TIMING], tbuf, len, errstr) == -1)
 	goto done;
+    sudoers_io_index_local(delay);
 
     /* Success. */
     ret = 1;
@@ -1083,6 +1184,9 @@ sudoers_io_change_winsize_remote(unsigned int lines, unsigned int cols,
     sudo_timespecadd(delay, &client_closure->elapsed, &client_closure->elapsed);
 
     if (fmt_winsize(client_closure, lines, cols, delay)) {
+	/* Nothing to send if the message was spooled. */
+	if (TAILQ_EMPTY(&client_closure->write_bufs))
+	    debug_return_int(1);
 	ret = client_closure->write_ev->add(client_closure->write_ev,
 	    &iolog_details.server_timeout);
 	if (ret == -1)
@@ -1143,21 +1247,21 @@ static int
 sudoers_io_suspend_local(const char *signame, struct timespec *delay,
     const char **errstr)
 {
-    unsigned int len;
     char tbuf[1024];
-    int ret = -1;
+    int len, ret = -1;
     debug_decl(sudoers_io_suspend_local, SUDOERS_DEBUG_PLUGIN);
 
     /* Write suspend event to the timing file. */
-    len = (unsigned int)snprintf(tbuf, sizeof(tbuf), "%d %lld.%09ld %s\n",
-	IO_EVENT_SUSPEND, (long long)delay->tv_sec, delay->tv_nsec, signame);
-    if (len >= sizeof(tbuf)) {
+    len = iolog_fmt_timing_suspend(tbuf, sizeof(tbuf),
+	iolog_files[IOFD_TIMING].binary, delay, signame);
+    if (len == -1) {
 	/* Not actually possible due to the size of tbuf[]. */
 	*errstr = strerror(EOVERFLOW);
 	goto done;
     }
     if (iolog_write(&iolog_files[IOFD_TIMING], tbuf, len, errstr) == -1)
 	goto done;
+    sudoers_io_index_local(delay);
 
     /* Success. */
     ret = 1;
@@ -1181,6 +1285,9 @@ sudoers_io_suspend_remote(const char *signame, struct timespec *delay,
     sudo_timespecadd(delay, &client_closure->elapsed, &client_closure->elapsed);
 
     if (fmt_suspend(client_closure, signame, delay)) {
+	/* Nothing to send if the message was spooled. */
+	if (TAILQ_EMPTY(&client_closure->write_bufs))
+	    debug_return_int(1);
 	ret = client_closure->write_ev->add(client_closure->write_ev,
 	    &iolog_details.server_timeout);
 	if (ret == -1)
@@ -23,6 +23,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -67,63 +68,199 @@
 static void client_msg_cb(int fd, int what, void *v);
 static void server_msg_cb(int fd, int what, void *v);
 
-static void
-connect_cb(int sock, int what, void *v)
+/*
+ * Create a non-blocking, close-on-exec socket suitable for connecting
+ * to the specified address.
+ * Returns the socket on success, else -1 and sets cause.
+ */
+static int
+new_socket(const struct addrinfo *res, bool keepalive, const char **cause)
 {
-    int optval, ret, *errnump = v;
-    socklen_t optlen = sizeof(optval);
-    debug_decl(connect_cb, SUDOERS_DEBUG_UTIL);
+    int flags, save_errno, sock;
+    debug_decl(new_socket, SUDOERS_DEBUG_UTIL);
 
-    if (what == SUDO_PLUGIN_EV_TIMEOUT) {
-	*errnump = ETIMEDOUT;
-    } else {
-	ret = getsockopt(sock, SOL_SOCKET, SO_ERROR, &optval, &optlen);
-	*errnump = ret == 0 ? optval : errno;
+    sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (sock == -1) {
+	*cause = "socket";
+	debug_return_int(-1);
+    }
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+	*cause = "fcntl(O_NONBLOCK)";
+	goto bad;
+    }
+    if (fcntl(sock, F_SETFD, FD_CLOEXEC) == -1) {
+	*cause = "fcntl(FD_CLOEXEC)";
+	goto bad;
+    }
+    if (keepalive && res->ai_family != AF_UNIX) {
+	flags = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &flags,
+		sizeof(flags)) == -1) {
+	    *cause = "setsockopt(SO_KEEPALIVE)";
+	    goto bad;
+	}
     }
+    debug_return_int(sock);
+bad:
+    save_errno = errno;
+    close(sock);
+    errno = save_errno;
+    debug_return_int(-1);
+}
+
+/*
+ * A connection to the first log server that was started before it
+ * was needed, see log_server_preconnect().
+ */
+static struct log_server_preconnect {
+    char *copy;
+    char *host;
+    char *port;
+    struct addrinfo *res0;
+    struct addrinfo *res;
+    struct timespec start;
+    int sock;
+    bool tls;
+} preconnect = { NULL, NULL, NULL, NULL, NULL, { 0, 0 }, -1, false };
+
+/*
+ * Free the preconnect state, closing the socket if it is still open.
+ */
+void
+log_server_preconnect_free(void)
+{
+    debug_decl(log_server_preconnect_free, SUDOERS_DEBUG_UTIL);
+
+    if (preconnect.sock != -1)
+	close(preconnect.sock);
+    if (preconnect.res0 != NULL)
+	freeaddrinfo(preconnect.res0);
+    free(preconnect.copy);
+    memset(&preconnect, 0, sizeof(preconnect));
+    preconnect.sock = -1;
 
     debug_return;
 }
 
 /*
- * Like connect(2) but with a timeout.
+ * Start a non-blocking connection to the specified log server so the
+ * TCP handshake can proceed while the policy is being evaluated and
+ * the user authenticated.  The connection is joined by connect_server()
+ * the first time a message must be sent to that server.
+ * Failure is not fatal; the server is simply connected to on demand.
  */
-static int
-timed_connect(int sock, const struct sockaddr *addr, socklen_t addrlen,
-    const struct timespec *timo)
+bool
+log_server_preconnect(const char *server, bool keepalive)
 {
-    struct sudo_event_base *evbase = NULL;
-    struct sudo_event *connect_event = NULL;
-    int ret, errnum = 0;
-    debug_decl(timed_connect, SUDOERS_DEBUG_UTIL);
-
-    ret = connect(sock, addr, addrlen);
-    if (ret == -1 && errno == EINPROGRESS) {
-	evbase = sudo_ev_base_alloc();
-	connect_event = sudo_ev_alloc(sock, SUDO_PLUGIN_EV_WRITE, connect_cb,
-	    &errnum);
-	if (evbase == NULL || connect_event == NULL) {
-	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
-	    goto done;
-	}
-	if (sudo_ev_add(evbase, connect_event, timo, false) == -1) {
-	    sudo_warnx("%s", U_("unable to add event to queue"));
-	    goto done;
-	}
-	if (sudo_ev_dispatch(evbase) == -1) {
-	    sudo_warn("%s", U_("error in event loop"));
-	    goto done;
+    struct addrinfo hints, *res;
+    const char *cause = "connect";
+    char *host, *port, *copy;
+    int error;
+    debug_decl(log_server_preconnect, SUDOERS_DEBUG_UTIL);
+
+    if (preconnect.host != NULL)
+	debug_return_bool(true);
+
+    /* Connecting to a local agent is cheap, there is nothing to gain. */
+    if (*server == '/')
+	debug_return_bool(true);
+
+    if ((copy = strdup(server)) == NULL)
+	debug_return_bool(false);
+    if (!iolog_parse_host_port(copy, &host, &port, &preconnect.tls,
+	    DEFAULT_PORT, DEFAULT_PORT_TLS)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to parse %s", copy);
+	free(copy);
+	debug_return_bool(false);
+    }
+    /* The host and port point into the copy. */
+    preconnect.copy = copy;
+    preconnect.host = host;
+    preconnect.port = port;
+#if !defined(HAVE_OPENSSL)
+    if (preconnect.tls)
+	goto bad;
+#endif
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    error = getaddrinfo(host, port, &hints, &preconnect.res0);
+    if (error != 0) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to look up %s:%s: %s", host, port, gai_strerror(error));
+	preconnect.res0 = NULL;
+	goto bad;
+    }
+    if (sudo_gettime_awake(&preconnect.start) == -1)
+	goto bad;
+
+    for (res = preconnect.res0; res != NULL; res = res->ai_next) {
+	preconnect.sock = new_socket(res, keepalive, &cause);
+	if (preconnect.sock == -1)
+	    continue;
+	if (connect(preconnect.sock, res->ai_addr, res->ai_addrlen) == 0 ||
+		errno == EINPROGRESS) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		"started connection to %s port %s%s", host, port,
+		preconnect.tls ? " (tls)" : "");
+	    preconnect.res = res;
+	    debug_return_bool(true);
 	}
-	if (errnum == 0)
-	    ret = 0;
-	else
-	    errno = errnum;
+	close(preconnect.sock);
+	preconnect.sock = -1;
     }
+    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	"unable to connect to %s port %s: %s", host, port, cause);
+bad:
+    log_server_preconnect_free();
+    debug_return_bool(false);
+}
 
-done:
-    sudo_ev_base_free(evbase);
-    sudo_ev_free(connect_event);
+/*
+ * If a connection to host:port was started by log_server_preconnect(),
+ * transfer ownership of the address list and socket to the caller.
+ * A connection older than max_age is discarded since the server
+ * may already have closed it for being idle.
+ * Returns true if there was a matching preconnect, else false.
+ */
+static bool
+preconnect_join(const char *host, const char *port, bool tls,
+    const struct timespec *max_age, struct addrinfo **res0,
+    struct addrinfo **res, int *sock, struct timespec *elapsed)
+{
+    struct timespec now;
+    debug_decl(preconnect_join, SUDOERS_DEBUG_UTIL);
+
+    if (preconnect.host == NULL || preconnect.tls != tls ||
+	    strcmp(preconnect.host, host) != 0 ||
+	    strcmp(preconnect.port, port) != 0)
+	debug_return_bool(false);
 
-    debug_return_int(ret);
+    if (sudo_gettime_awake(&now) == -1) {
+	log_server_preconnect_free();
+	debug_return_bool(false);
+    }
+    sudo_timespecsub(&now, &preconnect.start, elapsed);
+    if (sudo_timespecisset(max_age) &&
+	    sudo_timespeccmp(elapsed, max_age, >=)) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "discarding connection to %s port %s, idle for %lld seconds",
+	    host, port, (long long)elapsed->tv_sec);
+	log_server_preconnect_free();
+	debug_return_bool(false);
+    }
+
+    *res0 = preconnect.res0;
+    *res = preconnect.res;
+    *sock = preconnect.sock;
+    preconnect.res0 = NULL;
+    preconnect.sock = -1;
+    log_server_preconnect_free();
+
+    debug_return_bool(true);
 }
 
 #if defined(HAVE_OPENSSL)
@@ -168,6 +305,198 @@ verify_peer_identity(int preverify_ok, X509_STORE_CTX *ctx)
     }
 }
 
+/*
+ * The TLS session with the most recently used log server is cached in
+ * a root-owned file so the next sudo command can resume it instead of
+ * performing a full handshake.  The first line of the file is a key
+ * made from the server address and the TLS settings in effect when the
+ * session was established, followed by the session in PEM format.
+ */
+static bool
+tls_session_set_key(struct client_closure *closure, const char *host,
+    const char *port)
+{
+    struct log_details *details = closure->log_details;
+    int len;
+    debug_decl(tls_session_set_key, SUDOERS_DEBUG_UTIL);
+
+    free(closure->tls_session_key);
+    len = asprintf(&closure->tls_session_key, "%s:%s verify=%d ca=%s cert=%s",
+	host, port, details->verify_server,
+	details->ca_bundle ? details->ca_bundle : "",
+	details->cert_file ? details->cert_file : "");
+    if (len == -1) {
+	closure->tls_session_key = NULL;
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Load the cached TLS session, if it matches the current server and
+ * settings, and arrange for it to be resumed on the next handshake.
+ */
+static void
+tls_session_restore(struct client_closure *closure, const char *host,
+    const char *port)
+{
+    const char *path = _PATH_SUDO_LOG_SERVER_SESSION;
+    SSL_SESSION *sess = NULL;
+    char *line = NULL;
+    size_t linesize = 0;
+    ssize_t len;
+    bool uid_changed;
+    struct stat sb;
+    FILE *fp = NULL;
+    int fd;
+    debug_decl(tls_session_restore, SUDOERS_DEBUG_UTIL);
+
+    /* Don't resume a session left over from a different server. */
+    SSL_set_session(closure->ssl, NULL);
+    if (!tls_session_set_key(closure, host, port))
+	debug_return;
+
+    uid_changed = set_perms(PERM_ROOT);
+    fd = open(path, O_RDONLY);
+    if (uid_changed && !restore_perms()) {
+	if (fd != -1) {
+	    close(fd);
+	    fd = -1;
+	}
+    }
+    if (fd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to open %s", path);
+	debug_return;
+    }
+
+    /* Only trust a session file that nobody but root could have written. */
+    if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) ||
+	    sb.st_uid != ROOT_UID || (sb.st_mode & (S_IRWXG|S_IRWXO)) != 0) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "ignoring %s: bad owner or mode", path);
+	close(fd);
+	debug_return;
+    }
+    if ((fp = fdopen(fd, "r")) == NULL) {
+	close(fd);
+	debug_return;
+    }
+
+    len = getdelim(&line, &linesize, '\n', fp);
+    if (len <= 0 || line[len - 1] != '\n')
+	goto done;
+    line[len - 1] = '\0';
+    if (strcmp(line, closure->tls_session_key) != 0) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "cached TLS session is for %s, not %s", line,
+	    closure->tls_session_key);
+	goto done;
+    }
+    if ((sess = PEM_read_SSL_SESSION(fp, NULL, NULL, NULL)) == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "unable to read TLS session from %s: %s", path,
+	    ERR_reason_error_string(ERR_get_error()));
+	goto done;
+    }
+    if (!SSL_set_session(closure->ssl, sess)) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "unable to set TLS session: %s",
+	    ERR_reason_error_string(ERR_get_error()));
+	goto done;
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"attempting to resume TLS session for %s", closure->tls_session_key);
+
+done:
+    SSL_SESSION_free(sess);
+    free(line);
+    fclose(fp);
+    debug_return;
+}
+
+/*
+ * Write the TLS session to the cache file.  The new file is written
+ * to a temporary name and renamed so readers never see a partial file.
+ */
+static void
+tls_session_save(struct client_closure *closure, SSL_SESSION *sess)
+{
+    const char *path = _PATH_SUDO_LOG_SERVER_SESSION;
+    char tmpfile[PATH_MAX];
+    bool uid_changed, ok = false;
+    FILE *fp = NULL;
+    int len, fd = -1;
+    debug_decl(tls_session_save, SUDOERS_DEBUG_UTIL);
+
+    len = snprintf(tmpfile, sizeof(tmpfile), "%s.XXXXXX", path);
+    if (len < 0 || (size_t)len >= sizeof(tmpfile)) {
+	errno = ENAMETOOLONG;
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "%s", path);
+	debug_return;
+    }
+
+    uid_changed = set_perms(PERM_ROOT);
+    if (!sudo_mkdir_parents(tmpfile, ROOT_UID, ROOT_GID,
+	    S_IRWXU|S_IXGRP|S_IXOTH, true))
+	goto done;
+    if ((fd = mkstemp(tmpfile)) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to create %s", tmpfile);
+	goto done;
+    }
+    if ((fp = fdopen(fd, "w")) == NULL) {
+	close(fd);
+	goto done;
+    }
+    if (fprintf(fp, "%s\n", closure->tls_session_key) < 0 ||
+	    !PEM_write_SSL_SESSION(fp, sess)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to write TLS session to %s", tmpfile);
+	goto done;
+    }
+    if (fclose(fp) == EOF) {
+	fp = NULL;
+	goto done;
+    }
+    fp = NULL;
+    if (rename(tmpfile, path) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to rename %s to %s", tmpfile, path);
+	goto done;
+    }
+    ok = true;
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"cached TLS session for %s", closure->tls_session_key);
+
+done:
+    if (fp != NULL)
+	fclose(fp);
+    if (!ok && fd != -1)
+	unlink(tmpfile);
+    if (uid_changed)
+	restore_perms();
+    debug_return;
+}
+
+/*
+ * Called by OpenSSL when the server provides a new session, which
+ * for TLS 1.3 happens after the handshake has completed.
+ * Returns 0 since we do not keep a reference to the session.
+ */
+static int
+tls_session_new_cb(SSL *ssl, SSL_SESSION *sess)
+{
+    struct client_closure *closure = SSL_get_ex_data(ssl, 1);
+    debug_decl(tls_session_new_cb, SUDOERS_DEBUG_UTIL);
+
+    if (closure != NULL && closure->tls_session_key != NULL)
+	tls_session_save(closure, sess);
+
+    debug_return_int(0);
+}
+
 static bool
 tls_init(struct client_closure *closure)
 {
@@ -205,6 +534,11 @@ tls_init(struct client_closure *closure)
         SSL_OP_NO_SSLv2|SSL_OP_NO_SSLv3|SSL_OP_NO_TLSv1|SSL_OP_NO_TLSv1_1);
 #endif
 
+    /* Sessions are cached on disk by tls_session_new_cb(), not in memory. */
+    SSL_CTX_set_session_cache_mode(closure->ssl_ctx,
+	SSL_SESS_CACHE_CLIENT|SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(closure->ssl_ctx, tls_session_new_cb);
+
     /* Enable server cert verification if log_server_verify is set in sudoers */
     if (closure->log_details->verify_server) {
         if (closure->log_details->ca_bundle != NULL) {
@@ -301,8 +635,9 @@ tls_connect_cb(int sock, int what, void *v)
 
     if (tls_con == 1) {
         sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
-            "TLS version: %s, negotiated cipher suite: %s",
-            SSL_get_version(closure->ssl), SSL_get_cipher(closure->ssl));
+            "TLS version: %s, negotiated cipher suite: %s%s",
+            SSL_get_version(closure->ssl), SSL_get_cipher(closure->ssl),
+            SSL_session_reused(closure->ssl) ? " (resumed)" : "");
         closure->tls_conn_status = true;
     } else {
 	const char *errstr;
@@ -402,204 +737,533 @@ done:
 #endif /* HAVE_OPENSSL */
 
 /*
- * Connect to specified host:port
- * If host has multiple addresses, the first one that connects is used.
- * Returns open socket or -1 on error.
+ * An address of a log server that we may connect to.
  */
-static int
-connect_server(const char *host, const char *port, bool tls,
-    struct client_closure *closure, const char **reason)
-{
-    const struct timespec *timo = &closure->log_details->server_timeout;
-    struct addrinfo hints, *res, *res0;
-    const char *addr, *cause = NULL;
-    int error, sock = -1;
-    debug_decl(connect_server, SUDOERS_DEBUG_UTIL);
+struct connect_candidate {
+    TAILQ_ENTRY(connect_candidate) entries;
+    struct connect_race *race;
+    struct sudo_event *ev;
+    const struct addrinfo *res;
+    const char *host;
+    const char *port;
+    struct timespec timeout;
+    int sock;
+    bool tls;
+    bool joined;		/* socket from log_server_preconnect() */
+    bool failed;
+};
+TAILQ_HEAD(connect_candidate_list, connect_candidate);
+
+/*
+ * Resolved log server, owns the memory the candidates point to.
+ */
+struct connect_lookup {
+    SLIST_ENTRY(connect_lookup) entries;
+    char *copy;
+    struct addrinfo *res0;
+    struct addrinfo unix_res;
+    struct sockaddr_un unix_addr;
+};
+SLIST_HEAD(connect_lookup_list, connect_lookup);
 
+/*
+ * State for racing connections to log server addresses, in the style
+ * of RFC 8305 ("happy eyeballs").  A new connection attempt is started
+ * every CONNECT_ATTEMPT_DELAY, or as soon as an attempt fails, and the
+ * first one to connect wins.  Servers are only resolved when needed.
+ */
+struct connect_race {
+    struct connect_candidate_list candidates;
+    struct connect_lookup_list lookups;
+    struct client_closure *closure;
+    struct sudoers_string *server;	/* next server to resolve */
+    struct connect_candidate *next;	/* next candidate to start */
+    struct connect_candidate *winner;
+    struct sudo_event_base *evbase;
+    struct sudo_event *delay_ev;
+    const char *cause;
+    int pending;
+    int errnum;
+};
+
+/*
+ * Resolve the next server in the log_servers list and add its
+ * addresses to the list of candidates.  A connection started by
+ * log_server_preconnect() is adopted if it matches.
+ * Returns the first new candidate or NULL if there are no more servers.
+ */
+static struct connect_candidate *
+resolve_next_server(struct connect_race *race)
+{
+    const struct timespec *timo = &race->closure->log_details->server_timeout;
+    struct connect_candidate *c, *first = NULL;
+    struct connect_lookup *lookup = NULL;
+    struct addrinfo hints, *res, *pre_res = NULL;
+    struct timespec elapsed;
+    char *host, *port;
+    int error, pre_sock = -1;
+    bool tls;
+    debug_decl(resolve_next_server, SUDOERS_DEBUG_UTIL);
+
+    while (first == NULL && race->server != NULL) {
+	struct sudoers_string *server = race->server;
+	race->server = STAILQ_NEXT(server, entries);
+
+	if ((lookup = calloc(1, sizeof(*lookup))) == NULL)
+	    goto oom;
+	if ((lookup->copy = strdup(server->str)) == NULL)
+	    goto oom;
+	if (lookup->copy[0] == '/') {
+	    /* The UNIX domain socket of a local sudo_logagent, no TLS. */
+	    if (strlcpy(lookup->unix_addr.sun_path, lookup->copy,
+		    sizeof(lookup->unix_addr.sun_path)) >=
+		    sizeof(lookup->unix_addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		sudo_warn("%s", lookup->copy);
+		goto next;
+	    }
+	    lookup->unix_addr.sun_family = AF_UNIX;
+	    lookup->unix_res.ai_family = AF_UNIX;
+	    lookup->unix_res.ai_socktype = SOCK_STREAM;
+	    lookup->unix_res.ai_addr = (struct sockaddr *)&lookup->unix_addr;
+	    lookup->unix_res.ai_addrlen = sizeof(lookup->unix_addr);
+	    host = lookup->copy;
+	    port = "";
+	    tls = false;
+	    goto found;
+	}
+	if (!iolog_parse_host_port(lookup->copy, &host, &port, &tls,
+		DEFAULT_PORT, DEFAULT_PORT_TLS)) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to parse %s", lookup->copy);
+	    goto next;
+	}
 #if !defined(HAVE_OPENSSL)
-    if (tls) {
-        errno = EPROTONOSUPPORT;
-        sudo_warn("%s:%s(tls)", host, port);
-        debug_return_int(-1);
-    }
+	if (tls) {
+	    errno = EPROTONOSUPPORT;
+	    sudo_warn("%s:%s(tls)", host, port);
+	    goto next;
+	}
 #endif
 
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    error = getaddrinfo(host, port, &hints, &res0);
-    if (error != 0) {
-	sudo_warnx(U_("unable to look up %s:%s: %s"), host, port,
-	    gai_strerror(error));
-	debug_return_int(-1);
+	/* Use the connection started by log_server_preconnect() if present. */
+	if (!preconnect_join(host, port, tls, timo, &lookup->res0, &pre_res,
+		&pre_sock, &elapsed)) {
+	    memset(&hints, 0, sizeof(hints));
+	    hints.ai_family = AF_UNSPEC;
+	    hints.ai_socktype = SOCK_STREAM;
+	    error = getaddrinfo(host, port, &hints, &lookup->res0);
+	    if (error != 0) {
+		sudo_warnx(U_("unable to look up %s:%s: %s"), host, port,
+		    gai_strerror(error));
+		lookup->res0 = NULL;
+		goto next;
+	    }
+	}
+found:
+	SLIST_INSERT_HEAD(&race->lookups, lookup, entries);
+	res = lookup->res0 != NULL ? lookup->res0 : &lookup->unix_res;
+	lookup = NULL;
+
+	for (; res != NULL; res = res->ai_next) {
+	    if ((c = calloc(1, sizeof(*c))) == NULL)
+		goto oom;
+	    c->race = race;
+	    c->res = res;
+	    c->host = host;
+	    c->port = port;
+	    c->tls = tls;
+	    c->sock = -1;
+	    c->timeout = *timo;
+	    if (res == pre_res) {
+		/* Only wait for what is left of the timeout. */
+		c->sock = pre_sock;
+		c->joined = true;
+		pre_sock = -1;
+		sudo_timespecsub(&c->timeout, &elapsed, &c->timeout);
+		if (c->timeout.tv_sec < 0)
+		    sudo_timespecclear(&c->timeout);
+	    }
+	    TAILQ_INSERT_TAIL(&race->candidates, c, entries);
+	    if (first == NULL)
+		first = c;
+	}
+	continue;
+next:
+	free(lookup->copy);
+	free(lookup);
+	lookup = NULL;
     }
+    debug_return_ptr(first);
+oom:
+    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    if (lookup != NULL) {
+	free(lookup->copy);
+	free(lookup);
+    }
+    if (pre_sock != -1)
+	close(pre_sock);
+    race->server = NULL;
+    debug_return_ptr(first);
+}
 
-    for (res = res0; res; res = res->ai_next) {
-	int flags, save_errno;
+static void race_connect_cb(int sock, int what, void *v);
 
-	sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-	if (sock == -1) {
-	    cause = "socket";
-	    continue;
-	}
-	flags = fcntl(sock, F_GETFL, 0);
-	if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1) {
-	    cause = "fcntl(O_NONBLOCK)";
-	    save_errno = errno;
-	    close(sock);
-	    errno = save_errno;
-	    sock = -1;
-	    continue;
+/*
+ * Start a connection attempt to the next candidate that has not failed.
+ * Returns true if an attempt was started, else false.
+ */
+static bool
+race_start_next(struct connect_race *race)
+{
+    struct connect_candidate *c;
+    debug_decl(race_start_next, SUDOERS_DEBUG_UTIL);
+
+    for (;;) {
+	if ((c = race->next) == NULL) {
+	    if ((c = resolve_next_server(race)) == NULL)
+		debug_return_bool(false);
 	}
-        if (fcntl(sock, F_SETFD, FD_CLOEXEC) == -1) {
-	    cause = "fcntl(FD_CLOEXEC)";
-	    save_errno = errno;
-	    close(sock);
-	    errno = save_errno;
-	    sock = -1;
-	    continue;
-        }
-        if (closure->log_details->keepalive) {
-            flags = 1;
-            if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &flags,
-                    sizeof(flags)) == -1) {
-                cause = "setsockopt(SO_KEEPALIVE)";
-                save_errno = errno;
-                close(sock);
-                errno = save_errno;
-                sock = -1;
-                continue;
-            }
-        }
-	if (timed_connect(sock, res->ai_addr, res->ai_addrlen, timo) == -1) {
-	    /* No need to set cause, caller's error message is sufficient. */
-	    save_errno = errno;
-	    close(sock);
-	    errno = save_errno;
-	    sock = -1;
+	race->next = TAILQ_NEXT(c, entries);
+	if (c->failed)
 	    continue;
+
+	if (c->sock == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		"connecting to %s port %s%s", c->host, c->port,
+		c->tls ? " (tls)" : "");
+	    c->sock = new_socket(c->res, race->closure->log_details->keepalive,
+		&race->cause);
+	    if (c->sock == -1) {
+		race->errnum = errno;
+		c->failed = true;
+		continue;
+	    }
+	    if (connect(c->sock, c->res->ai_addr, c->res->ai_addrlen) == -1 &&
+		    errno != EINPROGRESS) {
+		race->errnum = errno;
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		    "unable to connect to %s port %s", c->host, c->port);
+		close(c->sock);
+		c->sock = -1;
+		c->failed = true;
+		continue;
+	    }
+	} else {
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		"joining connection to %s port %s", c->host, c->port);
 	}
-	switch (res->ai_family) {
-	case AF_INET:
-	    addr = (char *)&((struct sockaddr_in *)res->ai_addr)->sin_addr;
+
+	/* Wait for the connection to complete. */
+	c->ev = sudo_ev_alloc(c->sock, SUDO_EV_WRITE, race_connect_cb, c);
+	if (c->ev == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
 	    break;
-	case AF_INET6:
-	    addr = (char *)&((struct sockaddr_in6 *)res->ai_addr)->sin6_addr;
+	}
+	if (sudo_ev_add(race->evbase, c->ev, &c->timeout, false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
 	    break;
-	default:
-            cause = "ai_family";
-	    save_errno = EAFNOSUPPORT;
-	    close(sock);
-	    errno = save_errno;
-	    sock = -1;
-	    continue;
 	}
-        if (inet_ntop(res->ai_family, addr, closure->server_ip,
-                sizeof(closure->server_ip)) == NULL) {
-            cause = "inet_ntop";
-	    save_errno = errno;
-	    close(sock);
-	    errno = save_errno;
-	    sock = -1;
-	    continue;
-        }
-	free(closure->server_name);
-	if ((closure->server_name = strdup(host)) == NULL) {
-	    cause = "strdup";
-	    save_errno = errno;
-	    close(sock);
-	    errno = save_errno;
-	    sock = -1;
-	    continue;
+	race->pending++;
+	debug_return_bool(true);
+    }
+
+    /* Fatal error, stop the race. */
+    race->next = NULL;
+    race->server = NULL;
+    debug_return_bool(false);
+}
+
+/*
+ * Arm the timer that starts the next connection attempt.
+ */
+static void
+race_schedule_next(struct connect_race *race)
+{
+    struct timespec delay = { 0, CONNECT_ATTEMPT_DELAY };
+    debug_decl(race_schedule_next, SUDOERS_DEBUG_UTIL);
+
+    if (sudo_ev_add(race->evbase, race->delay_ev, &delay, false) == -1)
+	sudo_warnx("%s", U_("unable to add event to queue"));
+
+    debug_return;
+}
+
+/*
+ * A connection attempt has completed or timed out.
+ */
+static void
+race_connect_cb(int sock, int what, void *v)
+{
+    struct connect_candidate *c = v;
+    struct connect_race *race = c->race;
+    socklen_t optlen = sizeof(int);
+    int errnum;
+    debug_decl(race_connect_cb, SUDOERS_DEBUG_UTIL);
+
+    race->pending--;
+    if (race->winner != NULL) {
+	/* Lost the race in the same pass of the event loop. */
+	debug_return;
+    }
+    if (what == SUDO_EV_TIMEOUT) {
+	errnum = ETIMEDOUT;
+    } else {
+	if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &errnum, &optlen) == -1)
+	    errnum = errno;
+    }
+    if (errnum == 0) {
+	/* First one to connect wins. */
+	race->winner = c;
+	sudo_ev_loopexit(race->evbase);
+	debug_return;
+    }
+
+    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	"unable to connect to %s port %s: %s", c->host, c->port,
+	strerror(errnum));
+    race->errnum = errnum;
+    close(c->sock);
+    c->sock = -1;
+    c->failed = true;
+
+    /* Start the next attempt now rather than waiting for the timer. */
+    if (race_start_next(race))
+	race_schedule_next(race);
+    else if (race->pending == 0)
+	sudo_ev_loopexit(race->evbase);
+
+    debug_return;
+}
+
+/*
+ * The connection attempt delay has expired without a winner.
+ */
+static void
+race_delay_cb(int unused, int what, void *v)
+{
+    struct connect_race *race = v;
+    debug_decl(race_delay_cb, SUDOERS_DEBUG_UTIL);
+
+    if (race_start_next(race))
+	race_schedule_next(race);
+    else if (race->pending == 0)
+	sudo_ev_loopexit(race->evbase);
+
+    debug_return;
+}
+
+/*
+ * Race connections to the candidates that have not yet failed.
+ * Attempts that are still in progress when a winner is found are
+ * abandoned but may be restarted by a subsequent race.
+ * Returns the connected candidate or NULL if none could connect.
+ */
+static struct connect_candidate *
+race_connect(struct connect_race *race)
+{
+    struct connect_candidate *c;
+    debug_decl(race_connect, SUDOERS_DEBUG_UTIL);
+
+    race->winner = NULL;
+    race->pending = 0;
+    race->next = TAILQ_FIRST(&race->candidates);
+
+    if (!race_start_next(race))
+	debug_return_ptr(NULL);
+    race_schedule_next(race);
+
+    if (sudo_ev_dispatch(race->evbase) == -1)
+	sudo_warn("%s", U_("error in event loop"));
+    sudo_ev_del(race->evbase, race->delay_ev);
+
+    TAILQ_FOREACH(c, &race->candidates, entries) {
+	if (c->ev != NULL) {
+	    sudo_ev_free(c->ev);
+	    c->ev = NULL;
 	}
+	if (c != race->winner && c->sock != -1) {
+	    close(c->sock);
+	    c->sock = -1;
+	}
+    }
 
-#if defined(HAVE_OPENSSL)
-        if (tls) {
-            if (!tls_init(closure) || !SSL_set_fd(closure->ssl, sock)) {
-                cause = U_("TLS initialization was unsuccessful");
-                save_errno = errno;
-                close(sock);
-                errno = save_errno;
-                sock = -1;
-                continue;
-            }
-            /* Perform TLS handshake. */
-            if (!tls_timed_connect(closure->ssl, host, port, timo)) {
-                cause = U_("TLS handshake was unsuccessful");
-                save_errno = errno;
-                close(sock);
-                errno = save_errno;
-                sock = -1;
-                continue;
-            }
-        } else {
-            /* No TLS for this connection, make sure it is not initialized. */
-            SSL_free(closure->ssl);
-            closure->ssl = NULL;
-            SSL_CTX_free(closure->ssl_ctx);
-            closure->ssl_ctx = NULL;
-        }
-#endif /* HAVE_OPENSSL */
-	break;	/* success */
+    debug_return_ptr(race->winner);
+}
+
+static void
+race_free(struct connect_race *race)
+{
+    struct connect_candidate *c;
+    struct connect_lookup *lookup;
+    debug_decl(race_free, SUDOERS_DEBUG_UTIL);
+
+    while ((c = TAILQ_FIRST(&race->candidates)) != NULL) {
+	TAILQ_REMOVE(&race->candidates, c, entries);
+	if (c->ev != NULL)
+	    sudo_ev_free(c->ev);
+	if (c->sock != -1)
+	    close(c->sock);
+	free(c);
+    }
+    while ((lookup = SLIST_FIRST(&race->lookups)) != NULL) {
+	SLIST_REMOVE_HEAD(&race->lookups, entries);
+	if (lookup->res0 != NULL)
+	    freeaddrinfo(lookup->res0);
+	free(lookup->copy);
+	free(lookup);
+    }
+    sudo_ev_free(race->delay_ev);
+    sudo_ev_base_free(race->evbase);
+
+    debug_return;
+}
+
+/*
+ * Finish setting up a connected candidate: record the server name
+ * and address and perform the TLS handshake if needed.
+ * Returns true on success, else false and sets cause.
+ */
+static bool
+server_connected(struct client_closure *closure, struct connect_candidate *c,
+    const char **cause)
+{
+    const struct addrinfo *res = c->res;
+    const char *addr;
+    debug_decl(server_connected, SUDOERS_DEBUG_UTIL);
+
+    switch (res->ai_family) {
+    case AF_INET:
+	addr = (char *)&((struct sockaddr_in *)res->ai_addr)->sin_addr;
+	break;
+    case AF_INET6:
+	addr = (char *)&((struct sockaddr_in6 *)res->ai_addr)->sin6_addr;
+	break;
+    case AF_UNIX:
+	/* A local agent has no IP address. */
+	addr = NULL;
+	closure->server_ip[0] = '\0';
+	break;
+    default:
+	*cause = "ai_family";
+	errno = EAFNOSUPPORT;
+	debug_return_bool(false);
+    }
+    if (addr != NULL && inet_ntop(res->ai_family, addr, closure->server_ip,
+	    sizeof(closure->server_ip)) == NULL) {
+	*cause = "inet_ntop";
+	debug_return_bool(false);
     }
-    freeaddrinfo(res0);
+    free(closure->server_name);
+    if ((closure->server_name = strdup(c->host)) == NULL) {
+	*cause = "strdup";
+	debug_return_bool(false);
+    }
+
+#if defined(HAVE_OPENSSL)
+    if (c->tls) {
+	if (!tls_init(closure) || !SSL_set_fd(closure->ssl, c->sock)) {
+	    *cause = U_("TLS initialization was unsuccessful");
+	    debug_return_bool(false);
+	}
+	/* Resume the previous session with this server if possible. */
+	tls_session_restore(closure, c->host, c->port);
 
-    if (sock == -1)
-	*reason = cause;
+	/* Perform TLS handshake. */
+	if (!tls_timed_connect(closure->ssl, c->host, c->port,
+		&closure->log_details->server_timeout)) {
+	    *cause = U_("TLS handshake was unsuccessful");
+	    debug_return_bool(false);
+	}
+    } else {
+	/* No TLS for this connection, make sure it is not initialized. */
+	SSL_free(closure->ssl);
+	closure->ssl = NULL;
+	SSL_CTX_free(closure->ssl_ctx);
+	closure->ssl_ctx = NULL;
+	closure->ssl_initialized = false;
+    }
+#endif /* HAVE_OPENSSL */
 
-    debug_return_int(sock);
+    debug_return_bool(true);
 }
 
 /*
- * Connect to the first server in the list.
+ * Connect to the first available server in the list, racing
+ * connections to multiple addresses and servers in parallel.
  * Stores socket in closure with O_NONBLOCK and close-on-exec flags set.
  * Returns true on success, else false.
  */
 bool
 log_server_connect(struct client_closure *closure)
 {
-    struct sudoers_string *server;
-    char *host, *port, *copy = NULL;
+    struct connect_race race;
+    struct connect_candidate *c;
     const char *cause = NULL;
-    int sock;
-    bool tls, ret = false;
+    int save_errno;
+    bool ret = false;
     debug_decl(log_server_connect, SUDOERS_DEBUG_UTIL);
 
-    STAILQ_FOREACH(server, closure->log_details->log_servers, entries) {
-        free(copy);
-	if ((copy = strdup(server->str)) == NULL)
-                break;
-	if (!iolog_parse_host_port(copy, &host, &port, &tls, DEFAULT_PORT,
-		DEFAULT_PORT_TLS)) {
-            sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-                "unable to parse %s", copy);
+    memset(&race, 0, sizeof(race));
+    TAILQ_INIT(&race.candidates);
+    SLIST_INIT(&race.lookups);
+    race.closure = closure;
+    race.server = STAILQ_FIRST(closure->log_details->log_servers);
+    race.evbase = sudo_ev_base_alloc();
+    race.delay_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT, race_delay_cb, &race);
+    if (race.evbase == NULL || race.delay_ev == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	goto done;
+    }
+
+    while ((c = race_connect(&race)) != NULL) {
+	if (!server_connected(closure, c, &race.cause)) {
+	    race.errnum = errno;
+	    close(c->sock);
+	    c->sock = -1;
+	    if (c->joined) {
+		/* The server may have dropped it, retry with a new socket. */
+		sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		    "retrying connection to %s port %s", c->host, c->port);
+		c->joined = false;
+		c->timeout = closure->log_details->server_timeout;
+		continue;
+	    }
+	    /* Try the other candidates. */
+	    c->failed = true;
 	    continue;
 	}
-        sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
-            "connecting to %s port %s%s", host, port, tls ? " (tls)" : "");
-	sock = connect_server(host, port, tls, closure, &cause);
-	if (sock != -1) {
-            if (closure->read_ev->set(closure->read_ev, sock,
-                    SUDO_PLUGIN_EV_READ|SUDO_PLUGIN_EV_PERSIST,
-                    server_msg_cb, closure) == -1) {
-                cause = (U_("unable to add event to queue"));
-                break;
-            }
 
-            if (closure->write_ev->set(closure->write_ev, sock,
-                    SUDO_PLUGIN_EV_WRITE|SUDO_PLUGIN_EV_PERSIST,
-                    client_msg_cb, closure) == -1) {
-                cause = (U_("unable to add event to queue"));
-                break;
-            }
+	if (closure->read_ev->set(closure->read_ev, c->sock,
+		SUDO_PLUGIN_EV_READ|SUDO_PLUGIN_EV_PERSIST,
+		server_msg_cb, closure) == -1) {
+	    cause = (U_("unable to add event to queue"));
+	    break;
+	}
 
-            /* success */
-            closure->sock = sock;
-            ret = true;
-            break;
+	if (closure->write_ev->set(closure->write_ev, c->sock,
+		SUDO_PLUGIN_EV_WRITE|SUDO_PLUGIN_EV_PERSIST,
+		client_msg_cb, closure) == -1) {
+	    cause = (U_("unable to add event to queue"));
+	    break;
 	}
+
+	/* success */
+	closure->sock = c->sock;
+	closure->preconnected = c->joined;
+	c->sock = -1;
+	ret = true;
+	break;
     }
-    free(copy);
+    if (!ret && cause == NULL) {
+	cause = race.cause;
+	errno = race.errnum;
+    }
+
+done:
+    save_errno = errno;
+    race_free(&race);
+    errno = save_errno;
 
     if (!ret && cause != NULL)
         sudo_warn("%s", cause);
@@ -614,6 +1278,9 @@ void
 client_closure_free(struct client_closure *closure)
 {
     struct connection_buffer *buf;
+#if defined(HAVE_ZLIB_H)
+    int i;
+#endif
     debug_decl(client_closure_free, SUDOERS_DEBUG_UTIL);
 
     if (closure == NULL)
@@ -626,10 +1293,13 @@ client_closure_free(struct client_closure *closure)
 	SSL_free(closure->ssl);
     }
     SSL_CTX_free(closure->ssl_ctx);
+    free(closure->tls_session_key);
 #endif
 
     if (closure->sock != -1)
 	close(closure->sock);
+    if (closure->spool_fd != -1)
+	close(closure->spool_fd);
     free(closure->server_name);
     while ((buf = TAILQ_FIRST(&closure->write_bufs)) != NULL) {
 	TAILQ_REMOVE(&closure->write_bufs, buf, entries);
@@ -645,8 +1315,20 @@ client_closure_free(struct client_closure *closure)
 	closure->read_ev->free(closure->read_ev);
     if (closure->write_ev != NULL)
 	closure->write_ev->free(closure->write_ev);
+    if (closure->coalesce_ev != NULL)
+	closure->coalesce_ev->free(closure->coalesce_ev);
+    free(closure->coalesce_buf.data);
     free(closure->read_buf.data);
     free(closure->iolog_id);
+#if defined(HAVE_ZLIB_H)
+    for (i = 0; i < IO_BUF_TYPES; i++) {
+	if (closure->zstreams[i] != NULL) {
+	    deflateEnd(closure->zstreams[i]);
+	    free(closure->zstreams[i]);
+	}
+    }
+    free(closure->zbuf);
+#endif
 
     free(closure);
 
@@ -670,7 +1352,8 @@ get_free_buf(struct client_closure *closure)
 
 /*
  * Format a ClientMessage.
- * Appends the wire format message to the closure's write queue.
+ * Appends the wire format message to the closure's write queue,
+ * or writes it to the local spool file if spooling is enabled.
  * Returns true on success, false on failure.
  */
 bool
@@ -710,7 +1393,15 @@ fmt_client_message(struct client_closure *closure, ClientMessage *msg)
     memcpy(buf->data, &msg_len, sizeof(msg_len));
     client_message__pack(msg, buf->data + sizeof(msg_len));
     buf->len = len;
-    TAILQ_INSERT_TAIL(&closure->write_bufs, buf, entries);
+    if (closure->spool_fd != -1) {
+	/* The uploader sends the spooled message, reuse the buffer. */
+	if (!log_spool_write(closure, buf->data, buf->len))
+	    goto done;
+	buf->len = 0;
+	TAILQ_INSERT_TAIL(&closure->free_bufs, buf, entries);
+    } else {
+	TAILQ_INSERT_TAIL(&closure->write_bufs, buf, entries);
+    }
     buf = NULL;
 
     ret = true;
@@ -733,6 +1424,9 @@ fmt_client_hello(struct client_closure *closure)
 {
     ClientMessage client_msg = CLIENT_MESSAGE__INIT;
     ClientHello hello_msg = CLIENT_HELLO__INIT;
+#if defined(HAVE_ZLIB_H)
+    char *compression[] = { "deflate" };
+#endif
     bool ret = false;
     debug_decl(fmt_client_hello, SUDOERS_DEBUG_UTIL);
 
@@ -741,6 +1435,14 @@ fmt_client_hello(struct client_closure *closure)
     /* Client name + version */
     hello_msg.client_id = "sudoers " PACKAGE_VERSION;
 
+#if defined(HAVE_ZLIB_H)
+    /* Offer to compress I/O buffers, the server decides. */
+    if (closure->log_io) {
+	hello_msg.compression = compression;
+	hello_msg.n_compression = nitems(compression);
+    }
+#endif
+
     /* Schedule ClientMessage */
     client_msg.u.hello_msg = &hello_msg;
     client_msg.type_case = CLIENT_MESSAGE__TYPE_HELLO_MSG;
@@ -943,7 +1645,7 @@ bad:
  * Appends the wire format message to the closure's write queue.
  * Returns true on success, false on failure.
  */
-static bool
+bool
 fmt_accept_message(struct client_closure *closure)
 {
     ClientMessage client_msg = CLIENT_MESSAGE__INIT;
@@ -1094,6 +1796,10 @@ fmt_initial_message(struct client_closure *closure)
     bool ret = true;
     debug_decl(fmt_initial_message, SUDOERS_DEBUG_UTIL);
 
+    /* The spool uploader replays the AcceptMessage or restarts. */
+    if (closure->spool != NULL)
+	debug_return_bool(log_spool_initial_message(closure));
+
     closure->state = closure->initial_state;
     switch (closure->state) {
     case SEND_ACCEPT:
@@ -1128,9 +1834,9 @@ fmt_initial_message(struct client_closure *closure)
     debug_return_bool(ret);
 }
 
-#ifdef notyet
 /*
  * Build and format a RestartMessage wrapped in a ClientMessage.
+ * The resume point is the last commit point received from the server.
  * Appends the wire format message to the closure's write queue.
  * Returns true on success, false on failure.
  */
@@ -1145,21 +1851,20 @@ fmt_restart_message(struct client_closure *closure)
 
     sudo_debug_printf(SUDO_DEBUG_INFO,
 	"%s: sending RestartMessage, [%lld, %ld]", __func__,
-	(long long)closure->restart->tv_sec, closure->restart->tv_nsec);
+	(long long)closure->committed.tv_sec, closure->committed.tv_nsec);
 
-    tv.tv_sec = closure->restart->tv_sec;
-    tv.tv_nsec = closure->restart->tv_nsec;
+    tv.tv_sec = closure->committed.tv_sec;
+    tv.tv_nsec = closure->committed.tv_nsec;
     restart_msg.resume_point = &tv;
     restart_msg.log_id = closure->iolog_id;
 
     /* Schedule ClientMessage */
-    client_msg.restart_msg = &restart_msg;
+    client_msg.u.restart_msg = &restart_msg;
     client_msg.type_case = CLIENT_MESSAGE__TYPE_RESTART_MSG;
     ret = fmt_client_message(closure, &client_msg);
 
     debug_return_bool(ret);
 }
-#endif
 
 /*
  * Build and format an ExitMessage wrapped in a ClientMessage.
@@ -1177,6 +1882,10 @@ fmt_exit_message(struct client_closure *closure, int exit_status, int error)
     struct timespec run_time;
     debug_decl(fmt_exit_message, SUDOERS_DEBUG_UTIL);
 
+    /* Any pending I/O must be sent before the ExitMessage. */
+    if (!flush_io_buf(closure))
+	goto done;
+
     if (sudo_gettime_awake(&run_time) == -1) {
 	sudo_warn("%s", U_("unable to get time of day"));
 	goto done;
@@ -1230,20 +1939,87 @@ done:
     debug_return_bool(ret);
 }
 
+#if defined(HAVE_ZLIB_H)
+/*
+ * Compress buf into the IoBuffer's data using the stream's raw deflate
+ * state.  Each buffer ends with a sync flush so the server can store
+ * the chunks of a stream back to back in a gzip member.
+ * Returns true on success, false on failure.
+ */
+static bool
+compress_io_buf(struct client_closure *closure, int type, const char *buf,
+    unsigned int len, IoBuffer *iobuf_msg)
+{
+    z_stream *zs = closure->zstreams[type - CLIENT_MESSAGE__TYPE_TTYIN_BUF];
+    unsigned int zlen = 0;
+    int zerr;
+    debug_decl(compress_io_buf, SUDOERS_DEBUG_UTIL);
+
+    if (zs == NULL) {
+	if ((zs = calloc(1, sizeof(*zs))) == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    debug_return_bool(false);
+	}
+	zerr = deflateInit2(zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+	    -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+	if (zerr != Z_OK) {
+	    sudo_warnx(U_("%s: %s"), __func__, zError(zerr));
+	    free(zs);
+	    debug_return_bool(false);
+	}
+	closure->zstreams[type - CLIENT_MESSAGE__TYPE_TTYIN_BUF] = zs;
+    }
+
+    zs->next_in = (const Bytef *)buf;
+    zs->avail_in = len;
+    do {
+	/* Room for the worst case plus the sync flush marker. */
+	if (closure->zbufsize - zlen < 64) {
+	    unsigned int newsize =
+		sudo_pow2_roundup(deflateBound(zs, zs->avail_in) + zlen + 64);
+	    unsigned char *newbuf = realloc(closure->zbuf, newsize);
+	    if (newbuf == NULL) {
+		sudo_warnx(U_("%s: %s"), __func__,
+		    U_("unable to allocate memory"));
+		debug_return_bool(false);
+	    }
+	    closure->zbuf = newbuf;
+	    closure->zbufsize = newsize;
+	}
+	zs->next_out = closure->zbuf + zlen;
+	zs->avail_out = closure->zbufsize - zlen;
+	zerr = deflate(zs, Z_SYNC_FLUSH);
+	if (zerr != Z_OK && zerr != Z_BUF_ERROR) {
+	    sudo_warnx(U_("%s: %s"), __func__, zError(zerr));
+	    debug_return_bool(false);
+	}
+	zlen = closure->zbufsize - zs->avail_out;
+    } while (zs->avail_out == 0);
+
+    iobuf_msg->data.data = closure->zbuf;
+    iobuf_msg->data.len = zlen;
+    iobuf_msg->uncompressed_len = len;
+    iobuf_msg->checksum = crc32(0, (const Bytef *)buf, len);
+
+    debug_return_bool(true);
+}
+#endif /* HAVE_ZLIB_H */
+
 /*
  * Build and format an IoBuffer wrapped in a ClientMessage.
+ * If compression was negotiated, the data is sent as raw deflate.
  * Appends the wire format message to the closure's write queue.
  * Returns true on success, false on failure.
  */
 bool
-fmt_io_buf(struct client_closure *closure, int type, const char *buf,
+fmt_io_buf_msg(struct client_closure *closure, int type, const char *buf,
     unsigned int len, struct timespec *delay)
 {
     ClientMessage client_msg = CLIENT_MESSAGE__INIT;
     IoBuffer iobuf_msg = IO_BUFFER__INIT;
     TimeSpec ts = TIME_SPEC__INIT;
     bool ret = false;
-    debug_decl(fmt_io_buf, SUDOERS_DEBUG_UTIL);
+    debug_decl(fmt_io_buf_msg, SUDOERS_DEBUG_UTIL);
 
     /* Fill in IoBuffer. */
     ts.tv_sec = delay->tv_sec;
@@ -1251,6 +2027,12 @@ fmt_io_buf(struct client_closure *closure, int type, const char *buf,
     iobuf_msg.delay = &ts;
     iobuf_msg.data.data = (void *)buf;
     iobuf_msg.data.len = len;
+#if defined(HAVE_ZLIB_H)
+    if (closure->compress) {
+	if (!compress_io_buf(closure, type, buf, len, &iobuf_msg))
+	    goto done;
+    }
+#endif
 
     sudo_debug_printf(SUDO_DEBUG_INFO,
 	"%s: sending IoBuffer length %zu, type %d, size %zu", __func__,
@@ -1268,6 +2050,95 @@ done:
     debug_return_bool(ret);
 }
 
+/*
+ * Append any I/O held in the coalesce buffer to the write queue.
+ * Returns true on success, false on failure.
+ */
+bool
+flush_io_buf(struct client_closure *closure)
+{
+    struct coalesce_buffer *cbuf = &closure->coalesce_buf;
+    bool ret;
+    debug_decl(flush_io_buf, SUDOERS_DEBUG_UTIL);
+
+    if (cbuf->len == 0)
+	debug_return_bool(true);
+
+    closure->coalesce_ev->del(closure->coalesce_ev);
+    ret = fmt_io_buf_msg(closure, cbuf->type, cbuf->data, cbuf->len,
+	&cbuf->delay);
+    cbuf->len = 0;
+    sudo_timespecclear(&cbuf->delay);
+    sudo_timespecclear(&cbuf->held);
+
+    debug_return_bool(ret);
+}
+
+/*
+ * Merge consecutive I/O buffers for the same stream into a single
+ * IoBuffer, up to log_server_coalesce_bytes of data or until
+ * log_server_coalesce_delay has passed since the first one.
+ * The delay of the merged IoBuffer is the sum of the individual delays,
+ * so the total elapsed time seen by the server is unchanged; data is
+ * replayed no later than the last buffer it was merged with.
+ * Returns true on success, false on failure.
+ */
+bool
+fmt_io_buf(struct client_closure *closure, int type, const char *buf,
+    unsigned int len, struct timespec *delay)
+{
+    struct coalesce_buffer *cbuf = &closure->coalesce_buf;
+    struct log_details *details = closure->log_details;
+    debug_decl(fmt_io_buf, SUDOERS_DEBUG_UTIL);
+
+    if (closure->coalesce_ev == NULL)
+	debug_return_bool(fmt_io_buf_msg(closure, type, buf, len, delay));
+
+    /* Flush if the new buffer cannot be merged with the pending one. */
+    if (cbuf->len != 0) {
+	if (cbuf->type != type || details->coalesce_bytes - cbuf->len < len) {
+	    if (!flush_io_buf(closure))
+		debug_return_bool(false);
+	}
+    }
+    if (cbuf->len == 0) {
+	/* Nothing to gain by holding a buffer that is already full. */
+	if (len >= details->coalesce_bytes)
+	    debug_return_bool(fmt_io_buf_msg(closure, type, buf, len, delay));
+
+	if (cbuf->data == NULL) {
+	    cbuf->data = malloc(details->coalesce_bytes);
+	    if (cbuf->data == NULL) {
+		sudo_warnx(U_("%s: %s"), __func__,
+		    U_("unable to allocate memory"));
+		debug_return_bool(false);
+	    }
+	    cbuf->size = details->coalesce_bytes;
+	}
+	cbuf->type = type;
+	cbuf->delay = *delay;
+	if (closure->coalesce_ev->add(closure->coalesce_ev,
+		&details->coalesce_delay) == -1) {
+	    sudo_warn("%s", U_("unable to add event to queue"));
+	    debug_return_bool(false);
+	}
+    } else {
+	sudo_timespecadd(&cbuf->delay, delay, &cbuf->delay);
+	sudo_timespecadd(&cbuf->held, delay, &cbuf->held);
+    }
+    memcpy(cbuf->data + cbuf->len, buf, len);
+    cbuf->len += len;
+
+    sudo_debug_printf(SUDO_DEBUG_DEBUG,
+	"%s: holding %u bytes of type %d", __func__, cbuf->len, type);
+
+    if (cbuf->len == cbuf->size ||
+	    sudo_timespeccmp(&cbuf->held, &details->coalesce_delay, >=)) {
+	debug_return_bool(flush_io_buf(closure));
+    }
+    debug_return_bool(true);
+}
+
 /*
  * Build and format a ChangeWindowSize message wrapped in a ClientMessage.
  * Appends the wire format message to the closure's write queue.
@@ -1283,6 +2154,9 @@ fmt_winsize(struct client_closure *closure, unsigned int lines,
     bool ret = false;
     debug_decl(fmt_winsize, SUDOERS_DEBUG_UTIL);
 
+    if (!flush_io_buf(closure))
+	goto done;
+
     /* Fill in ChangeWindowSize message. */
     ts.tv_sec = delay->tv_sec;
     ts.tv_nsec = delay->tv_nsec;
@@ -1319,6 +2193,9 @@ fmt_suspend(struct client_closure *closure, const char *signame, struct timespec
     bool ret = false;
     debug_decl(fmt_suspend, SUDOERS_DEBUG_UTIL);
 
+    if (!flush_io_buf(closure))
+	goto done;
+
     /* Fill in CommandSuspend message. */
     ts.tv_sec = delay->tv_sec;
     ts.tv_nsec = delay->tv_nsec;
@@ -1369,6 +2246,11 @@ client_message_completion(struct client_closure *closure)
 	break;
     case SEND_IO:
 	/* Arbitrary number of I/O log buffers, no state change. */
+	if (closure->spool != NULL) {
+	    /* Queue more messages from the spool file. */
+	    if (!log_spool_fill(closure))
+		debug_return_bool(false);
+	}
 	break;
     case SEND_EXIT:
 	if (closure->log_io) {
@@ -1478,6 +2360,19 @@ handle_server_hello(ServerHello *msg, struct client_closure *closure)
 	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: server %zu: %s",
 	    __func__, n + 1, msg->servers[n]);
     }
+#if defined(HAVE_ZLIB_H)
+    /* The server lists compression it accepts, we only offer deflate. */
+    if (closure->log_io) {
+	for (n = 0; n < msg->n_compression; n++) {
+	    if (strcmp(msg->compression[n], "deflate") == 0) {
+		sudo_debug_printf(SUDO_DEBUG_INFO,
+		    "%s: compressing I/O buffers", __func__);
+		closure->compress = true;
+		break;
+	    }
+	}
+    }
+#endif
 
     debug_return_bool(true);
 }
@@ -1523,6 +2418,7 @@ handle_log_id(char *id, struct client_closure *closure)
     debug_decl(handle_log_id, SUDOERS_DEBUG_UTIL);
 
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: remote log ID: %s", __func__, id);
+    free(closure->iolog_id);
     if ((closure->iolog_id = strdup(id)) == NULL)
 	sudo_fatal(NULL);
     debug_return_bool(true);
@@ -1742,10 +2638,13 @@ server_msg_cb(int fd, int what, void *v)
     case -1:
 	if (errno == EAGAIN)
 	    debug_return;
-	sudo_warn("recv");
+	/* A preconnected socket the server has closed is retried. */
+	if (!closure->preconnected || closure->state != RECV_HELLO)
+	    sudo_warn("recv");
 	goto bad;
     case 0:
-	sudo_warnx("%s", U_("lost connection to log server"));
+	if (!closure->preconnected || closure->state != RECV_HELLO)
+	    sudo_warnx("%s", U_("lost connection to log server"));
 	goto bad;
     default:
 	break;
@@ -1906,10 +2805,46 @@ bad:
     debug_return;
 }
 
+/*
+ * Send coalesced I/O that has been held for log_server_coalesce_delay.
+ */
+static void
+coalesce_cb(int unused, int what, void *v)
+{
+    struct client_closure *closure = v;
+    debug_decl(coalesce_cb, SUDOERS_DEBUG_UTIL);
+
+    if (closure->disabled)
+	debug_return;
+
+    if (!flush_io_buf(closure))
+	goto bad;
+    if (!TAILQ_EMPTY(&closure->write_bufs)) {
+	if (closure->write_ev->add(closure->write_ev,
+		&closure->log_details->server_timeout) == -1) {
+	    sudo_warn("%s", U_("unable to add event to queue"));
+	    goto bad;
+	}
+    }
+    debug_return;
+
+bad:
+    if (closure->log_details->ignore_log_errors) {
+	/* Disable plugin, the command continues. */
+	closure->disabled = true;
+	closure->write_ev->del(closure->read_ev);
+	closure->write_ev->del(closure->write_ev);
+    } else {
+	/* Break out of sudo event loop and kill the command. */
+	closure->write_ev->loopbreak(closure->write_ev);
+    }
+    debug_return;
+}
+
 /*
  * Allocate and initialize a new client closure
  */
-static struct client_closure *
+struct client_closure *
 client_closure_alloc(struct log_details *details, struct timespec *now,
     bool log_io, enum client_state initial_state, const char *reason,
     struct sudo_plugin_event * (*event_alloc)(void))
@@ -1921,6 +2856,7 @@ client_closure_alloc(struct log_details *details, struct timespec *now,
         goto oom;
 
     closure->sock = -1;
+    closure->spool_fd = -1;
     closure->log_io = log_io;
     closure->reason = reason;
     closure->state = RECV_HELLO;
@@ -1943,16 +2879,60 @@ client_closure_alloc(struct log_details *details, struct timespec *now,
     if ((closure->write_ev = event_alloc()) == NULL)
 	goto oom;
 
+    /* Coalescing of I/O buffers is disabled if either limit is zero. */
+    if (log_io && details->coalesce_bytes != 0 &&
+	    sudo_timespecisset(&details->coalesce_delay)) {
+	if ((closure->coalesce_ev = event_alloc()) == NULL)
+	    goto oom;
+	if (closure->coalesce_ev->set(closure->coalesce_ev, -1,
+		SUDO_PLUGIN_EV_TIMEOUT, coalesce_cb, closure) == -1) {
+	    sudo_warn("%s", U_("unable to add event to queue"));
+	    goto bad;
+	}
+    }
+
     closure->log_details = details;
 
     debug_return_ptr(closure);
 oom:
     sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+bad:
     client_closure_free(closure);
     closure = NULL;
     debug_return_ptr(NULL);
 }
 
+/*
+ * Close a connection whose ServerHello could not be read and reset
+ * the closure so that log_server_connect() may be called again.
+ */
+static void
+log_server_disconnect(struct client_closure *closure)
+{
+    struct connection_buffer *buf;
+    debug_decl(log_server_disconnect, SUDOERS_DEBUG_UTIL);
+
+    /* The events were removed when the private event base was freed. */
+    close(closure->sock);
+    closure->sock = -1;
+    while ((buf = TAILQ_FIRST(&closure->write_bufs)) != NULL) {
+	buf->off = 0;
+	buf->len = 0;
+	TAILQ_REMOVE(&closure->write_bufs, buf, entries);
+	TAILQ_INSERT_TAIL(&closure->free_bufs, buf, entries);
+    }
+    closure->read_buf.off = 0;
+    closure->read_buf.len = 0;
+    closure->read_instead_of_write = false;
+    closure->write_instead_of_read = false;
+    closure->temporary_write_event = false;
+    closure->preconnected = false;
+    closure->disabled = false;
+    closure->state = RECV_HELLO;
+
+    debug_return;
+}
+
 struct client_closure *
 log_server_open(struct log_details *details, struct timespec *now,
     bool log_io, enum client_state initial_state, const char *reason,
@@ -1974,9 +2954,28 @@ log_server_open(struct log_details *details, struct timespec *now,
     }
 
     /* Read ServerHello synchronously or fail. */
-    if (read_server_hello(closure))
+    if (read_server_hello(closure) && !closure->disabled)
 	debug_return_ptr(closure);
 
+    /*
+     * A connection started by log_server_preconnect() may have been
+     * closed by the server while it was idle, reconnect once.
+     */
+    if (closure->preconnected) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "no ServerHello on preconnected socket, reconnecting");
+	log_server_disconnect(closure);
+	if (!log_server_connect(closure)) {
+	    sudo_warn("%s", U_("unable to connect to log server"));
+	    goto bad;
+	}
+	if (read_server_hello(closure))
+	    debug_return_ptr(closure);
+    } else if (closure->disabled) {
+	/* Log errors are ignored, the plugin has been disabled. */
+	debug_return_ptr(closure);
+    }
+
 bad:
     client_closure_free(closure);
     debug_return_ptr(NULL);
@@ -1999,6 +2998,15 @@ log_server_close(struct client_closure *closure, int exit_status, int error)
     if (!fmt_exit_message(closure, exit_status, error))
 	goto done;
 
+    /*
+     * When spooling, the ExitMessage has been written to the spool file.
+     * Closing it releases the lock and lets the uploader finish.
+     */
+    if (closure->spool_fd != -1) {
+	ret = true;
+	goto done;
+    }
+
     /*
      * Create private event base and reparent the read/write events.
      * We cannot use the main sudo event loop as it has already exited.
@@ -23,6 +23,9 @@
 #if defined(HAVE_OPENSSL)
 # include <openssl/ssl.h>
 #endif /* HAVE_OPENSSL */
+#if defined(HAVE_ZLIB_H)
+# include <zlib.h>
+#endif /* HAVE_ZLIB_H */
 
 #include "log_server.pb-c.h"
 #include "strlist.h"
@@ -35,9 +38,16 @@
 #define DEFAULT_PORT		"30343"
 #define DEFAULT_PORT_TLS	"30344"
 
+/* Delay between starting connections to log server addresses (250ms) */
+#define CONNECT_ATTEMPT_DELAY	250000000
+
 /* Maximum message size (2Mb) */
 #define MESSAGE_SIZE_MAX	(2 * 1024 * 1024)
 
+/* Number of IoBuffer types, ttyin through stderr. */
+#define IO_BUF_TYPES \
+    (CLIENT_MESSAGE__TYPE_STDERR_BUF - CLIENT_MESSAGE__TYPE_TTYIN_BUF + 1)
+
 /* TODO - share with logsrvd/sendlog */
 struct connection_buffer {
     TAILQ_ENTRY(connection_buffer) entries;
@@ -48,10 +58,23 @@ struct connection_buffer {
 };
 TAILQ_HEAD(connection_buffer_list, connection_buffer);
 
+/* Consecutive I/O buffers for the same stream, merged before sending. */
+struct coalesce_buffer {
+    char *data;
+    unsigned int size;
+    unsigned int len;
+    int type;
+    struct timespec delay;	/* sum of the delays of the merged buffers */
+    struct timespec held;	/* time since the first merged buffer */
+};
+
 struct log_details {
     struct eventlog *evlog;
     struct sudoers_str_list *log_servers;
     struct timespec server_timeout;
+    struct timespec coalesce_delay;
+    unsigned int coalesce_bytes;
+    char *spool_dir;
 #if defined(HAVE_OPENSSL)
     char *ca_bundle;
     char *cert_file;
@@ -65,7 +88,7 @@ struct log_details {
 enum client_state {
     ERROR,
     RECV_HELLO,
-    SEND_RESTART,	/* TODO: currently unimplemented */
+    SEND_RESTART,
     SEND_ACCEPT,
     SEND_ALERT,
     SEND_REJECT,
@@ -75,14 +98,19 @@ enum client_state {
     FINISHED
 };
 
+struct log_spool;
+
 /* Remote connection closure, non-zero fields must come first. */
 struct client_closure {
     int sock;
+    int spool_fd;
     bool read_instead_of_write;
     bool write_instead_of_read;
     bool temporary_write_event;
     bool disabled;
     bool log_io;
+    bool compress;
+    bool preconnected;		/* socket from log_server_preconnect() */
     char *server_name;
 #if defined(HAVE_STRUCT_IN6_ADDR)
     char server_ip[INET6_ADDRSTRLEN];
@@ -92,6 +120,7 @@ struct client_closure {
 #if defined(HAVE_OPENSSL)
     SSL_CTX *ssl_ctx;
     SSL *ssl;
+    char *tls_session_key;
     bool ssl_initialized;
 #endif /* HAVE_OPENSSL */
     enum client_state state;
@@ -101,7 +130,15 @@ struct client_closure {
     struct connection_buffer read_buf;
     struct sudo_plugin_event *read_ev;
     struct sudo_plugin_event *write_ev;
+    struct sudo_plugin_event *coalesce_ev;
+    struct coalesce_buffer coalesce_buf;
     struct log_details *log_details;
+    struct log_spool *spool;
+#if defined(HAVE_ZLIB_H)
+    z_stream *zstreams[IO_BUF_TYPES];
+    unsigned char *zbuf;
+    unsigned int zbufsize;
+#endif /* HAVE_ZLIB_H */
     struct timespec start_time;
     struct timespec elapsed;
     struct timespec committed;
@@ -110,15 +147,29 @@ struct client_closure {
 };
 
 /* iolog_client.c */
+struct client_closure *client_closure_alloc(struct log_details *details, struct timespec *now, bool log_io, enum client_state initial_state, const char *reason, struct sudo_plugin_event * (*event_alloc)(void));
 struct client_closure *log_server_open(struct log_details *details, struct timespec *now, bool log_io, enum client_state initial_state, const char *reason, struct sudo_plugin_event * (*event_alloc)(void));
 bool log_server_close(struct client_closure *closure, int exit_status, int error);
 bool fmt_client_message(struct client_closure *closure, ClientMessage *msg);
+bool fmt_client_hello(struct client_closure *closure);
+bool fmt_io_buf_msg(struct client_closure *closure, int type, const char *buf, unsigned int len, struct timespec *delay);
+bool fmt_accept_message(struct client_closure *closure);
+bool fmt_restart_message(struct client_closure *closure);
 bool fmt_exit_message(struct client_closure *closure, int exit_status, int error);
 bool fmt_io_buf(struct client_closure *closure, int type, const char *buf, unsigned int len, struct timespec *delay);
+bool flush_io_buf(struct client_closure *closure);
 bool fmt_suspend(struct client_closure *closure, const char *signame, struct timespec *delay);
 bool fmt_winsize(struct client_closure *closure, unsigned int lines, unsigned int cols, struct timespec *delay);
 bool log_server_connect(struct client_closure *closure);
+bool log_server_preconnect(const char *server, bool keepalive);
+void log_server_preconnect_free(void);
 void client_closure_free(struct client_closure *closure);
 bool read_server_hello(struct client_closure *closure);
 
+/* log_spool.c */
+struct client_closure *log_spool_open(struct log_details *details, struct timespec *now, struct sudo_plugin_event * (*event_alloc)(void));
+bool log_spool_write(struct client_closure *closure, const void *buf, size_t len);
+bool log_spool_initial_message(struct client_closure *closure);
+bool log_spool_fill(struct client_closure *closure);
+
 #endif /* SUDOERS_LOG_CLIENT_H */
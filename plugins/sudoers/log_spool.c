@@ -0,0 +1,736 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#ifdef SUDOERS_LOG_CLIENT
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sudoers.h"
+#include "sudo_event.h"
+#include "log_client.h"
+
+/* How often to check the spool file for new messages (100ms). */
+#define SPOOL_POLL_INTERVAL	100000000
+
+/* Stop reading the spool file when this much data is queued. */
+#define SPOOL_HIGH_WATER	(64 * 1024)
+
+/* Upload retry limits: delay doubles from 1s up to 60s, 10 tries. */
+#define SPOOL_RETRY_DELAY_MAX	60
+#define SPOOL_RETRY_MAX		10
+
+/*
+ * One-byte lock regions in the spool file: the writer holds the first
+ * until sudo exits, the uploader holds the second for its lifetime.
+ */
+#define SPOOL_WRITER_LOCK	0
+#define SPOOL_UPLOADER_LOCK	1
+
+/*
+ * State of the uploader process that drains a spool file.
+ * The spool file holds the ClientMessage stream in wire format,
+ * starting with the AcceptMessage and ending with the ExitMessage.
+ */
+struct log_spool {
+    struct log_details details;
+    struct sudo_plugin_event * (*event_alloc)(void);
+    struct sudo_plugin_event *poll_ev;
+    struct timespec start_time;
+    struct timespec restart;
+    char *iolog_id;
+    const char *path;
+    uint8_t *buf;
+    size_t bufsize;
+    off_t off;
+    int fd;
+    bool writer_done;
+};
+
+/*
+ * Lock or unlock one of the spool file's lock regions.
+ * Returns true on success, false on failure.
+ */
+static bool
+log_spool_lock(int fd, int type, off_t region)
+{
+    debug_decl(log_spool_lock, SUDOERS_DEBUG_UTIL);
+
+    /* The region starts at the current offset, the spool is read via pread. */
+    if (lseek(fd, region, SEEK_SET) == -1)
+	debug_return_bool(false);
+    debug_return_bool(sudo_lock_region(fd, type, 1));
+}
+
+/*
+ * Write a wire format ClientMessage to the spool file.
+ * Returns true on success, false on failure.
+ */
+bool
+log_spool_write(struct client_closure *closure, const void *buf, size_t len)
+{
+    const char *cp = buf;
+    ssize_t nwritten;
+    debug_decl(log_spool_write, SUDOERS_DEBUG_UTIL);
+
+    while (len > 0) {
+	nwritten = write(closure->spool_fd, cp, len);
+	if (nwritten == -1) {
+	    if (errno == EINTR)
+		continue;
+	    sudo_warn(U_("unable to write to %s"),
+		closure->log_details->spool_dir);
+	    debug_return_bool(false);
+	}
+	cp += nwritten;
+	len -= nwritten;
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Queue the initial message for an uploader connection: a RestartMessage
+ * if the server already has part of the log, else the spooled
+ * AcceptMessage is sent as-is.
+ * Returns true on success, false on failure.
+ */
+bool
+log_spool_initial_message(struct client_closure *closure)
+{
+    struct log_spool *spool = closure->spool;
+    debug_decl(log_spool_initial_message, SUDOERS_DEBUG_UTIL);
+
+    /* Read the spool from the start, skipping what the server has. */
+    spool->off = 0;
+    sudo_timespecclear(&closure->elapsed);
+    sudo_timespecclear(&spool->restart);
+    if (closure->iolog_id != NULL) {
+	if (!fmt_restart_message(closure))
+	    debug_return_bool(false);
+	spool->restart = closure->committed;
+    }
+    closure->state = SEND_IO;
+
+    /* Server messages may occur at any time, so no timeout. */
+    if (closure->read_ev->add(closure->read_ev, NULL) == -1) {
+	sudo_warn("%s", U_("unable to add event to queue"));
+	debug_return_bool(false);
+    }
+
+    debug_return_bool(log_spool_fill(closure));
+}
+
+/*
+ * Read messages from the spool file and append them to the write queue.
+ * When the end of the spool is reached, poll for more unless the
+ * writer has gone away.
+ * Returns true on success, false on failure.
+ */
+bool
+log_spool_fill(struct client_closure *closure)
+{
+    struct log_spool *spool = closure->spool;
+    struct timespec delay, poll_interval = { 0, SPOOL_POLL_INTERVAL };
+    ClientMessage *msg;
+    IoBuffer *iobuf;
+    TimeSpec *ts;
+    size_t queued = 0;
+    uint32_t msg_len;
+    ssize_t nread;
+    bool ok, skip;
+    debug_decl(log_spool_fill, SUDOERS_DEBUG_UTIL);
+
+again:
+    while (closure->state == SEND_IO && queued < SPOOL_HIGH_WATER) {
+	/* Wire message size (uint32_t in network byte order). */
+	nread = pread(spool->fd, &msg_len, sizeof(msg_len), spool->off);
+	if (nread != sizeof(msg_len)) {
+	    if (nread == -1) {
+		sudo_warn(U_("unable to read %s"), spool->path);
+		debug_return_bool(false);
+	    }
+	    break;
+	}
+	msg_len = ntohl(msg_len);
+	if (msg_len > MESSAGE_SIZE_MAX) {
+	    sudo_warnx(U_("client message too large: %zu"), (size_t)msg_len);
+	    debug_return_bool(false);
+	}
+	if (msg_len > spool->bufsize) {
+	    size_t newsize = sudo_pow2_roundup(msg_len);
+	    uint8_t *newbuf = realloc(spool->buf, newsize);
+	    if (newbuf == NULL) {
+		sudo_warnx(U_("%s: %s"), __func__,
+		    U_("unable to allocate memory"));
+		debug_return_bool(false);
+	    }
+	    spool->buf = newbuf;
+	    spool->bufsize = newsize;
+	}
+	nread = pread(spool->fd, spool->buf, msg_len,
+	    spool->off + sizeof(msg_len));
+	if (nread != (ssize_t)msg_len) {
+	    if (nread == -1) {
+		sudo_warn(U_("unable to read %s"), spool->path);
+		debug_return_bool(false);
+	    }
+	    /* Partial message, the writer has not finished it yet. */
+	    break;
+	}
+	msg = client_message__unpack(NULL, msg_len, spool->buf);
+	if (msg == NULL) {
+	    sudo_warnx("%s", U_("unable to unpack ClientMessage"));
+	    debug_return_bool(false);
+	}
+	spool->off += sizeof(msg_len) + msg_len;
+
+	ts = NULL;
+	iobuf = NULL;
+	skip = false;
+	switch (msg->type_case) {
+	case CLIENT_MESSAGE__TYPE_ACCEPT_MSG:
+	    /* Replaced by the RestartMessage when resuming. */
+	    skip = closure->iolog_id != NULL;
+	    break;
+	case CLIENT_MESSAGE__TYPE_TTYIN_BUF:
+	    iobuf = msg->u.ttyin_buf;
+	    break;
+	case CLIENT_MESSAGE__TYPE_TTYOUT_BUF:
+	    iobuf = msg->u.ttyout_buf;
+	    break;
+	case CLIENT_MESSAGE__TYPE_STDIN_BUF:
+	    iobuf = msg->u.stdin_buf;
+	    break;
+	case CLIENT_MESSAGE__TYPE_STDOUT_BUF:
+	    iobuf = msg->u.stdout_buf;
+	    break;
+	case CLIENT_MESSAGE__TYPE_STDERR_BUF:
+	    iobuf = msg->u.stderr_buf;
+	    break;
+	case CLIENT_MESSAGE__TYPE_WINSIZE_EVENT:
+	    ts = msg->u.winsize_event->delay;
+	    break;
+	case CLIENT_MESSAGE__TYPE_SUSPEND_EVENT:
+	    ts = msg->u.suspend_event->delay;
+	    break;
+	case CLIENT_MESSAGE__TYPE_EXIT_MSG:
+	    /* Last message in the spool. */
+	    closure->state = SEND_EXIT;
+	    break;
+	default:
+	    sudo_warnx(U_("%s: unexpected type_case value %d"),
+		__func__, msg->type_case);
+	    client_message__free_unpacked(msg, NULL);
+	    debug_return_bool(false);
+	}
+
+	if (iobuf != NULL)
+	    ts = iobuf->delay;
+	if (ts != NULL) {
+	    /* Track elapsed time for comparison with commit points. */
+	    delay.tv_sec = ts->tv_sec;
+	    delay.tv_nsec = ts->tv_nsec;
+	    sudo_timespecadd(&delay, &closure->elapsed, &closure->elapsed);
+
+	    /* If we have a restart point, ignore records until we hit it. */
+	    if (sudo_timespecisset(&spool->restart)) {
+		if (sudo_timespeccmp(&spool->restart, &closure->elapsed, >=))
+		    skip = true;
+		else
+		    sudo_timespecclear(&spool->restart);	/* caught up */
+	    }
+	}
+
+	if (!skip) {
+	    /* I/O buffers are re-encoded in case compression was negotiated. */
+	    if (iobuf != NULL) {
+		ok = fmt_io_buf_msg(closure, msg->type_case,
+		    (char *)iobuf->data.data, iobuf->data.len, &delay);
+	    } else {
+		ok = fmt_client_message(closure, msg);
+	    }
+	    if (!ok) {
+		client_message__free_unpacked(msg, NULL);
+		debug_return_bool(false);
+	    }
+	    queued += msg_len;
+	}
+	client_message__free_unpacked(msg, NULL);
+    }
+
+    if (!TAILQ_EMPTY(&closure->write_bufs)) {
+	if (closure->write_ev->add(closure->write_ev,
+		&closure->log_details->server_timeout) == -1) {
+	    sudo_warn("%s", U_("unable to add event to queue"));
+	    debug_return_bool(false);
+	}
+    } else if (closure->state == SEND_IO) {
+	if (!spool->writer_done) {
+	    /*
+	     * The writer holds a lock on the spool file until it exits.
+	     * If we can take the lock, check once more for new messages.
+	     */
+	    if (log_spool_lock(spool->fd, SUDO_TLOCK, SPOOL_WRITER_LOCK)) {
+		spool->writer_done = true;
+		goto again;
+	    }
+	    if (spool->poll_ev->add(spool->poll_ev, &poll_interval) == -1) {
+		sudo_warn("%s", U_("unable to add event to queue"));
+		debug_return_bool(false);
+	    }
+	} else {
+	    /* Writer exited without an ExitMessage, nothing more to send. */
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+		"%s: spool ended without an ExitMessage", spool->path);
+	    if (sudo_timespeccmp(&closure->committed, &closure->elapsed, <)) {
+		/* Keep the spool until the last record is committed. */
+		closure->state = CLOSING;
+		if (closure->read_ev->add(closure->read_ev,
+			&closure->log_details->server_timeout) == -1) {
+		    sudo_warn("%s", U_("unable to add event to queue"));
+		    debug_return_bool(false);
+		}
+	    } else {
+		closure->state = FINISHED;
+		closure->read_ev->del(closure->read_ev);
+	    }
+	}
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Check the spool file for new messages (poll timer callback).
+ */
+static void
+log_spool_poll_cb(int unused, int what, void *v)
+{
+    struct client_closure *closure = v;
+    debug_decl(log_spool_poll_cb, SUDOERS_DEBUG_UTIL);
+
+    if (!log_spool_fill(closure))
+	closure->read_ev->loopbreak(closure->read_ev);
+
+    debug_return;
+}
+
+/*
+ * Send the spool file to the log server over a single connection.
+ * Returns 1 if the whole spool was sent and committed, 0 if the
+ * upload should be retried and -1 on a fatal error.
+ */
+static int
+log_spool_upload(struct log_spool *spool)
+{
+    struct client_closure *closure;
+    struct sudo_event_base *evbase = NULL;
+    int ret = -1;
+    debug_decl(log_spool_upload, SUDOERS_DEBUG_UTIL);
+
+    closure = client_closure_alloc(&spool->details, &spool->start_time,
+	true, SEND_ACCEPT, NULL, spool->event_alloc);
+    if (closure == NULL)
+	goto done;
+    closure->spool = spool;
+    if (spool->iolog_id != NULL) {
+	if ((closure->iolog_id = strdup(spool->iolog_id)) == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    goto done;
+	}
+	closure->committed = spool->restart;
+    }
+
+    if ((evbase = sudo_ev_base_alloc()) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	goto done;
+    }
+    if ((spool->poll_ev = spool->event_alloc()) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	goto done;
+    }
+    if (spool->poll_ev->set(spool->poll_ev, -1, SUDO_PLUGIN_EV_TIMEOUT,
+	    log_spool_poll_cb, closure) == -1) {
+	sudo_warn("%s", U_("unable to add event to queue"));
+	goto done;
+    }
+    spool->poll_ev->setbase(spool->poll_ev, evbase);
+
+    ret = 0;
+    if (!log_server_connect(closure)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: unable to connect to log server", spool->path);
+	goto done;
+    }
+
+    /* Write ClientHello, the spool is sent once ServerHello arrives. */
+    if (!fmt_client_hello(closure)) {
+	ret = -1;
+	goto done;
+    }
+    closure->write_ev->setbase(closure->write_ev, evbase);
+    if (closure->write_ev->add(closure->write_ev,
+	    &closure->log_details->server_timeout) == -1) {
+	sudo_warnx("%s", U_("unable to add event to queue"));
+	goto done;
+    }
+    closure->read_ev->setbase(closure->read_ev, evbase);
+    if (closure->read_ev->add(closure->read_ev,
+	    &closure->log_details->server_timeout) == -1) {
+	sudo_warnx("%s", U_("unable to add event to queue"));
+	goto done;
+    }
+
+    if (sudo_ev_dispatch(evbase) == -1) {
+	sudo_warnx("%s", U_("error in event loop"));
+	goto done;
+    }
+    if (closure->state == FINISHED)
+	ret = 1;
+
+done:
+    if (closure != NULL && ret == 0) {
+	/*
+	 * Resume from the last commit point next time, if there is one.
+	 * If the server rejected us (possibly a restart), start over.
+	 */
+	free(spool->iolog_id);
+	spool->iolog_id = NULL;
+	sudo_timespecclear(&spool->restart);
+	if (closure->state != ERROR && closure->iolog_id != NULL &&
+		sudo_timespecisset(&closure->committed)) {
+	    spool->iolog_id = closure->iolog_id;
+	    closure->iolog_id = NULL;
+	    spool->restart = closure->committed;
+	}
+    }
+    client_closure_free(closure);
+    if (spool->poll_ev != NULL) {
+	spool->poll_ev->free(spool->poll_ev);
+	spool->poll_ev = NULL;
+    }
+    sudo_ev_base_free(evbase);
+    debug_return_int(ret);
+}
+
+/*
+ * Uploader process main loop, never returns.
+ * Sends the spool file to the log server, retrying with an exponential
+ * backoff, and removes it once the server has committed all of it.
+ */
+static void
+log_spool_uploader(struct client_closure *writer, const char *path,
+    struct sudo_plugin_event * (*event_alloc)(void))
+{
+    static const int sigs[] = {
+	SIGINT, SIGQUIT, SIGTERM, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD,
+	SIGALRM, SIGUSR1, SIGUSR2, SIGCONT, SIGWINCH, 0
+    };
+    struct log_spool spool;
+    struct timespec committed;
+    unsigned int delay = 1, tries = 0;
+    struct sigaction sa;
+    struct stat sb;
+    sigset_t mask;
+    int fd, i, rc;
+    debug_decl(log_spool_uploader, SUDOERS_DEBUG_UTIL);
+
+    /* Run as root so the invoking user cannot signal us. */
+    if (setgid(ROOT_GID) == -1 || setuid(ROOT_UID) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to change to uid %u", ROOT_UID);
+	_exit(1);
+    }
+
+    /* Detach from the terminal and reset signals inherited from sudo. */
+    if ((fd = open(_PATH_DEVNULL, O_RDWR)) != -1) {
+	(void) dup2(fd, STDIN_FILENO);
+	(void) dup2(fd, STDOUT_FILENO);
+	(void) dup2(fd, STDERR_FILENO);
+	if (fd > STDERR_FILENO)
+	    close(fd);
+    }
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = SIG_DFL;
+    for (i = 0; sigs[i] != 0; i++)
+	(void) sigaction(sigs[i], &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    (void) sigaction(SIGHUP, &sa, NULL);
+    (void) sigaction(SIGPIPE, &sa, NULL);
+    sigemptyset(&mask);
+    (void) sigprocmask(SIG_SETMASK, &mask, NULL);
+
+    memset(&spool, 0, sizeof(spool));
+    spool.details = *writer->log_details;
+    spool.details.ignore_log_errors = false;
+    spool.details.coalesce_bytes = 0;
+    spool.event_alloc = event_alloc;
+    spool.start_time = writer->start_time;
+    spool.path = path;
+
+    /* The lock is only held by the writer's own descriptor. */
+    close(writer->spool_fd);
+    writer->spool_fd = -1;
+    if ((spool.fd = open(path, O_RDWR)) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to open %s", path);
+	_exit(1);
+    }
+
+    /*
+     * Only one uploader per spool file.  If another uploader finished
+     * while we were waiting for the lock, the file has been removed.
+     */
+    if (!log_spool_lock(spool.fd, SUDO_LOCK, SPOOL_UPLOADER_LOCK)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to lock %s", path);
+	_exit(1);
+    }
+    if (fstat(spool.fd, &sb) == -1 || sb.st_nlink == 0) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "%s: already uploaded", path);
+	_exit(0);
+    }
+
+    for (;;) {
+	committed = spool.restart;
+	rc = log_spool_upload(&spool);
+	if (rc == 1) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		"%s: upload complete", path);
+	    unlink(path);
+	    break;
+	}
+	if (rc == -1)
+	    break;
+
+	/* Start the backoff over if the server committed more data. */
+	if (sudo_timespeccmp(&spool.restart, &committed, >)) {
+	    delay = 1;
+	    tries = 0;
+	}
+	if (++tries == SPOOL_RETRY_MAX)
+	    break;
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "%s: retrying upload in %u seconds", path, delay);
+	sleep(delay);
+	delay *= 2;
+	if (delay > SPOOL_RETRY_DELAY_MAX)
+	    delay = SPOOL_RETRY_DELAY_MAX;
+    }
+    if (rc != 1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: giving up, spool file left for the next session", path);
+    }
+    _exit(rc == 1 ? 0 : 1);
+}
+
+/*
+ * Fork a detached uploader process for the spool file.
+ * The intermediate child exits right away so the uploader
+ * is not a child of sudo.
+ * Returns true on success, false on failure.
+ */
+static bool
+log_spool_start_uploader(struct client_closure *closure, const char *path,
+    struct sudo_plugin_event * (*event_alloc)(void))
+{
+    int status;
+    pid_t pid, rv;
+    debug_decl(log_spool_start_uploader, SUDOERS_DEBUG_UTIL);
+
+    switch (pid = sudo_debug_fork()) {
+    case -1:
+	sudo_warn("%s", U_("unable to fork"));
+	debug_return_bool(false);
+    case 0:
+	/* child */
+	if (setsid() == -1)
+	    _exit(1);
+	switch (sudo_debug_fork()) {
+	case -1:
+	    _exit(1);
+	case 0:
+	    log_spool_uploader(closure, path, event_alloc);
+	    /* NOTREACHED */
+	default:
+	    _exit(0);
+	}
+    default:
+	/* parent */
+	do {
+	    rv = waitpid(pid, &status, 0);
+	} while (rv == -1 && errno == EINTR);
+	if (rv == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+	    sudo_warnx("%s", U_("unable to start the I/O log uploader"));
+	    debug_return_bool(false);
+	}
+	break;
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Start uploaders for spool files left behind by an earlier session
+ * whose uploader gave up or was killed.  A spool file that is not
+ * locked by either its writer or an uploader has been abandoned.
+ */
+static void
+log_spool_recover(struct log_details *details, struct timespec *now,
+    struct sudo_plugin_event * (*event_alloc)(void))
+{
+    struct client_closure *closure;
+    struct dirent *dent;
+    char path[PATH_MAX];
+    struct stat sb;
+    DIR *dir;
+    int len, fd;
+    debug_decl(log_spool_recover, SUDOERS_DEBUG_UTIL);
+
+    if ((dir = opendir(details->spool_dir)) == NULL)
+	debug_return;
+    while ((dent = readdir(dir)) != NULL) {
+	if (strncmp(dent->d_name, "spool.", sizeof("spool.") - 1) != 0)
+	    continue;
+	len = snprintf(path, sizeof(path), "%s/%s", details->spool_dir,
+	    dent->d_name);
+	if (len < 0 || (size_t)len >= sizeof(path))
+	    continue;
+	if ((fd = open(path, O_RDWR|O_NOFOLLOW)) == -1)
+	    continue;
+	(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	/* A new spool file is empty until its writer holds the lock. */
+	if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) || sb.st_size == 0 ||
+		!sudo_lock_file(fd, SUDO_TLOCK)) {
+	    close(fd);
+	    continue;
+	}
+
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "restarting upload of %s", path);
+	closure = client_closure_alloc(details, now, true, SEND_IO, NULL,
+	    event_alloc);
+	if (closure == NULL) {
+	    close(fd);
+	    break;
+	}
+	/* Our lock is dropped when the closure frees the descriptor. */
+	closure->spool_fd = fd;
+	(void)log_spool_start_uploader(closure, path, event_alloc);
+	client_closure_free(closure);
+    }
+    closedir(dir);
+
+    debug_return;
+}
+
+/*
+ * Create a spool file for the session's ClientMessage stream and
+ * start an uploader process to send it to the log server.
+ * I/O is written to the spool and never waits for the network.
+ * Returns a client closure on success, NULL on failure.
+ */
+struct client_closure *
+log_spool_open(struct log_details *details, struct timespec *now,
+    struct sudo_plugin_event * (*event_alloc)(void))
+{
+    struct client_closure *closure;
+    char path[PATH_MAX];
+    bool uid_changed, ok = false;
+    int len, fd = -1;
+    debug_decl(log_spool_open, SUDOERS_DEBUG_UTIL);
+
+    closure = client_closure_alloc(details, now, true, SEND_ACCEPT, NULL,
+	event_alloc);
+    if (closure == NULL)
+	debug_return_ptr(NULL);
+
+    len = snprintf(path, sizeof(path), "%s/spool.XXXXXX", details->spool_dir);
+    if (len < 0 || (size_t)len >= sizeof(path)) {
+	errno = ENAMETOOLONG;
+	sudo_warn("%s/spool.XXXXXX", details->spool_dir);
+	client_closure_free(closure);
+	debug_return_ptr(NULL);
+    }
+
+    uid_changed = set_perms(PERM_ROOT);
+    if (!sudo_mkdir_parents(path, ROOT_UID, ROOT_GID, S_IRWXU, false))
+	goto done;
+    log_spool_recover(details, now, event_alloc);
+    if ((fd = mkstemp(path)) == -1) {
+	sudo_warn(U_("unable to create %s"), path);
+	goto done;
+    }
+    (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+    closure->spool_fd = fd;
+
+    /* The lock tells the uploader that we are still writing. */
+    if (!log_spool_lock(fd, SUDO_LOCK, SPOOL_WRITER_LOCK)) {
+	sudo_warn(U_("unable to lock %s"), path);
+	goto done;
+    }
+    if (!fmt_accept_message(closure))
+	goto done;
+    closure->state = SEND_IO;
+
+    if (!log_spool_start_uploader(closure, path, event_alloc))
+	goto done;
+
+    /* The uploader has taken over any early connection to the server. */
+    log_server_preconnect_free();
+
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"spooling I/O log to %s", path);
+    ok = true;
+
+done:
+    if (!ok) {
+	if (fd != -1)
+	    unlink(path);
+	client_closure_free(closure);
+	closure = NULL;
+    }
+    if (uid_changed)
+	restore_perms();
+    debug_return_ptr(closure);
+}
+
+#endif /* SUDOERS_LOG_CLIENT */
@@ -116,6 +116,27 @@ init_log_details(struct log_details *details, struct eventlog *evlog)
     debug_return_bool(true);
 }
 
+/*
+ * Start connecting to the first log server so the connection can be
+ * established while the user is authenticating.  The connection is
+ * used by the first accept, reject or alert message that is sent.
+ */
+bool
+log_server_early_connect(void)
+{
+    struct list_member *item, *server = NULL;
+    debug_decl(log_server_early_connect, SUDOERS_DEBUG_LOGGING);
+
+    /* List is in reverse order, the first server is the last entry. */
+    SLIST_FOREACH(item, &def_log_servers, entries)
+	server = item;
+    if (server == NULL)
+	debug_return_bool(true);
+
+    debug_return_bool(log_server_preconnect(server->value,
+	def_log_server_keepalive));
+}
+
 bool
 log_server_reject(struct eventlog *evlog, const char *message,
     struct sudo_plugin_event * (*event_alloc)(void))
@@ -183,6 +204,12 @@ done:
     debug_return_bool(ret);
 }
 #else
+bool
+log_server_early_connect(void)
+{
+    return true;
+}
+
 bool
 log_server_reject(struct eventlog *evlog, const char *message,
     struct sudo_plugin_event * (*event_alloc)(void))
@@ -60,6 +60,7 @@ bool log_allowed(void);
 bool log_auth_failure(int status, unsigned int tries);
 bool log_denial(int status, bool inform_user);
 bool log_failure(int status, int flags);
+bool log_server_early_connect(void);
 bool log_server_alert(struct eventlog *evlog, struct timespec *now, const char *message, const char *errstr, struct sudo_plugin_event * (*event_alloc)(void));
 bool log_server_reject(struct eventlog *evlog, const char *message, struct sudo_plugin_event * (*event_alloc)(void));
 bool log_warning(int flags, const char *fmt, ...) __printflike(2, 3);
@@ -597,7 +597,7 @@ sudoers_policy_store_result(bool accepted, char *argv[], char *envp[],
 	debug_return_bool(true);	/* nothing to do */
 
     /* Increase the length of command_info as needed, it is *not* checked. */
-    command_info = calloc(55, sizeof(char *));
+    command_info = calloc(60, sizeof(char *));
     if (command_info == NULL)
 	goto oom;
 
@@ -624,13 +624,24 @@ sudoers_policy_store_result(bool accepted, char *argv[], char *envp[],
 		goto oom;
 	}
 	if (def_compress_io) {
-	    if ((command_info[info_len++] = strdup("iolog_compress=true")) == NULL)
+	    /* Older I/O plugins only understand a boolean for gzip. */
+	    if ((command_info[info_len++] = strdup(
+		    def_iolog_compress_method == zstd ?
+		    "iolog_compress=zstd" : "iolog_compress=true")) == NULL)
 		goto oom;
 	}
 	if (def_iolog_flush) {
 	    if ((command_info[info_len++] = strdup("iolog_flush=true")) == NULL)
 		goto oom;
 	}
+	if (def_iolog_binary_timing) {
+	    if ((command_info[info_len++] = strdup("iolog_binary_timing=true")) == NULL)
+		goto oom;
+	}
+	if (def_iolog_compress_thread) {
+	    if ((command_info[info_len++] = strdup("iolog_compress_thread=true")) == NULL)
+		goto oom;
+	}
 	if (def_maxseq != NULL) {
 	    if (asprintf(&command_info[info_len++], "maxseq=%s", def_maxseq) == -1)
 		goto oom;
@@ -787,6 +798,17 @@ sudoers_policy_store_result(bool accepted, char *argv[], char *envp[],
 
 	if (asprintf(&command_info[info_len++], "log_server_timeout=%u", def_log_server_timeout) == -1)
 	    goto oom;
+
+	if (asprintf(&command_info[info_len++], "log_server_coalesce_bytes=%u", def_log_server_coalesce_bytes) == -1)
+	    goto oom;
+
+	if (asprintf(&command_info[info_len++], "log_server_coalesce_delay=%u", def_log_server_coalesce_delay) == -1)
+	    goto oom;
+
+	if (def_log_server_spool != NULL) {
+	    if ((command_info[info_len++] = sudo_new_key_val("log_server_spool", def_log_server_spool)) == NULL)
+		goto oom;
+	}
     }
 
     if ((command_info[info_len++] = sudo_new_key_val("log_server_keepalive",
@@ -507,6 +507,13 @@ sudoers_policy_main(int argc, char * const argv[], int pwflag, char *env_add[],
     if (!rebuild_env())
 	goto bad;
 
+    /*
+     * Overlap the connection to the log server with authentication.
+     * An accept or reject message is always sent when running a command.
+     */
+    if (ISSET(sudo_mode, MODE_RUN|MODE_EDIT))
+	(void)log_server_early_connect();
+
     /* Require a password if sudoers says so.  */
     switch (check_user(validated, sudo_mode)) {
     case true:
@@ -83,6 +83,8 @@ struct replay_closure {
     struct sudo_event *sigterm_ev;
     struct sudo_event *sigtstp_ev;
     struct timespec *max_delay;
+    struct timespec offset;	/* where to start replaying */
+    struct timespec elapsed;	/* session time of the current record */
     struct timing_closure timing;
     int iolog_dir_fd;
     bool interactive;
@@ -151,7 +153,7 @@ static struct iolog_file iolog_files[] = {
     { true, },	/* IOFD_TIMING */
 };
 
-static const char short_opts[] =  "d:f:Fhlm:nRSs:V";
+static const char short_opts[] =  "d:f:Fhlm:no:RSs:V";
 static struct option long_opts[] = {
     { "directory",	required_argument,	NULL,	'd' },
     { "filter",		required_argument,	NULL,	'f' },
@@ -160,6 +162,7 @@ static struct option long_opts[] = {
     { "list",		no_argument,		NULL,	'l' },
     { "max-wait",	required_argument,	NULL,	'm' },
     { "non-interactive", no_argument,		NULL,	'n' },
+    { "offset",		required_argument,	NULL,	'o' },
     { "no-resize",	no_argument,		NULL,	'R' },
     { "suspend-wait",	no_argument,		NULL,	'S' },
     { "speed",		required_argument,	NULL,	's' },
@@ -176,8 +179,8 @@ static int parse_expr(struct search_node_list *, char **, bool);
 static void read_keyboard(int fd, int what, void *v);
 static void help(void) __attribute__((__noreturn__));
 static int replay_session(int iolog_dir_fd, const char *iolog_dir,
-    struct timespec *max_wait, const char *decimal, bool interactive,
-    bool suspend_wait);
+    struct timespec *max_wait, struct timespec *offset, const char *decimal,
+    bool interactive, bool suspend_wait);
 static void sudoreplay_cleanup(void);
 static void usage(int);
 static void write_output(int fd, int what, void *v);
@@ -209,6 +212,7 @@ main(int argc, char *argv[])
     char *cp, *ep, iolog_dir[PATH_MAX];
     struct eventlog *evlog;
     struct timespec max_delay_storage, *max_delay = NULL;
+    struct timespec offset = { 0, 0 };
     double dval;
     debug_decl(main, SUDO_DEBUG_MAIN);
 
@@ -283,6 +287,14 @@ main(int argc, char *argv[])
 	case 'n':
 	    interactive = false;
 	    break;
+	case 'o':
+	    errno = 0;
+	    dval = strtod(optarg, &ep);
+	    if (*ep != '\0' || errno != 0 || dval < 0.0)
+		sudo_fatalx(U_("invalid offset: %s"), optarg);
+	    offset.tv_sec = dval;
+	    offset.tv_nsec = (dval - offset.tv_sec) * 1000000000.0;
+	    break;
 	case 'R':
 	    resize = false;
 	    break;
@@ -376,8 +388,8 @@ main(int argc, char *argv[])
     evlog = NULL;
 
     /* Replay session corresponding to iolog_files[]. */
-    exitcode = replay_session(iolog_dir_fd, iolog_dir, max_delay, decimal,
-	interactive, suspend_wait);
+    exitcode = replay_session(iolog_dir_fd, iolog_dir, max_delay, &offset,
+	decimal, interactive, suspend_wait);
 
     restore_terminal_size();
     sudo_term_restore(ttyfd, true);
@@ -730,6 +742,39 @@ iolog_complete(struct replay_closure *closure)
     debug_return_bool(true);
 }
 
+/*
+ * Consume the timing record without replaying it.
+ * The terminal is still resized so it matches the session at the
+ * point replay starts.
+ */
+static bool
+skip_timing_record(struct replay_closure *closure)
+{
+    struct timing_closure *timing = &closure->timing;
+    debug_decl(skip_timing_record, SUDO_DEBUG_UTIL);
+
+    switch (timing->event) {
+    case IO_EVENT_WINSIZE:
+	resize_terminal(timing->u.winsize.lines, timing->u.winsize.cols);
+	break;
+    case IO_EVENT_STDIN:
+    case IO_EVENT_STDOUT:
+    case IO_EVENT_STDERR:
+    case IO_EVENT_TTYIN:
+    case IO_EVENT_TTYOUT:
+	if (!iolog_files[timing->event].enabled)
+	    break;
+	if (iolog_seek(&iolog_files[timing->event], timing->u.nbytes,
+		SEEK_CUR) == -1) {
+	    sudo_warn(U_("unable to read %s/%s"), closure->iolog_dir,
+		iolog_fd_to_name(timing->event));
+	    debug_return_bool(false);
+	}
+	break;
+    }
+    debug_return_bool(true);
+}
+
 /*
  * Read the next record from the timing file and schedule a delay
  * event with the specified timeout.
@@ -748,6 +793,7 @@ get_timing_record(struct replay_closure *closure)
 	nodelay = true;
     }
 
+again:
     switch (iolog_read_timing_record(&iolog_files[IOFD_TIMING], timing)) {
     case -1:
 	/* error */
@@ -765,6 +811,20 @@ get_timing_record(struct replay_closure *closure)
 	timing->event = IO_EVENT_COUNT;
 	break;
     default:
+	if (sudo_timespecisset(&closure->offset)) {
+	    /* Skip records before the starting offset. */
+	    sudo_timespecadd(&closure->elapsed, &timing->delay,
+		&closure->elapsed);
+	    if (sudo_timespeccmp(&closure->elapsed, &closure->offset, <)) {
+		if (!skip_timing_record(closure))
+		    debug_return_int(-1);
+		goto again;
+	    }
+	    sudo_timespecsub(&closure->elapsed, &closure->offset,
+		&timing->delay);
+	    sudo_timespecclear(&closure->offset);
+	}
+
 	/* Record number bytes to read. */
 	if (timing->event != IO_EVENT_WINSIZE &&
 		timing->event != IO_EVENT_SUSPEND) {
@@ -957,8 +1017,8 @@ signal_cb(int signo, int what, void *v)
 
 static struct replay_closure *
 replay_closure_alloc(int iolog_dir_fd, const char *iolog_dir,
-    struct timespec *max_delay, const char *decimal, bool interactive,
-    bool suspend_wait)
+    struct timespec *max_delay, struct timespec *offset, const char *decimal,
+    bool interactive, bool suspend_wait)
 {
     struct replay_closure *closure;
     debug_decl(replay_closure_alloc, SUDO_DEBUG_UTIL);
@@ -971,6 +1031,7 @@ replay_closure_alloc(int iolog_dir_fd, const char *iolog_dir,
     closure->interactive = interactive;
     closure->suspend_wait = suspend_wait;
     closure->max_delay = max_delay;
+    closure->offset = *offset;
     closure->timing.decimal = decimal;
 
     /*
@@ -1043,16 +1104,26 @@ bad:
 
 static int
 replay_session(int iolog_dir_fd, const char *iolog_dir,
-    struct timespec *max_delay, const char *decimal, bool interactive,
-    bool suspend_wait)
+    struct timespec *max_delay, struct timespec *offset, const char *decimal,
+    bool interactive, bool suspend_wait)
 {
     struct replay_closure *closure;
+    struct iolog_index_entry entry;
     int ret = 0;
     debug_decl(replay_session, SUDO_DEBUG_UTIL);
 
-    /* Allocate the delay closure and read the first timing record. */
-    closure = replay_closure_alloc(iolog_dir_fd, iolog_dir, max_delay, decimal,
-	interactive, suspend_wait);
+    /* Allocate the delay closure. */
+    closure = replay_closure_alloc(iolog_dir_fd, iolog_dir, max_delay, offset,
+	decimal, interactive, suspend_wait);
+
+    /* Use the index, if present, to skip to the starting offset. */
+    if (sudo_timespecisset(offset)) {
+	if (iolog_index_find(iolog_dir_fd, offset, &entry) &&
+		iolog_index_seek(iolog_dir_fd, iolog_files, &entry, true))
+	    closure->elapsed = entry.elapsed;
+    }
+
+    /* Read the first timing record. */
     if (get_timing_record(closure) != 0) {
 	ret = 1;
 	goto done;
@@ -1611,7 +1682,7 @@ static void
 usage(int fatal)
 {
     fprintf(fatal ? stderr : stdout,
-	_("usage: %s [-hnRS] [-d dir] [-m num] [-s num] ID\n"),
+	_("usage: %s [-hnRS] [-d dir] [-m num] [-o num] [-s num] ID\n"),
 	getprogname());
     fprintf(fatal ? stderr : stdout,
 	_("usage: %s [-h] [-d dir] -l [search expression]\n"),
@@ -1632,6 +1703,7 @@ help(void)
 	"  -l, --list             list available session IDs, with optional expression\n"
 	"  -m, --max-wait=num     max number of seconds to wait between events\n"
 	"  -n, --non-interactive  no prompts, session is sent to the standard output\n"
+	"  -o, --offset=num       start replay num seconds into the session\n"
 	"  -R, --no-resize        do not attempt to re-size the terminal\n"
 	"  -S, --suspend-wait     wait while the command was suspended\n"
 	"  -s, --speed=num        speed up or slow down output\n"